@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "arena.h"
+
+#define arena_align( size )    (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+static arena_block *arena_block_create( size_t size );
+
+
+boolean arena_create( arena *p_arena, size_t block_size )
+{
+	assert( p_arena );
+
+	p_arena->block_size      = block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+	p_arena->bytes_allocated = 0;
+	p_arena->p_head          = arena_block_create( p_arena->block_size );
+
+	return p_arena->p_head != NULL;
+}
+
+void arena_destroy( arena *p_arena )
+{
+	arena_block *p_block;
+
+	assert( p_arena );
+
+	/* one free() per block, not per allocation */
+	p_block = p_arena->p_head;
+
+	while( p_block )
+	{
+		arena_block *p_next = p_block->p_next;
+		free( p_block );
+		p_block = p_next;
+	}
+
+	p_arena->p_head          = NULL;
+	p_arena->bytes_allocated = 0;
+}
+
+/*
+ * Rewinds the arena so that its first block can be reused for the
+ * next run. Any extra blocks are released.
+ */
+void arena_reset( arena *p_arena )
+{
+	arena_block *p_block;
+
+	assert( p_arena );
+
+	if( !p_arena->p_head )
+	{
+		return;
+	}
+
+	p_block = p_arena->p_head->p_next;
+
+	while( p_block )
+	{
+		arena_block *p_next = p_block->p_next;
+		free( p_block );
+		p_block = p_next;
+	}
+
+	p_arena->p_head->p_next  = NULL;
+	p_arena->p_head->used    = 0;
+	p_arena->bytes_allocated = 0;
+}
+
+void* arena_alloc( arena *p_arena, size_t size )
+{
+	arena_block *p_block;
+	void *p_memory;
+
+	assert( p_arena );
+	assert( p_arena->p_head );
+
+	size    = arena_align( size );
+	p_block = p_arena->p_head;
+
+	if( p_block->used + size > p_block->size )
+	{
+		/* oversized requests get a block of their own */
+		size_t new_size = size > p_arena->block_size ? size : p_arena->block_size;
+
+		p_block = arena_block_create( new_size );
+
+		if( !p_block )
+		{
+			return NULL;
+		}
+
+		p_block->p_next = p_arena->p_head;
+		p_arena->p_head = p_block;
+	}
+
+	p_memory                  = &p_block->data[ p_block->used ];
+	p_block->used            += size;
+	p_arena->bytes_allocated += size;
+
+	return p_memory;
+}
+
+char* arena_strdup( arena *p_arena, const char *s_string )
+{
+	assert( s_string );
+	return arena_strndup( p_arena, s_string, strlen(s_string) );
+}
+
+char* arena_strndup( arena *p_arena, const char *s_string, size_t length )
+{
+	char *s_copy;
+
+	assert( s_string );
+
+	s_copy = (char *) arena_alloc( p_arena, length + 1 );
+
+	if( s_copy )
+	{
+		memcpy( s_copy, s_string, length );
+		s_copy[ length ] = '\0';
+	}
+
+	return s_copy;
+}
+
+arena_block *arena_block_create( size_t size )
+{
+	arena_block *p_block = (arena_block *) malloc( sizeof(arena_block) + size );
+
+	if( p_block )
+	{
+		p_block->p_next = NULL;
+		p_block->size   = size;
+		p_block->used   = 0;
+	}
+
+	return p_block;
+}
@@ -0,0 +1,38 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include "types.h"
+
+/*
+ * Bump allocator for per-run metadata. Allocations are carved out of
+ * large blocks and are never freed individually; the whole arena is
+ * released (or rewound) at once. Strings allocated back to back end up
+ * contiguous in memory, which keeps scans over paths and keys cheap.
+ */
+#define ARENA_DEFAULT_BLOCK_SIZE    (64 * 1024)
+#define ARENA_ALIGNMENT             (sizeof(void *))
+
+typedef struct tag_arena_block {
+	struct tag_arena_block *p_next;
+	size_t size;
+	size_t used;
+	byte data[];
+} arena_block;
+
+typedef struct tag_arena {
+	arena_block *p_head;       /* block currently being filled */
+	size_t block_size;
+	size_t bytes_allocated;
+} arena;
+
+boolean arena_create     ( arena *p_arena, size_t block_size );
+void    arena_destroy    ( arena *p_arena );
+void    arena_reset      ( arena *p_arena );
+void*   arena_alloc      ( arena *p_arena, size_t size );
+char*   arena_strdup     ( arena *p_arena, const char *s_string );
+char*   arena_strndup    ( arena *p_arena, const char *s_string, size_t length );
+
+#define arena_bytes_allocated( p_arena )    ((p_arena)->bytes_allocated)
+
+#endif /* _ARENA_H_ */
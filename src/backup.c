@@ -3,17 +3,34 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <getopt.h>
 #include <curl/curl.h>
 #include <glib.h>
 #include "s3.h"
+#include "localfs.h"
+#include "profile.h"
+#include "catalog.h"
+#include "sync.h"
+#include "blocks.h"
+#include "bufpool.h"
+#include "fanout.h"
+#include "ftp.h"
+#include "trace.h"
+#include "log.h"
 #include "backup.h"
 #include "types.h"
 #include "mime.h"
 #include "types.h"
+#ifdef _HAVE_MAGICK
+#include "image_pipeline.h"
+#endif
 
 #define BACKUP_CONFIGURATION_FILE         "/etc/backup_tool.conf"
 #define BACKUP_S3_GROUP_NAME              "S3"
+#define BACKUP_FTP_GROUP_NAME             "FTP"
+#define BACKUP_MAX_FTP                    (FANOUT_MAX_TARGETS - 1)
+#define BACKUP_FTP_SESSIONS               (4)  /* per FTP target */
 
 static struct option long_options[] = {
 	{ "help",    no_argument,       NULL, 'h' }, // 0
@@ -26,6 +43,22 @@ static struct option long_options[] = {
 	{ "list",    no_argument,       NULL, 'l' },
 	{ "put",     required_argument, NULL, 'p' },
 	{ "delete",  no_argument,       NULL, 'd' }, // 9
+	{ "local",   required_argument, NULL, 'L' },
+	{ "strip",   no_argument,       NULL, 's' },
+	{ "profile", no_argument,       NULL, 'P' }, // 12
+	{ "catalog", required_argument, NULL, 'C' },
+	{ "sync",    required_argument, NULL, 'S' },
+	{ "prune",   no_argument,       NULL, 'x' }, // 15
+	{ "nocache", no_argument,       NULL, 'N' },
+	{ "sparse",  no_argument,       NULL, 'Z' }, // 18
+	{ "blocks",  required_argument, NULL, 'B' },
+	{ "memory",  required_argument, NULL, 'M' },
+	{ "hugepages", no_argument,     NULL, 'H' }, // 21
+	{ "json-log", no_argument,      NULL, 'J' },
+	{ "startup-profile", no_argument, NULL, 'T' },
+	{ "endpoints", required_argument, NULL, 'E' }, // 24
+	{ "ftp",     required_argument, NULL, 'F' },
+	{ "derivatives", no_argument,   NULL, 'D' },
 	{ NULL, 0, NULL, 0 }
 };
 
@@ -40,36 +73,119 @@ static char* option_descriptions[] = {
 	"To list all of the buckets.",
 	"To put a file in the S3 bucket.",
 	"To delete a file from the S3 Bucket.",  // 9
+	"Use a local (or NFS) directory instead of S3.",
+	"Strip EXIF and comments from JPEG and PNG uploads.",
+	"Show live throughput and a per-stage report.", // 12
+	"Keep a catalog of uploads; unchanged puts and sync listings are skipped.",
+	"Mirror a directory below the key (used as a prefix).",
+	"With --sync, delete keys that have no local file.", // 15
+	"Read files without evicting the page cache (O_DIRECT).",
+	"Upload only the data of sparse files, with a map of the holes.", // 18
+	"Upload only changed blocks; block maps are kept in this directory.",
+	"Megabytes of I/O buffers to use at most (default 64).",
+	"Back the I/O buffers with huge pages.", // 21
+	"Write messages as JSON, one object per line.",
+	"Report the time spent setting up each subsystem.",
+	"S3 hosts to choose from by latency, comma separated.", // 24
+	"Also keep files on this FTP host[/path]; puts share one read.",
+	"With --put, also upload a thumbnail and a medium copy of images.",
 	NULL
 };
 
+/* set up on first use; see backup_startup_report() */
+typedef enum {
+	STARTUP_CONFIGURATION = 0,
+	STARTUP_LOG,
+	STARTUP_CURL,
+	STARTUP_MIME,
+	STARTUP_ENDPOINTS,
+	STARTUP_PHASES
+} backup_startup_phase;
+
+static const char* startup_phase_names[ STARTUP_PHASES ] = {
+	"configuration",
+	"log",
+	"curl",
+	"mime types",
+	"endpoint probe",
+};
+
 struct tag_backup_tool {
 	boolean b_verbose;
 	boolean b_quiet;
+	boolean b_strip_metadata;
+	boolean b_profile;
+	boolean b_prune;
+	boolean b_nocache;
+	boolean b_sparse;
+	boolean b_hugepages;
+	boolean b_json_log;
+	boolean b_startup_profile;
+	boolean b_derivatives;
+	boolean b_mime_loaded;
+	boolean b_s3_initialized;
+	uint buffer_megabytes;
 	backup_operation operation;
 	char s_s3_access_id[ 64 ];
 	char s_s3_secret_key[ 64 ];
 	char s_s3_bucket[ S3_MAX_BUCKET_NAME ];
 	char s_key[ 512 ];
 	char s_filename[ 512 ];
+	char s_local_root[ 512 ];
+	char s_catalog[ 512 ];
+	char s_directory[ 512 ];
+	char s_blocks_directory[ 512 ];
+	char s_endpoints[ 1024 ];
+	char s_ftp_hosts[ BACKUP_MAX_FTP ][ FTP_MAX_HOSTNAME ];
+	char s_ftp_paths[ BACKUP_MAX_FTP ][ 512 ];
+	char s_ftp_username[ FTP_MAX_CREDENTIAL ];
+	char s_ftp_password[ FTP_MAX_CREDENTIAL ];
+	uint ftp_count;
+	ftp_pool ftp_pools[ BACKUP_MAX_FTP ]; /* one per FTP target, logged in on first use */
+	uint ftp_pool_count;
+	uint endpoint_ttl;
+	endpoint_set endpoints;
 	uint retries;
 	CURL* p_curl;
 	mime_table mime_table;
 	S3 s3;
+	LocalFS local;
+	profiler profiler;
+	catalog catalog;
+	boolean b_catalog_open;
+	uint64_t startup_ns[ STARTUP_PHASES ];
+	uint64_t started;
 };
 
 boolean backup_initialize            ( backup_tool *p_tool );
 boolean backup_deinitialize          ( backup_tool *p_tool );
-
-#define backup_show_messages( p_tool, messages ) \
-	if( !(p_tool)->b_quiet ) { \
-		messages \
-	}
-
-#define backup_show_messages_if_verbose( p_tool, messages ) \
-	if( !(p_tool)->b_quiet && (p_tool)->b_verbose ) {\
-		messages \
-	}
+static boolean _backup_curl           ( backup_tool *p_tool );
+static mime_table* _backup_mime_table ( backup_tool *p_tool );
+static boolean _backup_ftp_pools      ( backup_tool *p_tool );
+static void _backup_startup_report    ( const backup_tool *p_tool, uint64_t ready );
+static boolean _backup_fanout_put     ( backup_tool *p_tool, char *s_etag, boolean *p_ftp_done, boolean *p_ftp_attempted );
+static void* _backup_transfer_thread  ( void *p_data );
+static boolean _backup_ftp_put        ( backup_tool *p_tool, const boolean *p_ftp_done, const boolean *p_ftp_attempted );
+static boolean _backup_ftp_delete     ( backup_tool *p_tool );
+static boolean _backup_is_cataloged   ( const backup_tool *p_tool );
+static boolean _backup_put_derivatives( backup_tool *p_tool, const char *s_mime_type );
+
+/* one target of a fan-out: 0 is S3, then the FTP targets in order */
+typedef struct tag_backup_transfer {
+	backup_tool *p_tool;
+	fanout_cursor *p_cursor;
+	uint target;
+	off_t size;
+	const char *s_mime_type;
+	char *s_etag;               /* S3 only */
+	boolean b_result;
+} backup_transfer;
+
+/* S3 has to get the file byte for byte for the targets to share a read */
+#define _backup_can_fan_out( p_tool )   (!backup_is_local( p_tool ) && !(p_tool)->s_blocks_directory[ 0 ] && \
+                                         !(p_tool)->b_strip_metadata && !(p_tool)->b_sparse)
+
+#define backup_is_local( p_tool )   ((p_tool)->s_local_root[ 0 ] != '\0')
 
 
 //////////////////////////////////////////////////////
@@ -90,7 +206,7 @@ int main( int argc, char *argv[] )
 	if( !p_bt ) return 1;
 
 	/* get all of the command line options */
-	while( (option = getopt_long( argc, argv, "b:k:p:c:r:dlvqh", long_options, &option_index )) >= 0 )
+	while( (option = getopt_long( argc, argv, "b:k:p:c:r:L:C:S:B:M:E:F:sPxNZHJTDdlvqh", long_options, &option_index )) >= 0 )
 	{
 		switch( option )
 		{
@@ -118,6 +234,58 @@ int main( int argc, char *argv[] )
 			case 'l': /* S3 list */
 				backup_set_op( p_bt, OP_S3_LIST );
 				break;
+			case 'L': /* local target */
+				backup_set_local_root( p_bt, optarg );
+				break;
+			case 'C': /* catalog */
+				backup_set_catalog( p_bt, optarg );
+				break;
+			case 's': /* strip metadata */
+				backup_set_strip_metadata( p_bt, TRUE );
+				break;
+			case 'P': /* profile */
+				backup_set_profile( p_bt, TRUE );
+				break;
+			case 'S': /* sync */
+				backup_set_op( p_bt, OP_SYNC );
+				backup_set_directory( p_bt, optarg );
+				break;
+			case 'x': /* prune */
+				backup_set_prune( p_bt, TRUE );
+				break;
+			case 'N': /* no cache */
+				backup_set_nocache( p_bt, TRUE );
+				break;
+			case 'Z': /* sparse */
+				backup_set_sparse( p_bt, TRUE );
+				break;
+			case 'B': /* changed blocks */
+				backup_set_blocks( p_bt, optarg );
+				break;
+			case 'M': /* buffer memory */
+				backup_set_buffer_memory( p_bt, (uint) atoi( optarg ), p_bt->b_hugepages );
+				break;
+			case 'H': /* huge pages */
+				backup_set_buffer_memory( p_bt, p_bt->buffer_megabytes, TRUE );
+				break;
+			case 'J': /* JSON messages */
+				backup_set_json_log( p_bt, TRUE );
+				break;
+			case 'E': /* candidate endpoints */
+				backup_set_endpoints( p_bt, optarg );
+				break;
+			case 'F': /* FTP target */
+				if( !backup_add_ftp_target( p_bt, optarg ) )
+				{
+					log_error( "Ignoring FTP target %s (at most %d, host up to %d characters).", optarg, BACKUP_MAX_FTP, FTP_MAX_HOSTNAME - 1 );
+				}
+				break;
+			case 'T': /* startup profile */
+				backup_set_startup_profile( p_bt, TRUE );
+				break;
+			case 'D': /* image derivatives */
+				backup_set_derivatives( p_bt, TRUE );
+				break;
 			case 'v': /* Verbose */
 				backup_set_verbose( p_bt, TRUE );
 				break;
@@ -133,31 +301,108 @@ int main( int argc, char *argv[] )
 		}
 	}
 
-	backup_show_messages_if_verbose( p_bt,
-		printf( "Using %s...\n", configuration_file );
-	);
+	/* before anything reads: the pool is mapped on first use */
+	buffer_pool_configure_shared( (size_t) p_bt->buffer_megabytes * 1024 * 1024, p_bt->b_hugepages ? BUFFER_POOL_HUGEPAGES : 0 );
+
+	/* from here on messages go through the log writer thread */
+	uint64_t begin = profiler_now( );
+	log_set_threshold( p_bt->b_quiet ? LOG_NONE : (p_bt->b_verbose ? LOG_DEBUG : LOG_INFO) );
+	log_start( p_bt->b_json_log ? LOG_NDJSON : LOG_TEXT );
+	p_bt->startup_ns[ STARTUP_LOG ] = profiler_now( ) - begin;
+
+	log_debug( "Using %s...", configuration_file );
 	boolean b_result = FALSE;
 
 	/* Read in configuration from file */
-	if( backup_read_configuration( p_bt, configuration_file ) )
+	begin = profiler_now( );
+	boolean b_configured = backup_read_configuration( p_bt, configuration_file );
+	p_bt->startup_ns[ STARTUP_CONFIGURATION ] = profiler_now( ) - begin;
+
+	if( b_configured )
 	{
-		switch( bt.operation )
+		/* only fills in the structure; libxml waits for the first listing */
+		s3_initialize( &p_bt->s3, p_bt->s_s3_access_id, p_bt->s_s3_secret_key, p_bt->b_verbose );
+		endpoint_set_create( &p_bt->endpoints, p_bt->endpoint_ttl, p_bt->b_verbose );
+		p_bt->b_s3_initialized = TRUE;
+
+		if( endpoint_set_parse( &p_bt->endpoints, p_bt->s_endpoints ) > 0 )
+		{
+			s3_set_endpoints( &p_bt->s3, &p_bt->endpoints );
+		}
+
+		if( backup_is_local( p_bt ) )
+		{
+			localfs_initialize( &p_bt->local, p_bt->s_local_root, p_bt->b_verbose );
+		}
+
+		s3_set_cache_neutral( &p_bt->s3, p_bt->b_nocache );
+		s3_set_sparse( &p_bt->s3, p_bt->b_sparse );
+
+		if( p_bt->b_profile )
+		{
+			/* the status line goes to stderr so it never mixes with results */
+			profiler_create( &p_bt->profiler, p_bt->b_quiet ? NULL : stderr );
+			s3_set_profiler( &p_bt->s3, &p_bt->profiler );
+			localfs_set_profiler( &p_bt->local, &p_bt->profiler );
+		}
+
+		if( p_bt->s_catalog[ 0 ] != '\0' )
+		{
+			p_bt->b_catalog_open = catalog_open( &p_bt->catalog, p_bt->s_catalog );
+
+			if( !p_bt->b_catalog_open )
+			{
+				log_error( "Unable to open catalog (%s).", p_bt->s_catalog );
+			}
+		}
+
+		uint64_t ready = profiler_now( );
+
+		switch( p_bt->operation )
 		{
 			case OP_S3_PUT:
-				b_result = backup_s3_put_file( p_bt, &s3 );
+				b_result = backup_s3_put_file( p_bt );
 				break;
 			case OP_S3_DELETE:
-				b_result = backup_s3_delete_file( p_bt, &s3 );
+				b_result = backup_s3_delete_file( p_bt );
 				break;
 			case OP_S3_LIST:
-				b_result = backup_s3_list_buckets( p_bt, &s3 );
+				b_result = backup_s3_list_buckets( p_bt );
+				break;
+			case OP_SYNC:
+				b_result = backup_sync( p_bt );
 				break;
 			case OP_NOTHING:
 			default:
 				break;
 		}
+
+		if( p_bt->b_catalog_open )
+		{
+			/* one atomic rewrite per run, however many objects changed */
+			if( !catalog_commit( &p_bt->catalog ) )
+			{
+				log_error( "Unable to update catalog (%s).", p_bt->s_catalog );
+			}
+
+			catalog_close( &p_bt->catalog );
+		}
+
+		if( p_bt->b_profile )
+		{
+			profiler_status( &p_bt->profiler, TRUE );
+			log_flush( );
+			profiler_report( &p_bt->profiler, stderr );
+		}
+
+		if( p_bt->b_startup_profile )
+		{
+			log_flush( );
+			_backup_startup_report( p_bt, ready );
+		}
 	}
 
+	log_stop( );
 	backup_destroy( &p_bt );
 
 	return b_result ? 0 : 2;
@@ -196,33 +441,43 @@ boolean backup_destroy( backup_tool** p_tool )
 boolean backup_initialize( backup_tool *p_tool )
 {
 	assert( p_tool );
-	curl_global_init( CURL_GLOBAL_ALL );
 
+	/* nothing here may cost more than filling in fields; cURL, the
+	 * MIME table and libxml are set up when an operation first needs them */
+	p_tool->started          = profiler_now( );
 	p_tool->b_verbose        = FALSE;
 	p_tool->b_quiet          = FALSE;
+	p_tool->b_strip_metadata = FALSE;
+	p_tool->b_profile        = FALSE;
+	p_tool->b_prune          = FALSE;
+	p_tool->b_nocache        = FALSE;
+	p_tool->b_sparse         = FALSE;
+	p_tool->b_hugepages      = FALSE;
+	p_tool->b_json_log       = FALSE;
+	p_tool->b_derivatives    = FALSE;
+	p_tool->b_startup_profile = FALSE;
+	p_tool->b_mime_loaded    = FALSE;
+	p_tool->b_s3_initialized = FALSE;
+	p_tool->buffer_megabytes = BUFFER_POOL_DEFAULT_LIMIT / (1024 * 1024);
 	p_tool->operation        = OP_NOTHING;
 	p_tool->s_s3_bucket[ 0 ] = '\0';
 	p_tool->s_key[ 0 ]       = '\0';
+	p_tool->s_local_root[ 0 ] = '\0';
+	p_tool->s_catalog[ 0 ]   = '\0';
+	p_tool->s_directory[ 0 ] = '\0';
+	p_tool->s_blocks_directory[ 0 ] = '\0';
+	p_tool->b_catalog_open   = FALSE;
 	p_tool->retries          = 1;
-	p_tool->p_curl           = curl_easy_init( );
-
-	if( !p_tool->p_curl )
-	{
-		backup_show_messages( p_tool,
-			fprintf( stderr, "Unable to create cURL handle.\n" );
-		);
-		return FALSE;
-	}
-
-	/* Set common options */
-	#ifdef _CURL_VERBOSE
-		curl_easy_setopt( p_tool->p_curl, CURLOPT_VERBOSE, 1 );
-	#endif
-
-	/* this allocates memory */
-	mime_create( &p_tool->mime_table );
-
-	s3_initialize( &s3, bt.s_s3_access_id, bt.s_s3_secret_key, bt.b_verbose );
+	p_tool->p_curl           = NULL;
+	p_tool->s_s3_access_id[ 0 ]  = '\0';
+	p_tool->s_s3_secret_key[ 0 ] = '\0';
+	p_tool->s_endpoints[ 0 ]     = '\0';
+	p_tool->s_ftp_username[ 0 ]  = '\0';
+	p_tool->s_ftp_password[ 0 ]  = '\0';
+	p_tool->ftp_count            = 0;
+	p_tool->ftp_pool_count       = 0;
+	p_tool->endpoint_ttl         = ENDPOINT_DEFAULT_TTL;
+	memset( p_tool->startup_ns, 0, sizeof(p_tool->startup_ns) );
 
 	return TRUE;
 }
@@ -230,8 +485,18 @@ boolean backup_initialize( backup_tool *p_tool )
 boolean backup_deinitialize( backup_tool *p_tool )
 {
 	assert( p_tool );
-	curl_easy_cleanup( p_tool->p_curl );
-	curl_global_cleanup( );
+
+	/* logs out; before cURL goes away */
+	while( p_tool->ftp_pool_count > 0 )
+	{
+		ftp_pool_destroy( &p_tool->ftp_pools[ --p_tool->ftp_pool_count ] );
+	}
+
+	if( p_tool->p_curl )
+	{
+		curl_easy_cleanup( p_tool->p_curl );
+		curl_global_cleanup( );
+	}
 
 	#ifdef _DEBUG
 	p_tool->b_verbose        = FALSE;
@@ -242,45 +507,153 @@ boolean backup_deinitialize( backup_tool *p_tool )
 	p_tool->p_curl           = NULL;
 	#endif
 
-	mime_destroy( &p_tool->mime_table );
+	if( p_tool->b_mime_loaded )
+	{
+		mime_destroy( &p_tool->mime_table );
+		p_tool->b_mime_loaded = FALSE;
+	}
 
-	s3_deinitialize( );
+	if( p_tool->b_s3_initialized )
+	{
+		endpoint_set_destroy( &p_tool->endpoints );
+		s3_deinitialize( );
+		p_tool->b_s3_initialized = FALSE;
+	}
 
 	return TRUE;
 }
 
+/* cURL is only needed to talk to S3; the first caller pays for it */
+boolean _backup_curl( backup_tool *p_tool )
+{
+	if( !p_tool->p_curl )
+	{
+		uint64_t begin = profiler_now( );
+
+		/* not thread safe; sync's workers make their own handles after this */
+		curl_global_init( CURL_GLOBAL_ALL );
+		p_tool->p_curl = curl_easy_init( );
+
+		if( !p_tool->p_curl )
+		{
+			log_error( "Unable to create cURL handle." );
+			curl_global_cleanup( );
+		}
+		else
+		{
+			/* Set common options */
+			#ifdef _CURL_VERBOSE
+				curl_easy_setopt( p_tool->p_curl, CURLOPT_VERBOSE, 1 );
+			#endif
+		}
+
+		p_tool->startup_ns[ STARTUP_CURL ] += profiler_now( ) - begin;
+
+		/* all candidates at once, before the first request rather than inside it */
+		if( p_tool->p_curl && p_tool->s3.p_endpoints )
+		{
+			begin = profiler_now( );
+			endpoint_probe( p_tool->s3.p_endpoints );
+			p_tool->startup_ns[ STARTUP_ENDPOINTS ] += profiler_now( ) - begin;
+		}
+	}
+
+	return p_tool->p_curl != NULL;
+}
+
+/* the sessions log in with their first transfer and stay logged in until the tool goes away */
+boolean _backup_ftp_pools( backup_tool *p_tool )
+{
+	if( !_backup_curl( p_tool ) ) return FALSE;
+
+	while( p_tool->ftp_pool_count < p_tool->ftp_count )
+	{
+		uint i = p_tool->ftp_pool_count;
+
+		if( !ftp_pool_create( &p_tool->ftp_pools[ i ], p_tool->s_ftp_hosts[ i ], p_tool->s_ftp_username[ 0 ] ? p_tool->s_ftp_username : NULL,
+		                      p_tool->s_ftp_password, BACKUP_FTP_SESSIONS, p_tool->b_verbose ) )
+		{
+			log_error( "Unable to set up FTP sessions for %s.", p_tool->s_ftp_hosts[ i ] );
+			return FALSE;
+		}
+
+		p_tool->ftp_pool_count++;
+	}
+
+	return TRUE;
+}
+
+/* parsing and sorting /etc/mime.types is only worth it for uploads to S3 */
+mime_table* _backup_mime_table( backup_tool *p_tool )
+{
+	if( !p_tool->b_mime_loaded )
+	{
+		uint64_t begin = profiler_now( );
+
+		/* this allocates memory */
+		mime_create( &p_tool->mime_table );
+		p_tool->b_mime_loaded = TRUE;
+
+		p_tool->startup_ns[ STARTUP_MIME ] += profiler_now( ) - begin;
+	}
+
+	return &p_tool->mime_table;
+}
+
+/* phases that never ran show as "not used" */
+void _backup_startup_report( const backup_tool *p_tool, uint64_t ready )
+{
+	int i;
+
+	fprintf( stderr, "Startup:\n" );
+	fprintf( stderr, "  %-16s %10.3f ms\n", "before operation", (ready - p_tool->started) / 1000000.0 );
+
+	for( i = 0; i < STARTUP_PHASES; i++ )
+	{
+		if( p_tool->startup_ns[ i ] > 0 )
+		{
+			fprintf( stderr, "  %-16s %10.3f ms\n", startup_phase_names[ i ], p_tool->startup_ns[ i ] / 1000000.0 );
+		}
+		else
+		{
+			fprintf( stderr, "  %-16s %13s\n", startup_phase_names[ i ], "not used" );
+		}
+	}
+}
+
 boolean backup_read_configuration( backup_tool *p_tool, const char *configuration_file )
 {
 	boolean b_result = TRUE;
-	GKeyFile *p_configuration_file = g_key_file_new( );
+	GKeyFile *p_configuration_file;
+
+	/* a local target needs no S3 credentials; with no FTP target either, don't even read the file */
+	if( backup_is_local( p_tool ) && p_tool->ftp_count == 0 )
+	{
+		return TRUE;
+	}
 
+	p_configuration_file = g_key_file_new( );
 	b_result = g_key_file_load_from_file( p_configuration_file, configuration_file, G_KEY_FILE_NONE, NULL );
 
-	if( !b_result )
+	if( !b_result && !backup_is_local( p_tool ) )
 	{
-		backup_show_messages( p_tool,
-			fprintf( stderr, "Unable to load configuration file (%s).\n", configuration_file );
-		);
+		log_error( "Unable to load configuration file (%s).", configuration_file );
 		//b_result = FALSE;
 	}
 
-	if( b_result )
+	if( b_result && !backup_is_local( p_tool ) )
 	{
 		gchar *aws_access_id  = g_key_file_get_value( p_configuration_file, BACKUP_S3_GROUP_NAME, "AccessId", NULL );
 		gchar *aws_secret_key = g_key_file_get_value( p_configuration_file, BACKUP_S3_GROUP_NAME, "SecretKey", NULL );
 
 		if( !aws_access_id || *aws_access_id == '\0' )
 		{
-			backup_show_messages( p_tool,
-				fprintf( stderr, "AWS access ID is required in configuration file (%s).\n", configuration_file );
-			);
+			log_error( "AWS access ID is required in configuration file (%s).", configuration_file );
 			b_result = FALSE;
 		}
 		else if( !aws_secret_key || *aws_secret_key == '\0' )
 		{
-			backup_show_messages( p_tool,
-				fprintf( stderr, "AWS secret key is required in configuration file (%s).\n", configuration_file );
-			);
+			log_error( "AWS secret key is required in configuration file (%s).", configuration_file );
 			b_result = FALSE;
 		}
 
@@ -296,9 +669,47 @@ boolean backup_read_configuration( backup_tool *p_tool, const char *configuratio
 		g_free( aws_secret_key );
 	}
 
+	/* optional: Endpoints=host,host... and EndpointTTL=seconds; --endpoints wins */
+	if( b_result && !backup_is_local( p_tool ) )
+	{
+		gchar *endpoints = g_key_file_get_value( p_configuration_file, BACKUP_S3_GROUP_NAME, "Endpoints", NULL );
+		gint ttl         = g_key_file_get_integer( p_configuration_file, BACKUP_S3_GROUP_NAME, "EndpointTTL", NULL );
+
+		if( endpoints && p_tool->s_endpoints[ 0 ] == '\0' )
+		{
+			backup_set_endpoints( p_tool, endpoints );
+		}
+
+		if( ttl > 0 )
+		{
+			p_tool->endpoint_ttl = (uint) ttl;
+		}
+
+		g_free( endpoints );
+	}
+
+	/* optional: without Username= the FTP targets are logged into anonymously */
+	if( b_result && p_tool->ftp_count > 0 )
+	{
+		gchar *ftp_username = g_key_file_get_value( p_configuration_file, BACKUP_FTP_GROUP_NAME, "Username", NULL );
+		gchar *ftp_password = g_key_file_get_value( p_configuration_file, BACKUP_FTP_GROUP_NAME, "Password", NULL );
+
+		if( ftp_username )
+		{
+			strncpy( p_tool->s_ftp_username, ftp_username, sizeof(p_tool->s_ftp_username) );
+			strncpy( p_tool->s_ftp_password, ftp_password ? ftp_password : "", sizeof(p_tool->s_ftp_password) );
+			p_tool->s_ftp_username[ sizeof(p_tool->s_ftp_username) - 1 ] = '\0';
+			p_tool->s_ftp_password[ sizeof(p_tool->s_ftp_password) - 1 ] = '\0';
+		}
+
+		g_free( ftp_username );
+		g_free( ftp_password );
+	}
+
 	g_key_file_free( p_configuration_file );
 
-	return b_result;
+	/* a local target does without the file */
+	return b_result || backup_is_local( p_tool );
 }
 
 void backup_set_s3_bucket( backup_tool *p_tool, const char *bucket )
@@ -325,6 +736,79 @@ void backup_set_file( backup_tool *p_tool, const char *filename )
 	p_tool->s_filename[ sizeof(p_tool->s_filename) - 1 ] = '\0';
 }
 
+void backup_set_local_root( backup_tool *p_tool, const char *s_root )
+{
+	assert( p_tool );
+	assert( s_root && *s_root );
+	strncpy( p_tool->s_local_root, s_root, sizeof(p_tool->s_local_root) );
+	p_tool->s_local_root[ sizeof(p_tool->s_local_root) - 1 ] = '\0';
+}
+
+void backup_set_strip_metadata( backup_tool *p_tool, boolean b_strip )
+{
+	assert( p_tool );
+	p_tool->b_strip_metadata = b_strip;
+}
+
+void backup_set_catalog( backup_tool *p_tool, const char *s_catalog )
+{
+	assert( p_tool );
+	assert( s_catalog && *s_catalog );
+	strncpy( p_tool->s_catalog, s_catalog, sizeof(p_tool->s_catalog) );
+	p_tool->s_catalog[ sizeof(p_tool->s_catalog) - 1 ] = '\0';
+}
+
+void backup_set_profile( backup_tool *p_tool, boolean b_profile )
+{
+	assert( p_tool );
+	p_tool->b_profile = b_profile;
+}
+
+void backup_set_directory( backup_tool *p_tool, const char *s_directory )
+{
+	assert( p_tool );
+	strncpy( p_tool->s_directory, s_directory, sizeof(p_tool->s_directory) );
+	p_tool->s_directory[ sizeof(p_tool->s_directory) - 1 ] = '\0';
+}
+
+void backup_set_blocks( backup_tool *p_tool, const char *s_directory )
+{
+	assert( p_tool );
+	strncpy( p_tool->s_blocks_directory, s_directory, sizeof(p_tool->s_blocks_directory) );
+	p_tool->s_blocks_directory[ sizeof(p_tool->s_blocks_directory) - 1 ] = '\0';
+}
+
+void backup_set_buffer_memory( backup_tool *p_tool, uint megabytes, boolean b_hugepages )
+{
+	assert( p_tool );
+	p_tool->buffer_megabytes = megabytes > 0 ? megabytes : 1;
+	p_tool->b_hugepages      = b_hugepages;
+}
+
+void backup_set_prune( backup_tool *p_tool, boolean b_prune )
+{
+	assert( p_tool );
+	p_tool->b_prune = b_prune;
+}
+
+void backup_set_nocache( backup_tool *p_tool, boolean b_nocache )
+{
+	assert( p_tool );
+	p_tool->b_nocache = b_nocache;
+}
+
+void backup_set_sparse( backup_tool *p_tool, boolean b_sparse )
+{
+	assert( p_tool );
+	p_tool->b_sparse = b_sparse;
+}
+
+void backup_set_derivatives( backup_tool *p_tool, boolean b_derivatives )
+{
+	assert( p_tool );
+	p_tool->b_derivatives = b_derivatives;
+}
+
 void backup_set_op( backup_tool *p_tool, backup_operation op )
 {
 	assert( p_tool );
@@ -349,6 +833,52 @@ void backup_set_quiet( backup_tool *p_tool, boolean quiet )
 	p_tool->b_quiet = quiet;
 }
 
+void backup_set_json_log( backup_tool *p_tool, boolean b_json_log )
+{
+	assert( p_tool );
+	p_tool->b_json_log = b_json_log;
+}
+
+void backup_set_startup_profile( backup_tool *p_tool, boolean b_startup_profile )
+{
+	assert( p_tool );
+	p_tool->b_startup_profile = b_startup_profile;
+}
+
+void backup_set_endpoints( backup_tool *p_tool, const char *s_endpoints )
+{
+	assert( p_tool );
+	assert( s_endpoints );
+	strncpy( p_tool->s_endpoints, s_endpoints, sizeof(p_tool->s_endpoints) );
+	p_tool->s_endpoints[ sizeof(p_tool->s_endpoints) - 1 ] = '\0';
+}
+
+boolean backup_add_ftp_target( backup_tool *p_tool, const char *s_target )
+{
+	const char *p_slash;
+	size_t host_length;
+
+	assert( p_tool );
+	assert( s_target );
+
+	/* host[/path]; the path is absolute on the server */
+	p_slash     = strchr( s_target, '/' );
+	host_length = p_slash ? (size_t) (p_slash - s_target) : strlen( s_target );
+
+	if( p_tool->ftp_count >= BACKUP_MAX_FTP || host_length == 0 || host_length >= FTP_MAX_HOSTNAME )
+	{
+		return FALSE;
+	}
+
+	memcpy( p_tool->s_ftp_hosts[ p_tool->ftp_count ], s_target, host_length );
+	p_tool->s_ftp_hosts[ p_tool->ftp_count ][ host_length ] = '\0';
+	strncpy( p_tool->s_ftp_paths[ p_tool->ftp_count ], p_slash ? p_slash + 1 : "", sizeof(p_tool->s_ftp_paths[ 0 ]) );
+	p_tool->s_ftp_paths[ p_tool->ftp_count ][ sizeof(p_tool->s_ftp_paths[ 0 ]) - 1 ] = '\0';
+	p_tool->ftp_count++;
+
+	return TRUE;
+}
+
 void backup_set_retries( backup_tool *p_tool, uint retries )
 {
 	assert( p_tool );
@@ -377,75 +907,503 @@ boolean backup_s3_put_file( backup_tool *p_tool )
 {
 	boolean b_result        = FALSE;
 	const char *p_dot       = strrchr( p_tool->s_filename, '.' );
-	const char *extension   = p_dot ? p_dot + 1 : "txt";
-	const char *s_mime_type = mime_type( &p_tool->mime_table, extension );
+	const char *s_mime_type = NULL;
 	uint retry_attempts     = p_tool->retries + 1;
+	boolean b_fan_out       = p_tool->ftp_count > 0 && _backup_can_fan_out( p_tool );
+	boolean b_archived      = TRUE;
+	boolean b_derived       = TRUE;
+	boolean ftp_done[ BACKUP_MAX_FTP ];
+	boolean ftp_attempted[ BACKUP_MAX_FTP ];
+	char s_etag[ S3_MAX_ETAG ];
 
-	assert( extension );
-	assert( s_mime_type );
 	assert( retry_attempts > 0 );
 
+	s_etag[ 0 ] = '\0';
+	memset( ftp_done, 0, sizeof(ftp_done) );
+	memset( ftp_attempted, 0, sizeof(ftp_attempted) );
+
+	/* the catalog knows what the bucket holds, but nothing about the FTP archives */
+	if( p_tool->b_catalog_open && p_tool->ftp_count == 0 && _backup_is_cataloged( p_tool ) )
+	{
+		log_info( "Uploading: %-12.12s   %40.40s --> UNCHANGED", "", p_tool->s_filename );
+		return TRUE;
+	}
+
+	if( p_tool->b_profile )
+	{
+		struct stat info;
+
+		if( stat( p_tool->s_filename, &info ) == 0 )
+		{
+			profiler_set_total( &p_tool->profiler, 1, (uint64_t) info.st_size );
+		}
+	}
+
+	if( !backup_is_local( p_tool ) && !_backup_curl( p_tool ) ) return FALSE;
+
+	/* the FTP targets need cURL even next to a local target */
+	if( p_tool->ftp_count > 0 && !_backup_ftp_pools( p_tool ) ) return FALSE;
+
+	if( !backup_is_local( p_tool ) )
+	{
+		/* s3_put_file() sniffs the real type from the first bytes it uploads */
+		s_mime_type = p_dot ? mime_type( _backup_mime_table( p_tool ), p_dot + 1 ) : NULL;
+		s3_set_mime_table( &p_tool->s3, _backup_mime_table( p_tool ) );
+	}
+
+	if( p_tool->ftp_count > 0 && !b_fan_out )
+	{
+		log_debug( "%s is read once for each target: %s.", p_tool->s_filename,
+		           backup_is_local( p_tool ) ? "local copies are made by the kernel" : "S3 gets a rewritten copy" );
+	}
+
 	while( !b_result && retry_attempts > 0 )
 	{
-		backup_show_messages( p_tool,
-			printf( "Uploading: %-12.12s   %40.40s --> ", s_mime_type, p_tool->s_filename );
-		);
+		if( b_fan_out && retry_attempts == p_tool->retries + 1 )
+		{
+			/* the first attempt reads the file once for S3 and the FTP targets; retries go alone */
+			b_result = _backup_fanout_put( p_tool, s_etag, ftp_done, ftp_attempted );
+		}
+		else if( backup_is_local( p_tool ) )
+		{
+			b_result = localfs_put_file( &p_tool->local, p_tool->s_s3_bucket, p_tool->s_key, p_tool->s_filename );
+		}
+		else if( p_tool->s_blocks_directory[ 0 ] )
+		{
+			blocks_stats stats;
 
-		b_result = s3_put_file( p_tool->p_curl, &p_tool->s3, p_tool->s_s3_bucket, p_tool->s_key, p_tool->s_filename, s_mime_type );
+			b_result = blocks_put_file( p_tool->p_curl, &p_tool->s3, p_tool->s_s3_bucket, p_tool->s_key, p_tool->s_filename, p_tool->s_blocks_directory, &stats );
 
-		backup_show_messages( p_tool,
-			if( retry_attempts > 1 )
-			{
-				printf( "%s\n", b_result ? "SUCCESS" : "FAILED (but will retry)" );
-			}
-			else
-			{
-				printf( "%s\n", b_result ? "SUCCESS" : "FAILED" );
-			}
-		);
+			log_debug( "%s: %llu of %llu blocks changed, %llu sent, %llu bytes", p_tool->s_filename, (unsigned long long) stats.changed, (unsigned long long) stats.blocks,
+			           (unsigned long long) stats.uploaded, (unsigned long long) stats.bytes );
+		}
+		else
+		{
+			s3_set_strip_metadata( &p_tool->s3, p_tool->b_strip_metadata );
+			b_result = s3_put_file( p_tool->p_curl, &p_tool->s3, p_tool->s_s3_bucket, p_tool->s_key, p_tool->s_filename, NULL, s_etag );
+		}
+
+		log_info( "Uploading: %-12.12s   %40.40s --> %s", s_mime_type ? s_mime_type : (backup_is_local( p_tool ) ? "" : "(sniffed)"), p_tool->s_filename,
+		          b_result ? "SUCCESS" : (retry_attempts > 1 ? "FAILED (but will retry)" : "FAILED") );
+
+		/* the number of the attempt that failed */
+		if( !b_result && retry_attempts > 1 ) TRACE3( put_retry, p_tool->s_s3_bucket, p_tool->s_key, p_tool->retries + 2 - retry_attempts );
 
 		retry_attempts--;
 	}
 
+	/* retries, and targets that could not share the read, read the file on their own */
+	if( p_tool->ftp_count > 0 )
+	{
+		b_archived = _backup_ftp_put( p_tool, ftp_done, ftp_attempted );
+	}
+
+	if( b_result && p_tool->b_profile )
+	{
+		profiler_file_done( &p_tool->profiler );
+	}
+
+	if( b_result && p_tool->b_catalog_open )
+	{
+		char s_catalog_key[ CATALOG_MAX_KEY ];
+		struct stat info;
+
+		if( stat( p_tool->s_filename, &info ) == 0 )
+		{
+			snprintf( s_catalog_key, sizeof(s_catalog_key), "%s/%s", p_tool->s_s3_bucket, p_tool->s_key );
+			catalog_put( &p_tool->catalog, s_catalog_key, (uint64_t) info.st_size, (int64_t) info.st_mtime, s_etag );
+		}
+	}
+
+	if( b_result && p_tool->b_derivatives )
+	{
+		b_derived = _backup_put_derivatives( p_tool, s_mime_type );
+	}
+
+	return b_result && b_archived && b_derived;
+}
+
+#ifdef _HAVE_MAGICK
+static const image_derivative backup_derivatives[] = {
+	{ "thumbnail", 160,  160, 0, 0, 0, 0, TRUE,  "JPEG", 80 },
+	{ "medium",    1024, 0,   0, 0, 0, 0, TRUE,  "JPEG", 85 },
+};
+#endif
+
+/* resized copies go next to the key, as <key's directory>/<derivative>/<file name>, straight from memory */
+boolean _backup_put_derivatives( backup_tool *p_tool, const char *s_mime_type )
+{
+#ifdef _HAVE_MAGICK
+	const char *filenames[ 1 ] = { p_tool->s_filename };
+	const char *p_slash        = strrchr( p_tool->s_key, '/' );
+	char s_prefix[ sizeof(p_tool->s_key) ];
+	image_pipeline pipeline;
+	image_s3_sink sink;
+	boolean b_result;
+
+	if( backup_is_local( p_tool ) )
+	{
+		log_warning( "Derivatives are only uploaded to S3." );
+		return TRUE;
+	}
+
+	if( !s_mime_type || strncmp( s_mime_type, "image/", 6 ) != 0 )
+	{
+		return TRUE;
+	}
+
+	snprintf( s_prefix, sizeof(s_prefix), "%.*s", p_slash ? (int) (p_slash - p_tool->s_key) : 0, p_tool->s_key );
+
+	if( !simple_image_initialize( NULL, 0 ) || !image_s3_sink_create( &sink, &p_tool->s3, p_tool->s_s3_bucket, s_prefix, 1 ) )
+	{
+		log_error( "Cannot set up the image pipeline." );
+		return FALSE;
+	}
+
+	memset( &pipeline, 0, sizeof(image_pipeline) );
+	pipeline.derivatives      = backup_derivatives;
+	pipeline.derivative_count = sizeof(backup_derivatives) / sizeof(backup_derivatives[0]);
+	pipeline.worker_count     = 1;
+	pipeline.sink             = image_s3_sink_put;
+	pipeline.sink_data        = &sink;
+	pipeline.b_verbose        = p_tool->b_verbose;
+
+	b_result = image_pipeline_run( &pipeline, filenames, 1, NULL );
+
+	log_info( " Deriving: %-12.12s   %40.40s --> %s", s_mime_type, p_tool->s_filename, b_result ? "SUCCESS" : "FAILED" );
+
+	image_s3_sink_destroy( &sink );
+	simple_image_deinitialize( );
+
+	return b_result;
+#else
+	log_error( "Built without ImageMagick; no derivatives for %s.", p_tool->s_filename );
+	return FALSE;
+#endif
+}
+
+/* the file is what was last put under the key: same size and mtime */
+boolean _backup_is_cataloged( const backup_tool *p_tool )
+{
+	char s_catalog_key[ CATALOG_MAX_KEY ];
+	catalog_entry entry;
+	struct stat info;
+
+	if( stat( p_tool->s_filename, &info ) != 0 )
+	{
+		return FALSE;
+	}
+
+	snprintf( s_catalog_key, sizeof(s_catalog_key), "%s/%s", p_tool->s_s3_bucket, p_tool->s_key );
+
+	return catalog_lookup( &p_tool->catalog, s_catalog_key, &entry ) &&
+	       entry.size == (uint64_t) info.st_size && entry.mtime == (int64_t) info.st_mtime;
+}
+
+/* one read of the file for S3 and every FTP target, each sending at its own pace */
+boolean _backup_fanout_put( backup_tool *p_tool, char *s_etag, boolean *p_ftp_done, boolean *p_ftp_attempted )
+{
+	backup_transfer transfers[ FANOUT_MAX_TARGETS ];
+	pthread_t threads[ FANOUT_MAX_TARGETS ];
+	const byte *p_first = NULL;
+	size_t first_length = 0;
+	const char *s_mime_type;
+	uint count          = 1 + p_tool->ftp_count;
+	uint started;
+	uint i;
+	off_t size          = 0;
+	fanout fan;
+
+	if( !fanout_open( &fan, p_tool->s_filename, p_tool->b_nocache ? READAHEAD_NOCACHE : 0, count, p_tool->b_profile ? &p_tool->profiler : NULL, &size ) )
+	{
+		log_error( "Cannot read %s.", p_tool->s_filename );
+		return FALSE;
+	}
+
+	/* the first chunk doubles as the sniffing buffer, as in s3_put_file() */
+	fanout_peek( &fan, &p_first, &first_length );
+	s_mime_type = mime_detect( p_tool->s3.p_mime_table, p_tool->s_filename, p_first, first_length );
+
+	for( i = 0; i < count; i++ )
+	{
+		transfers[ i ].p_tool      = p_tool;
+		transfers[ i ].p_cursor    = fanout_cursor( &fan, i );
+		transfers[ i ].target      = i;
+		transfers[ i ].size        = size;
+		transfers[ i ].s_mime_type = s_mime_type;
+		transfers[ i ].s_etag      = i == 0 ? s_etag : NULL;
+		transfers[ i ].b_result    = FALSE;
+	}
+
+	/* S3 goes on this thread with the tool's handle, the FTP targets on threads of their own */
+	for( started = 1; started < count; started++ )
+	{
+		if( pthread_create( &threads[ started ], NULL, _backup_transfer_thread, &transfers[ started ] ) != 0 )
+		{
+			break;
+		}
+	}
+
+	/* targets without a thread must not hold the others back; they are sent on their own later */
+	for( i = started; i < count; i++ )
+	{
+		fanout_detach( transfers[ i ].p_cursor );
+	}
+
+	_backup_transfer_thread( &transfers[ 0 ] );
+
+	for( i = 1; i < started; i++ )
+	{
+		pthread_join( threads[ i ], NULL );
+	}
+
+	if( fanout_failed( &fan ) )
+	{
+		log_error( "Cannot read %s.", p_tool->s_filename );
+	}
+
+	fanout_close( &fan );
+
+	for( i = 1; i < count; i++ )
+	{
+		p_ftp_done[ i - 1 ]      = transfers[ i ].b_result;
+		p_ftp_attempted[ i - 1 ] = i < started;
+
+		log_info( "Archiving: %-12.12s   %40.40s --> ftp://%s/%s %s", s_mime_type, p_tool->s_filename, p_tool->s_ftp_hosts[ i - 1 ], p_tool->s_ftp_paths[ i - 1 ],
+		          i >= started            ? "NOT STARTED (will be sent on its own)" :
+		          transfers[ i ].b_result ? "SUCCESS" : (p_tool->retries > 0 ? "FAILED (but will retry)" : "FAILED") );
+	}
+
+	return transfers[ 0 ].b_result;
+}
+
+void* _backup_transfer_thread( void *p_data )
+{
+	backup_transfer *p_transfer = (backup_transfer *) p_data;
+	backup_tool *p_tool         = p_transfer->p_tool;
+
+	if( p_transfer->target == 0 )
+	{
+		p_transfer->b_result = s3_put_reader( p_tool->p_curl, &p_tool->s3, p_tool->s_s3_bucket, p_tool->s_key, fanout_read, p_transfer->p_cursor,
+		                                      (size_t) p_transfer->size, p_transfer->s_mime_type, p_transfer->s_etag );
+	}
+	else
+	{
+		uint ftp = p_transfer->target - 1;
+
+		/* every target has a pool of its own, so no other thread touches it */
+		p_transfer->b_result = ftp_pool_upload_reader( &p_tool->ftp_pools[ ftp ], p_tool->s_ftp_paths[ ftp ], p_tool->s_filename,
+		                                               fanout_read, p_transfer->p_cursor, (curl_off_t) p_transfer->size );
+	}
+
+	/* done or failed, this target no longer holds the others back */
+	fanout_detach( p_transfer->p_cursor );
+
+	return NULL;
+}
+
+/* FTP targets the fan-out did not serve, each reading the file itself */
+boolean _backup_ftp_put( backup_tool *p_tool, const boolean *p_ftp_done, const boolean *p_ftp_attempted )
+{
+	const char *filenames[ 1 ] = { p_tool->s_filename };
+	boolean b_result           = TRUE;
+	uint i;
+
+	for( i = 0; i < p_tool->ftp_count; i++ )
+	{
+		ftp_pool *p_pool    = &p_tool->ftp_pools[ i ];
+		/* a fan-out transfer that failed was the first attempt; one that never started was not */
+		uint retry_attempts = p_ftp_attempted[ i ] ? p_tool->retries : p_tool->retries + 1;
+		boolean b_retry     = p_ftp_attempted[ i ];
+		boolean b_done      = p_ftp_done[ i ];
+
+		ftp_pool_set_profiler( p_pool, p_tool->b_profile ? &p_tool->profiler : NULL );
+
+		while( !b_done && retry_attempts > 0 )
+		{
+			/* a retry continues what reached the server (SIZE, HASH/XCRC, APPE), over the session that is still logged in;
+			 * without a digest only what the failed attempt itself sent is continued, anything else goes again in full */
+			ftp_pool_set_resume( p_pool, b_retry );
+			b_done = ftp_pool_upload( p_pool, p_tool->s_ftp_paths[ i ], filenames, 1, NULL );
+
+			log_info( "Archiving: %40.40s --> ftp://%s/%s %s", p_tool->s_filename, p_tool->s_ftp_hosts[ i ], p_tool->s_ftp_paths[ i ],
+			          b_done ? "SUCCESS" : (retry_attempts > 1 ? "FAILED (but will retry)" : "FAILED") );
+
+			b_retry = TRUE;
+			retry_attempts--;
+		}
+
+		ftp_pool_set_resume( p_pool, FALSE );
+		b_result = b_result && b_done;
+	}
+
+	return b_result;
+}
+
+/* FTP targets keep files under their base name, so the key's base name is what goes */
+boolean _backup_ftp_delete( backup_tool *p_tool )
+{
+	const char *p_slash = strrchr( p_tool->s_key, '/' );
+	const char *s_name  = p_slash ? p_slash + 1 : p_tool->s_key;
+	boolean b_result    = TRUE;
+	char s_filepath[ 1024 ];
+	uint i;
+
+	for( i = 0; i < p_tool->ftp_count; i++ )
+	{
+		const char *filepaths[ 1 ] = { s_filepath };
+		const char *s_path         = p_tool->s_ftp_paths[ i ];
+		uint retry_attempts        = p_tool->retries + 1;
+		boolean b_done             = FALSE;
+
+		while( *s_path == '/' ) s_path++;
+		snprintf( s_filepath, sizeof(s_filepath), *s_path ? "/%s/%s" : "/%s%s", s_path, s_name );
+
+		while( !b_done && retry_attempts > 0 )
+		{
+			/* a missing file counts as deleted */
+			b_done = ftp_pool_delete( &p_tool->ftp_pools[ i ], filepaths, 1 );
+
+			log_info( " Deleting:    ftp://%s%s --> %s", p_tool->s_ftp_hosts[ i ], s_filepath,
+			          b_done ? "SUCCESS" : (retry_attempts > 1 ? "FAILED (but will retry)" : "FAILED") );
+
+			retry_attempts--;
+		}
+
+		b_result = b_result && b_done;
+	}
+
 	return b_result;
 }
 
 boolean backup_s3_delete_file( backup_tool *p_tool )
 {
 	boolean b_result    = FALSE;
+	boolean b_archived  = TRUE;
 	uint retry_attempts = p_tool->retries + 1;
 
+	/* no MIME table and no XML here: a cron-driven delete pays for cURL alone */
+	if( !backup_is_local( p_tool ) && !_backup_curl( p_tool ) ) return FALSE;
+	if( p_tool->ftp_count > 0 && !_backup_ftp_pools( p_tool ) ) return FALSE;
+
 	while( !b_result && retry_attempts > 0 )
 	{
-		backup_show_messages( p_tool,
+		if( backup_is_local( p_tool ) )
+		{
+			b_result = localfs_delete_file( &p_tool->local, p_tool->s_s3_bucket, p_tool->s_key );
+		}
+		else
+		{
+			b_result = s3_delete_file( p_tool->p_curl, &p_tool->s3, p_tool->s_s3_bucket, p_tool->s_key );
+		}
+
+		if( log_is_enabled(LOG_INFO) )
+		{
 			char s_bucket_and_key[ 52 ];
 			snprintf( s_bucket_and_key, sizeof(s_bucket_and_key), "%s/%s", p_tool->s_s3_bucket, p_tool->s_key );
-			printf( " Deleting:    %52.52s --> ", s_bucket_and_key );
-		);
-
-		b_result = s3_delete_file( p_tool->p_curl, &p_tool->s3, p_tool->s_s3_bucket, p_tool->s_key );
+			log_info( " Deleting:    %52.52s --> %s", s_bucket_and_key, b_result ? "SUCCESS" : (retry_attempts > 1 ? "FAILED (but will retry)" : "FAILED") );
+		}
 
-		backup_show_messages( p_tool,
-			if( retry_attempts > 1 )
-			{
-				printf( "%s\n", b_result ? "SUCCESS" : "FAILED (but will retry)" );
-			}
-			else
-			{
-				printf( "%s\n", b_result ? "SUCCESS" : "FAILED" );
-			}
-		);
+		if( !b_result && retry_attempts > 1 ) TRACE3( delete_retry, p_tool->s_s3_bucket, p_tool->s_key, p_tool->retries + 2 - retry_attempts );
 
 		retry_attempts--;
 	}
 
-	return b_result;
+	if( b_result && p_tool->b_catalog_open )
+	{
+		char s_catalog_key[ CATALOG_MAX_KEY ];
+
+		snprintf( s_catalog_key, sizeof(s_catalog_key), "%s/%s", p_tool->s_s3_bucket, p_tool->s_key );
+		catalog_delete( &p_tool->catalog, s_catalog_key );
+	}
+
+	/* the archived copies go too */
+	if( p_tool->ftp_count > 0 )
+	{
+		b_archived = _backup_ftp_delete( p_tool );
+	}
+
+	return b_result && b_archived;
 }
 
 boolean backup_s3_list_buckets( backup_tool *p_tool )
 {
 	boolean b_result = FALSE;
-	b_result = s3_list_buckets( p_tool->p_curl, &p_tool->s3 );
+
+	/* the listing is printed directly; keep it after earlier messages */
+	log_flush( );
+
+	if( backup_is_local( p_tool ) )
+	{
+		b_result = localfs_list_buckets( &p_tool->local );
+	}
+	else if( _backup_curl( p_tool ) )
+	{
+		b_result = s3_list_buckets( p_tool->p_curl, &p_tool->s3 );
+	}
+
+	return b_result;
+}
+
+boolean backup_sync( backup_tool *p_tool )
+{
+	sync_options options;
+	sync_stats stats;
+	boolean b_result;
+
+	sync_options_initialize( &options );
+	options.s_directory = p_tool->s_directory;
+	options.s_bucket    = p_tool->s_s3_bucket;
+	options.s_prefix    = p_tool->s_key;
+	options.b_delete    = p_tool->b_prune;
+	options.b_verbose   = p_tool->b_verbose && !p_tool->b_quiet;
+	options.p_catalog   = p_tool->b_catalog_open ? &p_tool->catalog : NULL;
+
+	if( backup_is_local( p_tool ) )
+	{
+		options.p_fs = &p_tool->local;
+	}
+	else
+	{
+		/* before sync_run() starts the workers that make their own handles */
+		if( !_backup_curl( p_tool ) ) return FALSE;
+
+		s3_set_mime_table( &p_tool->s3, _backup_mime_table( p_tool ) );
+		s3_set_strip_metadata( &p_tool->s3, p_tool->b_strip_metadata );
+		options.p_s3 = &p_tool->s3;
+	}
+
+	log_info( "Syncing: %s --> %s/%s", p_tool->s_directory, p_tool->s_s3_bucket, p_tool->s_key );
+
+	b_result = sync_run( &options, &stats );
+
+	log_info( "%zu new, %zu changed, %zu unchanged, %zu deleted, %zu failed: %s",
+	          stats.created, stats.changed, stats.unchanged, stats.deleted, stats.failed,
+	          b_result ? "SUCCESS" : "FAILED" );
+
+	/* every FTP target mirrors the directory below its path; --prune deletes there too */
+	if( p_tool->ftp_count > 0 )
+	{
+		uint i;
+
+		if( !_backup_ftp_pools( p_tool ) ) return FALSE;
+
+		for( i = 0; i < p_tool->ftp_count; i++ )
+		{
+			ftp_sync_stats ftp_stats;
+			boolean b_synced;
+
+			log_info( "Syncing: %s --> ftp://%s/%s", p_tool->s_directory, p_tool->s_ftp_hosts[ i ], p_tool->s_ftp_paths[ i ] );
+
+			b_synced = ftp_pool_sync( &p_tool->ftp_pools[ i ], p_tool->s_directory, p_tool->s_ftp_paths[ i ], p_tool->b_prune, &ftp_stats );
+
+			log_info( "%zu sent, %zu unchanged, %zu deleted, %zu failed: %s",
+			          ftp_stats.uploaded, ftp_stats.unchanged, ftp_stats.deleted, ftp_stats.failed,
+			          b_synced ? "SUCCESS" : "FAILED" );
+
+			b_result = b_result && b_synced;
+		}
+	}
 
 	return b_result;
 }
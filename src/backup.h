@@ -7,6 +7,7 @@ typedef enum {
 	OP_S3_PUT,
 	OP_S3_DELETE,
 	OP_S3_LIST,
+	OP_SYNC,
 } backup_operation;
 
 struct tag_backup_tool;
@@ -19,12 +20,30 @@ boolean      backup_read_configuration ( backup_tool *p_tool, const char *config
 void         backup_set_s3_bucket      ( backup_tool *p_tool, const char *bucket );
 void         backup_set_s3_key         ( backup_tool *p_tool, const char *key );
 void         backup_set_file           ( backup_tool *p_tool, const char *filename );
+void         backup_set_local_root     ( backup_tool *p_tool, const char *s_root );
+void         backup_set_strip_metadata ( backup_tool *p_tool, boolean b_strip );
+void         backup_set_profile        ( backup_tool *p_tool, boolean b_profile );
+void         backup_set_catalog        ( backup_tool *p_tool, const char *s_catalog );
+void         backup_set_directory      ( backup_tool *p_tool, const char *s_directory );
+void         backup_set_prune          ( backup_tool *p_tool, boolean b_prune );
+void         backup_set_blocks         ( backup_tool *p_tool, const char *s_directory );
+void         backup_set_buffer_memory  ( backup_tool *p_tool, uint megabytes, boolean b_hugepages );
+void         backup_set_nocache        ( backup_tool *p_tool, boolean b_nocache );
+void         backup_set_sparse         ( backup_tool *p_tool, boolean b_sparse );
 void         backup_set_op             ( backup_tool *p_tool, backup_operation op );
+void         backup_set_verbose        ( backup_tool *p_tool, boolean verbose );
+void         backup_set_quiet          ( backup_tool *p_tool, boolean quiet );
+void         backup_set_json_log       ( backup_tool *p_tool, boolean b_json_log );
+void         backup_set_startup_profile( backup_tool *p_tool, boolean b_startup_profile );
+void         backup_set_derivatives    ( backup_tool *p_tool, boolean b_derivatives );
+void         backup_set_endpoints      ( backup_tool *p_tool, const char *s_endpoints );
+boolean      backup_add_ftp_target     ( backup_tool *p_tool, const char *s_target );
 void         backup_set_retries        ( backup_tool *p_tool, uint retries );
 int          backup_help               ( const char *program );
 boolean      backup_s3_put_file        ( backup_tool *p_tool );
 boolean      backup_s3_delete_file     ( backup_tool *p_tool );
 boolean      backup_s3_list_buckets    ( backup_tool *p_tool );
+boolean      backup_sync               ( backup_tool *p_tool );
 
 
 
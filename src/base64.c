@@ -1,38 +1,611 @@
+#include <stdlib.h>
 #include <string.h>
-#include <openssl/sha.h>
-#include <openssl/hmac.h>
-#include <openssl/evp.h>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
 #include <assert.h>
 #include "base64.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(_BASE64_NO_SIMD)
+#define _BASE64_X86
+#include <immintrin.h>
+#endif
+
+#define BASE64_INVALID    (0xFF)
+
+/* Kernels return how much of the input they consumed; the rest is left to the scalar code. */
+typedef size_t (*base64_encode_kernel)( const byte *input, size_t length, char *output );
+typedef size_t (*base64_decode_kernel)( const char *input, size_t length, byte *output );
+
+static const char base64_alphabet[ 64 ] = {
+	'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P',
+	'Q','R','S','T','U','V','W','X','Y','Z','a','b','c','d','e','f',
+	'g','h','i','j','k','l','m','n','o','p','q','r','s','t','u','v',
+	'w','x','y','z','0','1','2','3','4','5','6','7','8','9','+','/'
+};
+
+/* character --> 6-bit value, BASE64_INVALID otherwise ('=' included) */
+static const byte base64_reverse[ 256 ] = {
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255, 62,255,255,255, 63,
+	 52, 53, 54, 55, 56, 57, 58, 59, 60, 61,255,255,255,255,255,255,
+	255,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+	 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,255,255,255,255,255,
+	255, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+	 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,
+	255,255,255,255,255,255,255,255,255,255,255,255,255,255,255,255
+};
+
+static size_t base64_encode_scalar  ( const byte *input, size_t length, char *output );
+static size_t base64_decode_scalar  ( const char *input, size_t length, byte *output );
+static void   base64_select_kernels ( void );
+
+static base64_encode_kernel base64_encode_bulk = NULL;
+static base64_decode_kernel base64_decode_bulk = NULL;
+static const char *base64_kernel           = NULL;
+
+
+size_t base64_encode( const byte *input, size_t length, char *output )
+{
+	size_t i = 0;
+	char *p  = output;
+
+	assert( input || length == 0 );
+	assert( output );
+
+	if( !base64_encode_bulk )
+	{
+		base64_select_kernels( );
+	}
+
+	i  = base64_encode_bulk( input, length, p );
+	p += (i / 3) * 4;
+
+	/* leftovers and padding */
+	if( length - i >= 1 )
+	{
+		uint b0 = input[ i ];
+		uint b1 = length - i >= 2 ? input[ i + 1 ] : 0;
+
+		*p++ = base64_alphabet[ b0 >> 2 ];
+		*p++ = base64_alphabet[ ((b0 & 0x03) << 4) | (b1 >> 4) ];
+		*p++ = length - i >= 2 ? base64_alphabet[ (b1 & 0x0F) << 2 ] : '=';
+		*p++ = '=';
+	}
+
+	*p = '\0';
+
+	return (size_t) (p - output);
+}
+
+boolean base64_decode( const char *input, size_t length, byte *output, size_t *p_output_length )
+{
+	size_t i = 0;
+	byte *p  = output;
+	uint padding = 0;
+
+	assert( input || length == 0 );
+	assert( output );
+	assert( p_output_length );
+
+	if( !base64_decode_bulk )
+	{
+		base64_select_kernels( );
+	}
+
+	/* padding is only legal at the very end */
+	while( length > 0 && padding < 2 && input[ length - 1 ] == '=' )
+	{
+		length--;
+		padding++;
+	}
+
+	if( length % 4 == 1 || (padding > 0 && (length + padding) % 4 != 0) )
+	{
+		return FALSE;
+	}
+
+	/* whole groups, the fast path stops at the first bad character */
+	i = base64_decode_bulk( input, length, p );
+	p += (i / 4) * 3;
+
+	for( ; i + 4 <= length; i += 4 )
+	{
+		uint a = base64_reverse[ (byte) input[ i + 0 ] ];
+		uint b = base64_reverse[ (byte) input[ i + 1 ] ];
+		uint c = base64_reverse[ (byte) input[ i + 2 ] ];
+		uint d = base64_reverse[ (byte) input[ i + 3 ] ];
+
+		if( (a | b | c | d) & 0xC0 )
+		{
+			return FALSE;
+		}
+
+		*p++ = (byte) ((a << 2) | (b >> 4));
+		*p++ = (byte) ((b << 4) | (c >> 2));
+		*p++ = (byte) ((c << 6) | d);
+	}
+
+	/* final partial group (2 or 3 characters) */
+	if( i < length )
+	{
+		uint a = base64_reverse[ (byte) input[ i + 0 ] ];
+		uint b = base64_reverse[ (byte) input[ i + 1 ] ];
+		uint c = length - i == 3 ? base64_reverse[ (byte) input[ i + 2 ] ] : 0;
+
+		if( (a | b | c) & 0xC0 )
+		{
+			return FALSE;
+		}
+
+		*p++ = (byte) ((a << 2) | (b >> 4));
+
+		if( length - i == 3 )
+		{
+			*p++ = (byte) ((b << 4) | (c >> 2));
+		}
+	}
+
+	*p_output_length = (size_t) (p - output);
+
+	return TRUE;
+}
+
 /* caller is responsible for freeing the memory. */
 byte *base64( const byte *input, size_t length )
+{
+	char *buffer = (char *) malloc( base64_encoded_length(length) + 1 );
+
+	if( buffer )
+	{
+		base64_encode( input, length, buffer );
+	}
+
+	return (byte *) buffer;
+}
+
+/* caller is responsible for freeing the memory. */
+byte *unbase64( byte *input, size_t length )
+{
+	size_t output_length = 0;
+	byte *buffer         = (byte *) malloc( base64_decoded_length(length) + 1 );
+
+	if( buffer )
+	{
+		if( !base64_decode( (const char *) input, length, buffer, &output_length ) )
+		{
+			output_length = 0;
+		}
+
+		buffer[ output_length ] = '\0';
+	}
+
+	return buffer;
+}
+
+void base64_stream_begin( base64_stream *p_stream )
+{
+	assert( p_stream );
+	p_stream->carry_length = 0;
+	p_stream->b_finished   = FALSE;
+}
+
+size_t base64_stream_encode( base64_stream *p_stream, const byte *input, size_t length, char *output )
+{
+	size_t written = 0;
+	size_t bulk;
+
+	assert( p_stream );
+	assert( p_stream->carry_length < 3 );
+
+	/* complete a group started by the previous call */
+	while( p_stream->carry_length > 0 && p_stream->carry_length < 3 && length > 0 )
+	{
+		p_stream->carry[ p_stream->carry_length++ ] = *input++;
+		length--;
+	}
+
+	if( p_stream->carry_length == 3 )
+	{
+		written += base64_encode( p_stream->carry, 3, output );
+		p_stream->carry_length = 0;
+	}
+
+	bulk     = (length / 3) * 3;
+	written += base64_encode( input, bulk, output + written );
+
+	for( ; bulk < length; bulk++ )
+	{
+		p_stream->carry[ p_stream->carry_length++ ] = input[ bulk ];
+	}
+
+	return written;
+}
+
+size_t base64_stream_encode_end( base64_stream *p_stream, char *output )
+{
+	char tail[ 5 ];
+	size_t written;
+
+	assert( p_stream );
+
+	written = base64_encode( p_stream->carry, p_stream->carry_length, tail );
+	memcpy( output, tail, written );
+	p_stream->carry_length = 0;
+
+	return written;
+}
+
+boolean base64_stream_decode( base64_stream *p_stream, const char *input, size_t length, byte *output, size_t *p_output_length )
+{
+	size_t written = 0;
+	size_t decoded = 0;
+	size_t bulk;
+
+	assert( p_stream );
+	assert( p_output_length );
+
+	*p_output_length = 0;
+
+	if( p_stream->b_finished )
+	{
+		/* nothing may follow the padding */
+		return length == 0;
+	}
+
+	while( p_stream->carry_length > 0 && p_stream->carry_length < 4 && length > 0 )
+	{
+		p_stream->carry[ p_stream->carry_length++ ] = (byte) *input++;
+		length--;
+	}
+
+	if( p_stream->carry_length == 4 )
+	{
+		if( !base64_decode( (const char *) p_stream->carry, 4, output, &decoded ) )
+		{
+			return FALSE;
+		}
+
+		p_stream->b_finished   = p_stream->carry[ 3 ] == '=';
+		p_stream->carry_length = 0;
+		written               += decoded;
+
+		if( p_stream->b_finished )
+		{
+			*p_output_length = written;
+			return length == 0;
+		}
+	}
+
+	bulk = (length / 4) * 4;
+
+	if( bulk > 0 )
+	{
+		if( !base64_decode( input, bulk, output + written, &decoded ) )
+		{
+			return FALSE;
+		}
+
+		p_stream->b_finished = input[ bulk - 1 ] == '=';
+		written             += decoded;
+	}
+
+	if( p_stream->b_finished && bulk < length )
+	{
+		return FALSE;
+	}
+
+	for( ; bulk < length; bulk++ )
+	{
+		p_stream->carry[ p_stream->carry_length++ ] = (byte) input[ bulk ];
+	}
+
+	*p_output_length = written;
+
+	return TRUE;
+}
+
+boolean base64_stream_decode_end( base64_stream *p_stream, byte *output, size_t *p_output_length )
+{
+	boolean b_result;
+
+	assert( p_stream );
+	assert( p_output_length );
+
+	/* an unpadded final group is accepted */
+	b_result = base64_decode( (const char *) p_stream->carry, p_stream->carry_length, output, p_output_length );
+	p_stream->carry_length = 0;
+	p_stream->b_finished   = TRUE;
+
+	return b_result;
+}
+
+const char* base64_kernel_name( void )
+{
+	if( !base64_kernel )
+	{
+		base64_select_kernels( );
+	}
+
+	return base64_kernel;
+}
+
+/*
+ * Scalar kernels
+ */
+size_t base64_encode_scalar( const byte *input, size_t length, char *output )
+{
+	size_t i;
+
+	for( i = 0; i + 3 <= length; i += 3 )
+	{
+		uint triple = (input[ i ] << 16) | (input[ i + 1 ] << 8) | input[ i + 2 ];
+
+		*output++ = base64_alphabet[ (triple >> 18) & 0x3F ];
+		*output++ = base64_alphabet[ (triple >> 12) & 0x3F ];
+		*output++ = base64_alphabet[ (triple >>  6) & 0x3F ];
+		*output++ = base64_alphabet[ triple & 0x3F ];
+	}
+
+	return i;
+}
+
+size_t base64_decode_scalar( const char *input, size_t length, byte *output )
+{
+	/* base64_decode() handles everything itself */
+	return 0;
+}
+
+#ifdef _BASE64_X86
+/*
+ * SIMD kernels. The encoders spread 3 bytes over 4 lanes and map the
+ * 6-bit indices to ASCII with a pshufb lookup of per-range offsets; the
+ * decoders classify characters by nibble to validate and translate them,
+ * then pack 4 x 6 bits back into 3 bytes with multiply-adds.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i base64_encode_translate_ssse3( __m128i indices )
+{
+	const __m128i shift_lut = _mm_setr_epi8( 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                         '/' - 63, 'A', 0, 0 );
+	__m128i result = _mm_subs_epu8( indices, _mm_set1_epi8( 51 ) );
+	__m128i less   = _mm_cmpgt_epi8( _mm_set1_epi8( 26 ), indices );
+
+	result = _mm_or_si128( result, _mm_and_si128( less, _mm_set1_epi8( 13 ) ) );
+	result = _mm_shuffle_epi8( shift_lut, result );
+
+	return _mm_add_epi8( result, indices );
+}
+
+__attribute__((target("ssse3")))
+static size_t base64_encode_ssse3( const byte *input, size_t length, char *output )
+{
+	const __m128i shuffle = _mm_set_epi8( 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1 );
+	size_t i;
+
+	/* 12 bytes are consumed per round but 16 are loaded */
+	for( i = 0; i + 16 <= length; i += 12 )
+	{
+		__m128i in = _mm_loadu_si128( (const __m128i *) (input + i) );
+		__m128i t0, t1, t2, t3;
+
+		in = _mm_shuffle_epi8( in, shuffle );
+		t0 = _mm_and_si128( in, _mm_set1_epi32( 0x0fc0fc00 ) );
+		t1 = _mm_mulhi_epu16( t0, _mm_set1_epi32( 0x04000040 ) );
+		t2 = _mm_and_si128( in, _mm_set1_epi32( 0x003f03f0 ) );
+		t3 = _mm_mullo_epi16( t2, _mm_set1_epi32( 0x01000010 ) );
+
+		_mm_storeu_si128( (__m128i *) output, base64_encode_translate_ssse3( _mm_or_si128( t1, t3 ) ) );
+		output += 16;
+	}
+
+	return i + base64_encode_scalar( input + i, length - i, output );
+}
+
+__attribute__((target("ssse3")))
+static size_t base64_decode_ssse3( const char *input, size_t length, byte *output )
+{
+	const __m128i lut_lo  = _mm_setr_epi8( 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                                       0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A );
+	const __m128i lut_hi  = _mm_setr_epi8( 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+	const __m128i lut_roll = _mm_setr_epi8( 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 );
+	const __m128i mask_2f = _mm_set1_epi8( 0x2F );
+	const __m128i pack    = _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+	size_t i;
+
+	/* 16 bytes are stored per round but only 12 are produced; stay clear of the end */
+	for( i = 0; i + 24 <= length; i += 16 )
+	{
+		__m128i in         = _mm_loadu_si128( (const __m128i *) (input + i) );
+		__m128i hi_nibbles = _mm_and_si128( _mm_srli_epi32( in, 4 ), mask_2f );
+		__m128i lo_nibbles = _mm_and_si128( in, mask_2f );
+		__m128i lo         = _mm_shuffle_epi8( lut_lo, lo_nibbles );
+		__m128i hi         = _mm_shuffle_epi8( lut_hi, hi_nibbles );
+		__m128i roll;
+
+		if( _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_and_si128( lo, hi ), _mm_setzero_si128( ) ) ) != 0xFFFF )
+		{
+			break; /* bad character (or padding); let the scalar code deal with it */
+		}
+
+		roll = _mm_shuffle_epi8( lut_roll, _mm_add_epi8( _mm_cmpeq_epi8( in, mask_2f ), hi_nibbles ) );
+		in   = _mm_add_epi8( in, roll );
+		in   = _mm_maddubs_epi16( in, _mm_set1_epi32( 0x01400140 ) );
+		in   = _mm_madd_epi16( in, _mm_set1_epi32( 0x00011000 ) );
+		in   = _mm_shuffle_epi8( in, pack );
+
+		_mm_storeu_si128( (__m128i *) output, in );
+		output += 12;
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t base64_encode_avx2( const byte *input, size_t length, char *output )
+{
+	const __m256i shuffle   = _mm256_set_epi8( 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+	                                           10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1 );
+	const __m256i shift_lut = _mm256_setr_epi8( 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                            '/' - 63, 'A', 0, 0,
+	                                            'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	                                            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+	                                            '/' - 63, 'A', 0, 0 );
+	size_t i;
+
+	/* 24 bytes are consumed per round, the second lane loads 16 from offset 12 */
+	for( i = 0; i + 28 <= length; i += 24 )
+	{
+		__m128i lo = _mm_loadu_si128( (const __m128i *) (input + i) );
+		__m128i hi = _mm_loadu_si128( (const __m128i *) (input + i + 12) );
+		__m256i in = _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+		__m256i t0, t1, t2, t3, indices, result, less;
+
+		in      = _mm256_shuffle_epi8( in, shuffle );
+		t0      = _mm256_and_si256( in, _mm256_set1_epi32( 0x0fc0fc00 ) );
+		t1      = _mm256_mulhi_epu16( t0, _mm256_set1_epi32( 0x04000040 ) );
+		t2      = _mm256_and_si256( in, _mm256_set1_epi32( 0x003f03f0 ) );
+		t3      = _mm256_mullo_epi16( t2, _mm256_set1_epi32( 0x01000010 ) );
+		indices = _mm256_or_si256( t1, t3 );
+
+		result  = _mm256_subs_epu8( indices, _mm256_set1_epi8( 51 ) );
+		less    = _mm256_cmpgt_epi8( _mm256_set1_epi8( 26 ), indices );
+		result  = _mm256_or_si256( result, _mm256_and_si256( less, _mm256_set1_epi8( 13 ) ) );
+		result  = _mm256_shuffle_epi8( shift_lut, result );
+
+		_mm256_storeu_si256( (__m256i *) output, _mm256_add_epi8( result, indices ) );
+		output += 32;
+	}
+
+	return i + base64_encode_ssse3( input + i, length - i, output );
+}
+
+__attribute__((target("avx2")))
+static size_t base64_decode_avx2( const char *input, size_t length, byte *output )
+{
+	const __m256i lut_lo   = _mm256_setr_epi8( 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+	                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A );
+	const __m256i lut_hi   = _mm256_setr_epi8( 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+	                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+	const __m256i lut_roll = _mm256_setr_epi8( 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+	                                           0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 );
+	const __m256i mask_2f  = _mm256_set1_epi8( 0x2F );
+	const __m256i pack     = _mm256_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+	                                           2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+	size_t i;
+
+	/* 32 bytes are stored per round but only 24 are produced */
+	for( i = 0; i + 44 <= length; i += 32 )
+	{
+		__m256i in         = _mm256_loadu_si256( (const __m256i *) (input + i) );
+		__m256i hi_nibbles = _mm256_and_si256( _mm256_srli_epi32( in, 4 ), mask_2f );
+		__m256i lo_nibbles = _mm256_and_si256( in, mask_2f );
+		__m256i lo         = _mm256_shuffle_epi8( lut_lo, lo_nibbles );
+		__m256i hi         = _mm256_shuffle_epi8( lut_hi, hi_nibbles );
+		__m256i roll;
+
+		if( !_mm256_testz_si256( lo, hi ) )
+		{
+			break;
+		}
+
+		roll = _mm256_shuffle_epi8( lut_roll, _mm256_add_epi8( _mm256_cmpeq_epi8( in, mask_2f ), hi_nibbles ) );
+		in   = _mm256_add_epi8( in, roll );
+		in   = _mm256_maddubs_epi16( in, _mm256_set1_epi32( 0x01400140 ) );
+		in   = _mm256_madd_epi16( in, _mm256_set1_epi32( 0x00011000 ) );
+		in   = _mm256_shuffle_epi8( in, pack );
+		in   = _mm256_permutevar8x32_epi32( in, _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, 3, 7 ) );
+
+		_mm256_storeu_si256( (__m256i *) output, in );
+		output += 24;
+	}
+
+	return i + base64_decode_ssse3( input + i, length - i, output );
+}
+#endif /* _BASE64_X86 */
+
+void base64_select_kernels( void )
+{
+	base64_encode_bulk = base64_encode_scalar;
+	base64_decode_bulk = base64_decode_scalar;
+	base64_kernel      = "scalar";
+
+	#ifdef _BASE64_X86
+	__builtin_cpu_init( );
+
+	if( __builtin_cpu_supports( "avx2" ) )
+	{
+		base64_encode_bulk = base64_encode_avx2;
+		base64_decode_bulk = base64_decode_avx2;
+		base64_kernel      = "avx2";
+	}
+	else if( __builtin_cpu_supports( "ssse3" ) )
+	{
+		base64_encode_bulk = base64_encode_ssse3;
+		base64_decode_bulk = base64_decode_ssse3;
+		base64_kernel      = "ssse3";
+	}
+	#endif
+}
+
+#ifdef _TEST_BASE64
+void test_base64( const char *text, size_t length )
+{
+	byte *output;
+	byte *original;
+
+	output = base64( (byte *) text, length );
+	printf( " Base64: %s\n", output );
+	original = unbase64( output, strlen(output) );
+	printf( "Orginal: %s\n", original );
+	
+	free(output);
+	free(original);
+}
+#endif
+
+#ifdef _BENCH_BASE64
+#include <time.h>
+#include <openssl/bio.h>
+#include <openssl/buffer.h>
+#include <openssl/evp.h>
+
+/* The original BIO filter chain, kept as the baseline to measure against. */
+static byte *base64_bio( const byte *input, size_t length )
 {
 	BIO *bmem, *b64;
 	BUF_MEM *bptr;
 
 	b64 = BIO_new(BIO_f_base64());
-
+	BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
 	bmem = BIO_new(BIO_s_mem());
 	b64 = BIO_push(b64, bmem);
 	BIO_write(b64, input, length);
 	BIO_flush(b64);
 	BIO_get_mem_ptr(b64, &bptr);
 
-	byte *buff = (byte *)malloc(bptr->length);
-	memcpy(buff, bptr->data, bptr->length - 1 );
-	buff[ bptr->length - 1 ] = 0;
+	byte *buff = (byte *)malloc(bptr->length + 1);
+	memcpy(buff, bptr->data, bptr->length);
+	buff[ bptr->length ] = 0;
 
 	BIO_free_all(b64);
 
 	return buff;
 }
 
-
-/* caller is responsible for freeing the memory. */
-byte *unbase64( byte *input, size_t length )
+static byte *unbase64_bio( byte *input, size_t length )
 {
 	BIO *b64, *bmem;
 
@@ -49,22 +622,58 @@ byte *unbase64( byte *input, size_t length )
 
 	BIO_free_all(bmem);
 
-	assert( buffer );
 	return buffer;
 }
 
-#ifdef _TEST_BASE64
-void test_base64( const char *text, size_t length )
+static double bench_base64_now( void )
 {
-	byte *output;
-	byte *original;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	output = base64( (byte *) text, length );
-	printf( " Base64: %s\n", output );
-	original = unbase64( output, strlen(output) );
-	printf( "Orginal: %s\n", original );
-	
-	free(output);
-	free(original);
+void bench_base64( FILE *p_output, size_t length, uint iterations )
+{
+	byte *input   = (byte *) malloc( length );
+	char *encoded = (char *) malloc( base64_encoded_length(length) + 1 );
+	byte *decoded = (byte *) malloc( base64_decoded_length(base64_encoded_length(length)) );
+	size_t decoded_length = 0;
+	double start, bio_encode, bio_decode, encode, decode;
+	uint i;
+
+	assert( input && encoded && decoded );
+
+	for( i = 0; i < length; i++ )
+	{
+		input[ i ] = (byte) rand( );
+	}
+
+	start = bench_base64_now( );
+	for( i = 0; i < iterations; i++ ) free( base64_bio( input, length ) );
+	bio_encode = bench_base64_now( ) - start;
+
+	base64_encode( input, length, encoded );
+
+	start = bench_base64_now( );
+	for( i = 0; i < iterations; i++ ) free( unbase64_bio( (byte *) encoded, strlen(encoded) ) );
+	bio_decode = bench_base64_now( ) - start;
+
+	start = bench_base64_now( );
+	for( i = 0; i < iterations; i++ ) base64_encode( input, length, encoded );
+	encode = bench_base64_now( ) - start;
+
+	start = bench_base64_now( );
+	for( i = 0; i < iterations; i++ ) base64_decode( encoded, strlen(encoded), decoded, &decoded_length );
+	decode = bench_base64_now( ) - start;
+
+	assert( decoded_length == length && memcmp( decoded, input, length ) == 0 );
+
+	fprintf( p_output, "base64 %lu bytes x %u (kernel: %s)\n", (unsigned long) length, iterations, base64_kernel_name( ) );
+	fprintf( p_output, "  encode: %10.1f ns/op (BIO: %10.1f ns/op)\n", encode * 1e9 / iterations, bio_encode * 1e9 / iterations );
+	fprintf( p_output, "  decode: %10.1f ns/op (BIO: %10.1f ns/op)\n", decode * 1e9 / iterations, bio_decode * 1e9 / iterations );
+
+	free( input );
+	free( encoded );
+	free( decoded );
 }
 #endif
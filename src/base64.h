@@ -1,18 +1,58 @@
 #ifndef _BASE64_H_
 #define _BASE64_H_
 
+#include <stddef.h>
 #include "types.h"
-/* Requires OpenSSL (-lssl) */
 
+/*
+ * Table driven base64 codec (RFC 4648, no line breaks). On x86 the bulk
+ * of the work is done by AVX2 or SSSE3 kernels picked at runtime; other
+ * targets use the scalar code.
+ */
 
+/* number of characters needed to encode length bytes (not counting '\0') */
+#define base64_encoded_length( length )    ((((length) + 2) / 3) * 4)
+/* upper bound on the bytes produced by decoding length characters */
+#define base64_decoded_length( length )    ((((length) + 3) / 4) * 3)
+
+/* output must hold base64_encoded_length(length) + 1 chars; returns the string length */
+size_t  base64_encode ( const byte *input, size_t length, /*out*/ char *output );
+/* output must hold base64_decoded_length(length) bytes */
+boolean base64_decode ( const char *input, size_t length, /*out*/ byte *output, /*out*/ size_t *p_output_length );
 
 /* caller is responsible for freeing the memory. */
 byte *base64(const byte *input, size_t length);
 /* caller is responsible for freeing the memory. */
 byte *unbase64(byte *input, size_t length);
 
+/*
+ * Streaming interface for data that arrives in pieces (e.g. while a file
+ * is being uploaded). Partial groups are carried over between calls.
+ */
+typedef struct tag_base64_stream {
+	byte carry[ 4 ];
+	uint carry_length;
+	boolean b_finished;   /* decoding only: padding has been seen */
+} base64_stream;
+
+void    base64_stream_begin         ( base64_stream *p_stream );
+/* output must hold base64_encoded_length(length + 2) chars */
+size_t  base64_stream_encode        ( base64_stream *p_stream, const byte *input, size_t length, /*out*/ char *output );
+/* output must hold 4 chars */
+size_t  base64_stream_encode_end    ( base64_stream *p_stream, /*out*/ char *output );
+/* output must hold base64_decoded_length(length + 3) bytes */
+boolean base64_stream_decode        ( base64_stream *p_stream, const char *input, size_t length, /*out*/ byte *output, /*out*/ size_t *p_output_length );
+boolean base64_stream_decode_end    ( base64_stream *p_stream, /*out*/ byte *output, /*out*/ size_t *p_output_length );
+
+const char* base64_kernel_name ( void );
+
 #ifdef _TEST_BASE64
 void test_base64( const char *text, size_t length );
 #endif
+#ifdef _BENCH_BASE64
+#include <stdio.h>
+/* Compares the codec against the OpenSSL BIO chain (requires -lcrypto). */
+void bench_base64( FILE *p_output, size_t length, uint iterations );
+#endif
 
 #endif // _BASE64_H_
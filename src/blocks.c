@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include "blocks.h"
+#include "log.h"
+#include "profile.h"
+#include "bufpool.h"
+#include "workpool.h"
+
+#define BLOCKS_MAX_PATH          (1024)
+
+typedef struct tag_blocks_hasher {
+	block_map *p_map;
+	int fd;
+	uint64_t next;               /* next block to hash, taken atomically */
+	boolean b_error;
+	profiler *p_profiler;
+	buffer_pool *p_pool;         /* blocks are read and hashed a pool buffer at a time */
+} blocks_hasher;
+
+/* a block to send, sorted by hash so equal blocks go up once */
+typedef struct tag_blocks_change {
+	byte hash[ BLOCKS_HASH_LENGTH ];
+	uint64_t index;
+} blocks_change;
+
+static void    _blocks_hash_task     ( void *data );
+static boolean _blocks_read          ( int fd, byte *p_buffer, size_t length, uint64_t offset );
+static byte*   _blocks_serialize     ( const block_map *p_map, /*out*/ size_t *p_length );
+static boolean _blocks_state_path    ( char *s_path, size_t size, const char *s_directory, const char *s_bucket, const char *s_key );
+static void    _blocks_hex           ( const byte *p_hash, /*out*/ char *s_hex );
+static int     _blocks_compare_hashes  ( const void *p_left, const void *p_right );
+static int     _blocks_compare_changes ( const void *p_left, const void *p_right );
+
+
+void block_map_initialize( block_map *p_map )
+{
+	assert( p_map );
+
+	p_map->size       = 0;
+	p_map->block_size = BLOCKS_DEFAULT_SIZE;
+	p_map->count      = 0;
+	p_map->p_hashes   = NULL;
+}
+
+void block_map_destroy( block_map *p_map )
+{
+	assert( p_map );
+
+	free( p_map->p_hashes );
+	block_map_initialize( p_map );
+}
+
+/* threads == 0 uses every worker of the shared pool */
+boolean block_map_hash_file( block_map *p_map, int fd, uint64_t size, uint32_t block_size, uint threads, profiler *p_profiler )
+{
+	workpool *p_workers = workpool_shared( );
+	workpool_batch batch;
+	blocks_hasher hasher;
+	uint i;
+
+	assert( p_map );
+	assert( block_size > 0 );
+
+	block_map_destroy( p_map );
+
+	p_map->size       = size;
+	p_map->block_size = block_size;
+	p_map->count      = (size + block_size - 1) / block_size;
+	p_map->p_hashes   = (byte *) malloc( p_map->count * BLOCKS_HASH_LENGTH + 1 );
+
+	if( !p_map->p_hashes )
+	{
+		return FALSE;
+	}
+
+	hasher.p_map      = p_map;
+	hasher.fd         = fd;
+	hasher.next       = 0;
+	hasher.b_error    = FALSE;
+	hasher.p_profiler = p_profiler;
+	hasher.p_pool     = buffer_pool_shared( );
+
+	if( !hasher.p_pool )
+	{
+		return FALSE;
+	}
+
+	posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+	/* no workers at all: do the work here */
+	if( !p_workers )
+	{
+		_blocks_hash_task( &hasher );
+		return !hasher.b_error;
+	}
+
+	if( threads == 0 || threads > workpool_threads(p_workers) ) threads = workpool_threads( p_workers );
+	if( threads > BLOCKS_MAX_THREADS ) threads = BLOCKS_MAX_THREADS;
+	if( threads > p_map->count ) threads = (uint) p_map->count;
+
+	/* each task takes blocks off the counter until there are none left */
+	workpool_batch_initialize( &batch );
+
+	for( i = 0; i < threads; i++ )
+	{
+		workpool_submit( p_workers, &batch, _blocks_hash_task, &hasher );
+	}
+
+	workpool_wait( p_workers, &batch );
+
+	return !hasher.b_error;
+}
+
+boolean block_map_load( block_map *p_map, const char *s_path )
+{
+	block_map_header header;
+	struct stat info;
+	boolean b_result = FALSE;
+	FILE *p_file;
+
+	assert( p_map );
+	assert( s_path );
+
+	block_map_destroy( p_map );
+
+	if( !(p_file = fopen( s_path, "rb" )) )
+	{
+		return FALSE;
+	}
+
+	if( fstat( fileno( p_file ), &info ) == 0 &&
+	    fread( &header, sizeof(header), 1, p_file ) == 1 &&
+	    memcmp( header.magic, BLOCKS_MAGIC, sizeof(header.magic) ) == 0 &&
+	    header.version == BLOCKS_VERSION &&
+	    header.block_size > 0 &&
+	    header.count == (header.size + header.block_size - 1) / header.block_size &&
+	    header.count <= ((uint64_t) info.st_size - sizeof(header)) / BLOCKS_HASH_LENGTH )
+	{
+		p_map->p_hashes = (byte *) malloc( header.count * BLOCKS_HASH_LENGTH + 1 );
+
+		if( p_map->p_hashes && fread( p_map->p_hashes, BLOCKS_HASH_LENGTH, header.count, p_file ) == header.count )
+		{
+			p_map->size       = header.size;
+			p_map->block_size = header.block_size;
+			p_map->count      = header.count;
+			b_result          = TRUE;
+		}
+	}
+
+	fclose( p_file );
+
+	if( !b_result )
+	{
+		block_map_destroy( p_map );
+	}
+
+	return b_result;
+}
+
+boolean block_map_save( const block_map *p_map, const char *s_path )
+{
+	char s_temporary[ BLOCKS_MAX_PATH + 8 ];
+	boolean b_result = TRUE;
+	size_t length    = 0;
+	byte *p_data;
+	FILE *p_file     = NULL;
+	int fd;
+
+	assert( p_map );
+	assert( s_path );
+
+	if( !(p_data = _blocks_serialize( p_map, &length )) )
+	{
+		return FALSE;
+	}
+
+	snprintf( s_temporary, sizeof(s_temporary), "%s.XXXXXX", s_path );
+
+	if( (fd = mkstemp( s_temporary )) < 0 || !(p_file = fdopen( fd, "wb" )) )
+	{
+		if( fd >= 0 ) close( fd );
+		free( p_data );
+		return FALSE;
+	}
+
+	b_result = fwrite( p_data, length, 1, p_file ) == 1;
+	b_result = fflush( p_file ) == 0 && fsync( fileno( p_file ) ) == 0 && b_result;
+	b_result = fclose( p_file ) == 0 && b_result;
+
+	if( b_result && rename( s_temporary, s_path ) == 0 )
+	{
+		char s_directory[ BLOCKS_MAX_PATH ];
+		int fd_directory;
+
+		/* make the rename itself durable */
+		strncpy( s_directory, s_path, sizeof(s_directory) );
+		s_directory[ sizeof(s_directory) - 1 ] = '\0';
+
+		if( (fd_directory = open( dirname( s_directory ), O_RDONLY )) >= 0 )
+		{
+			fsync( fd_directory );
+			close( fd_directory );
+		}
+	}
+	else
+	{
+		unlink( s_temporary );
+		b_result = FALSE;
+	}
+
+	free( p_data );
+
+	return b_result;
+}
+
+/*
+ * Sends the blocks whose hash the previous map does not have, then the
+ * new map, then records the map locally. A failure anywhere leaves the
+ * previous local map in place, so the next attempt sends at least what
+ * this one did not finish.
+ */
+boolean blocks_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *s_filename, const char *s_state_directory, blocks_stats *p_stats )
+{
+	char s_state[ BLOCKS_MAX_PATH ];
+	char s_block_key[ S3_MAX_KEY + 1 ];
+	char s_hex[ BLOCKS_HASH_LENGTH * 2 + 1 ];
+	block_map previous;
+	block_map current;
+	blocks_change *p_changes = NULL;
+	byte *p_known            = NULL;
+	byte *p_buffer           = NULL;
+	byte *p_data             = NULL;
+	size_t change_count      = 0;
+	size_t length            = 0;
+	boolean b_result         = TRUE;
+	struct stat info;
+	uint64_t i;
+	int fd;
+
+	assert( p_curl );
+	assert( p_s3 );
+	assert( s_bucket );
+	assert( s_key );
+	assert( s_filename );
+	assert( s_state_directory );
+	assert( p_stats );
+
+	memset( p_stats, 0, sizeof(*p_stats) );
+	block_map_initialize( &previous );
+	block_map_initialize( &current );
+
+	if( !_blocks_state_path( s_state, sizeof(s_state), s_state_directory, s_bucket, s_key ) ||
+	    strlen( s_key ) + sizeof(".blocks/") + sizeof(s_hex) > sizeof(s_block_key) )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "key too long for block tracking." );
+		return FALSE;
+	}
+
+	if( (fd = open( s_filename, O_RDONLY )) < 0 || fstat( fd, &info ) != 0 )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "cannot open %s.", s_filename );
+		if( fd >= 0 ) close( fd );
+		return FALSE;
+	}
+
+	/* the block size sticks with the file; otherwise no block would match */
+	block_map_load( &previous, s_state );
+
+	if( !block_map_hash_file( &current, fd, (uint64_t) info.st_size, previous.block_size, 0, p_s3->p_profiler ) )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "cannot read %s.", s_filename );
+		b_result = FALSE;
+	}
+
+	if( b_result )
+	{
+		p_known   = (byte *) malloc( previous.count * BLOCKS_HASH_LENGTH + 1 );
+		p_changes = (blocks_change *) malloc( current.count * sizeof(blocks_change) + 1 );
+		p_buffer  = (byte *) malloc( current.block_size );
+		b_result  = p_known && p_changes && p_buffer;
+	}
+
+	if( b_result )
+	{
+		memcpy( p_known, previous.p_hashes, previous.count * BLOCKS_HASH_LENGTH );
+		qsort( p_known, previous.count, BLOCKS_HASH_LENGTH, _blocks_compare_hashes );
+
+		for( i = 0; i < current.count; i++ )
+		{
+			if( previous.count > 0 && bsearch( block_map_hash( &current, i ), p_known, previous.count, BLOCKS_HASH_LENGTH, _blocks_compare_hashes ) )
+			{
+				continue;
+			}
+
+			memcpy( p_changes[ change_count ].hash, block_map_hash( &current, i ), BLOCKS_HASH_LENGTH );
+			p_changes[ change_count ].index = i;
+			change_count++;
+		}
+
+		qsort( p_changes, change_count, sizeof(blocks_change), _blocks_compare_changes );
+
+		p_stats->blocks  = current.count;
+		p_stats->changed = change_count;
+	}
+
+	for( i = 0; b_result && i < change_count; i++ )
+	{
+		uint64_t offset = p_changes[ i ].index * current.block_size;
+		size_t size     = current.size - offset < current.block_size ? (size_t) (current.size - offset) : current.block_size;
+		byte hash[ BLOCKS_HASH_LENGTH ];
+
+		if( i > 0 && memcmp( p_changes[ i ].hash, p_changes[ i - 1 ].hash, BLOCKS_HASH_LENGTH ) == 0 )
+		{
+			continue;
+		}
+
+		/* the block is read again; it has to be what the map says */
+		if( !_blocks_read( fd, p_buffer, size, offset ) ||
+		    !EVP_Digest( p_buffer, size, hash, NULL, EVP_sha256( ), NULL ) ||
+		    memcmp( hash, p_changes[ i ].hash, BLOCKS_HASH_LENGTH ) != 0 )
+		{
+			if( s3_is_verbose(p_s3) ) log_error( "%s changed while it was read.", s_filename );
+			b_result = FALSE;
+			break;
+		}
+
+		_blocks_hex( hash, s_hex );
+		snprintf( s_block_key, sizeof(s_block_key), "%s.blocks/%s", s_key, s_hex );
+
+		b_result = s3_put_buffer( p_curl, p_s3, s_bucket, s_block_key, p_buffer, size, "application/octet-stream", NULL );
+
+		if( b_result )
+		{
+			p_stats->uploaded++;
+			p_stats->bytes += size;
+		}
+	}
+
+	/* the map goes last: until it is there, the old map still describes the old blocks */
+	if( b_result && !(p_data = _blocks_serialize( &current, &length )) )
+	{
+		b_result = FALSE;
+	}
+
+	if( b_result )
+	{
+		b_result = s3_put_buffer( p_curl, p_s3, s_bucket, s_key, p_data, length, BLOCKS_MIME_TYPE, NULL );
+	}
+
+	if( b_result && !block_map_save( &current, s_state ) )
+	{
+		/* the upload is fine; the next run just sends more than it has to */
+		if( s3_is_verbose(p_s3) ) log_error( "cannot save %s.", s_state );
+	}
+
+	close( fd );
+	free( p_data );
+	free( p_buffer );
+	free( p_changes );
+	free( p_known );
+	block_map_destroy( &current );
+	block_map_destroy( &previous );
+
+	return b_result;
+}
+
+void _blocks_hash_task( void *data )
+{
+	blocks_hasher *p_hasher = (blocks_hasher *) data;
+	block_map *p_map        = p_hasher->p_map;
+	size_t chunk_size       = buffer_pool_buffer_size( p_hasher->p_pool );
+	EVP_MD_CTX *p_context   = EVP_MD_CTX_create( );
+	uint64_t index;
+
+	if( !p_context )
+	{
+		p_hasher->b_error = TRUE;
+		return;
+	}
+
+	while( !p_hasher->b_error && (index = __atomic_fetch_add( &p_hasher->next, 1, __ATOMIC_RELAXED )) < p_map->count )
+	{
+		uint64_t offset = index * p_map->block_size;
+		uint64_t end    = p_map->size - offset < p_map->block_size ? p_map->size : offset + p_map->block_size;
+		byte *p_buffer  = buffer_pool_acquire( p_hasher->p_pool );
+
+		EVP_DigestInit_ex( p_context, EVP_sha256( ), NULL );
+
+		for( ; offset < end; offset += chunk_size )
+		{
+			size_t size    = end - offset < chunk_size ? (size_t) (end - offset) : chunk_size;
+			uint64_t begin = profiler_begin( p_hasher->p_profiler );
+
+			if( !_blocks_read( p_hasher->fd, p_buffer, size, offset ) )
+			{
+				p_hasher->b_error = TRUE;
+				break;
+			}
+
+			profiler_end( p_hasher->p_profiler, PROFILE_READ, begin, size );
+			begin = profiler_begin( p_hasher->p_profiler );
+
+			EVP_DigestUpdate( p_context, p_buffer, size );
+
+			profiler_end( p_hasher->p_profiler, PROFILE_HASH, begin, size );
+		}
+
+		EVP_DigestFinal_ex( p_context, block_map_hash( p_map, index ), NULL );
+		buffer_pool_release( p_hasher->p_pool, p_buffer );
+	}
+
+	EVP_MD_CTX_destroy( p_context );
+}
+
+/* a short read means the file shrank under us */
+boolean _blocks_read( int fd, byte *p_buffer, size_t length, uint64_t offset )
+{
+	while( length > 0 )
+	{
+		ssize_t n = pread( fd, p_buffer, length, (off_t) offset );
+
+		if( n < 0 && errno == EINTR ) continue;
+		if( n <= 0 ) return FALSE;
+
+		p_buffer += n;
+		offset   += (uint64_t) n;
+		length   -= (size_t) n;
+	}
+
+	return TRUE;
+}
+
+byte* _blocks_serialize( const block_map *p_map, size_t *p_length )
+{
+	block_map_header header;
+	byte *p_data;
+
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, BLOCKS_MAGIC, sizeof(header.magic) );
+	header.version    = BLOCKS_VERSION;
+	header.block_size = p_map->block_size;
+	header.size       = p_map->size;
+	header.count      = p_map->count;
+
+	*p_length = sizeof(header) + p_map->count * BLOCKS_HASH_LENGTH;
+
+	if( (p_data = (byte *) malloc( *p_length )) )
+	{
+		memcpy( p_data, &header, sizeof(header) );
+		memcpy( p_data + sizeof(header), p_map->p_hashes, p_map->count * BLOCKS_HASH_LENGTH );
+	}
+
+	return p_data;
+}
+
+/* one flat file per object: "<dir>/<bucket>%2F<key with '/' and '%' escaped>.blockmap" */
+boolean _blocks_state_path( char *s_path, size_t size, const char *s_directory, const char *s_bucket, const char *s_key )
+{
+	int n = snprintf( s_path, size, "%s/%s%%2F", s_directory, s_bucket );
+	size_t length;
+
+	if( n < 0 || (size_t) n >= size )
+	{
+		return FALSE;
+	}
+
+	for( length = (size_t) n; *s_key; s_key++ )
+	{
+		const char *s_piece = *s_key == '/' ? "%2F" : *s_key == '%' ? "%25" : NULL;
+		size_t piece_length = s_piece ? 3 : 1;
+
+		if( length + piece_length >= size )
+		{
+			return FALSE;
+		}
+
+		if( s_piece ) memcpy( s_path + length, s_piece, 3 );
+		else s_path[ length ] = *s_key;
+
+		length += piece_length;
+	}
+
+	n = snprintf( s_path + length, size - length, ".blockmap" );
+
+	return n >= 0 && (size_t) n < size - length;
+}
+
+void _blocks_hex( const byte *p_hash, char *s_hex )
+{
+	static const char digits[] = "0123456789abcdef";
+	uint i;
+
+	for( i = 0; i < BLOCKS_HASH_LENGTH; i++ )
+	{
+		s_hex[ 2 * i ]     = digits[ p_hash[ i ] >> 4 ];
+		s_hex[ 2 * i + 1 ] = digits[ p_hash[ i ] & 0x0F ];
+	}
+
+	s_hex[ 2 * BLOCKS_HASH_LENGTH ] = '\0';
+}
+
+int _blocks_compare_hashes( const void *p_left, const void *p_right )
+{
+	return memcmp( p_left, p_right, BLOCKS_HASH_LENGTH );
+}
+
+int _blocks_compare_changes( const void *p_left, const void *p_right )
+{
+	return memcmp( ((const blocks_change *) p_left)->hash, ((const blocks_change *) p_right)->hash, BLOCKS_HASH_LENGTH );
+}
@@ -0,0 +1,65 @@
+#ifndef _BLOCKS_H_
+#define _BLOCKS_H_
+
+#include <stdint.h>
+#include <curl/curl.h>
+#include "types.h"
+#include "s3.h"
+
+/*
+ * Changed-block tracking for large files modified in place (databases,
+ * VM images). The file is cut in fixed-size blocks that are hashed
+ * (SHA-256) in parallel. Blocks are stored content addressed below the
+ * key, as "<key>.blocks/<hex hash>", and the object at the key itself is
+ * the block map: the list of hashes that rebuilds the file.
+ *
+ * The map of the last upload is kept in a local state directory. The
+ * next run hashes the file again and only sends blocks whose hash the
+ * previous map does not have, then the new map. A file with 0.5% churn
+ * costs about 0.5% of its size to back up.
+ *
+ * The state directory belongs to one target: it says which blocks are
+ * already there, so it must not be shared between buckets that do not
+ * hold the same blocks.
+ */
+#define BLOCKS_MAGIC             "BTBLKMP1"
+#define BLOCKS_VERSION           (1)
+#define BLOCKS_MIME_TYPE         "application/x-backup-blockmap"
+#define BLOCKS_DEFAULT_SIZE      (4 * 1024 * 1024)
+#define BLOCKS_HASH_LENGTH       (32) /* SHA-256 */
+#define BLOCKS_MAX_THREADS       (16)
+
+/* both the state file and the uploaded map: the header, then count hashes */
+typedef struct tag_block_map_header {
+	char magic[ 8 ];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t size;               /* of the file */
+	uint64_t count;              /* blocks; the last one may be short */
+} block_map_header;
+
+typedef struct tag_block_map {
+	uint64_t size;
+	uint32_t block_size;
+	uint64_t count;
+	byte *p_hashes;              /* count x BLOCKS_HASH_LENGTH */
+} block_map;
+
+typedef struct tag_blocks_stats {
+	uint64_t blocks;
+	uint64_t changed;            /* hash not in the previous map */
+	uint64_t uploaded;           /* distinct blocks sent */
+	uint64_t bytes;              /* block bytes sent, without the map */
+} blocks_stats;
+
+void    block_map_initialize ( block_map *p_map );
+void    block_map_destroy    ( block_map *p_map );
+boolean block_map_hash_file  ( block_map *p_map, int fd, uint64_t size, uint32_t block_size, uint threads, profiler *p_profiler );
+boolean block_map_load       ( block_map *p_map, const char *s_path ); /* FALSE if missing or not a map */
+boolean block_map_save       ( const block_map *p_map, const char *s_path ); /* replaces the file atomically */
+
+#define block_map_hash( p_map, index )   ((p_map)->p_hashes + (size_t) (index) * BLOCKS_HASH_LENGTH)
+
+boolean blocks_put_file      ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *s_filename, const char *s_state_directory, /*out*/ blocks_stats *p_stats );
+
+#endif /* _BLOCKS_H_ */
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "bufpool.h"
+
+#define BUFFER_POOL_HUGEPAGE_SIZE  (2 * 1024 * 1024)
+
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+static buffer_pool shared_pool;
+static boolean b_shared_ready     = FALSE;
+static boolean b_shared_used      = FALSE;
+static size_t shared_limit        = BUFFER_POOL_DEFAULT_LIMIT;
+static uint shared_flags          = 0;
+
+static void _buffer_pool_shared_create( void );
+
+
+boolean buffer_pool_create( buffer_pool *p_pool, size_t buffer_size, size_t limit, uint flags )
+{
+	uint i;
+
+	assert( p_pool );
+	assert( buffer_size > 0 );
+
+	buffer_size = (buffer_size + BUFFER_POOL_ALIGNMENT - 1) & ~((size_t) BUFFER_POOL_ALIGNMENT - 1);
+
+	p_pool->buffer_size = buffer_size;
+	p_pool->count       = (uint) (limit / buffer_size > 0 ? limit / buffer_size : 1);
+	p_pool->memory_size = (size_t) p_pool->count * buffer_size;
+	p_pool->p_memory    = MAP_FAILED;
+	p_pool->b_hugetlb   = FALSE;
+	p_pool->waits       = 0;
+
+	#ifdef MAP_HUGETLB
+	if( flags & BUFFER_POOL_HUGEPAGES )
+	{
+		size_t size = (p_pool->memory_size + BUFFER_POOL_HUGEPAGE_SIZE - 1) & ~((size_t) BUFFER_POOL_HUGEPAGE_SIZE - 1);
+
+		p_pool->p_memory = (byte *) mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+
+		if( p_pool->p_memory != MAP_FAILED )
+		{
+			p_pool->memory_size = size;
+			p_pool->b_hugetlb   = TRUE;
+		}
+	}
+	#endif
+
+	if( p_pool->p_memory == MAP_FAILED )
+	{
+		p_pool->p_memory = (byte *) mmap( NULL, p_pool->memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+		if( p_pool->p_memory == MAP_FAILED )
+		{
+			p_pool->p_memory = NULL;
+			return FALSE;
+		}
+
+		#ifdef MADV_HUGEPAGE
+		if( flags & BUFFER_POOL_HUGEPAGES )
+		{
+			/* no reserved huge pages: let khugepaged back the mapping where it can */
+			madvise( p_pool->p_memory, p_pool->memory_size, MADV_HUGEPAGE );
+		}
+		#endif
+	}
+
+	p_pool->p_free = (byte **) malloc( sizeof(byte *) * p_pool->count );
+
+	if( !p_pool->p_free )
+	{
+		munmap( p_pool->p_memory, p_pool->memory_size );
+		p_pool->p_memory = NULL;
+		return FALSE;
+	}
+
+	/* the lowest addresses go out first */
+	for( i = 0; i < p_pool->count; i++ )
+	{
+		p_pool->p_free[ i ] = p_pool->p_memory + (size_t) (p_pool->count - 1 - i) * buffer_size;
+	}
+
+	p_pool->free_count = p_pool->count;
+	p_pool->low_water  = p_pool->count;
+
+	pthread_mutex_init( &p_pool->lock, NULL );
+	pthread_cond_init( &p_pool->available, NULL );
+
+	return TRUE;
+}
+
+void buffer_pool_destroy( buffer_pool *p_pool )
+{
+	assert( p_pool );
+
+	if( !p_pool->p_memory ) return;
+
+	assert( p_pool->free_count == p_pool->count );
+
+	pthread_cond_destroy( &p_pool->available );
+	pthread_mutex_destroy( &p_pool->lock );
+	free( p_pool->p_free );
+	munmap( p_pool->p_memory, p_pool->memory_size );
+
+	p_pool->p_free   = NULL;
+	p_pool->p_memory = NULL;
+}
+
+byte* buffer_pool_acquire( buffer_pool *p_pool )
+{
+	byte *p_buffer;
+
+	assert( p_pool );
+
+	pthread_mutex_lock( &p_pool->lock );
+
+	if( p_pool->free_count == 0 )
+	{
+		p_pool->waits++;
+
+		do {
+			pthread_cond_wait( &p_pool->available, &p_pool->lock );
+		} while( p_pool->free_count == 0 );
+	}
+
+	p_buffer = p_pool->p_free[ --p_pool->free_count ];
+	if( p_pool->free_count < p_pool->low_water ) p_pool->low_water = p_pool->free_count;
+
+	pthread_mutex_unlock( &p_pool->lock );
+
+	return p_buffer;
+}
+
+byte* buffer_pool_try_acquire( buffer_pool *p_pool )
+{
+	byte *p_buffer = NULL;
+
+	assert( p_pool );
+
+	pthread_mutex_lock( &p_pool->lock );
+
+	if( p_pool->free_count > 0 )
+	{
+		p_buffer = p_pool->p_free[ --p_pool->free_count ];
+		if( p_pool->free_count < p_pool->low_water ) p_pool->low_water = p_pool->free_count;
+	}
+
+	pthread_mutex_unlock( &p_pool->lock );
+
+	return p_buffer;
+}
+
+void buffer_pool_release( buffer_pool *p_pool, byte *p_buffer )
+{
+	assert( p_pool );
+	assert( p_buffer >= p_pool->p_memory && p_buffer < p_pool->p_memory + (size_t) p_pool->count * p_pool->buffer_size );
+	assert( (size_t) (p_buffer - p_pool->p_memory) % p_pool->buffer_size == 0 );
+
+	pthread_mutex_lock( &p_pool->lock );
+
+	assert( p_pool->free_count < p_pool->count );
+	p_pool->p_free[ p_pool->free_count++ ] = p_buffer;
+
+	pthread_cond_signal( &p_pool->available );
+	pthread_mutex_unlock( &p_pool->lock );
+}
+
+buffer_pool* buffer_pool_shared( void )
+{
+	pthread_once( &shared_once, _buffer_pool_shared_create );
+
+	return b_shared_ready ? &shared_pool : NULL;
+}
+
+boolean buffer_pool_configure_shared( size_t limit, uint flags )
+{
+	if( __atomic_load_n( &b_shared_used, __ATOMIC_ACQUIRE ) )
+	{
+		return FALSE;
+	}
+
+	shared_limit = limit;
+	shared_flags = flags;
+
+	return TRUE;
+}
+
+/* lives until the process exits, like the read-ahead thread pool */
+void _buffer_pool_shared_create( void )
+{
+	__atomic_store_n( &b_shared_used, TRUE, __ATOMIC_RELEASE );
+	b_shared_ready = buffer_pool_create( &shared_pool, BUFFER_POOL_DEFAULT_SIZE, shared_limit, shared_flags );
+}
@@ -0,0 +1,53 @@
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+
+/*
+ * Fixed-size, page aligned I/O buffers carved out of one mapping whose
+ * size is the memory ceiling. Nothing is allocated after creation: when
+ * every buffer is out, acquiring blocks until one comes back, which is
+ * the backpressure that keeps RSS bounded whatever the concurrency.
+ * Buffers are handed out last-in first-out so the same few pages stay
+ * hot and untouched ones are never faulted in.
+ *
+ * The shared pool is what the read, hash and upload stages draw from;
+ * its ceiling can be set once, before its first use.
+ */
+#define BUFFER_POOL_ALIGNMENT      (4096)
+#define BUFFER_POOL_DEFAULT_SIZE   (256 * 1024)        /* one read-ahead chunk */
+#define BUFFER_POOL_DEFAULT_LIMIT  (64 * 1024 * 1024)
+
+/* back the pool with huge pages: reserved ones if there are any, else transparent */
+#define BUFFER_POOL_HUGEPAGES      (1 << 0)
+
+typedef struct tag_buffer_pool {
+	byte *p_memory;
+	size_t memory_size;
+	size_t buffer_size;
+	uint count;
+	byte **p_free;               /* stack of free buffers */
+	uint free_count;
+	uint low_water;              /* fewest free buffers seen */
+	uint64_t waits;              /* acquires that had to block */
+	boolean b_hugetlb;           /* got reserved huge pages */
+	pthread_mutex_t lock;
+	pthread_cond_t available;
+} buffer_pool;
+
+boolean      buffer_pool_create      ( buffer_pool *p_pool, size_t buffer_size, size_t limit, uint flags ); /* at least one buffer */
+void         buffer_pool_destroy     ( buffer_pool *p_pool ); /* every buffer must be back */
+byte*        buffer_pool_acquire     ( buffer_pool *p_pool ); /* blocks while the pool is empty */
+byte*        buffer_pool_try_acquire ( buffer_pool *p_pool ); /* NULL while the pool is empty */
+void         buffer_pool_release     ( buffer_pool *p_pool, byte *p_buffer );
+buffer_pool* buffer_pool_shared      ( void ); /* NULL if it could not be mapped */
+boolean      buffer_pool_configure_shared ( size_t limit, uint flags ); /* FALSE once the pool is in use */
+
+#define buffer_pool_buffer_size( p_pool )   ((p_pool)->buffer_size)
+#define buffer_pool_count( p_pool )         ((p_pool)->count)
+#define buffer_pool_peak( p_pool )          ((p_pool)->count - (p_pool)->low_water)
+
+#endif /* _BUFPOOL_H_ */
@@ -0,0 +1,718 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "catalog.h"
+
+typedef struct tag_catalog_change {
+	const char *s_key;           /* in the catalog's arena */
+	size_t key_length;
+	uint64_t size;
+	int64_t mtime;
+	const char *s_etag;
+	boolean b_delete;
+	size_t sequence;             /* later changes to a key win */
+} catalog_change;
+
+/* walks the entries of a mapped catalog in key order */
+typedef struct tag_catalog_cursor {
+	const catalog *p_catalog;
+	uint64_t block;
+	const byte *p;
+	const byte *p_end;           /* end of the current block */
+	boolean b_valid;
+	boolean b_error;             /* stopped on a damaged block rather than at the end */
+	catalog_entry entry;
+} catalog_cursor;
+
+typedef struct tag_catalog_writer {
+	FILE *p_file;
+	uint64_t offset;
+	uint64_t count;
+	vector index;                /* uint64_t offset of every block */
+	char s_previous[ CATALOG_MAX_KEY ];
+	size_t previous_length;
+} catalog_writer;
+
+static boolean _catalog_map             ( catalog *p_catalog );
+static void    _catalog_unmap           ( catalog *p_catalog );
+static int     _catalog_compare_keys    ( const char *a, size_t a_length, const char *b, size_t b_length );
+static int     _catalog_change_compare  ( const void *a, const void *b );
+static boolean _catalog_get_varint      ( const byte **p_p, const byte *p_end, uint64_t *p_value );
+static size_t  _catalog_put_varint      ( byte *p, uint64_t value );
+static boolean _catalog_block_range     ( const catalog *p_catalog, uint64_t block, const byte **p_p_begin, const byte **p_p_end );
+static boolean _catalog_first_key       ( const catalog *p_catalog, uint64_t block, const char **p_s_key, size_t *p_length );
+static boolean _catalog_cursor_seek     ( catalog_cursor *p_cursor, const catalog *p_catalog, const char *s_key, size_t length );
+static boolean _catalog_cursor_next     ( catalog_cursor *p_cursor );
+static void    _catalog_writer_begin    ( catalog_writer *p_writer, FILE *p_file );
+static boolean _catalog_writer_add      ( catalog_writer *p_writer, const char *s_key, size_t length, uint64_t size, int64_t mtime, const char *s_etag );
+static boolean _catalog_writer_finish   ( catalog_writer *p_writer );
+static boolean _catalog_merge           ( catalog *p_catalog, catalog_writer *p_writer );
+static boolean _catalog_is_md5          ( const char *s_etag, size_t length );
+
+
+boolean catalog_open( catalog *p_catalog, const char *s_path )
+{
+	assert( p_catalog );
+	assert( s_path );
+
+	memset( p_catalog, 0, sizeof(catalog) );
+	strncpy( p_catalog->s_path, s_path, sizeof(p_catalog->s_path) );
+	p_catalog->s_path[ sizeof(p_catalog->s_path) - 1 ] = '\0';
+
+	vector_create( &p_catalog->changes, sizeof(catalog_change), NULL );
+	arena_create( &p_catalog->strings, ARENA_DEFAULT_BLOCK_SIZE );
+
+	if( !_catalog_map( p_catalog ) )
+	{
+		catalog_close( p_catalog );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void catalog_close( catalog *p_catalog )
+{
+	assert( p_catalog );
+
+	_catalog_unmap( p_catalog );
+	vector_destroy( &p_catalog->changes );
+	arena_destroy( &p_catalog->strings );
+}
+
+boolean catalog_lookup( const catalog *p_catalog, const char *s_key, catalog_entry *p_entry )
+{
+	catalog_cursor cursor;
+	size_t length;
+
+	assert( p_catalog );
+	assert( s_key );
+	assert( p_entry );
+
+	length = strlen( s_key );
+
+	if( !_catalog_cursor_seek( &cursor, p_catalog, s_key, length ) ||
+	    _catalog_compare_keys( cursor.entry.s_key, cursor.entry.key_length, s_key, length ) != 0 )
+	{
+		return FALSE;
+	}
+
+	memcpy( p_entry, &cursor.entry, sizeof(catalog_entry) );
+
+	return TRUE;
+}
+
+boolean catalog_scan( const catalog *p_catalog, const char *s_prefix, catalog_scan_callback callback, void *data )
+{
+	catalog_cursor cursor;
+	size_t length;
+
+	assert( p_catalog );
+	assert( callback );
+
+	if( !s_prefix ) s_prefix = "";
+	length = strlen( s_prefix );
+
+	if( !_catalog_cursor_seek( &cursor, p_catalog, s_prefix, length ) )
+	{
+		return TRUE;
+	}
+
+	/* everything with the prefix is contiguous, starting at the seek position */
+	while( cursor.b_valid && cursor.entry.key_length >= length && memcmp( cursor.entry.s_key, s_prefix, length ) == 0 )
+	{
+		if( !callback( data, &cursor.entry ) )
+		{
+			break;
+		}
+
+		_catalog_cursor_next( &cursor );
+	}
+
+	return TRUE;
+}
+
+void catalog_put( catalog *p_catalog, const char *s_key, uint64_t size, int64_t mtime, const char *s_etag )
+{
+	catalog_change change;
+
+	assert( p_catalog );
+	assert( s_key && *s_key );
+
+	change.key_length = strlen( s_key );
+	assert( change.key_length < CATALOG_MAX_KEY );
+
+	change.s_key    = arena_strndup( &p_catalog->strings, s_key, change.key_length );
+	change.size     = size;
+	change.mtime    = mtime;
+	change.s_etag   = arena_strdup( &p_catalog->strings, s_etag ? s_etag : "" );
+	change.b_delete = FALSE;
+	change.sequence = vector_size( &p_catalog->changes );
+
+	vector_push( &p_catalog->changes, &change );
+}
+
+void catalog_delete( catalog *p_catalog, const char *s_key )
+{
+	catalog_change change;
+
+	assert( p_catalog );
+	assert( s_key && *s_key );
+
+	memset( &change, 0, sizeof(catalog_change) );
+	change.key_length = strlen( s_key );
+	change.s_key      = arena_strndup( &p_catalog->strings, s_key, change.key_length );
+	change.s_etag     = "";
+	change.b_delete   = TRUE;
+	change.sequence   = vector_size( &p_catalog->changes );
+
+	vector_push( &p_catalog->changes, &change );
+}
+
+/*
+ * Merges the queued changes into a new file and renames it over the
+ * old one. The old mapping stays valid until the rename succeeded.
+ */
+boolean catalog_commit( catalog *p_catalog )
+{
+	char s_temporary[ sizeof(p_catalog->s_path) + 8 ];
+	catalog_writer writer;
+	boolean b_result = TRUE;
+	FILE *p_file     = NULL;
+	int fd;
+
+	assert( p_catalog );
+
+	if( vector_is_empty( &p_catalog->changes ) )
+	{
+		return TRUE;
+	}
+
+	qsort( vector_array(&p_catalog->changes), vector_size(&p_catalog->changes), sizeof(catalog_change), _catalog_change_compare );
+
+	snprintf( s_temporary, sizeof(s_temporary), "%s.XXXXXX", p_catalog->s_path );
+
+	if( (fd = mkstemp( s_temporary )) < 0 || !(p_file = fdopen( fd, "wb" )) )
+	{
+		if( fd >= 0 ) close( fd );
+		return FALSE;
+	}
+
+	_catalog_writer_begin( &writer, p_file );
+
+	b_result = _catalog_merge( p_catalog, &writer ) && _catalog_writer_finish( &writer );
+	b_result = fflush( p_file ) == 0 && fsync( fileno( p_file ) ) == 0 && b_result;
+	b_result = fclose( p_file ) == 0 && b_result;
+
+	if( b_result && rename( s_temporary, p_catalog->s_path ) == 0 )
+	{
+		char s_directory[ sizeof(p_catalog->s_path) ];
+		int fd_directory;
+
+		/* make the rename itself durable */
+		strncpy( s_directory, p_catalog->s_path, sizeof(s_directory) );
+		s_directory[ sizeof(s_directory) - 1 ] = '\0';
+
+		if( (fd_directory = open( dirname( s_directory ), O_RDONLY )) >= 0 )
+		{
+			fsync( fd_directory );
+			close( fd_directory );
+		}
+
+		_catalog_unmap( p_catalog );
+		b_result = _catalog_map( p_catalog );
+
+		vector_size( &p_catalog->changes ) = 0;
+		arena_reset( &p_catalog->strings );
+	}
+	else
+	{
+		unlink( s_temporary );
+		b_result = FALSE;
+	}
+
+	return b_result;
+}
+
+boolean _catalog_map( catalog *p_catalog )
+{
+	const catalog_header *p_header;
+	struct stat info;
+	void *p_map;
+	int fd;
+
+	fd = open( p_catalog->s_path, O_RDONLY );
+
+	if( fd < 0 )
+	{
+		return errno == ENOENT; /* nothing uploaded yet */
+	}
+
+	if( fstat( fd, &info ) != 0 || (size_t) info.st_size < sizeof(catalog_header) )
+	{
+		close( fd );
+		return FALSE;
+	}
+
+	p_map = mmap( NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if( p_map == MAP_FAILED )
+	{
+		return FALSE;
+	}
+
+	p_header = (const catalog_header *) p_map;
+
+	if( memcmp( p_header->magic, CATALOG_MAGIC, sizeof(p_header->magic) ) != 0 ||
+	    p_header->version != CATALOG_VERSION ||
+	    p_header->index_offset % sizeof(uint64_t) != 0 ||
+	    p_header->data_end > p_header->index_offset ||
+	    p_header->index_offset > (uint64_t) info.st_size ||
+	    p_header->block_count > ((uint64_t) info.st_size - p_header->index_offset) / sizeof(uint64_t) )
+	{
+		munmap( p_map, (size_t) info.st_size );
+		return FALSE;
+	}
+
+	/* lookups jump around; there is no point reading ahead */
+	madvise( p_map, (size_t) info.st_size, MADV_RANDOM );
+
+	p_catalog->p_map    = (const byte *) p_map;
+	p_catalog->map_size = (size_t) info.st_size;
+	p_catalog->p_header = p_header;
+	p_catalog->p_index  = (const uint64_t *) (p_catalog->p_map + p_header->index_offset);
+
+	return TRUE;
+}
+
+void _catalog_unmap( catalog *p_catalog )
+{
+	if( p_catalog->p_map )
+	{
+		munmap( (void *) p_catalog->p_map, p_catalog->map_size );
+	}
+
+	p_catalog->p_map    = NULL;
+	p_catalog->map_size = 0;
+	p_catalog->p_header = NULL;
+	p_catalog->p_index  = NULL;
+}
+
+int _catalog_compare_keys( const char *a, size_t a_length, const char *b, size_t b_length )
+{
+	int result = memcmp( a, b, a_length < b_length ? a_length : b_length );
+
+	if( result != 0 ) return result;
+
+	return a_length < b_length ? -1 : (a_length > b_length ? 1 : 0);
+}
+
+int _catalog_change_compare( const void *a, const void *b )
+{
+	const catalog_change *p_a = (const catalog_change *) a;
+	const catalog_change *p_b = (const catalog_change *) b;
+	int result = _catalog_compare_keys( p_a->s_key, p_a->key_length, p_b->s_key, p_b->key_length );
+
+	if( result != 0 ) return result;
+
+	return p_a->sequence < p_b->sequence ? -1 : 1;
+}
+
+boolean _catalog_get_varint( const byte **p_p, const byte *p_end, uint64_t *p_value )
+{
+	const byte *p  = *p_p;
+	uint64_t value = 0;
+	uint shift     = 0;
+
+	while( p < p_end && shift < 64 )
+	{
+		byte b = *p++;
+
+		value |= (uint64_t) (b & 0x7F) << shift;
+		shift += 7;
+
+		if( (b & 0x80) == 0 )
+		{
+			*p_p     = p;
+			*p_value = value;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+size_t _catalog_put_varint( byte *p, uint64_t value )
+{
+	size_t length = 0;
+
+	while( value >= 0x80 )
+	{
+		p[ length++ ] = (byte) (value | 0x80);
+		value >>= 7;
+	}
+
+	p[ length++ ] = (byte) value;
+
+	return length;
+}
+
+boolean _catalog_block_range( const catalog *p_catalog, uint64_t block, const byte **p_p_begin, const byte **p_p_end )
+{
+	uint64_t begin = p_catalog->p_index[ block ];
+	uint64_t end   = block + 1 < p_catalog->p_header->block_count ? p_catalog->p_index[ block + 1 ] : p_catalog->p_header->data_end;
+
+	if( begin < sizeof(catalog_header) || begin > end || end > p_catalog->p_header->data_end )
+	{
+		return FALSE;
+	}
+
+	*p_p_begin = p_catalog->p_map + begin;
+	*p_p_end   = p_catalog->p_map + end;
+
+	return TRUE;
+}
+
+/* the first key of a block is stored whole: shared length 0 */
+boolean _catalog_first_key( const catalog *p_catalog, uint64_t block, const char **p_s_key, size_t *p_length )
+{
+	const byte *p;
+	const byte *p_end;
+	uint64_t shared;
+	uint64_t length;
+
+	if( !_catalog_block_range( p_catalog, block, &p, &p_end ) ||
+	    !_catalog_get_varint( &p, p_end, &shared ) || shared != 0 ||
+	    !_catalog_get_varint( &p, p_end, &length ) || length > (uint64_t) (p_end - p) )
+	{
+		return FALSE;
+	}
+
+	*p_s_key  = (const char *) p;
+	*p_length = (size_t) length;
+
+	return TRUE;
+}
+
+/* positions the cursor on the first entry not less than s_key */
+boolean _catalog_cursor_seek( catalog_cursor *p_cursor, const catalog *p_catalog, const char *s_key, size_t length )
+{
+	uint64_t low  = 0;
+	uint64_t high;
+
+	p_cursor->p_catalog = p_catalog;
+	p_cursor->b_valid   = FALSE;
+	p_cursor->b_error   = FALSE;
+	p_cursor->entry.key_length = 0;
+
+	if( !p_catalog->p_header || p_catalog->p_header->block_count == 0 )
+	{
+		return FALSE;
+	}
+
+	/* last block whose first key is <= s_key */
+	high = p_catalog->p_header->block_count;
+
+	while( high - low > 1 )
+	{
+		uint64_t middle = low + (high - low) / 2;
+		const char *s_first;
+		size_t first_length;
+
+		if( !_catalog_first_key( p_catalog, middle, &s_first, &first_length ) )
+		{
+			p_cursor->b_error = TRUE;
+			return FALSE;
+		}
+
+		if( _catalog_compare_keys( s_first, first_length, s_key, length ) <= 0 ) low = middle;
+		else                                                                     high = middle;
+	}
+
+	p_cursor->block = low;
+
+	if( !_catalog_block_range( p_catalog, low, &p_cursor->p, &p_cursor->p_end ) )
+	{
+		p_cursor->b_error = TRUE;
+		return FALSE;
+	}
+
+	while( _catalog_cursor_next( p_cursor ) )
+	{
+		if( _catalog_compare_keys( p_cursor->entry.s_key, p_cursor->entry.key_length, s_key, length ) >= 0 )
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+boolean _catalog_cursor_next( catalog_cursor *p_cursor )
+{
+	const catalog *p_catalog = p_cursor->p_catalog;
+	catalog_entry *p_entry   = &p_cursor->entry;
+	uint64_t shared, suffix, size, mtime, etag_length;
+
+	p_cursor->b_valid = FALSE;
+
+	if( p_cursor->p >= p_cursor->p_end )
+	{
+		if( p_cursor->block + 1 >= p_catalog->p_header->block_count )
+		{
+			return FALSE;
+		}
+
+		if( !_catalog_block_range( p_catalog, ++p_cursor->block, &p_cursor->p, &p_cursor->p_end ) )
+		{
+			p_cursor->b_error = TRUE;
+			return FALSE;
+		}
+	}
+
+	if( !_catalog_get_varint( &p_cursor->p, p_cursor->p_end, &shared ) ||
+	    !_catalog_get_varint( &p_cursor->p, p_cursor->p_end, &suffix ) ||
+	    shared > p_entry->key_length || shared + suffix >= CATALOG_MAX_KEY ||
+	    suffix > (uint64_t) (p_cursor->p_end - p_cursor->p) )
+	{
+		p_cursor->b_error = TRUE;
+		return FALSE;
+	}
+
+	memcpy( p_entry->s_key + shared, p_cursor->p, (size_t) suffix );
+	p_entry->key_length = (size_t) (shared + suffix);
+	p_entry->s_key[ p_entry->key_length ] = '\0';
+	p_cursor->p += suffix;
+
+	if( !_catalog_get_varint( &p_cursor->p, p_cursor->p_end, &size ) ||
+	    !_catalog_get_varint( &p_cursor->p, p_cursor->p_end, &mtime ) ||
+	    !_catalog_get_varint( &p_cursor->p, p_cursor->p_end, &etag_length ) ||
+	    ((etag_length & 1) ? etag_length : etag_length >> 1) >= CATALOG_MAX_ETAG ||
+	    (etag_length >> 1) > (uint64_t) (p_cursor->p_end - p_cursor->p) )
+	{
+		p_cursor->b_error = TRUE;
+		return FALSE;
+	}
+
+	p_entry->size  = size;
+	p_entry->mtime = (int64_t) (mtime >> 1) ^ -(int64_t) (mtime & 1); /* zigzag */
+
+	if( etag_length & 1 )
+	{
+		static const char hex[] = "0123456789abcdef";
+		uint64_t i;
+
+		for( i = 0; i < (etag_length >> 1); i++ )
+		{
+			p_entry->s_etag[ 2 * i ]     = hex[ p_cursor->p[ i ] >> 4 ];
+			p_entry->s_etag[ 2 * i + 1 ] = hex[ p_cursor->p[ i ] & 0x0F ];
+		}
+
+		p_entry->s_etag[ 2 * (etag_length >> 1) ] = '\0';
+	}
+	else
+	{
+		memcpy( p_entry->s_etag, p_cursor->p, (size_t) (etag_length >> 1) );
+		p_entry->s_etag[ etag_length >> 1 ] = '\0';
+	}
+
+	p_cursor->p += etag_length >> 1;
+
+	p_cursor->b_valid = TRUE;
+
+	return TRUE;
+}
+
+void _catalog_writer_begin( catalog_writer *p_writer, FILE *p_file )
+{
+	catalog_header header;
+
+	memset( &header, 0, sizeof(header) );
+	memset( p_writer, 0, sizeof(catalog_writer) );
+	p_writer->p_file = p_file;
+	p_writer->offset = sizeof(catalog_header);
+
+	vector_create( &p_writer->index, sizeof(uint64_t), NULL );
+
+	/* the real header is written once the counts are known */
+	fwrite( &header, sizeof(header), 1, p_file );
+}
+
+boolean _catalog_writer_add( catalog_writer *p_writer, const char *s_key, size_t length, uint64_t size, int64_t mtime, const char *s_etag )
+{
+	byte buffer[ 4 * 10 + CATALOG_MAX_KEY + CATALOG_MAX_ETAG ];
+	size_t etag_length = strlen( s_etag );
+	size_t shared      = 0;
+	size_t used        = 0;
+
+	if( length >= CATALOG_MAX_KEY )
+	{
+		return FALSE;
+	}
+
+	if( etag_length >= CATALOG_MAX_ETAG ) etag_length = CATALOG_MAX_ETAG - 1;
+
+	if( p_writer->count % CATALOG_BLOCK_ENTRIES == 0 )
+	{
+		vector_push( &p_writer->index, &p_writer->offset );
+	}
+	else
+	{
+		size_t limit = length < p_writer->previous_length ? length : p_writer->previous_length;
+
+		while( shared < limit && s_key[ shared ] == p_writer->s_previous[ shared ] ) shared++;
+	}
+
+	used += _catalog_put_varint( buffer + used, shared );
+	used += _catalog_put_varint( buffer + used, length - shared );
+	memcpy( buffer + used, s_key + shared, length - shared );
+	used += length - shared;
+	used += _catalog_put_varint( buffer + used, size );
+	used += _catalog_put_varint( buffer + used, ((uint64_t) mtime << 1) ^ (uint64_t) (mtime >> 63) ); /* zigzag */
+	if( _catalog_is_md5( s_etag, etag_length ) )
+	{
+		size_t i;
+
+		/* the common single part ETag is an MD5 in hex; store it as 16 bytes */
+		used += _catalog_put_varint( buffer + used, ((etag_length / 2) << 1) | 1 );
+
+		for( i = 0; i < etag_length / 2; i++ )
+		{
+			char pair[ 3 ] = { s_etag[ 2 * i ], s_etag[ 2 * i + 1 ], '\0' };
+			buffer[ used++ ] = (byte) strtoul( pair, NULL, 16 );
+		}
+	}
+	else
+	{
+		used += _catalog_put_varint( buffer + used, etag_length << 1 );
+		memcpy( buffer + used, s_etag, etag_length );
+		used += etag_length;
+	}
+
+	if( fwrite( buffer, 1, used, p_writer->p_file ) != used )
+	{
+		return FALSE;
+	}
+
+	memcpy( p_writer->s_previous + shared, s_key + shared, length - shared );
+	p_writer->previous_length = length;
+	p_writer->offset += used;
+	p_writer->count++;
+
+	return TRUE;
+}
+
+boolean _catalog_writer_finish( catalog_writer *p_writer )
+{
+	static const byte padding[ sizeof(uint64_t) ] = { 0 };
+	size_t pad = (size_t) ((sizeof(uint64_t) - p_writer->offset % sizeof(uint64_t)) % sizeof(uint64_t));
+	uint64_t data_end = p_writer->offset;
+	catalog_header header;
+	boolean b_result = TRUE;
+
+	/* the index is read in place, so it has to be aligned */
+	b_result = fwrite( padding, 1, pad, p_writer->p_file ) == pad;
+	p_writer->offset += pad;
+
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, CATALOG_MAGIC, sizeof(header.magic) );
+	header.version       = CATALOG_VERSION;
+	header.block_entries = CATALOG_BLOCK_ENTRIES;
+	header.entry_count   = p_writer->count;
+	header.block_count   = vector_size( &p_writer->index );
+	header.data_end      = data_end;
+	header.index_offset  = p_writer->offset;
+
+	if( b_result && header.block_count > 0 )
+	{
+		b_result = fwrite( vector_array(&p_writer->index), sizeof(uint64_t), header.block_count, p_writer->p_file ) == header.block_count;
+	}
+
+	b_result = b_result &&
+	           fseeko( p_writer->p_file, 0, SEEK_SET ) == 0 &&
+	           fwrite( &header, sizeof(header), 1, p_writer->p_file ) == 1;
+
+	vector_destroy( &p_writer->index );
+
+	return b_result;
+}
+
+/* one pass over the old catalog and the sorted changes */
+boolean _catalog_merge( catalog *p_catalog, catalog_writer *p_writer )
+{
+	catalog_change *changes = (catalog_change *) vector_array( &p_catalog->changes );
+	size_t count            = vector_size( &p_catalog->changes );
+	size_t i                = 0;
+	catalog_cursor cursor;
+
+	_catalog_cursor_seek( &cursor, p_catalog, "", 0 );
+
+	while( cursor.b_valid || i < count )
+	{
+		const catalog_change *p_change;
+		int order;
+
+		if( i < count )
+		{
+			/* only the last change to a key counts */
+			while( i + 1 < count && _catalog_compare_keys( changes[ i ].s_key, changes[ i ].key_length, changes[ i + 1 ].s_key, changes[ i + 1 ].key_length ) == 0 ) i++;
+		}
+
+		p_change = i < count ? &changes[ i ] : NULL;
+		order    = !cursor.b_valid ? 1 : (!p_change ? -1 :
+		           _catalog_compare_keys( cursor.entry.s_key, cursor.entry.key_length, p_change->s_key, p_change->key_length ));
+
+		if( order < 0 )
+		{
+			if( !_catalog_writer_add( p_writer, cursor.entry.s_key, cursor.entry.key_length, cursor.entry.size, cursor.entry.mtime, cursor.entry.s_etag ) )
+			{
+				return FALSE;
+			}
+
+			_catalog_cursor_next( &cursor );
+			continue;
+		}
+
+		if( !p_change->b_delete &&
+		    !_catalog_writer_add( p_writer, p_change->s_key, p_change->key_length, p_change->size, p_change->mtime, p_change->s_etag ) )
+		{
+			return FALSE;
+		}
+
+		if( order == 0 )
+		{
+			_catalog_cursor_next( &cursor );
+		}
+
+		i++;
+	}
+
+	/* never write out a catalog that silently lost the rest of a damaged one */
+	return !cursor.b_error;
+}
+
+boolean _catalog_is_md5( const char *s_etag, size_t length )
+{
+	size_t i;
+
+	if( length != 32 )
+	{
+		return FALSE;
+	}
+
+	for( i = 0; i < length; i++ )
+	{
+		if( !((s_etag[ i ] >= '0' && s_etag[ i ] <= '9') || (s_etag[ i ] >= 'a' && s_etag[ i ] <= 'f')) ) return FALSE;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,76 @@
+#ifndef _CATALOG_H_
+#define _CATALOG_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "types.h"
+#include "vector.h"
+#include "arena.h"
+
+/*
+ * Local catalog of every object we have uploaded, so finding out what a
+ * bucket holds needs neither a listing nor a HEAD per key.
+ *
+ * The file is sorted by key (byte order, like S3 listings) and split in
+ * blocks of CATALOG_BLOCK_ENTRIES. Inside a block each key only stores
+ * what differs from the previous one (front coding); the first key of
+ * every block is stored whole so a binary search over the block index
+ * finds any key in O(log n). The file is mmapped read only, so opening
+ * costs nothing no matter how large it is.
+ *
+ * The file is never modified in place. Puts and deletes are queued and
+ * catalog_commit() merges them with the current file into a new one,
+ * which replaces the old by rename(2). Readers see either the old or
+ * the new catalog, never a mix; queued changes are not visible until
+ * they are committed.
+ */
+#define CATALOG_MAGIC           "BTCATLG1"
+#define CATALOG_VERSION         (1)
+#define CATALOG_BLOCK_ENTRIES   (64)
+#define CATALOG_MAX_KEY         (1024 + 256) /* bucket, '/' and an S3 key */
+#define CATALOG_MAX_ETAG        (72)
+
+typedef struct tag_catalog_header {
+	char magic[ 8 ];
+	uint32_t version;
+	uint32_t block_entries;
+	uint64_t entry_count;
+	uint64_t block_count;
+	uint64_t data_end;           /* entries end here; padding follows */
+	uint64_t index_offset;       /* array of block_count uint64_t file offsets */
+	byte reserved[ 16 ];
+} catalog_header;
+
+typedef struct tag_catalog_entry {
+	char s_key[ CATALOG_MAX_KEY ];
+	size_t key_length;
+	uint64_t size;               /* of the local file that was uploaded */
+	int64_t mtime;
+	char s_etag[ CATALOG_MAX_ETAG ];
+} catalog_entry;
+
+typedef struct tag_catalog {
+	char s_path[ 512 ];
+	const byte *p_map;           /* NULL while the catalog is empty */
+	size_t map_size;
+	const catalog_header *p_header;
+	const uint64_t *p_index;
+	vector changes;              /* queued puts and deletes */
+	arena strings;               /* keys and ETags of the queued changes */
+} catalog;
+
+/* return FALSE to stop the scan */
+typedef boolean (*catalog_scan_callback)( void *data, const catalog_entry *p_entry );
+
+boolean catalog_open     ( catalog *p_catalog, const char *s_path ); /* a missing file is an empty catalog */
+void    catalog_close    ( catalog *p_catalog );
+boolean catalog_lookup   ( const catalog *p_catalog, const char *s_key, /*out*/ catalog_entry *p_entry );
+boolean catalog_scan     ( const catalog *p_catalog, const char *s_prefix, catalog_scan_callback callback, void *data );
+void    catalog_put      ( catalog *p_catalog, const char *s_key, uint64_t size, int64_t mtime, const char *s_etag );
+void    catalog_delete   ( catalog *p_catalog, const char *s_key );
+boolean catalog_commit   ( catalog *p_catalog );
+
+#define catalog_size( p_catalog )       ((p_catalog)->p_header ? (p_catalog)->p_header->entry_count : 0)
+#define catalog_pending( p_catalog )    (vector_size( &(p_catalog)->changes ))
+
+#endif /* _CATALOG_H_ */
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <curl/curl.h>
+#include "endpoint.h"
+#include "profile.h"
+#include "log.h"
+
+#define ENDPOINT_WAIT_MS     (100)
+
+static boolean _endpoint_probe_locked ( endpoint_set *p_set );
+static void    _endpoint_measure      ( endpoint *p_endpoint, CURL *p_curl, CURLcode res );
+
+
+void endpoint_set_create( endpoint_set *p_set, uint ttl, boolean verbose )
+{
+	assert( p_set );
+
+	memset( p_set->candidates, 0, sizeof(p_set->candidates) );
+	p_set->count      = 0;
+	p_set->current    = 0;
+	p_set->ttl        = ttl > 0 ? ttl : ENDPOINT_DEFAULT_TTL;
+	p_set->chosen_at  = 0;
+	p_set->average_ns = 0;
+	p_set->failures   = 0;
+	p_set->b_stale    = TRUE;
+	p_set->b_verbose  = verbose;
+	pthread_mutex_init( &p_set->lock, NULL );
+}
+
+void endpoint_set_destroy( endpoint_set *p_set )
+{
+	assert( p_set );
+
+	pthread_mutex_destroy( &p_set->lock );
+	p_set->count = 0;
+}
+
+boolean endpoint_set_add( endpoint_set *p_set, const char *s_hostname )
+{
+	size_t length;
+
+	assert( p_set );
+	assert( s_hostname );
+
+	length = strlen( s_hostname );
+
+	if( length == 0 || length >= ENDPOINT_MAX_HOSTNAME || p_set->count >= ENDPOINT_MAX )
+	{
+		if( p_set->b_verbose ) log_warning( "Ignoring endpoint %.128s.", s_hostname );
+		return FALSE;
+	}
+
+	memcpy( p_set->candidates[ p_set->count ].s_hostname, s_hostname, length + 1 );
+	p_set->count++;
+	p_set->b_stale = TRUE;
+
+	return TRUE;
+}
+
+uint endpoint_set_parse( endpoint_set *p_set, const char *s_list )
+{
+	char buffer[ ENDPOINT_MAX * ENDPOINT_MAX_HOSTNAME ];
+	char *s_saved = NULL;
+	char *s_hostname;
+	uint added = 0;
+
+	assert( p_set );
+	assert( s_list );
+
+	strncpy( buffer, s_list, sizeof(buffer) );
+	buffer[ sizeof(buffer) - 1 ] = '\0';
+
+	for( s_hostname = strtok_r( buffer, ",; \t", &s_saved ); s_hostname; s_hostname = strtok_r( NULL, ",; \t", &s_saved ) )
+	{
+		if( endpoint_set_add( p_set, s_hostname ) ) added++;
+	}
+
+	return added;
+}
+
+boolean endpoint_probe( endpoint_set *p_set )
+{
+	boolean b_result;
+
+	assert( p_set );
+
+	pthread_mutex_lock( &p_set->lock );
+	b_result = _endpoint_probe_locked( p_set );
+	pthread_mutex_unlock( &p_set->lock );
+
+	return b_result;
+}
+
+const char* endpoint_current( endpoint_set *p_set )
+{
+	const char *s_hostname = NULL;
+
+	assert( p_set );
+
+	pthread_mutex_lock( &p_set->lock );
+
+	if( p_set->count > 0 )
+	{
+		/* the other requests wait for the probe rather than go to a bad endpoint */
+		if( p_set->b_stale || profiler_now( ) - p_set->chosen_at > (uint64_t) p_set->ttl * 1000000000ULL )
+		{
+			_endpoint_probe_locked( p_set );
+		}
+
+		s_hostname = p_set->candidates[ p_set->current ].s_hostname;
+	}
+
+	pthread_mutex_unlock( &p_set->lock );
+
+	return s_hostname;
+}
+
+void endpoint_report( endpoint_set *p_set, const char *s_hostname, uint64_t first_byte_ns, boolean b_ok )
+{
+	endpoint *p_endpoint;
+
+	assert( p_set );
+
+	pthread_mutex_lock( &p_set->lock );
+
+	p_endpoint = &p_set->candidates[ p_set->current ];
+
+	/* reports about an endpoint we have moved away from say nothing */
+	if( p_set->count > 0 && s_hostname == p_endpoint->s_hostname && !p_set->b_stale )
+	{
+		if( !b_ok )
+		{
+			if( ++p_set->failures >= ENDPOINT_MAX_FAILURES )
+			{
+				if( p_set->b_verbose ) log_warning( "%s failed %u requests in a row, probing again.", p_endpoint->s_hostname, p_set->failures );
+				p_set->b_stale = TRUE;
+			}
+		}
+		else
+		{
+			p_set->failures = 0;
+
+			if( first_byte_ns > 0 )
+			{
+				uint64_t limit = (uint64_t) ENDPOINT_DEGRADED_FACTOR * p_endpoint->first_byte_ns;
+
+				if( limit < (uint64_t) ENDPOINT_DEGRADED_FLOOR_MS * 1000000ULL )
+				{
+					limit = (uint64_t) ENDPOINT_DEGRADED_FLOOR_MS * 1000000ULL;
+				}
+
+				p_set->average_ns = p_set->average_ns ? (p_set->average_ns * 7 + first_byte_ns) / 8 : first_byte_ns;
+
+				if( p_set->average_ns > limit )
+				{
+					if( p_set->b_verbose ) log_warning( "%s slowed to %.1f ms (probed at %.1f ms), probing again.", p_endpoint->s_hostname,
+					                                    p_set->average_ns / 1000000.0, p_endpoint->first_byte_ns / 1000000.0 );
+					p_set->b_stale = TRUE;
+				}
+			}
+		}
+	}
+
+	pthread_mutex_unlock( &p_set->lock );
+}
+
+/* sends a HEAD to every candidate at once and keeps the quickest healthy one */
+boolean _endpoint_probe_locked( endpoint_set *p_set )
+{
+	char urls[ ENDPOINT_MAX ][ ENDPOINT_MAX_HOSTNAME + 16 ];
+	CURL *handles[ ENDPOINT_MAX ];
+	CURLM *p_multi = curl_multi_init( );
+	uint best = p_set->count;
+	uint i;
+
+	for( i = 0; i < p_set->count; i++ )
+	{
+		p_set->candidates[ i ].b_healthy = FALSE;
+		handles[ i ] = p_multi ? curl_easy_init( ) : NULL;
+
+		if( handles[ i ] )
+		{
+			snprintf( urls[ i ], sizeof(urls[ i ]), "https://%s/", p_set->candidates[ i ].s_hostname );
+			curl_easy_setopt( handles[ i ], CURLOPT_URL, urls[ i ] );
+			curl_easy_setopt( handles[ i ], CURLOPT_NOBODY, 1L );
+			curl_easy_setopt( handles[ i ], CURLOPT_NOSIGNAL, 1L );
+			curl_easy_setopt( handles[ i ], CURLOPT_TIMEOUT_MS, (long) ENDPOINT_PROBE_TIMEOUT_MS );
+			curl_multi_add_handle( p_multi, handles[ i ] );
+		}
+	}
+
+	if( p_multi )
+	{
+		int running = 0;
+		int pending = 0;
+
+		for( ;; )
+		{
+			CURLMsg *p_message;
+
+			curl_multi_perform( p_multi, &running );
+
+			while( (p_message = curl_multi_info_read( p_multi, &pending )) )
+			{
+				if( p_message->msg != CURLMSG_DONE ) continue;
+
+				for( i = 0; i < p_set->count; i++ )
+				{
+					if( handles[ i ] == p_message->easy_handle )
+					{
+						_endpoint_measure( &p_set->candidates[ i ], handles[ i ], p_message->data.result );
+						break;
+					}
+				}
+			}
+
+			if( running == 0 )
+			{
+				break;
+			}
+
+			curl_multi_wait( p_multi, NULL, 0, ENDPOINT_WAIT_MS, NULL );
+		}
+
+		for( i = 0; i < p_set->count; i++ )
+		{
+			if( handles[ i ] )
+			{
+				curl_multi_remove_handle( p_multi, handles[ i ] );
+				curl_easy_cleanup( handles[ i ] );
+			}
+		}
+
+		curl_multi_cleanup( p_multi );
+	}
+
+	for( i = 0; i < p_set->count; i++ )
+	{
+		const endpoint *p_endpoint = &p_set->candidates[ i ];
+
+		if( p_set->b_verbose )
+		{
+			if( p_endpoint->b_healthy )
+			{
+				log_debug( "%s: connect %.1f ms, TLS %.1f ms, first byte %.1f ms", p_endpoint->s_hostname,
+				           p_endpoint->connect_ns / 1000000.0, p_endpoint->tls_ns / 1000000.0, p_endpoint->first_byte_ns / 1000000.0 );
+			}
+			else
+			{
+				log_debug( "%s: no answer, or a server error", p_endpoint->s_hostname );
+			}
+		}
+
+		if( p_endpoint->b_healthy && (best == p_set->count || p_endpoint->first_byte_ns < p_set->candidates[ best ].first_byte_ns) )
+		{
+			best = i;
+		}
+	}
+
+	if( best < p_set->count )
+	{
+		if( p_set->b_verbose && best != p_set->current ) log_debug( "Switching to endpoint %s.", p_set->candidates[ best ].s_hostname );
+		p_set->current = best;
+	}
+	else if( p_set->b_verbose )
+	{
+		log_warning( "No endpoint answered; staying with %s.", p_set->candidates[ p_set->current ].s_hostname );
+	}
+
+	/* even a failed probe waits out the TTL, unless requests keep failing */
+	p_set->chosen_at  = profiler_now( );
+	p_set->average_ns = 0;
+	p_set->failures   = 0;
+	p_set->b_stale    = FALSE;
+
+	return best < p_set->count;
+}
+
+/* any HTTP answer short of a server error means the endpoint is up */
+void _endpoint_measure( endpoint *p_endpoint, CURL *p_curl, CURLcode res )
+{
+	curl_off_t connect = 0;
+	curl_off_t tls = 0;
+	curl_off_t first_byte = 0;
+	long status = 0L;
+
+	if( res != CURLE_OK )
+	{
+		return;
+	}
+
+	curl_easy_getinfo( p_curl, CURLINFO_RESPONSE_CODE, &status );
+	curl_easy_getinfo( p_curl, CURLINFO_CONNECT_TIME_T, &connect );
+	curl_easy_getinfo( p_curl, CURLINFO_APPCONNECT_TIME_T, &tls );
+	curl_easy_getinfo( p_curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte );
+
+	p_endpoint->b_healthy     = status > 0 && status < 500;
+	p_endpoint->connect_ns    = (uint64_t) connect * 1000;
+	p_endpoint->tls_ns        = tls > connect ? (uint64_t) (tls - connect) * 1000 : 0;
+	p_endpoint->first_byte_ns = (uint64_t) first_byte * 1000;
+}
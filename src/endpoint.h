@@ -0,0 +1,58 @@
+#ifndef _ENDPOINT_H_
+#define _ENDPOINT_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+
+/*
+ * Chooses the S3 endpoint to talk to from a list of candidates (regional,
+ * dual-stack, private link or a local mirror). The candidates are probed
+ * in parallel with a HEAD request that times connect, TLS and the first
+ * byte, and requests go to the healthy one with the quickest first byte.
+ *
+ * The choice is kept for a TTL. Requests report back how they went; when
+ * the chosen endpoint slows to several times what its probe measured, or
+ * fails a few times in a row, the next request probes again first.
+ */
+#define ENDPOINT_MAX               (8)
+#define ENDPOINT_MAX_HOSTNAME      (128)
+#define ENDPOINT_DEFAULT_TTL       (300)   /* seconds */
+#define ENDPOINT_PROBE_TIMEOUT_MS  (3000)
+#define ENDPOINT_DEGRADED_FACTOR   (4)     /* request first byte vs. probe first byte */
+#define ENDPOINT_DEGRADED_FLOOR_MS (50)    /* below this nothing counts as degraded */
+#define ENDPOINT_MAX_FAILURES      (3)     /* in a row */
+
+typedef struct tag_endpoint {
+	char s_hostname[ ENDPOINT_MAX_HOSTNAME ];
+	boolean b_healthy;         /* answered the last probe */
+	uint64_t connect_ns;       /* name lookup and TCP connect */
+	uint64_t tls_ns;           /* handshake, after connect */
+	uint64_t first_byte_ns;    /* from the start; what candidates are ranked by */
+} endpoint;
+
+typedef struct tag_endpoint_set {
+	endpoint candidates[ ENDPOINT_MAX ];
+	uint count;
+	uint current;              /* index into candidates */
+	uint ttl;                  /* seconds a choice is kept */
+	uint64_t chosen_at;        /* profiler_now() of the last probe */
+	uint64_t average_ns;       /* moving average of reported first-byte times */
+	uint failures;             /* failed requests in a row */
+	boolean b_stale;           /* probe before the next request */
+	boolean b_verbose;
+	pthread_mutex_t lock;
+} endpoint_set;
+
+void        endpoint_set_create  ( endpoint_set *p_set, uint ttl, boolean verbose );
+void        endpoint_set_destroy ( endpoint_set *p_set );
+boolean     endpoint_set_add     ( endpoint_set *p_set, const char *s_hostname );
+uint        endpoint_set_parse   ( endpoint_set *p_set, const char *s_list ); /* comma, semicolon or space separated; returns how many were added */
+boolean     endpoint_probe       ( endpoint_set *p_set ); /* FALSE when no candidate answered */
+const char* endpoint_current     ( endpoint_set *p_set ); /* probes first when the choice is stale or expired */
+void        endpoint_report      ( endpoint_set *p_set, const char *s_hostname, uint64_t first_byte_ns, boolean b_ok ); /* 0 ns when the time says nothing, e.g. uploads */
+
+#define endpoint_set_count( p_set )          ((p_set)->count)
+#define endpoint_set_ttl( p_set, seconds )   ((p_set)->ttl = (seconds))
+
+#endif /* _ENDPOINT_H_ */
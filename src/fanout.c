@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <curl/curl.h>
+#include "fanout.h"
+
+#define FANOUT_NONE    (UINT64_MAX)
+
+static void*    _fanout_reader         ( void *p_data );
+static uint64_t _fanout_slowest        ( const fanout *p_fanout );
+static void     _fanout_release_locked ( fanout *p_fanout );
+
+
+boolean fanout_open( fanout *p_fanout, const char *s_filename, uint flags, uint targets, profiler *p_profiler, off_t *p_size )
+{
+	uint i;
+
+	assert( p_fanout );
+	assert( s_filename );
+
+	if( targets == 0 || targets > FANOUT_MAX_TARGETS )
+	{
+		return FALSE;
+	}
+
+	p_fanout->p_pool = buffer_pool_shared( );
+
+	if( !p_fanout->p_pool || !readahead_open( &p_fanout->source, s_filename, flags, p_size ) )
+	{
+		return FALSE;
+	}
+
+	/* leave the other half of a small pool to the read-ahead window */
+	p_fanout->window = buffer_pool_count( p_fanout->p_pool ) / 2;
+	if( p_fanout->window > FANOUT_WINDOW ) p_fanout->window = FANOUT_WINDOW;
+	if( p_fanout->window == 0 ) p_fanout->window = 1;
+
+	p_fanout->p_profiler   = p_profiler;
+	p_fanout->read         = 0;
+	p_fanout->released     = 0;
+	p_fanout->cursor_count = targets;
+	p_fanout->b_eof        = FALSE;
+	p_fanout->b_error      = FALSE;
+	p_fanout->b_stopping   = FALSE;
+
+	for( i = 0; i < targets; i++ )
+	{
+		p_fanout->cursors[ i ].p_fanout   = p_fanout;
+		p_fanout->cursors[ i ].chunk      = 0;
+		p_fanout->cursors[ i ].offset     = 0;
+		p_fanout->cursors[ i ].b_attached = TRUE;
+	}
+
+	pthread_mutex_init( &p_fanout->lock, NULL );
+	pthread_cond_init( &p_fanout->changed, NULL );
+
+	if( pthread_create( &p_fanout->reader, NULL, _fanout_reader, p_fanout ) != 0 )
+	{
+		/* without a reader the targets could not move independently */
+		pthread_cond_destroy( &p_fanout->changed );
+		pthread_mutex_destroy( &p_fanout->lock );
+		readahead_close( &p_fanout->source );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean fanout_peek( fanout *p_fanout, const byte **p_p_data, size_t *p_length )
+{
+	boolean b_result = FALSE;
+
+	assert( p_fanout );
+	assert( p_p_data );
+	assert( p_length );
+
+	pthread_mutex_lock( &p_fanout->lock );
+
+	while( p_fanout->read == 0 && !p_fanout->b_eof && !p_fanout->b_error )
+	{
+		pthread_cond_wait( &p_fanout->changed, &p_fanout->lock );
+	}
+
+	if( p_fanout->read > 0 && p_fanout->released == 0 )
+	{
+		*p_p_data = p_fanout->chunks[ 0 ].p_buffer;
+		*p_length = p_fanout->chunks[ 0 ].length;
+		b_result  = TRUE;
+	}
+	else if( p_fanout->read == 0 && p_fanout->b_eof )
+	{
+		/* an empty file */
+		*p_p_data = NULL;
+		*p_length = 0;
+		b_result  = TRUE;
+	}
+
+	pthread_mutex_unlock( &p_fanout->lock );
+
+	return b_result;
+}
+
+size_t fanout_read( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	fanout_cursor *p_cursor = (fanout_cursor *) data;
+	fanout *p_fanout        = p_cursor->p_fanout;
+	const fanout_chunk *p_chunk = NULL;
+	size_t length           = 0;
+
+	pthread_mutex_lock( &p_fanout->lock );
+
+	while( p_cursor->chunk >= p_fanout->read && !p_fanout->b_eof && !p_fanout->b_error )
+	{
+		pthread_cond_wait( &p_fanout->changed, &p_fanout->lock );
+	}
+
+	if( p_cursor->chunk < p_fanout->read )
+	{
+		p_chunk = &p_fanout->chunks[ p_cursor->chunk % FANOUT_WINDOW ];
+		length  = p_chunk->length - p_cursor->offset;
+		if( length > size * nmemb ) length = size * nmemb;
+	}
+	else if( p_fanout->b_error )
+	{
+		pthread_mutex_unlock( &p_fanout->lock );
+		return CURL_READFUNC_ABORT;
+	}
+
+	pthread_mutex_unlock( &p_fanout->lock );
+
+	if( !p_chunk )
+	{
+		/* the end of the file */
+		return 0;
+	}
+
+	/* the chunk cannot go back to the pool while this cursor is on it */
+	memcpy( ptr, p_chunk->p_buffer + p_cursor->offset, length );
+
+	pthread_mutex_lock( &p_fanout->lock );
+
+	p_cursor->offset += length;
+
+	if( p_cursor->offset == p_chunk->length )
+	{
+		p_cursor->chunk++;
+		p_cursor->offset = 0;
+
+		_fanout_release_locked( p_fanout );
+		pthread_cond_broadcast( &p_fanout->changed );
+	}
+
+	pthread_mutex_unlock( &p_fanout->lock );
+
+	return length;
+}
+
+void fanout_detach( fanout_cursor *p_cursor )
+{
+	fanout *p_fanout = p_cursor->p_fanout;
+
+	pthread_mutex_lock( &p_fanout->lock );
+
+	if( p_cursor->b_attached )
+	{
+		p_cursor->b_attached = FALSE;
+
+		_fanout_release_locked( p_fanout );
+		pthread_cond_broadcast( &p_fanout->changed );
+	}
+
+	pthread_mutex_unlock( &p_fanout->lock );
+}
+
+void fanout_close( fanout *p_fanout )
+{
+	uint i;
+
+	assert( p_fanout );
+
+	pthread_mutex_lock( &p_fanout->lock );
+	p_fanout->b_stopping = TRUE;
+	pthread_cond_broadcast( &p_fanout->changed );
+	pthread_mutex_unlock( &p_fanout->lock );
+
+	pthread_join( p_fanout->reader, NULL );
+
+	for( i = 0; i < p_fanout->cursor_count; i++ )
+	{
+		p_fanout->cursors[ i ].b_attached = FALSE;
+	}
+
+	/* with no cursor left this hands back every chunk still held */
+	_fanout_release_locked( p_fanout );
+
+	readahead_close( &p_fanout->source );
+	pthread_cond_destroy( &p_fanout->changed );
+	pthread_mutex_destroy( &p_fanout->lock );
+}
+
+/* reads chunk after chunk while the slowest target is less than a window behind */
+void* _fanout_reader( void *p_data )
+{
+	fanout *p_fanout   = (fanout *) p_data;
+	size_t buffer_size = buffer_pool_buffer_size( p_fanout->p_pool );
+
+	pthread_mutex_lock( &p_fanout->lock );
+
+	while( !p_fanout->b_stopping && !p_fanout->b_eof && !p_fanout->b_error )
+	{
+		uint64_t slowest = _fanout_slowest( p_fanout );
+		byte *p_buffer;
+		size_t filled = 0;
+		ssize_t n     = 0;
+		uint64_t begin;
+
+		if( slowest == FANOUT_NONE )
+		{
+			/* every target has stopped */
+			break;
+		}
+
+		if( p_fanout->read - slowest >= p_fanout->window )
+		{
+			pthread_cond_wait( &p_fanout->changed, &p_fanout->lock );
+			continue;
+		}
+
+		pthread_mutex_unlock( &p_fanout->lock );
+
+		/* may wait; the targets hand chunks back as they move on */
+		p_buffer = buffer_pool_acquire( p_fanout->p_pool );
+		begin    = profiler_begin( p_fanout->p_profiler );
+
+		while( filled < buffer_size && (n = readahead_read( &p_fanout->source, p_buffer + filled, buffer_size - filled )) > 0 )
+		{
+			filled += (size_t) n;
+		}
+
+		profiler_end( p_fanout->p_profiler, PROFILE_READ, begin, filled );
+
+		pthread_mutex_lock( &p_fanout->lock );
+
+		if( n < 0 )
+		{
+			p_fanout->b_error = TRUE;
+			buffer_pool_release( p_fanout->p_pool, p_buffer );
+		}
+		else if( filled == 0 )
+		{
+			p_fanout->b_eof = TRUE;
+			buffer_pool_release( p_fanout->p_pool, p_buffer );
+		}
+		else
+		{
+			fanout_chunk *p_chunk = &p_fanout->chunks[ p_fanout->read % FANOUT_WINDOW ];
+
+			p_chunk->p_buffer = p_buffer;
+			p_chunk->length   = filled;
+			p_fanout->read++;
+
+			/* a short chunk is the last one */
+			if( filled < buffer_size ) p_fanout->b_eof = TRUE;
+		}
+
+		pthread_cond_broadcast( &p_fanout->changed );
+	}
+
+	pthread_mutex_unlock( &p_fanout->lock );
+
+	return NULL;
+}
+
+uint64_t _fanout_slowest( const fanout *p_fanout )
+{
+	uint64_t slowest = FANOUT_NONE;
+	uint i;
+
+	for( i = 0; i < p_fanout->cursor_count; i++ )
+	{
+		if( p_fanout->cursors[ i ].b_attached && p_fanout->cursors[ i ].chunk < slowest )
+		{
+			slowest = p_fanout->cursors[ i ].chunk;
+		}
+	}
+
+	return slowest;
+}
+
+/* gives back the chunks every attached cursor has moved past */
+void _fanout_release_locked( fanout *p_fanout )
+{
+	uint64_t slowest = _fanout_slowest( p_fanout );
+
+	if( slowest == FANOUT_NONE || slowest > p_fanout->read )
+	{
+		slowest = p_fanout->read;
+	}
+
+	while( p_fanout->released < slowest )
+	{
+		buffer_pool_release( p_fanout->p_pool, p_fanout->chunks[ p_fanout->released % FANOUT_WINDOW ].p_buffer );
+		p_fanout->released++;
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef _FANOUT_H_
+#define _FANOUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "types.h"
+#include "bufpool.h"
+#include "readahead.h"
+#include "profile.h"
+
+/*
+ * Reads a file once for several transfers. A reader thread fills chunks
+ * from the shared buffer pool, and each target reads them through its
+ * own cursor at its own pace; a chunk goes back to the pool when the
+ * last cursor has moved past it.
+ *
+ * The reader stays at most FANOUT_WINDOW chunks ahead of the slowest
+ * target, so that is as far as the fastest one can get ahead, and all
+ * the memory a fan-out holds besides the read-ahead window. A target
+ * that is done, or gives up, detaches so it no longer holds the others
+ * back. A target that failed cannot rewind; it has to read the file
+ * again on its own.
+ */
+#define FANOUT_MAX_TARGETS     (4)
+#define FANOUT_WINDOW          (16)  /* chunks of buffer_pool_buffer_size() */
+
+struct tag_fanout;
+
+typedef struct tag_fanout_chunk {
+	byte *p_buffer;          /* from the buffer pool while the chunk is held */
+	size_t length;           /* less than the buffer only for the last chunk */
+} fanout_chunk;
+
+typedef struct tag_fanout_cursor {
+	struct tag_fanout *p_fanout;
+	uint64_t chunk;          /* sequence number of the chunk being read */
+	size_t offset;           /* into that chunk */
+	boolean b_attached;
+} fanout_cursor;
+
+typedef struct tag_fanout {
+	readahead_reader source;
+	buffer_pool *p_pool;
+	profiler *p_profiler;    /* the reads count as the read stage, may be NULL */
+	uint window;             /* FANOUT_WINDOW, less when the pool is small */
+	fanout_chunk chunks[ FANOUT_WINDOW ];  /* chunk n is chunks[ n % FANOUT_WINDOW ] */
+	uint64_t read;           /* chunks read so far */
+	uint64_t released;       /* chunks given back to the pool */
+	fanout_cursor cursors[ FANOUT_MAX_TARGETS ];
+	uint cursor_count;
+	boolean b_eof;
+	boolean b_error;
+	boolean b_stopping;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;  /* a chunk was read or a cursor moved */
+	pthread_t reader;
+} fanout;
+
+boolean fanout_open   ( fanout *p_fanout, const char *s_filename, uint flags, uint targets, profiler *p_profiler, /*out*/ off_t *p_size ); /* flags as for readahead_open() */
+boolean fanout_peek   ( fanout *p_fanout, /*out*/ const byte **p_p_data, /*out*/ size_t *p_length ); /* the first chunk, e.g. to sniff the type; before any target reads */
+size_t  fanout_read   ( void *ptr, size_t size, size_t nmemb, void *data ); /* cURL read callback; data is a fanout_cursor */
+void    fanout_detach ( fanout_cursor *p_cursor );
+void    fanout_close  ( fanout *p_fanout ); /* after every target has stopped reading */
+
+#define fanout_cursor( p_fanout, target )   (&(p_fanout)->cursors[ (target) ])
+#define fanout_failed( p_fanout )           ((p_fanout)->b_error)
+
+#endif /* _FANOUT_H_ */
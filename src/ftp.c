@@ -1,183 +1,1369 @@
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
 #include "ftp.h"
+#include "trace.h"
+#include "log.h"
 
 #define FTP_USERAGENT   "Shrewd LLC/FTP"
+#define FTP_WAIT_MS     (1000)
+#define FTP_READ_SIZE   (64 * 1024)
+#define FTP_MAX_LINE    (1024)
+#define FTP_MAX_PATH    (1024)
 
-boolean ftp_upload( CURL *p_curl, const char *s_hostname, const char *s_username, const char *s_password, const char *s_path, const char *s_filename )
+/* carries a partial line between chunks of a directory listing */
+typedef struct tag_ftp_list_parser {
+	ftp_inventory *p_inventory;
+	char line[ FTP_MAX_LINE ];
+	size_t length;
+	boolean b_overflow;
+} ftp_list_parser;
+
+/* request helpers shared by the one-shot calls and the session pool */
+static const char* _ftp_basename         ( const char *s_filename );
+static void        _ftp_build_url        ( char *s_url, size_t size, const char *s_hostname, const char *s_path, const char *s_name );
+static void        _ftp_prepare_request  ( CURL *p_curl, const char *s_username, const char *s_password, char *curl_err );
+static curl_off_t  _ftp_prepare_upload   ( CURL *p_curl, const char *s_hostname, const char *s_path, const char *s_filename, FILE *fd_tmp, curl_off_t offset );
+static void        _ftp_prepare_commands ( CURL *p_curl, const char *s_hostname, struct curl_slist *p_commands );
+static struct curl_slist* _ftp_append_delete( struct curl_slist *p_commands, const char *s_filepath, boolean b_ignore_errors );
+/* resume helpers */
+static struct curl_slist* _ftp_prepare_probe( CURL *p_curl, const char *s_hostname, const char *s_path, const char *s_filename, ftp_resume *p_resume );
+static size_t      _ftp_probe_handle_response ( void *ptr, size_t size, size_t nmemb, void *data );
+static void        _ftp_probe_finish     ( CURL *p_curl, CURLcode res, ftp_resume *p_resume );
+static curl_off_t  _ftp_resume_offset    ( const ftp_resume *p_resume, FILE *fd_tmp, curl_off_t sent, boolean b_verbose, profiler *p_profiler );
+static boolean     _ftp_local_digest     ( FILE *fd_tmp, curl_off_t length, const char *s_algorithm, /*out*/ char *s_digest, size_t size, profiler *p_profiler );
+static uint        _ftp_crc32            ( uint crc, const byte *buffer, size_t length );
+static curl_off_t  _ftp_file_size        ( FILE *fd_tmp );
+/* session pool helpers */
+static boolean     _ftp_pool_start       ( ftp_pool *p_pool, ftp_session *p_session );
+static void        _ftp_pool_finish      ( ftp_pool *p_pool, ftp_session *p_session );
+static ftp_session* _ftp_pool_run        ( ftp_pool *p_pool, /*out*/ CURLcode *p_res );
+static boolean     _ftp_pool_resume      ( ftp_pool *p_pool, ftp_session *p_session, const char *s_path, const char *s_filename, /*in/out*/ CURLcode *p_res );
+static CURLcode    _ftp_pool_perform     ( ftp_pool *p_pool, ftp_session *p_session );
+static void        _ftp_pool_record_sent ( ftp_pool *p_pool, const ftp_session *p_session, CURLcode res );
+/* listing and sync helpers */
+static void        _ftp_prepare_list     ( CURL *p_curl, const char *s_hostname, const char *s_path, ftp_list_parser *p_parser, boolean b_mlsd );
+static size_t      _ftp_list_handle_response ( void *ptr, size_t size, size_t nmemb, void *data );
+static void        _ftp_list_parse_line  ( ftp_inventory *p_inventory, char *line );
+static boolean     _ftp_list_parse_mlsd  ( ftp_inventory *p_inventory, char *line );
+static boolean     _ftp_list_parse_unix  ( ftp_inventory *p_inventory, char *line );
+static void        _ftp_inventory_add    ( ftp_inventory *p_inventory, const char *s_name, curl_off_t size, time_t modified, boolean b_directory );
+static int         _ftp_entry_compare    ( const void *a, const void *b );
+static boolean     _ftp_pool_mkdir       ( ftp_pool *p_pool, const char *s_path );
+static boolean     _ftp_pool_sync_directory ( ftp_pool *p_pool, const char *s_local_directory, const char *s_remote_path, boolean b_delete, ftp_sync_stats *p_stats );
+
+
+boolean ftp_pool_create( ftp_pool *p_pool, const char *s_hostname, const char *s_username, const char *s_password, uint sessions, boolean verbose )
+{
+	uint i;
+
+	assert( p_pool );
+	assert( s_hostname );
+	assert( !s_username || s_password );
+
+	memset( p_pool, 0, sizeof(ftp_pool) );
+
+	snprintf( p_pool->s_hostname, sizeof(p_pool->s_hostname), "%s", s_hostname );
+
+	if( s_username )
+	{
+		snprintf( p_pool->s_username, sizeof(p_pool->s_username), "%s", s_username );
+		snprintf( p_pool->s_password, sizeof(p_pool->s_password), "%s", s_password );
+	}
+
+	p_pool->b_verbose     = verbose;
+	p_pool->session_count = sessions < 1 ? 1 : (sessions > FTP_MAX_SESSIONS ? FTP_MAX_SESSIONS : sessions);
+	p_pool->p_multi       = curl_multi_init( );
+
+	if( !p_pool->p_multi )
+	{
+		return FALSE;
+	}
+
+	/* keep every session's control connection alive between transfers */
+	curl_multi_setopt( p_pool->p_multi, CURLMOPT_MAXCONNECTS, (long) p_pool->session_count );
+
+	for( i = 0; i < p_pool->session_count; i++ )
+	{
+		p_pool->sessions[ i ].p_curl = curl_easy_init( );
+
+		if( !p_pool->sessions[ i ].p_curl )
+		{
+			ftp_pool_destroy( p_pool );
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+void ftp_pool_destroy( ftp_pool *p_pool )
+{
+	uint i;
+
+	assert( p_pool );
+
+	for( i = 0; i < p_pool->session_count; i++ )
+	{
+		ftp_session *p_session = &p_pool->sessions[ i ];
+
+		if( p_session->b_busy )
+		{
+			_ftp_pool_finish( p_pool, p_session );
+		}
+
+		if( p_session->p_curl )
+		{
+			curl_easy_cleanup( p_session->p_curl );
+			p_session->p_curl = NULL;
+		}
+	}
+
+	/* closes the pooled connections */
+	if( p_pool->p_multi )
+	{
+		curl_multi_cleanup( p_pool->p_multi );
+		p_pool->p_multi = NULL;
+	}
+
+	p_pool->session_count = 0;
+}
+
+boolean ftp_pool_upload( ftp_pool *p_pool, const char *s_path, const char **filenames, size_t count, boolean *p_results )
+{
+	size_t next      = 0;
+	size_t remaining = count;
+	boolean b_result = TRUE;
+	uint i;
+
+	assert( p_pool );
+	assert( p_pool->p_multi );
+	assert( filenames || count == 0 );
+
+	TRACE3( ftp_pool_upload_start, p_pool->s_hostname, s_path, (uint64_t) count );
+
+	while( remaining > 0 )
+	{
+		ftp_session *p_session;
+		CURLcode res;
+
+		/* hand out files to idle sessions */
+		for( i = 0; i < p_pool->session_count && next < count; i++ )
+		{
+			p_session = &p_pool->sessions[ i ];
+
+			while( !p_session->b_busy && next < count )
+			{
+				p_session->job       = next++;
+				p_session->job_count = 1;
+				p_session->offset    = 0;
+				p_session->length    = 0;
+				p_session->p_file    = fopen( filenames[ p_session->job ], "rb" );
+
+				TRACE3( ftp_upload_start, p_pool->s_hostname, s_path, filenames[ p_session->job ] );
+
+				if( !p_session->p_file )
+				{
+					if( ftp_pool_is_verbose(p_pool) ) log_error( "Cannot open file (%s)", filenames[ p_session->job ] );
+					TRACE4( ftp_upload_done, s_path, filenames[ p_session->job ], (int64_t) 0, FALSE );
+					if( p_results ) p_results[ p_session->job ] = FALSE;
+					p_pool->sent = 0;
+					b_result = FALSE;
+					remaining--;
+					continue;
+				}
+
+				_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+
+				if( p_pool->b_resume )
+				{
+					/* ask about a partial remote copy first, see _ftp_pool_resume() */
+					p_session->b_probing  = TRUE;
+					p_session->p_commands = _ftp_prepare_probe( p_session->p_curl, p_pool->s_hostname, s_path, filenames[ p_session->job ], &p_session->resume );
+				}
+				else
+				{
+					p_session->length = _ftp_prepare_upload( p_session->p_curl, p_pool->s_hostname, s_path, filenames[ p_session->job ], p_session->p_file, 0 );
+				}
+
+				if( !_ftp_pool_start( p_pool, p_session ) )
+				{
+					if( p_results ) p_results[ p_session->job ] = FALSE;
+					p_pool->sent = 0;
+					b_result = FALSE;
+					remaining--;
+				}
+			}
+		}
+
+		if( remaining == 0 )
+		{
+			break;
+		}
+
+		/* wait for a transfer to complete */
+		p_session = _ftp_pool_run( p_pool, &res );
+
+		if( p_session )
+		{
+			if( p_session->b_probing && _ftp_pool_resume( p_pool, p_session, s_path, filenames[ p_session->job ], &res ) )
+			{
+				continue; /* the upload itself is running now */
+			}
+
+			if( res != 0 )
+			{
+				if( ftp_pool_is_verbose(p_pool) ) log_error( "Error uploading %s (host = %.128s res = %d, err = %.1024s).", filenames[ p_session->job ], p_pool->s_hostname, res, p_session->curl_err );
+				b_result = FALSE;
+			}
+
+			TRACE4( ftp_upload_done, s_path, filenames[ p_session->job ], (int64_t) (res == 0 ? p_session->length : 0), res == 0 );
+			_ftp_pool_record_sent( p_pool, p_session, res );
+
+			if( p_results ) p_results[ p_session->job ] = res == 0;
+			remaining -= p_session->job_count;
+			_ftp_pool_finish( p_pool, p_session );
+		}
+	}
+
+	TRACE2( ftp_pool_upload_done, (uint64_t) count, b_result );
+
+	return b_result;
+}
+
+boolean ftp_pool_delete( ftp_pool *p_pool, const char **filepaths, size_t count )
+{
+	size_t next      = 0;
+	size_t remaining = count;
+	boolean b_result = TRUE;
+	uint i;
+
+	assert( p_pool );
+	assert( p_pool->p_multi );
+	assert( filepaths || count == 0 );
+
+	TRACE2( ftp_pool_delete_start, p_pool->s_hostname, (uint64_t) count );
+
+	while( remaining > 0 )
+	{
+		ftp_session *p_session;
+		CURLcode res;
+
+		/* each idle session gets a batch of DELE commands */
+		for( i = 0; i < p_pool->session_count && next < count; i++ )
+		{
+			p_session = &p_pool->sessions[ i ];
+
+			if( !p_session->b_busy )
+			{
+				p_session->job       = next;
+				p_session->job_count = 0;
+
+				while( next < count && p_session->job_count < FTP_DELETE_BATCH_SIZE )
+				{
+					/* a missing file must not abort the rest of the batch */
+					p_session->p_commands = _ftp_append_delete( p_session->p_commands, filepaths[ next++ ], TRUE );
+					p_session->job_count++;
+				}
+
+				_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+				_ftp_prepare_commands( p_session->p_curl, p_pool->s_hostname, p_session->p_commands );
+
+				if( !_ftp_pool_start( p_pool, p_session ) )
+				{
+					b_result   = FALSE;
+					remaining -= p_session->job_count;
+				}
+			}
+		}
+
+		if( remaining == 0 )
+		{
+			break;
+		}
+
+		p_session = _ftp_pool_run( p_pool, &res );
+
+		if( p_session )
+		{
+			if( res != 0 && res != 21 )
+			{
+				if( ftp_pool_is_verbose(p_pool) ) log_error( "Error deleting files (host = %.128s res = %d, err = %.1024s).", p_pool->s_hostname, res, p_session->curl_err );
+				b_result = FALSE;
+			}
+
+			remaining -= p_session->job_count;
+			_ftp_pool_finish( p_pool, p_session );
+		}
+	}
+
+	TRACE2( ftp_pool_delete_done, (uint64_t) count, b_result );
+
+	return b_result;
+}
+
+boolean ftp_pool_upload_reader( ftp_pool *p_pool, const char *s_path, const char *s_filename, ftp_read_function read_function, void *p_data, curl_off_t size )
+{
+	ftp_session *p_session = &p_pool->sessions[ 0 ];
+	char buffer[ 1024 ];
+	CURLcode res;
+
+	assert( p_pool );
+	assert( p_pool->p_multi );
+	assert( s_filename );
+	assert( read_function );
+	assert( !p_session->b_busy );
+
+	TRACE3( ftp_upload_start, p_pool->s_hostname, s_path, s_filename );
+
+	_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+
+	p_session->offset = 0;
+	curl_easy_setopt( p_session->p_curl, CURLOPT_APPEND, 0L );
+	curl_easy_setopt( p_session->p_curl, CURLOPT_INFILESIZE_LARGE, size );
+	curl_easy_setopt( p_session->p_curl, CURLOPT_READFUNCTION, read_function );
+	curl_easy_setopt( p_session->p_curl, CURLOPT_READDATA, p_data );
+	curl_easy_setopt( p_session->p_curl, CURLOPT_UPLOAD, 1 );
+
+	/* build URL (cURL copies it) */
+	_ftp_build_url( buffer, sizeof(buffer), p_pool->s_hostname, s_path, _ftp_basename( s_filename ) );
+	curl_easy_setopt( p_session->p_curl, CURLOPT_URL, buffer /* URL */ );
+
+	res = _ftp_pool_perform( p_pool, p_session );
+
+	if( res != 0 )
+	{
+		if( ftp_pool_is_verbose(p_pool) ) log_error( "Error uploading %s (host = %.128s res = %d, err = %.1024s).", s_filename, p_pool->s_hostname, res, p_session->curl_err );
+	}
+
+	TRACE4( ftp_upload_done, s_path, s_filename, (int64_t) (res == 0 ? size : 0), res == 0 );
+	_ftp_pool_record_sent( p_pool, p_session, res );
+
+	return res == 0;
+}
+
+boolean ftp_inventory_create( ftp_inventory *p_inventory )
+{
+	assert( p_inventory );
+
+	p_inventory->b_sorted = TRUE;
+
+	return vector_create( &p_inventory->entries, sizeof(ftp_entry), NULL ) &&
+	       arena_create( &p_inventory->names, 0 );
+}
+
+void ftp_inventory_destroy( ftp_inventory *p_inventory )
+{
+	assert( p_inventory );
+
+	vector_destroy( &p_inventory->entries );
+	arena_destroy( &p_inventory->names );
+}
+
+void ftp_inventory_clear( ftp_inventory *p_inventory )
+{
+	assert( p_inventory );
+
+	vector_size( &p_inventory->entries ) = 0;
+	arena_reset( &p_inventory->names );
+	p_inventory->b_sorted = TRUE;
+}
+
+ftp_entry* ftp_inventory_find( ftp_inventory *p_inventory, const char *s_name )
+{
+	ftp_entry key;
+
+	assert( p_inventory );
+	assert( s_name );
+
+	/* entries arrive in server order; sort once on the first lookup */
+	if( !p_inventory->b_sorted )
+	{
+		qsort( vector_array(&p_inventory->entries), vector_size(&p_inventory->entries), sizeof(ftp_entry), _ftp_entry_compare );
+		p_inventory->b_sorted = TRUE;
+	}
+
+	key.s_name = s_name;
+
+	return (ftp_entry *) bsearch( &key, vector_array(&p_inventory->entries), vector_size(&p_inventory->entries), sizeof(ftp_entry), _ftp_entry_compare );
+}
+
+boolean ftp_pool_list( ftp_pool *p_pool, const char *s_path, ftp_inventory *p_inventory )
+{
+	ftp_session *p_session = &p_pool->sessions[ 0 ];
+	ftp_list_parser parser;
+	CURLcode res = 0;
+
+	assert( p_pool );
+	assert( p_pool->p_multi );
+	assert( p_inventory );
+	assert( !p_session->b_busy );
+
+	parser.p_inventory = p_inventory;
+
+	_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+	_ftp_prepare_list( p_session->p_curl, p_pool->s_hostname, s_path, &parser, TRUE );
+	res = _ftp_pool_perform( p_pool, p_session );
+
+	if( res != 0 )
+	{
+		/* older servers have no MLSD; fall back to parsing LIST */
+		ftp_inventory_clear( p_inventory );
+		_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+		_ftp_prepare_list( p_session->p_curl, p_pool->s_hostname, s_path, &parser, FALSE );
+		res = _ftp_pool_perform( p_pool, p_session );
+	}
+
+	/* a final line without a newline */
+	if( res == 0 && parser.length > 0 && !parser.b_overflow )
+	{
+		parser.line[ parser.length ] = '\0';
+		_ftp_list_parse_line( p_inventory, parser.line );
+	}
+
+	return res == 0;
+}
+
+boolean ftp_pool_sync( ftp_pool *p_pool, const char *s_local_directory, const char *s_remote_path, boolean b_delete, ftp_sync_stats *p_stats )
+{
+	ftp_sync_stats stats;
+
+	assert( p_pool );
+	assert( s_local_directory );
+
+	memset( &stats, 0, sizeof(stats) );
+
+	boolean b_result = _ftp_pool_sync_directory( p_pool, s_local_directory, s_remote_path ? s_remote_path : "", b_delete, &stats );
+
+	if( p_stats )
+	{
+		*p_stats = stats;
+	}
+
+	return b_result && stats.failed == 0;
+}
+
+/*
+ * Request helpers
+ */
+const char* _ftp_basename( const char *s_filename )
+{
+	const char *p_slash = strrchr( s_filename, '/' );
+	return p_slash ? p_slash + 1 : s_filename;
+}
+
+void _ftp_build_url( char *s_url, size_t size, const char *s_hostname, const char *s_path, const char *s_name )
+{
+	/* A leading %2F makes the path absolute, which saves sending "CWD /" with every request. */
+	while( s_path && *s_path == '/' ) s_path++;
+	while( s_name && *s_name == '/' ) s_name++;
+
+	if( s_path && *s_path )
+	{
+		snprintf( s_url, size, "ftp://%.128s/%%2F%s/%s", s_hostname, s_path, s_name ? s_name : "" );
+	}
+	else
+	{
+		snprintf( s_url, size, "ftp://%.128s/%%2F%s", s_hostname, s_name ? s_name : "" );
+	}
+}
+
+void _ftp_prepare_request( CURL *p_curl, const char *s_username, const char *s_password, char *curl_err )
+{
+	/* drops the options of the previous transfer but keeps its connection */
+	curl_easy_reset( p_curl );
+
+	curl_easy_setopt( p_curl, CURLOPT_ERRORBUFFER, curl_err );
+	curl_easy_setopt( p_curl, CURLOPT_USERAGENT, FTP_USERAGENT );
+	curl_easy_setopt( p_curl, CURLOPT_FTP_FILEMETHOD, CURLFTPMETHOD_NOCWD );
+
+	/* credentials are kept out of the URL */
+	if( s_username )
+	{
+		assert( s_password );
+		curl_easy_setopt( p_curl, CURLOPT_USERNAME, s_username );
+		curl_easy_setopt( p_curl, CURLOPT_PASSWORD, s_password );
+	}
+
+	#ifdef _CURL_VERBOSE
+	curl_easy_setopt( p_curl, CURLOPT_VERBOSE, 1 );
+	#endif
+}
+
+/* returns the number of bytes the upload will send */
+curl_off_t _ftp_prepare_upload( CURL *p_curl, const char *s_hostname, const char *s_path, const char *s_filename, FILE *fd_tmp, curl_off_t offset )
+{
+	char buffer[ 1024 ];
+	curl_off_t length = _ftp_file_size( fd_tmp ) - offset;
+
+	/* a non-zero offset continues a partial upload with APPE */
+	fseeko( fd_tmp, (off_t) offset, SEEK_SET );
+	curl_easy_setopt( p_curl, CURLOPT_APPEND, offset > 0 ? 1L : 0L );
+	curl_easy_setopt( p_curl, CURLOPT_INFILESIZE_LARGE, length );
+
+	#ifdef _NO_FILE_STDIO_STREAM
+		curl_easy_setopt( p_curl, CURLOPT_READDATA, fd_tmp ); /* I had no stdio_stream in my FILE structure */
+	#else
+		curl_easy_setopt( p_curl, CURLOPT_READDATA, fd_tmp->stdio_stream ); /*** URGENT: this is for FCGI compatibility, normally is would be fd_tmp only !!! ***/		
+	#endif
+	curl_easy_setopt( p_curl, CURLOPT_UPLOAD, 1 );
+
+	/* build URL (cURL copies it) */
+	_ftp_build_url( buffer, sizeof(buffer), s_hostname, s_path, _ftp_basename( s_filename ) );
+	curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
+
+	return length;
+}
+
+void _ftp_prepare_commands( CURL *p_curl, const char *s_hostname, struct curl_slist *p_commands )
+{
+	char buffer[ 1024 ];
+
+	/* no data transfer, only the quoted commands are sent (no more dummy download into /dev/null) */
+	curl_easy_setopt( p_curl, CURLOPT_NOBODY, 1 );
+	curl_easy_setopt( p_curl, CURLOPT_QUOTE, p_commands );
+
+	snprintf( buffer, sizeof(buffer), "ftp://%.128s/", s_hostname );
+	curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
+}
+
+struct curl_slist* _ftp_append_delete( struct curl_slist *p_commands, const char *s_filepath, boolean b_ignore_errors )
+{
+	char buffer[ 1024 ];
+
+	/* cURL carries on past a quote command prefixed with '*' when it fails */
+	snprintf( buffer, sizeof(buffer), "%sDELE %s", b_ignore_errors ? "*" : "", s_filepath );
+
+	return curl_slist_append( p_commands, buffer /* delete command */ );
+}
+
+/*
+ * Resume helpers
+ */
+struct curl_slist* _ftp_prepare_probe( CURL *p_curl, const char *s_hostname, const char *s_path, const char *s_filename, ftp_resume *p_resume )
+{
+	struct curl_slist *p_commands = NULL;
+	const char *s_name            = _ftp_basename( s_filename );
+	char buffer[ 1024 ];
+
+	p_resume->remote_size      = -1;
+	p_resume->s_algorithm[ 0 ] = '\0';
+	p_resume->s_digest[ 0 ]    = '\0';
+
+	while( s_path && *s_path == '/' ) s_path++;
+
+	/* A partial file's digest is the digest of the prefix we sent. Both
+	 * commands are optional extensions, so their failure is ignored. */
+	if( s_path && *s_path )
+	{
+		snprintf( buffer, sizeof(buffer), "*HASH /%s/%s", s_path, s_name );
+		p_commands = curl_slist_append( p_commands, buffer );
+		snprintf( buffer, sizeof(buffer), "*XCRC /%s/%s", s_path, s_name );
+		p_commands = curl_slist_append( p_commands, buffer );
+	}
+	else
+	{
+		snprintf( buffer, sizeof(buffer), "*HASH /%s", s_name );
+		p_commands = curl_slist_append( p_commands, buffer );
+		snprintf( buffer, sizeof(buffer), "*XCRC /%s", s_name );
+		p_commands = curl_slist_append( p_commands, buffer );
+	}
+
+	/* NOBODY on a file URL makes cURL issue SIZE */
+	curl_easy_setopt( p_curl, CURLOPT_NOBODY, 1 );
+	curl_easy_setopt( p_curl, CURLOPT_QUOTE, p_commands );
+	curl_easy_setopt( p_curl, CURLOPT_HEADERFUNCTION, _ftp_probe_handle_response );
+	curl_easy_setopt( p_curl, CURLOPT_HEADERDATA, (void *) p_resume );
+
+	_ftp_build_url( buffer, sizeof(buffer), s_hostname, s_path, s_name );
+	curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
+
+	return p_commands;
+}
+
+/*
+ * Picks the digests out of the server replies:
+ *   HASH --> "213 SHA-256 0-1048575 9f86d081884c7d65... name"
+ *   XCRC --> "250 1A2B3C4D"
+ */
+size_t _ftp_probe_handle_response( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	size_t realsize      = size * nmemb;
+	ftp_resume *p_resume = (ftp_resume *) data;
+	char line[ 512 ];
+	char algorithm[ 16 ];
+	char range[ 64 ];
+	char digest[ FTP_MAX_DIGEST ];
+	size_t length = realsize < sizeof(line) - 1 ? realsize : sizeof(line) - 1;
+
+	memcpy( line, ptr, length );
+	line[ length ] = '\0';
+
+	if( strncmp( line, "213 ", 4 ) == 0 && isalpha( (byte) line[ 4 ] ) )
+	{
+		if( sscanf( line + 4, "%15s %63s %128s", algorithm, range, digest ) == 3 )
+		{
+			strcpy( p_resume->s_algorithm, algorithm );
+			strcpy( p_resume->s_digest, digest );
+		}
+	}
+	else if( strncmp( line, "250 ", 4 ) == 0 && p_resume->s_algorithm[ 0 ] == '\0' )
+	{
+		const char *p = line + 4;
+		size_t i;
+
+		if( p[ 0 ] == '0' && (p[ 1 ] == 'x' || p[ 1 ] == 'X') ) p += 2;
+
+		for( i = 0; i < 8 && isxdigit( (byte) p[ i ] ); i++ );
+
+		if( i == 8 && (p[ 8 ] == '\0' || isspace( (byte) p[ 8 ] )) )
+		{
+			strcpy( p_resume->s_algorithm, "CRC32" );
+			memcpy( p_resume->s_digest, p, 8 );
+			p_resume->s_digest[ 8 ] = '\0';
+		}
+	}
+
+	return realsize;
+}
+
+void _ftp_probe_finish( CURL *p_curl, CURLcode res, ftp_resume *p_resume )
+{
+	curl_off_t remote_size = -1;
+
+	/* a missing file simply means there is nothing to resume */
+	if( res == CURLE_OK )
+	{
+		curl_easy_getinfo( p_curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &remote_size );
+	}
+
+	p_resume->remote_size = remote_size;
+}
+
+/* returns the offset at which the upload should continue */
+curl_off_t _ftp_resume_offset( const ftp_resume *p_resume, FILE *fd_tmp, curl_off_t sent, boolean b_verbose, profiler *p_profiler )
+{
+	curl_off_t local_size = _ftp_file_size( fd_tmp );
+	char s_digest[ FTP_MAX_DIGEST ];
+
+	if( p_resume->remote_size <= 0 || p_resume->remote_size > local_size )
+	{
+		return 0;
+	}
+
+	if( p_resume->s_algorithm[ 0 ] == '\0' )
+	{
+		/* Unverifiable; the remote file is only known to be a prefix of
+		 * this one as far as a failed attempt sent it. Anything else may
+		 * be an older version, which an append would corrupt. */
+		if( p_resume->remote_size < local_size && p_resume->remote_size <= sent )
+		{
+			return p_resume->remote_size;
+		}
+
+		if( b_verbose ) log_warning( "Remote file cannot be verified (no HASH or XCRC), sending it again." );
+		return 0;
+	}
+
+	if( !_ftp_local_digest( fd_tmp, p_resume->remote_size, p_resume->s_algorithm, s_digest, sizeof(s_digest), p_profiler ) ||
+	    strcasecmp( s_digest, p_resume->s_digest ) != 0 )
+	{
+		if( b_verbose ) log_warning( "Remote file does not match the local one (%s), sending it again.", p_resume->s_algorithm );
+		return 0;
+	}
+
+	return p_resume->remote_size;
+}
+
+boolean _ftp_local_digest( FILE *fd_tmp, curl_off_t length, const char *s_algorithm, char *s_digest, size_t size, profiler *p_profiler )
+{
+	byte buffer[ FTP_READ_SIZE ];
+	byte md[ EVP_MAX_MD_SIZE ];
+	uint md_length        = 0;
+	uint crc              = 0;
+	boolean b_crc         = strcasecmp( s_algorithm, "CRC32" ) == 0;
+	const EVP_MD *p_md    = NULL;
+	EVP_MD_CTX *p_context = NULL;
+	char s_name[ 16 ];
+	size_t i, j;
+
+	/* "SHA-256" --> "SHA256" for OpenSSL */
+	for( i = 0, j = 0; s_algorithm[ i ] && j < sizeof(s_name) - 1; i++ )
+	{
+		if( s_algorithm[ i ] != '-' ) s_name[ j++ ] = s_algorithm[ i ];
+	}
+	s_name[ j ] = '\0';
+
+	if( !b_crc )
+	{
+		p_md = EVP_get_digestbyname( s_name );
+
+		if( !p_md || 2 * (size_t) EVP_MD_size( p_md ) + 1 > size )
+		{
+			return FALSE;
+		}
+
+		p_context = EVP_MD_CTX_create( );
+		EVP_DigestInit_ex( p_context, p_md, NULL );
+	}
+
+	fseeko( fd_tmp, 0, SEEK_SET );
+
+	while( length > 0 )
+	{
+		size_t chunk   = length < (curl_off_t) sizeof(buffer) ? (size_t) length : sizeof(buffer);
+		uint64_t begin = profiler_begin( p_profiler );
+		size_t read    = fread( buffer, 1, chunk, fd_tmp );
+
+		profiler_end( p_profiler, PROFILE_READ, begin, read );
+
+		if( read == 0 ) break;
+
+		begin = profiler_begin( p_profiler );
+
+		if( b_crc ) crc = _ftp_crc32( crc, buffer, read );
+		else        EVP_DigestUpdate( p_context, buffer, read );
+
+		profiler_end( p_profiler, PROFILE_HASH, begin, read );
+
+		length -= read;
+	}
+
+	if( b_crc )
+	{
+		snprintf( s_digest, size, "%08X", crc );
+	}
+	else
+	{
+		EVP_DigestFinal_ex( p_context, md, &md_length );
+		EVP_MD_CTX_destroy( p_context );
+
+		for( i = 0; i < md_length; i++ )
+		{
+			snprintf( &s_digest[ 2 * i ], 3, "%02x", md[ i ] );
+		}
+	}
+
+	fseeko( fd_tmp, 0, SEEK_SET );
+
+	return length == 0;
+}
+
+uint _ftp_crc32( uint crc, const byte *buffer, size_t length )
 {
-	char curl_err[ CURL_ERROR_SIZE ];
-	char buffer[ 1024 ];
-	struct curl_slist *headerlist = NULL;
-	FILE *fd_tmp                  = NULL;
-	CURLcode res                  = 0;
-	boolean b_result              = TRUE;
+	static uint table[ 256 ];
+	size_t i;
 
-	assert( p_curl );
-	assert( s_hostname );
-	assert( s_filename );
+	if( table[ 1 ] == 0 )
+	{
+		for( i = 0; i < 256; i++ )
+		{
+			uint c = (uint) i;
+			int k;
+
+			for( k = 0; k < 8; k++ )
+			{
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
 
-	/* open file */
-	fd_tmp = fopen( s_filename, "rb" );
+			table[ i ] = c;
+		}
+	}
 
-	if( !fd_tmp )
+	crc = ~crc;
+
+	for( i = 0; i < length; i++ )
 	{
-		b_result = FALSE;
-		fprintf( stderr, "Cannot open file\n" );
+		crc = table[ (crc ^ buffer[ i ]) & 0xFF ] ^ (crc >> 8);
 	}
 
-	/* prepare url */
+	return ~crc;
+}
+
+curl_off_t _ftp_file_size( FILE *fd_tmp )
+{
+	struct stat info;
+	return fstat( fileno( fd_tmp ), &info ) == 0 ? (curl_off_t) info.st_size : 0;
+}
+
+/*
+ * Listing helpers
+ */
+void _ftp_prepare_list( CURL *p_curl, const char *s_hostname, const char *s_path, ftp_list_parser *p_parser, boolean b_mlsd )
+{
+	char buffer[ 1024 ];
+
+	p_parser->length     = 0;
+	p_parser->b_overflow = FALSE;
+
+	curl_easy_setopt( p_curl, CURLOPT_WRITEFUNCTION, _ftp_list_handle_response );
+	curl_easy_setopt( p_curl, CURLOPT_WRITEDATA, (void *) p_parser );
 
-	if( b_result )
+	/* a custom request replaces LIST on a directory URL */
+	if( b_mlsd )
 	{
-		#ifdef _NO_FILE_STDIO_STREAM
-			curl_easy_setopt( p_curl, CURLOPT_READDATA, fd_tmp ); /* I had no stdio_stream in my FILE structure */
-		#else
-			curl_easy_setopt( p_curl, CURLOPT_READDATA, fd_tmp->stdio_stream ); /*** URGENT: this is for FCGI compatibility, normally is would be fd_tmp only !!! ***/		
-		#endif
-		curl_easy_setopt( p_curl, CURLOPT_ERRORBUFFER, curl_err );
-		curl_easy_setopt( p_curl, CURLOPT_UPLOAD, 1 );
-		curl_easy_setopt( p_curl, CURLOPT_USERAGENT, FTP_USERAGENT );
-		curl_easy_setopt( p_curl, CURLOPT_FTP_FILEMETHOD,	CURLFTPMETHOD_NOCWD );
+		curl_easy_setopt( p_curl, CURLOPT_CUSTOMREQUEST, "MLSD" );
+	}
 
-		/* build URL */
-		{
-			char *s_filename_basename = strrchr( s_filename, '/' ) + 1;//basename( s_filename ); //use the gnu version
+	/* the trailing slash makes it a directory URL */
+	_ftp_build_url( buffer, sizeof(buffer), s_hostname, s_path, "" );
+	if( buffer[ strlen(buffer) - 1 ] != '/' ) strncat( buffer, "/", sizeof(buffer) - strlen(buffer) - 1 );
+	curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
+}
 
-			if( s_username )
-			{
-				assert( s_password );
+/* splits the listing into lines as it arrives; nothing is buffered beyond one line */
+size_t _ftp_list_handle_response( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	register size_t realsize  = size * nmemb;
+	ftp_list_parser *p_parser = (ftp_list_parser *) data;
+	const char *p_data        = (const char *) ptr;
+	size_t i;
 
-				if( s_path )
-				{
-					snprintf( buffer, sizeof(buffer), "ftp://%.64s:%.64s@%.128s/%s/%s", s_username, s_password, s_hostname, s_path, s_filename_basename );
-				}
-				else
-				{
-					snprintf( buffer, sizeof(buffer), "ftp://%.64s:%.64s@%.128s/%s", s_username, s_password, s_hostname, s_filename_basename );
-				}
-			}
-			else
+	for( i = 0; i < realsize; i++ )
+	{
+		char c = p_data[ i ];
+
+		if( c == '\n' )
+		{
+			if( !p_parser->b_overflow )
 			{
-				if( s_path )
-				{
-					snprintf( buffer, sizeof(buffer), "ftp://%.128s/%s/%s", s_hostname, s_path, s_filename_basename );
-				}
-				else
-				{
-					snprintf( buffer, sizeof(buffer), "ftp://%.128s/%s", s_hostname, s_filename_basename );
-				}
+				if( p_parser->length > 0 && p_parser->line[ p_parser->length - 1 ] == '\r' ) p_parser->length--;
+				p_parser->line[ p_parser->length ] = '\0';
+				_ftp_list_parse_line( p_parser->p_inventory, p_parser->line );
 			}
 
-			curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
+			p_parser->length     = 0;
+			p_parser->b_overflow = FALSE;
 		}
+		else if( p_parser->length < sizeof(p_parser->line) - 1 )
+		{
+			p_parser->line[ p_parser->length++ ] = c;
+		}
+		else
+		{
+			p_parser->b_overflow = TRUE; /* absurdly long line, skip it */
+		}
+	}
+
+	return realsize;
+}
+
+void _ftp_list_parse_line( ftp_inventory *p_inventory, char *line )
+{
+	if( *line == '\0' )
+	{
+		return;
+	}
+
+	/* MLSD lines are "fact=value;...; name" */
+	if( !_ftp_list_parse_mlsd( p_inventory, line ) )
+	{
+		_ftp_list_parse_unix( p_inventory, line );
+	}
+}
+
+/* type=file;size=1234;modify=20240101120000; name */
+boolean _ftp_list_parse_mlsd( ftp_inventory *p_inventory, char *line )
+{
+	char *s_name        = strstr( line, "; " );
+	char *s_fact        = line;
+	curl_off_t size     = -1;
+	time_t modified     = 0;
+	boolean b_directory = FALSE;
+
+	if( !s_name || !strchr( line, '=' ) || strchr( line, '=' ) > s_name )
+	{
+		return FALSE;
+	}
 
-		/* assemble headers and add headers to curl request */
+	*s_name = '\0';
+	s_name += 2;
+
+	while( s_fact && *s_fact )
+	{
+		char *s_next = strchr( s_fact, ';' );
+		if( s_next ) *s_next++ = '\0';
+
+		if( strncasecmp( s_fact, "type=", 5 ) == 0 )
 		{
-			/* Add CWD */
+			const char *s_type = s_fact + 5;
+
+			/* the directory itself and its parent */
+			if( strcasecmp( s_type, "cdir" ) == 0 || strcasecmp( s_type, "pdir" ) == 0 )
 			{
-				headerlist = curl_slist_append( headerlist, "CWD /" );
+				return TRUE;
 			}
 
-			curl_easy_setopt( p_curl, CURLOPT_PREQUOTE, headerlist );
+			b_directory = strcasecmp( s_type, "dir" ) == 0;
 		}
-								
-		/* perform request */				
-		res = curl_easy_perform( p_curl );
+		else if( strncasecmp( s_fact, "size=", 5 ) == 0 )
+		{
+			size = (curl_off_t) strtoll( s_fact + 5, NULL, 10 );
+		}
+		else if( strncasecmp( s_fact, "modify=", 7 ) == 0 )
+		{
+			struct tm tm;
 
-		/* cleanup */
-		fclose( fd_tmp );
-		curl_slist_free_all( headerlist );
-		#ifdef _DEBUG
-		headerlist = NULL;
-		#endif
+			memset( &tm, 0, sizeof(tm) );
 
-		if( res != 0 )
-		{
-			b_result = FALSE;
-			fprintf( stderr, "%s:%d: Error performing curl request (host = %.128s res = %d, err = %.1024s).\n", __FUNCTION__, __LINE__, (s_hostname ? s_hostname : "<null>"), res, curl_err );			
-		}	
+			if( sscanf( s_fact + 7, "%4d%2d%2d%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec ) == 6 )
+			{
+				tm.tm_year -= 1900;
+				tm.tm_mon  -= 1;
+				modified    = timegm( &tm );
+			}
+		}
+
+		s_fact = s_next;
 	}
 
-	return b_result;
+	_ftp_inventory_add( p_inventory, s_name, size, modified, b_directory );
+
+	return TRUE;
 }
 
-boolean ftp_delete( CURL *p_curl, const char *s_hostname, const char *s_username, const char *s_password, const char *s_filepath )
+/* -rw-r--r--   1 owner group   1234 Jan 01 12:00 name */
+boolean _ftp_list_parse_unix( ftp_inventory *p_inventory, char *line )
 {
-	char curl_err[ CURL_ERROR_SIZE ];
-	char buffer[ 1024 ];
-	struct curl_slist *headerlist = NULL;
-	CURLcode res                  = 0;
-	FILE *fd_tmp                  = NULL;
-	boolean b_result              = TRUE;
+	static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	char permissions[ 16 ], links[ 16 ], owner[ 64 ], group[ 64 ], month[ 8 ], day[ 8 ], clock[ 8 ];
+	long long size = 0;
+	int offset     = 0;
+	time_t modified = 0;
+	char *s_name;
+
+	if( sscanf( line, "%15s %15s %63s %63s %lld %7s %7s %7s %n", permissions, links, owner, group, &size, month, day, clock, &offset ) < 8 || offset == 0 )
+	{
+		return FALSE; /* "total 42" and formats we do not know */
+	}
 
-	if( b_result /*ec == 0*/ )
+	if( permissions[ 0 ] != '-' && permissions[ 0 ] != 'd' && permissions[ 0 ] != 'l' )
 	{
-		/* open dummy file */
-		fd_tmp = fopen("/dev/null", "wb");		/* do dummy download/list into devnull */
+		return FALSE;
+	}
+
+	s_name = line + offset;
+
+	if( permissions[ 0 ] == 'l' )
+	{
+		char *s_arrow = strstr( s_name, " -> " );
+		if( s_arrow ) *s_arrow = '\0';
+	}
+
+	if( strcmp( s_name, "." ) == 0 || strcmp( s_name, ".." ) == 0 )
+	{
+		return TRUE;
+	}
 
-		#ifdef _NO_FILE_STDIO_STREAM
-			curl_easy_setopt( p_curl, CURLOPT_WRITEDATA, fd_tmp ); /* I had no stdio_stream in my FILE structure */
-		#else
-			curl_easy_setopt( p_curl, CURLOPT_WRITEDATA, fd_tmp->stdio_stream);		/*** URGENT: this is for FCGI compatibility, normally is would be fd_tmp only !!! ***/						
-		#endif
+	/* "Jan 01 12:00" (within the last six months) or "Jan 01 2023" */
+	{
+		const char *p_month = strstr( months, month );
+		struct tm tm;
+		time_t now = time( NULL );
 
-		curl_easy_setopt( p_curl, CURLOPT_ERRORBUFFER, curl_err);								
-		curl_easy_setopt( p_curl, CURLOPT_USERAGENT, FTP_USERAGENT );
-		curl_easy_setopt( p_curl, CURLOPT_UPLOAD, 0 );
-		curl_easy_setopt( p_curl, CURLOPT_FTP_FILEMETHOD, CURLFTPMETHOD_NOCWD );
+		memset( &tm, 0, sizeof(tm) );
 
-		/* build URL */
+		if( p_month && strlen(month) == 3 )
 		{
-			if( s_username )
+			tm.tm_mon  = (int) (p_month - months) / 3;
+			tm.tm_mday = atoi( day );
+
+			if( strchr( clock, ':' ) )
 			{
-				assert( s_password );
-				snprintf( buffer, sizeof(buffer), "ftp://%.64s:%.64s@%.128s/", s_username, s_password, s_hostname );
+				struct tm today;
+
+				gmtime_r( &now, &today ); /* listings may be parsed on several threads */
+				sscanf( clock, "%d:%d", &tm.tm_hour, &tm.tm_min );
+				tm.tm_year = today.tm_year;
+				modified   = timegm( &tm );
+
+				if( modified > now + 86400 )
+				{
+					tm.tm_year--;
+					modified = timegm( &tm );
+				}
 			}
 			else
 			{
-				snprintf( buffer, sizeof(buffer), "ftp://%.128s/", s_hostname );
+				tm.tm_year = atoi( clock ) - 1900;
+				modified   = timegm( &tm );
 			}
+		}
+	}
+
+	_ftp_inventory_add( p_inventory, s_name, (curl_off_t) size, modified, permissions[ 0 ] == 'd' );
+
+	return TRUE;
+}
+
+void _ftp_inventory_add( ftp_inventory *p_inventory, const char *s_name, curl_off_t size, time_t modified, boolean b_directory )
+{
+	ftp_entry entry;
+
+	entry.s_name      = arena_strdup( &p_inventory->names, s_name );
+	entry.size        = size;
+	entry.modified    = modified;
+	entry.b_directory = b_directory;
+	entry.b_seen      = FALSE;
+
+	if( entry.s_name )
+	{
+		vector_push( &p_inventory->entries, &entry );
+		p_inventory->b_sorted = FALSE;
+	}
+}
+
+int _ftp_entry_compare( const void *a, const void *b )
+{
+	assert( a && b );
+	return strcmp( ((const ftp_entry *) a)->s_name, ((const ftp_entry *) b)->s_name );
+}
+
+/*
+ * Sync helpers
+ */
+boolean _ftp_pool_mkdir( ftp_pool *p_pool, const char *s_path )
+{
+	ftp_session *p_session = &p_pool->sessions[ 0 ];
+	char buffer[ FTP_MAX_PATH + 8 ];
+
+	while( *s_path == '/' ) s_path++;
+
+	snprintf( buffer, sizeof(buffer), "MKD /%s", s_path );
+	p_session->p_commands = curl_slist_append( NULL, buffer );
+
+	_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+	_ftp_prepare_commands( p_session->p_curl, p_pool->s_hostname, p_session->p_commands );
+
+	return _ftp_pool_perform( p_pool, p_session ) == 0;
+}
+
+/*
+ * Files of one directory are compared against the remote listing and
+ * the differences are handed to the pool in bulk; subdirectories are
+ * visited afterwards. A file counts as changed when its size differs or
+ * it was modified after the remote copy (when the server reports times).
+ */
+boolean _ftp_pool_sync_directory( ftp_pool *p_pool, const char *s_local_directory, const char *s_remote_path, boolean b_delete, ftp_sync_stats *p_stats )
+{
+	char s_local[ FTP_MAX_PATH ];
+	char s_remote[ FTP_MAX_PATH ];
+	ftp_inventory inventory;
+	vector uploads;          /* local paths */
+	vector deletes;          /* remote paths */
+	vector directories;      /* subdirectory names */
+	arena scratch;
+	boolean b_result = TRUE;
+	struct dirent *p_dirent;
+	DIR *p_directory;
+	size_t i;
+
+	p_directory = opendir( s_local_directory );
 
-			curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
+	if( !p_directory )
+	{
+		if( ftp_pool_is_verbose(p_pool) ) log_error( "Cannot open directory (%s)", s_local_directory );
+		return FALSE;
+	}
+
+	ftp_inventory_create( &inventory );
+	vector_create( &uploads, sizeof(const char *), NULL );
+	vector_create( &deletes, sizeof(const char *), NULL );
+	vector_create( &directories, sizeof(const char *), NULL );
+	arena_create( &scratch, 0 );
+
+	/* a listing that fails on a directory we cannot create either is an error */
+	if( !ftp_pool_list( p_pool, s_remote_path, &inventory ) )
+	{
+		ftp_inventory_clear( &inventory );
+
+		if( !_ftp_pool_mkdir( p_pool, s_remote_path ) )
+		{
+			if( ftp_pool_is_verbose(p_pool) ) log_error( "Cannot list or create remote directory (%s)", s_remote_path );
+			b_result = FALSE;
 		}
+	}
+
+	while( b_result && (p_dirent = readdir( p_directory )) )
+	{
+		struct stat info;
+		ftp_entry *p_entry;
+		const char *s_path;
+		boolean b_link;
+
+		if( strcmp( p_dirent->d_name, "." ) == 0 || strcmp( p_dirent->d_name, ".." ) == 0 ) continue;
+
+		if( (size_t) snprintf( s_local, sizeof(s_local), "%s/%s", s_local_directory, p_dirent->d_name ) >= sizeof(s_local) )
+		{
+			if( ftp_pool_is_verbose(p_pool) ) log_warning( "Skipping %s/%s, the path is too long.", s_local_directory, p_dirent->d_name );
+			continue;
+		}
+
+		if( lstat( s_local, &info ) != 0 ) continue;
 
-		/* assemble headers and add headers to curl request */
+		/* links to files are followed, links to directories are not (as in sync) */
+		b_link = S_ISLNK(info.st_mode);
+
+		if( b_link && stat( s_local, &info ) != 0 ) continue;
+
+		p_entry = ftp_inventory_find( &inventory, p_dirent->d_name );
+
+		if( S_ISDIR(info.st_mode) && !b_link )
+		{
+			const char *s_name = arena_strdup( &scratch, p_dirent->d_name );
+			vector_push( &directories, &s_name );
+			if( p_entry ) p_entry->b_seen = TRUE;
+		}
+		else if( S_ISREG(info.st_mode) )
 		{
-			/* build and add delete header */
+			if( p_entry && !p_entry->b_directory )
 			{
-				if( *s_filepath == '/' )
+				p_entry->b_seen = TRUE;
+
+				if( p_entry->size == (curl_off_t) info.st_size &&
+				    (p_entry->modified == 0 || p_entry->modified >= info.st_mtime) )
 				{
-					snprintf( buffer,	sizeof(buffer), "DELE /%s", s_filepath );
+					p_stats->unchanged++;
+					continue;
 				}
-				else
+			}
+
+			s_path = arena_strdup( &scratch, s_local );
+			vector_push( &uploads, &s_path );
+		}
+	}
+
+	closedir( p_directory );
+
+	if( b_result && !vector_is_empty(&uploads) )
+	{
+		boolean *p_results = (boolean *) arena_alloc( &scratch, vector_size(&uploads) * sizeof(boolean) );
+
+		ftp_pool_upload( p_pool, s_remote_path, (const char **) vector_array(&uploads), vector_size(&uploads), p_results );
+
+		for( i = 0; i < vector_size(&uploads); i++ )
+		{
+			if( p_results[ i ] ) p_stats->uploaded++;
+			else                 p_stats->failed++;
+		}
+	}
+
+	if( b_result && b_delete )
+	{
+		for( i = 0; i < ftp_inventory_size(&inventory); i++ )
+		{
+			ftp_entry *p_entry = ftp_inventory_entry( &inventory, i );
+			const char *s_path;
+
+			if( !p_entry->b_seen && !p_entry->b_directory )
+			{
+				if( (size_t) snprintf( s_remote, sizeof(s_remote), "/%s/%s", s_remote_path, p_entry->s_name ) >= sizeof(s_remote) )
 				{
-					snprintf( buffer,	sizeof(buffer), "DELE %s", s_filepath );
+					if( ftp_pool_is_verbose(p_pool) ) log_warning( "Not deleting %s/%s, the path is too long.", s_remote_path, p_entry->s_name );
+					continue;
 				}
 
-				headerlist = curl_slist_append( headerlist, buffer /* delete header */ );
+				s_path = arena_strdup( &scratch, *s_remote_path ? s_remote : s_remote + 1 );
+				vector_push( &deletes, &s_path );
 			}
+		}
 
-			curl_easy_setopt( p_curl, CURLOPT_POSTQUOTE, headerlist );
+		if( !vector_is_empty(&deletes) )
+		{
+			if( ftp_pool_delete( p_pool, (const char **) vector_array(&deletes), vector_size(&deletes) ) )
+			{
+				p_stats->deleted += vector_size(&deletes);
+			}
+			else
+			{
+				p_stats->failed += vector_size(&deletes);
+			}
 		}
-							
-		/* perform request */				
-		res = curl_easy_perform( p_curl );
+	}
 
-		/* cleanup */
-		curl_slist_free_all( headerlist );
-		#ifdef _DEBUG
-		headerlist = NULL;
-		#endif
+	/* a failing subdirectory does not stop its siblings */
+	for( i = 0; i < vector_size(&directories); i++ )
+	{
+		const char *s_name = *(const char **) vector_element_at( &directories, i );
+
+		/* s_local fitted when the directory was read */
+		snprintf( s_local, sizeof(s_local), "%s/%s", s_local_directory, s_name );
+
+		if( (size_t) snprintf( s_remote, sizeof(s_remote), "%s/%s", s_remote_path, s_name ) >= sizeof(s_remote) )
+		{
+			if( ftp_pool_is_verbose(p_pool) ) log_warning( "Skipping %s, the remote path is too long.", s_local );
+			continue;
+		}
 
-		if( res != 0 && res != 21 ) /* wir ignorieren hier fehler 21, weil wenn file nicht existert, is das wurst. */
+		if( !_ftp_pool_sync_directory( p_pool, s_local, *s_remote_path ? s_remote : s_remote + 1, b_delete, p_stats ) )
 		{
 			b_result = FALSE;
-			fprintf( stderr, "%s:%d: Error performing curl request (host = %.128s res = %d, err = %.1024s).\n", __FUNCTION__, __LINE__, (s_hostname ? s_hostname : "<null>"), res, curl_err );			
 		}
 	}
 
-	fclose( fd_tmp );
+	arena_destroy( &scratch );
+	vector_destroy( &directories );
+	vector_destroy( &deletes );
+	vector_destroy( &uploads );
+	ftp_inventory_destroy( &inventory );
+
+	return b_result;
+}
+
+/*
+ * Session pool helpers
+ */
+boolean _ftp_pool_start( ftp_pool *p_pool, ftp_session *p_session )
+{
+	p_session->b_busy = TRUE;
+
+	if( curl_multi_add_handle( p_pool->p_multi, p_session->p_curl ) != CURLM_OK )
+	{
+		_ftp_pool_finish( p_pool, p_session );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void _ftp_pool_finish( ftp_pool *p_pool, ftp_session *p_session )
+{
+	/* the connection goes back into the multi handle's cache for the next job */
+	curl_multi_remove_handle( p_pool->p_multi, p_session->p_curl );
+
+	if( p_session->p_file )
+	{
+		fclose( p_session->p_file );
+		p_session->p_file = NULL;
+	}
+
+	if( p_session->p_commands )
+	{
+		curl_slist_free_all( p_session->p_commands );
+		p_session->p_commands = NULL;
+	}
+
+	p_session->b_busy    = FALSE;
+	p_session->b_probing = FALSE;
+}
+
+/* turns a finished probe into the (resumed) upload; FALSE when the job is over */
+boolean _ftp_pool_resume( ftp_pool *p_pool, ftp_session *p_session, const char *s_path, const char *s_filename, CURLcode *p_res )
+{
+	curl_off_t offset;
+
+	_ftp_probe_finish( p_session->p_curl, *p_res, &p_session->resume );
+
+	curl_multi_remove_handle( p_pool->p_multi, p_session->p_curl );
+	curl_slist_free_all( p_session->p_commands );
+	p_session->p_commands = NULL;
+	p_session->b_probing  = FALSE;
+
+	offset = _ftp_resume_offset( &p_session->resume, p_session->p_file, p_pool->sent, ftp_pool_is_verbose(p_pool), p_pool->p_profiler );
+	TRACE4( ftp_upload_resume, s_path, s_filename, (int64_t) p_session->resume.remote_size, (int64_t) offset );
+
+	if( offset > 0 && offset >= _ftp_file_size( p_session->p_file ) )
+	{
+		*p_res = CURLE_OK; /* already complete */
+		return FALSE;
+	}
+
+	_ftp_prepare_request( p_session->p_curl, p_pool->s_username[ 0 ] ? p_pool->s_username : NULL, p_pool->s_password, p_session->curl_err );
+	p_session->offset = offset;
+	p_session->length = _ftp_prepare_upload( p_session->p_curl, p_pool->s_hostname, s_path, s_filename, p_session->p_file, offset );
+
+	if( curl_multi_add_handle( p_pool->p_multi, p_session->p_curl ) != CURLM_OK )
+	{
+		*p_res = CURLE_FAILED_INIT;
+		return FALSE;
+	}
+
 	return TRUE;
 }
+
+/*
+ * A failed upload leaves the server with the file up to its offset plus
+ * what it sent, which a retry without HASH/XCRC may continue; a finished
+ * job leaves nothing to continue.
+ */
+void _ftp_pool_record_sent( ftp_pool *p_pool, const ftp_session *p_session, CURLcode res )
+{
+	curl_off_t uploaded = 0;
+
+	if( res == CURLE_OK )
+	{
+		p_pool->sent = 0;
+		return;
+	}
+
+	if( curl_easy_getinfo( p_session->p_curl, CURLINFO_SIZE_UPLOAD_T, &uploaded ) != CURLE_OK )
+	{
+		uploaded = 0;
+	}
+
+	p_pool->sent = p_session->offset + uploaded;
+}
+
+/* runs a single transfer on an idle session to completion */
+CURLcode _ftp_pool_perform( ftp_pool *p_pool, ftp_session *p_session )
+{
+	ftp_session *p_done = NULL;
+	CURLcode res        = CURLE_FAILED_INIT;
+
+	if( !_ftp_pool_start( p_pool, p_session ) )
+	{
+		return res;
+	}
+
+	while( p_done != p_session )
+	{
+		p_done = _ftp_pool_run( p_pool, &res );
+
+		if( !p_done ) break;
+	}
+
+	_ftp_pool_finish( p_pool, p_session );
+
+	return res;
+}
+
+/* drives all active transfers until one of them completes */
+ftp_session* _ftp_pool_run( ftp_pool *p_pool, CURLcode *p_res )
+{
+	int running = 0;
+	int pending = 0;
+	uint i;
+
+	for( ;; )
+	{
+		CURLMsg *p_message;
+
+		curl_multi_perform( p_pool->p_multi, &running );
+
+		while( (p_message = curl_multi_info_read( p_pool->p_multi, &pending )) )
+		{
+			if( p_message->msg != CURLMSG_DONE ) continue;
+
+			for( i = 0; i < p_pool->session_count; i++ )
+			{
+				if( p_pool->sessions[ i ].p_curl == p_message->easy_handle )
+				{
+					*p_res = p_message->data.result;
+					return &p_pool->sessions[ i ];
+				}
+			}
+		}
+
+		if( running == 0 )
+		{
+			return NULL;
+		}
+
+		curl_multi_wait( p_pool->p_multi, NULL, 0, FTP_WAIT_MS, NULL );
+	}
+}
@@ -1,10 +1,113 @@
 #ifndef _FTP_H_
 #define _FTP_H_
 
+#include <stdio.h>
+#include <time.h>
 #include <curl/curl.h>
 #include "types.h"
+#include "arena.h"
+#include "vector.h"
+#include "profile.h"
 
-boolean ftp_upload( CURL *p_curl, const char *s_hostname, const char *s_username, const char *s_password, const char *s_path, const char *s_filename );
-boolean ftp_delete( CURL *p_curl, const char *s_hostname, const char *s_username, const char *s_password, const char *s_filepath );
+#define FTP_MAX_SESSIONS       (16)
+#define FTP_DELETE_BATCH_SIZE  (64)   /* DELE commands sent per transfer */
+#define FTP_MAX_HOSTNAME       (128)
+#define FTP_MAX_CREDENTIAL     (64)
+#define FTP_MAX_DIGEST         (129)  /* hex SHA-512 plus '\0' */
+
+/* a cURL read callback: fills ptr with up to size * nmemb bytes of the upload */
+typedef size_t (*ftp_read_function)( void *ptr, size_t size, size_t nmemb, void *data );
+
+/*
+ * What the server told us about a partially uploaded file: its size
+ * (SIZE) and, when the server supports HASH or XCRC, a digest of it.
+ */
+typedef struct tag_ftp_resume {
+	curl_off_t remote_size;        /* -1 when the file does not exist */
+	char s_algorithm[ 16 ];        /* e.g. "SHA-256", "CRC32"; empty when unverifiable */
+	char s_digest[ FTP_MAX_DIGEST ];
+} ftp_resume;
+
+/*
+ * A logged in control connection. Each session owns a cURL handle that
+ * stays attached to its connection between transfers, so the login is
+ * paid once per session rather than once per file.
+ */
+typedef struct tag_ftp_session {
+	CURL *p_curl;
+	char curl_err[ CURL_ERROR_SIZE ];
+	FILE *p_file;                    /* file being uploaded, if any */
+	struct curl_slist *p_commands;   /* quote commands being sent, if any */
+	size_t job;                      /* index of the current job */
+	size_t job_count;                /* number of jobs covered by the current transfer */
+	curl_off_t offset;               /* where in the file the current upload starts */
+	curl_off_t length;               /* bytes the current upload sends */
+	boolean b_busy;
+	boolean b_probing;               /* asking for SIZE/HASH before a resumed upload */
+	ftp_resume resume;
+} ftp_session;
+
+typedef struct tag_ftp_pool {
+	char s_hostname[ FTP_MAX_HOSTNAME ];
+	char s_username[ FTP_MAX_CREDENTIAL ];
+	char s_password[ FTP_MAX_CREDENTIAL ];
+	boolean b_verbose;
+	boolean b_resume;                /* continue partial remote files instead of re-sending them */
+	curl_off_t sent;                 /* how far into its file the last failed upload got */
+	profiler *p_profiler;            /* resume checksums count as the hash stage, may be NULL */
+	CURLM *p_multi;
+	ftp_session sessions[ FTP_MAX_SESSIONS ];
+	uint session_count;
+} ftp_pool;
+
+/*
+ * Remote directory listing, filled from MLSD (or LIST on servers that
+ * lack it) as the listing streams in. Names live in the arena.
+ */
+typedef struct tag_ftp_entry {
+	const char *s_name;
+	curl_off_t size;
+	time_t modified;        /* UTC, 0 when the server did not say */
+	boolean b_directory;
+	boolean b_seen;         /* sync: matched by a local file */
+} ftp_entry;
+
+typedef struct tag_ftp_inventory {
+	vector entries;
+	arena names;
+	boolean b_sorted;
+} ftp_inventory;
+
+typedef struct tag_ftp_sync_stats {
+	size_t uploaded;
+	size_t unchanged;
+	size_t deleted;
+	size_t failed;
+} ftp_sync_stats;
+
+
+boolean ftp_pool_create  ( ftp_pool *p_pool, const char *s_hostname, const char *s_username, const char *s_password, uint sessions, boolean verbose );
+void    ftp_pool_destroy ( ftp_pool *p_pool );
+/* uploads run in parallel, one per session; p_results (optional) receives per-file outcomes */
+boolean ftp_pool_upload  ( ftp_pool *p_pool, const char *s_path, const char **filenames, size_t count, /*out*/ boolean *p_results );
+/* deletes are batched, FTP_DELETE_BATCH_SIZE DELE commands per transfer */
+boolean ftp_pool_delete  ( ftp_pool *p_pool, const char **filepaths, size_t count );
+/* one upload on the first session, the data coming from read_function (a cURL read callback); s_filename only names the remote file */
+boolean ftp_pool_upload_reader ( ftp_pool *p_pool, const char *s_path, const char *s_filename, ftp_read_function read_function, void *p_data, curl_off_t size );
+
+boolean          ftp_inventory_create  ( ftp_inventory *p_inventory );
+void             ftp_inventory_destroy ( ftp_inventory *p_inventory );
+void             ftp_inventory_clear   ( ftp_inventory *p_inventory );
+ftp_entry*       ftp_inventory_find    ( ftp_inventory *p_inventory, const char *s_name );
+#define          ftp_inventory_size( p_inventory )         (vector_size(&(p_inventory)->entries))
+#define          ftp_inventory_entry( p_inventory, i )     ((ftp_entry *) vector_element_at( &(p_inventory)->entries, (i) ))
+
+boolean ftp_pool_list ( ftp_pool *p_pool, const char *s_path, /*out*/ ftp_inventory *p_inventory );
+/* uploads new and changed files under s_local_directory, optionally deleting remote files that are gone locally */
+boolean ftp_pool_sync ( ftp_pool *p_pool, const char *s_local_directory, const char *s_remote_path, boolean b_delete, /*out*/ ftp_sync_stats *p_stats );
+
+#define ftp_pool_is_verbose( p_pool )           ((p_pool)->b_verbose)
+#define ftp_pool_set_resume( p_pool, resume )   ((p_pool)->b_resume = (resume))
+#define ftp_pool_set_profiler( p_pool, p_prof ) ((p_pool)->p_profiler = (p_prof))
 
 #endif /* _FTP_H_ */
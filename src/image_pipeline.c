@@ -0,0 +1,323 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "image_pipeline.h"
+#include "log.h"
+
+/* shared by the workers of one image_pipeline_run() */
+typedef struct tag_image_pipeline_run {
+	const image_pipeline *p_pipeline;
+	const char **filenames;
+	boolean *p_results;
+	size_t count;
+	size_t next;
+	boolean b_result;
+	pthread_mutex_t lock;
+} image_pipeline_run_state;
+
+typedef struct tag_image_pipeline_worker {
+	image_pipeline_run_state *p_run;
+	uint index;
+} image_pipeline_worker;
+
+static void*   _image_pipeline_worker   ( void *data );
+static boolean _image_pipeline_process  ( const image_pipeline *p_pipeline, uint worker, const char *s_filename );
+static boolean _image_pipeline_derive   ( const Image *p_source, const image_derivative *p_derivative, /*out*/ Image **p_p_result );
+static void    _image_pipeline_decode_size ( const image_pipeline *p_pipeline, /*out*/ uint *p_width, /*out*/ uint *p_height );
+
+
+boolean image_pipeline_run( const image_pipeline *p_pipeline, const char **filenames, size_t count, boolean *p_results )
+{
+	pthread_t threads[ IMAGE_PIPELINE_MAX_WORKERS ];
+	image_pipeline_worker workers[ IMAGE_PIPELINE_MAX_WORKERS ];
+	image_pipeline_run_state run;
+	uint worker_count;
+	uint i;
+
+	assert( p_pipeline );
+	assert( p_pipeline->sink );
+	assert( filenames || count == 0 );
+
+	run.p_pipeline = p_pipeline;
+	run.filenames  = filenames;
+	run.p_results  = p_results;
+	run.count      = count;
+	run.next       = 0;
+	run.b_result   = TRUE;
+	pthread_mutex_init( &run.lock, NULL );
+
+	worker_count = p_pipeline->worker_count;
+	if( worker_count < 1 ) worker_count = 1;
+	if( worker_count > IMAGE_PIPELINE_MAX_WORKERS ) worker_count = IMAGE_PIPELINE_MAX_WORKERS;
+	if( worker_count > count ) worker_count = (uint) count;
+
+	for( i = 0; i < worker_count; i++ )
+	{
+		workers[ i ].p_run = &run;
+		workers[ i ].index = i;
+
+		if( pthread_create( &threads[ i ], NULL, _image_pipeline_worker, &workers[ i ] ) != 0 )
+		{
+			break;
+		}
+	}
+
+	if( i == 0 && count > 0 )
+	{
+		workers[ 0 ].p_run = &run;
+		workers[ 0 ].index = 0;
+		_image_pipeline_worker( &workers[ 0 ] );
+	}
+
+	while( i > 0 )
+	{
+		pthread_join( threads[ --i ], NULL );
+	}
+
+	pthread_mutex_destroy( &run.lock );
+
+	return run.b_result;
+}
+
+boolean image_s3_sink_create( image_s3_sink *p_sink, const S3 *p_s3, const char *s_bucket, const char *s_prefix, uint worker_count )
+{
+	uint i;
+
+	assert( p_sink );
+	assert( p_s3 );
+	assert( s_bucket );
+
+	memset( p_sink, 0, sizeof(image_s3_sink) );
+	p_sink->p_s3     = p_s3;
+	p_sink->s_bucket = s_bucket;
+	p_sink->s_prefix = s_prefix;
+
+	if( worker_count > IMAGE_PIPELINE_MAX_WORKERS ) worker_count = IMAGE_PIPELINE_MAX_WORKERS;
+
+	/* cURL handles must not be shared between threads */
+	for( i = 0; i < worker_count; i++ )
+	{
+		p_sink->handles[ i ] = curl_easy_init( );
+
+		if( !p_sink->handles[ i ] )
+		{
+			image_s3_sink_destroy( p_sink );
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+void image_s3_sink_destroy( image_s3_sink *p_sink )
+{
+	uint i;
+
+	assert( p_sink );
+
+	for( i = 0; i < IMAGE_PIPELINE_MAX_WORKERS; i++ )
+	{
+		if( p_sink->handles[ i ] )
+		{
+			curl_easy_cleanup( p_sink->handles[ i ] );
+			p_sink->handles[ i ] = NULL;
+		}
+	}
+}
+
+boolean image_s3_sink_put( void *data, uint worker, const char *s_filename, const image_derivative *p_derivative,
+                           const byte *p_blob, size_t length, const char *s_mime_type )
+{
+	image_s3_sink *p_sink = (image_s3_sink *) data;
+	const char *s_name    = strrchr( s_filename, '/' ) ? strrchr( s_filename, '/' ) + 1 : s_filename;
+	char s_key[ 1024 ];
+
+	assert( p_sink );
+	assert( worker < IMAGE_PIPELINE_MAX_WORKERS && p_sink->handles[ worker ] );
+
+	if( p_sink->s_prefix && *p_sink->s_prefix )
+	{
+		snprintf( s_key, sizeof(s_key), "%s/%s/%s", p_sink->s_prefix, p_derivative->s_name, s_name );
+	}
+	else
+	{
+		snprintf( s_key, sizeof(s_key), "%s/%s", p_derivative->s_name, s_name );
+	}
+
+	return s3_put_buffer( p_sink->handles[ worker ], p_sink->p_s3, p_sink->s_bucket, s_key, p_blob, length, s_mime_type, NULL );
+}
+
+void* _image_pipeline_worker( void *data )
+{
+	image_pipeline_worker *p_worker = (image_pipeline_worker *) data;
+	image_pipeline_run_state *p_run = p_worker->p_run;
+
+	for( ;; )
+	{
+		size_t job;
+		boolean b_result;
+
+		pthread_mutex_lock( &p_run->lock );
+		job = p_run->next < p_run->count ? p_run->next++ : p_run->count;
+		pthread_mutex_unlock( &p_run->lock );
+
+		if( job >= p_run->count )
+		{
+			break;
+		}
+
+		b_result = _image_pipeline_process( p_run->p_pipeline, p_worker->index, p_run->filenames[ job ] );
+
+		if( p_run->p_results ) p_run->p_results[ job ] = b_result;
+
+		if( !b_result )
+		{
+			pthread_mutex_lock( &p_run->lock );
+			p_run->b_result = FALSE;
+			pthread_mutex_unlock( &p_run->lock );
+		}
+	}
+
+	return NULL;
+}
+
+/* one decode, then every derivative is built, encoded in memory and handed over */
+boolean _image_pipeline_process( const image_pipeline *p_pipeline, uint worker, const char *s_filename )
+{
+	Image *p_source  = NULL;
+	boolean b_result = TRUE;
+	uint width;
+	uint height;
+	size_t i;
+
+	_image_pipeline_decode_size( p_pipeline, &width, &height );
+
+	if( !simple_image_load_at_size( s_filename, strlen(s_filename), width, height, &p_source ) || !p_source )
+	{
+		if( p_pipeline->b_verbose ) log_error( "Cannot decode image (%s)", s_filename );
+		return FALSE;
+	}
+
+	for( i = 0; i < p_pipeline->derivative_count; i++ )
+	{
+		const image_derivative *p_derivative = &p_pipeline->derivatives[ i ];
+		Image *p_image = NULL;
+		byte *p_blob   = NULL;
+		size_t length  = 0;
+		char *s_mime   = NULL;
+
+		if( !_image_pipeline_derive( p_source, p_derivative, &p_image ) ||
+		    !simple_image_to_blob( p_image, p_derivative->s_format, p_derivative->quality, &p_blob, &length ) )
+		{
+			if( p_pipeline->b_verbose ) log_error( "Cannot create %s of %s", p_derivative->s_name, s_filename );
+			if( p_image ) simple_image_destroy( p_image );
+			b_result = FALSE;
+			continue;
+		}
+
+		s_mime = MagickToMime( simple_image_format( p_image ) );
+
+		if( !p_pipeline->sink( p_pipeline->sink_data, worker, s_filename, p_derivative, p_blob, length, s_mime ? s_mime : "application/octet-stream" ) )
+		{
+			b_result = FALSE;
+		}
+
+		if( s_mime ) RelinquishMagickMemory( s_mime );
+		simple_image_free_blob( p_blob );
+		simple_image_destroy( p_image );
+	}
+
+	simple_image_destroy( p_source );
+
+	return b_result;
+}
+
+boolean _image_pipeline_derive( const Image *p_source, const image_derivative *p_derivative, Image **p_p_result )
+{
+	Image *p_current = NULL;
+	Image *p_next    = NULL;
+
+	*p_p_result = NULL;
+
+	if( p_derivative->crop_width > 0 && p_derivative->crop_height > 0 )
+	{
+		if( !simple_image_crop( p_source, p_derivative->crop_x, p_derivative->crop_y, p_derivative->crop_width, p_derivative->crop_height, &p_current ) )
+		{
+			return FALSE;
+		}
+	}
+
+	if( p_derivative->width > 0 || p_derivative->height > 0 )
+	{
+		const Image *p_input = p_current ? p_current : p_source;
+		double scale_x = p_derivative->width  ? (double) p_derivative->width  / p_input->columns : 0.0;
+		double scale_y = p_derivative->height ? (double) p_derivative->height / p_input->rows    : 0.0;
+		double scale;
+		uint width;
+		uint height;
+
+		/* fit inside the box, keeping the aspect ratio */
+		if( scale_x > 0.0 && scale_y > 0.0 ) scale = scale_x < scale_y ? scale_x : scale_y;
+		else                                 scale = scale_x > 0.0 ? scale_x : scale_y;
+
+		width  = (uint) (p_input->columns * scale + 0.5);
+		height = (uint) (p_input->rows * scale + 0.5);
+
+		if( !simple_image_resize( p_input, width > 0 ? width : 1, height > 0 ? height : 1, &p_next ) )
+		{
+			if( p_current ) simple_image_destroy( p_current );
+			return FALSE;
+		}
+
+		if( p_current ) simple_image_destroy( p_current );
+		p_current = p_next;
+	}
+
+	/* the source is shared by all derivatives and must stay untouched */
+	if( !p_current && !simple_image_clone( p_source, &p_current ) )
+	{
+		return FALSE;
+	}
+
+	if( p_derivative->b_strip )
+	{
+		simple_image_strip_image( p_current );
+	}
+
+	*p_p_result = p_current;
+
+	return TRUE;
+}
+
+/*
+ * Smallest decode size that still serves every derivative, or 0x0 when
+ * one of them needs the full resolution (crops use source coordinates).
+ */
+void _image_pipeline_decode_size( const image_pipeline *p_pipeline, uint *p_width, uint *p_height )
+{
+	boolean b_proportional = FALSE;
+	size_t i;
+
+	*p_width  = 0;
+	*p_height = 0;
+
+	for( i = 0; i < p_pipeline->derivative_count; i++ )
+	{
+		const image_derivative *p_derivative = &p_pipeline->derivatives[ i ];
+
+		if( p_derivative->crop_width > 0 || p_derivative->width == 0 )
+		{
+			*p_width  = 0;
+			*p_height = 0;
+			return;
+		}
+
+		if( p_derivative->width > *p_width ) *p_width = p_derivative->width;
+		if( p_derivative->height > *p_height ) *p_height = p_derivative->height;
+		if( p_derivative->height == 0 ) b_proportional = TRUE;
+	}
+
+	/* a width-only hint already bounds the height proportionally */
+	if( b_proportional ) *p_height = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _IMAGE_PIPELINE_H_
+#define _IMAGE_PIPELINE_H_
+
+#include <curl/curl.h>
+#include "types.h"
+#include "simple_image.h"
+#include "s3.h"
+
+#define IMAGE_PIPELINE_MAX_WORKERS   (32)
+
+/*
+ * One output produced from every source image. Operations are applied
+ * in the order crop, resize, strip.
+ */
+typedef struct tag_image_derivative {
+	const char *s_name;          /* e.g. "thumbnail"; becomes part of the key */
+	uint width;                  /* resize to fit in width x height, 0 = proportional */
+	uint height;                 /* (both 0 = no resize) */
+	uint crop_x;
+	uint crop_y;
+	uint crop_width;             /* 0 = no crop */
+	uint crop_height;
+	boolean b_strip;             /* drop EXIF, ICC and comments */
+	const char *s_format;        /* e.g. "JPEG", NULL keeps the source format */
+	uint quality;                /* 0 = encoder default */
+} image_derivative;
+
+/*
+ * Receives each encoded derivative. It runs on the worker that produced
+ * it, identified by worker (0 .. worker_count - 1), and must not keep
+ * p_blob after returning.
+ */
+typedef boolean (*image_pipeline_sink)( void *data, uint worker, const char *s_filename, const image_derivative *p_derivative,
+                                        const byte *p_blob, size_t length, const char *s_mime_type );
+
+typedef struct tag_image_pipeline {
+	const image_derivative *derivatives;
+	size_t derivative_count;
+	uint worker_count;
+	image_pipeline_sink sink;
+	void *sink_data;
+	boolean b_verbose;
+} image_pipeline;
+
+/* decodes every file once and hands all of its derivatives to the sink; p_results (optional) is per file */
+boolean image_pipeline_run( const image_pipeline *p_pipeline, const char **filenames, size_t count, /*out*/ boolean *p_results );
+
+/*
+ * Ready made sink that uploads every derivative straight from memory
+ * to <bucket>/<prefix>/<derivative name>/<file name>.
+ */
+typedef struct tag_image_s3_sink {
+	const S3 *p_s3;
+	const char *s_bucket;
+	const char *s_prefix;        /* may be NULL */
+	CURL *handles[ IMAGE_PIPELINE_MAX_WORKERS ];   /* one per worker */
+} image_s3_sink;
+
+boolean image_s3_sink_create  ( image_s3_sink *p_sink, const S3 *p_s3, const char *s_bucket, const char *s_prefix, uint worker_count );
+void    image_s3_sink_destroy ( image_s3_sink *p_sink );
+boolean image_s3_sink_put     ( void *data, uint worker, const char *s_filename, const image_derivative *p_derivative,
+                                const byte *p_blob, size_t length, const char *s_mime_type );
+
+#endif /* _IMAGE_PIPELINE_H_ */
@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "intern.h"
+
+static uint    intern_hash  ( const char *s_string, size_t length );
+static boolean intern_grow  ( intern_table *p_table );
+
+
+boolean intern_create( intern_table *p_table, arena *p_arena )
+{
+	assert( p_table );
+	assert( p_arena );
+
+	p_table->p_arena  = p_arena;
+	p_table->capacity = INTERN_INITIAL_CAPACITY;
+	p_table->size     = 0;
+	p_table->entries  = (intern_entry *) calloc( p_table->capacity, sizeof(intern_entry) );
+
+	return p_table->entries != NULL;
+}
+
+void intern_destroy( intern_table *p_table )
+{
+	assert( p_table );
+
+	/* the strings themselves belong to the arena */
+	free( p_table->entries );
+
+	#ifdef _DEBUG
+	p_table->p_arena  = NULL;
+	p_table->entries  = NULL;
+	p_table->capacity = 0;
+	p_table->size     = 0;
+	#endif
+}
+
+const char* intern_string( intern_table *p_table, const char *s_string )
+{
+	assert( s_string );
+	return intern_string_n( p_table, s_string, strlen(s_string) );
+}
+
+const char* intern_string_n( intern_table *p_table, const char *s_string, size_t length )
+{
+	uint hash;
+	size_t mask;
+	size_t i;
+
+	assert( p_table );
+	assert( s_string );
+
+	/* keep the load factor under 3/4 */
+	if( 4 * (p_table->size + 1) > 3 * p_table->capacity )
+	{
+		if( !intern_grow( p_table ) )
+		{
+			return NULL;
+		}
+	}
+
+	hash = intern_hash( s_string, length );
+	mask = p_table->capacity - 1;
+
+	/* linear probing */
+	for( i = hash & mask; p_table->entries[ i ].s_string; i = (i + 1) & mask )
+	{
+		intern_entry *p_entry = &p_table->entries[ i ];
+
+		if( p_entry->hash == hash && p_entry->length == length &&
+		    memcmp( p_entry->s_string, s_string, length ) == 0 )
+		{
+			return p_entry->s_string;
+		}
+	}
+
+	const char *s_copy = arena_strndup( p_table->p_arena, s_string, length );
+
+	if( s_copy )
+	{
+		p_table->entries[ i ].hash     = hash;
+		p_table->entries[ i ].length   = (uint) length;
+		p_table->entries[ i ].s_string = s_copy;
+		p_table->size++;
+	}
+
+	return s_copy;
+}
+
+/* FNV-1a */
+uint intern_hash( const char *s_string, size_t length )
+{
+	uint hash = 2166136261u;
+	size_t i;
+
+	for( i = 0; i < length; i++ )
+	{
+		hash ^= (byte) s_string[ i ];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+boolean intern_grow( intern_table *p_table )
+{
+	size_t new_capacity     = 2 * p_table->capacity;
+	size_t mask             = new_capacity - 1;
+	intern_entry *p_entries = (intern_entry *) calloc( new_capacity, sizeof(intern_entry) );
+	size_t i;
+
+	if( !p_entries )
+	{
+		return FALSE;
+	}
+
+	for( i = 0; i < p_table->capacity; i++ )
+	{
+		intern_entry *p_entry = &p_table->entries[ i ];
+
+		if( p_entry->s_string )
+		{
+			size_t j = p_entry->hash & mask;
+
+			while( p_entries[ j ].s_string )
+			{
+				j = (j + 1) & mask;
+			}
+
+			p_entries[ j ] = *p_entry;
+		}
+	}
+
+	free( p_table->entries );
+	p_table->entries  = p_entries;
+	p_table->capacity = new_capacity;
+
+	return TRUE;
+}
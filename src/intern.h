@@ -0,0 +1,36 @@
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+#include "types.h"
+#include "arena.h"
+
+/*
+ * String interning table. Every distinct string is stored exactly once
+ * in the backing arena, so equal strings share one pointer and can be
+ * compared with ==. The table never frees strings; they live as long as
+ * the arena does.
+ */
+#define INTERN_INITIAL_CAPACITY    (256) /* must be a power of 2 */
+
+typedef struct tag_intern_entry {
+	uint hash;
+	uint length;
+	const char *s_string;
+} intern_entry;
+
+typedef struct tag_intern_table {
+	arena *p_arena;
+	intern_entry *entries;
+	size_t capacity;
+	size_t size;
+} intern_table;
+
+boolean     intern_create      ( intern_table *p_table, arena *p_arena );
+void        intern_destroy     ( intern_table *p_table );
+const char* intern_string      ( intern_table *p_table, const char *s_string );
+const char* intern_string_n    ( intern_table *p_table, const char *s_string, size_t length );
+
+#define intern_size( p_table )    ((p_table)->size)
+
+#endif /* _INTERN_H_ */
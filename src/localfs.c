@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+#include "localfs.h"
+#include "log.h"
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define _LOCALFS_HAVE_COPY_FILE_RANGE
+#endif
+
+#define LOCALFS_CHUNK_SIZE   (8 * 1024 * 1024)
+#define LOCALFS_BUFFER_SIZE  (64 * 1024)
+
+static boolean _localfs_path         ( const LocalFS *p_fs, const char *s_bucket, const char *s_key, /*out*/ char *s_path, size_t size );
+static boolean _localfs_make_parents ( char *s_path );
+static boolean _localfs_copy         ( int fd_in, int fd_out, off_t size );
+
+
+void localfs_initialize( LocalFS *p_fs, const char *s_root, boolean verbose )
+{
+	assert( p_fs );
+	assert( s_root );
+
+	strncpy( p_fs->s_root, s_root, sizeof(p_fs->s_root) );
+	p_fs->s_root[ sizeof(p_fs->s_root) - 1 ] = '\0';
+	p_fs->b_verbose  = verbose;
+	p_fs->p_profiler = NULL;
+}
+
+boolean localfs_list_buckets( const LocalFS *p_fs )
+{
+	char s_path[ LOCALFS_MAX_PATH ];
+	struct dirent *p_dirent;
+	DIR *p_directory;
+	int count = 0;
+
+	assert( p_fs );
+
+	p_directory = opendir( p_fs->s_root );
+
+	if( !p_directory )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Cannot open %s (%s).", p_fs->s_root, strerror(errno) );
+		return FALSE;
+	}
+
+	while( (p_dirent = readdir( p_directory )) )
+	{
+		struct stat info;
+		char s_date[ 32 ];
+		struct tm created;
+
+		if( p_dirent->d_name[ 0 ] == '.' ) continue;
+
+		snprintf( s_path, sizeof(s_path), "%s/%s", p_fs->s_root, p_dirent->d_name );
+
+		if( stat( s_path, &info ) != 0 || !S_ISDIR(info.st_mode) ) continue;
+
+		if( count++ == 0 )
+		{
+			fprintf( stdout, "%-20s %-20s\n", "Bucket Name", "Created On" );
+			fprintf( stdout, "----------------------------------------------\n" );
+		}
+
+		gmtime_r( &info.st_mtime, &created );
+		strftime( s_date, sizeof(s_date), "%Y-%m-%dT%H:%M:%S", &created );
+		fprintf( stdout, "%-20s %-20s\n", p_dirent->d_name, s_date );
+	}
+
+	closedir( p_directory );
+
+	if( count == 0 )
+	{
+		/* no buckets */
+		fprintf( stdout, "No buckets exist.\n" );
+	}
+
+	return TRUE;
+}
+
+/*
+ * The data goes to a temporary file next to the destination, which is
+ * renamed over it once complete, so readers never see a partial copy.
+ */
+boolean localfs_put_file( const LocalFS *p_fs, const char *s_bucket, const char *s_key, const char *s_filename )
+{
+	char s_path[ LOCALFS_MAX_PATH ];
+	char s_temporary[ LOCALFS_MAX_PATH + 16 ];
+	struct stat info;
+	int fd_in        = -1;
+	int fd_out       = -1;
+	boolean b_result = TRUE;
+	uint64_t begin;
+
+	assert( p_fs );
+	assert( s_bucket && *s_bucket );
+	assert( s_key && *s_key );
+	assert( s_filename );
+
+	if( !_localfs_path( p_fs, s_bucket, s_key, s_path, sizeof(s_path) ) )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Bad key." );
+		return FALSE;
+	}
+
+	/* open file */
+	fd_in = open( s_filename, O_RDONLY );
+
+	if( fd_in < 0 || fstat( fd_in, &info ) != 0 )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Cannot open file" );
+		if( fd_in >= 0 ) close( fd_in );
+		return FALSE;
+	}
+
+	snprintf( s_temporary, sizeof(s_temporary), "%s.XXXXXX", s_path );
+
+	if( !_localfs_make_parents( s_temporary ) || (fd_out = mkstemp( s_temporary )) < 0 )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Cannot create %s (%s).", s_temporary, strerror(errno) );
+		close( fd_in );
+		return FALSE;
+	}
+
+	begin = profiler_begin( p_fs->p_profiler );
+
+	if( !_localfs_copy( fd_in, fd_out, info.st_size ) )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Error copying %s (%s).", s_filename, strerror(errno) );
+		b_result = FALSE;
+	}
+
+	/* the kernel reads and writes in one go, so the whole copy is one stage */
+	profiler_end( p_fs->p_profiler, PROFILE_SEND, begin, b_result ? (uint64_t) info.st_size : 0 );
+
+	if( b_result )
+	{
+		struct timespec times[ 2 ];
+
+		/* keep the source's permissions and modification time */
+		times[ 0 ] = info.st_atim;
+		times[ 1 ] = info.st_mtim;
+		fchmod( fd_out, info.st_mode & 07777 );
+		futimens( fd_out, times );
+	}
+
+	if( close( fd_out ) != 0 )
+	{
+		b_result = FALSE;
+	}
+
+	close( fd_in );
+
+	if( b_result && rename( s_temporary, s_path ) != 0 )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Cannot rename %s (%s).", s_temporary, strerror(errno) );
+		b_result = FALSE;
+	}
+
+	if( !b_result )
+	{
+		unlink( s_temporary );
+	}
+
+	return b_result;
+}
+
+boolean localfs_delete_file( const LocalFS *p_fs, const char *s_bucket, const char *s_key )
+{
+	char s_path[ LOCALFS_MAX_PATH ];
+
+	assert( p_fs );
+	assert( s_bucket && *s_bucket );
+	assert( s_key && *s_key );
+
+	if( !_localfs_path( p_fs, s_bucket, s_key, s_path, sizeof(s_path) ) )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Bad key." );
+		return FALSE;
+	}
+
+	/* like S3, deleting something that is not there is not an error */
+	if( unlink( s_path ) != 0 && errno != ENOENT )
+	{
+		if( localfs_is_verbose(p_fs) ) log_error( "Cannot delete %s (%s).", s_path, strerror(errno) );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean _localfs_path( const LocalFS *p_fs, const char *s_bucket, const char *s_key, char *s_path, size_t size )
+{
+	const char *s_segment;
+
+	/* keys must stay inside the bucket: no ".." anywhere between slashes */
+	for( s_segment = s_key; s_segment; s_segment = strchr( s_segment, '/' ) ? strchr( s_segment, '/' ) + 1 : NULL )
+	{
+		if( s_segment[ 0 ] == '.' && s_segment[ 1 ] == '.' && (s_segment[ 2 ] == '/' || s_segment[ 2 ] == '\0') )
+		{
+			return FALSE;
+		}
+	}
+
+	if( strstr( s_bucket, ".." ) || strchr( s_bucket, '/' ) )
+	{
+		return FALSE;
+	}
+
+	while( *s_key == '/' ) s_key++;
+
+	return *s_key && snprintf( s_path, size, "%s/%s/%s", p_fs->s_root, s_bucket, s_key ) < (int) size;
+}
+
+/* mkdir -p for everything before the last '/' */
+boolean _localfs_make_parents( char *s_path )
+{
+	char *p_slash = s_path;
+
+	while( (p_slash = strchr( p_slash + 1, '/' )) )
+	{
+		*p_slash = '\0';
+
+		if( mkdir( s_path, 0755 ) != 0 && errno != EEXIST )
+		{
+			*p_slash = '/';
+			return FALSE;
+		}
+
+		*p_slash = '/';
+	}
+
+	return TRUE;
+}
+
+/*
+ * Cheapest first: a reflink shares the source's extents (XFS, btrfs),
+ * copy_file_range() lets the kernel or the NFS server do the copy, and
+ * sendfile() at least avoids the trip through user space. A plain
+ * read/write loop is the last resort.
+ */
+boolean _localfs_copy( int fd_in, int fd_out, off_t size )
+{
+	off_t copied = 0;
+
+	#ifdef FICLONE
+	if( ioctl( fd_out, FICLONE, fd_in ) == 0 )
+	{
+		return TRUE;
+	}
+	#endif
+
+	#ifdef _LOCALFS_HAVE_COPY_FILE_RANGE
+	while( copied < size )
+	{
+		size_t chunk  = size - copied > LOCALFS_CHUNK_SIZE ? LOCALFS_CHUNK_SIZE : (size_t) (size - copied);
+		ssize_t bytes = copy_file_range( fd_in, NULL, fd_out, NULL, chunk, 0 );
+
+		if( bytes <= 0 )
+		{
+			if( bytes < 0 && errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP )
+			{
+				return FALSE;
+			}
+
+			break; /* not supported here; continue below from where we are */
+		}
+
+		copied += bytes;
+	}
+	#endif
+
+	#ifdef __linux__
+	while( copied < size )
+	{
+		size_t chunk  = size - copied > LOCALFS_CHUNK_SIZE ? LOCALFS_CHUNK_SIZE : (size_t) (size - copied);
+		ssize_t bytes = sendfile( fd_out, fd_in, &copied, chunk );
+
+		if( bytes <= 0 )
+		{
+			if( bytes < 0 && errno != EINVAL && errno != ENOSYS )
+			{
+				return FALSE;
+			}
+
+			break;
+		}
+	}
+	#endif
+
+	if( copied < size )
+	{
+		char buffer[ LOCALFS_BUFFER_SIZE ];
+
+		if( lseek( fd_in, copied, SEEK_SET ) < 0 || lseek( fd_out, copied, SEEK_SET ) < 0 )
+		{
+			return FALSE;
+		}
+
+		while( copied < size )
+		{
+			ssize_t bytes = read( fd_in, buffer, sizeof(buffer) );
+			ssize_t written = 0;
+
+			if( bytes <= 0 )
+			{
+				return FALSE;
+			}
+
+			while( written < bytes )
+			{
+				ssize_t n = write( fd_out, buffer + written, bytes - written );
+				if( n < 0 ) return FALSE;
+				written += n;
+			}
+
+			copied += bytes;
+		}
+	}
+
+	return TRUE;
+}
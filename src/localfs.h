@@ -0,0 +1,28 @@
+#ifndef _LOCALFS_H_
+#define _LOCALFS_H_
+
+#include <stdio.h>
+#include "types.h"
+#include "profile.h"
+
+/*
+ * Local (or NFS mounted) directory as a backup target. Buckets are the
+ * directories directly below the root and keys are paths below those,
+ * mirroring the S3 layout.
+ */
+typedef struct sLocalFS {
+	char s_root[ 512 ];
+	boolean b_verbose;
+	profiler *p_profiler;   /* copies count as the send stage, may be NULL */
+} LocalFS;
+
+#define LOCALFS_MAX_PATH        (1024)
+
+#define localfs_is_verbose( p_fs ) ( (p_fs)->b_verbose )
+#define localfs_set_profiler( p_fs, p_prof )   ((p_fs)->p_profiler = (p_prof))
+void    localfs_initialize   ( LocalFS *p_fs, const char *s_root, boolean verbose );
+boolean localfs_list_buckets ( const LocalFS *p_fs );
+boolean localfs_put_file     ( const LocalFS *p_fs, const char *s_bucket, const char *s_key, const char *s_filename );
+boolean localfs_delete_file  ( const LocalFS *p_fs, const char *s_bucket, const char *s_key );
+
+#endif /* _LOCALFS_H_ */
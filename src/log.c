@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include "log.h"
+
+#define LOG_BATCH           (512)
+#define LOG_INTERVAL_MS     (20)    /* how long the writer sleeps when there was nothing to write */
+#define LOG_BUSY_MS         (1)     /* and when there was */
+#define LOG_CACHE_LINE      (64)
+
+/* single producer (the owning thread), single consumer (the writer) */
+typedef struct tag_log_ring {
+	struct tag_log_ring *p_next; /* the registry only grows */
+	boolean b_owned;             /* a live thread writes here */
+	uint16_t thread;
+	uint64_t dropped;
+	char pad0[ LOG_CACHE_LINE ];
+	uint64_t head;               /* written by the producer */
+	char pad1[ LOG_CACHE_LINE - sizeof(uint64_t) ];
+	uint64_t tail;               /* written by the consumer */
+	char pad2[ LOG_CACHE_LINE - sizeof(uint64_t) ];
+	log_record records[ LOG_RING_SIZE ];
+} log_ring;
+
+int log_threshold = LOG_INFO;
+
+static log_ring *p_rings            = NULL;
+static uint16_t ring_count          = 0;
+static __thread log_ring *p_thread_ring = NULL;
+static pthread_once_t key_once      = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+
+static log_format output_format     = LOG_TEXT;
+static boolean b_running            = FALSE;
+static boolean b_stopping           = FALSE;
+static uint64_t flush_requested     = 0;
+static uint64_t flush_completed     = 0;
+static uint64_t dropped_reported    = 0;
+static pthread_t writer;
+static pthread_mutex_t lock         = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake          = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t flushed       = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t direct_lock  = PTHREAD_MUTEX_INITIALIZER;
+
+static void      _log_key_create    ( void );
+static void      _log_ring_release  ( void *data );
+static log_ring* _log_ring_claim    ( void );
+static void      _log_fill          ( log_record *p_record, log_level level, const char *s_function, int line, const char *s_format, va_list args );
+static size_t    _log_collect       ( log_record *p_batch, size_t capacity );
+static int       _log_compare       ( const void *p_left, const void *p_right );
+static void      _log_write         ( const log_record *p_record );
+static void      _log_write_json_string ( FILE *p_output, const char *s_string, size_t length );
+static void*     _log_writer        ( void *data );
+
+
+boolean log_start( log_format format )
+{
+	pthread_mutex_lock( &lock );
+
+	if( !b_running )
+	{
+		output_format = format;
+		b_stopping    = FALSE;
+		__atomic_store_n( &b_running, pthread_create( &writer, NULL, _log_writer, NULL ) == 0, __ATOMIC_RELEASE );
+	}
+
+	pthread_mutex_unlock( &lock );
+
+	return b_running;
+}
+
+void log_stop( void )
+{
+	pthread_mutex_lock( &lock );
+
+	if( !b_running )
+	{
+		pthread_mutex_unlock( &lock );
+		return;
+	}
+
+	/* new messages are written directly; the writer drains the rings one last time */
+	__atomic_store_n( &b_running, FALSE, __ATOMIC_RELEASE );
+	b_stopping = TRUE;
+	pthread_cond_signal( &wake );
+	pthread_cond_broadcast( &flushed );
+	pthread_mutex_unlock( &lock );
+
+	pthread_join( writer, NULL );
+}
+
+void log_flush( void )
+{
+	uint64_t ticket;
+
+	pthread_mutex_lock( &lock );
+
+	if( b_running )
+	{
+		ticket = ++flush_requested;
+		pthread_cond_signal( &wake );
+
+		while( flush_completed < ticket && b_running )
+		{
+			pthread_cond_wait( &flushed, &lock );
+		}
+	}
+
+	pthread_mutex_unlock( &lock );
+}
+
+void log_push( log_level level, const char *s_function, int line, const char *s_format, ... )
+{
+	log_ring *p_ring = p_thread_ring;
+	va_list args;
+
+	if( !__atomic_load_n( &b_running, __ATOMIC_ACQUIRE ) )
+	{
+		log_record record;
+
+		/* nobody to hand it to: write it out here */
+		va_start( args, s_format );
+		_log_fill( &record, level, s_function, line, s_format, args );
+		va_end( args );
+
+		pthread_mutex_lock( &direct_lock );
+		_log_write( &record );
+		pthread_mutex_unlock( &direct_lock );
+		return;
+	}
+
+	if( !p_ring && !(p_ring = _log_ring_claim( )) )
+	{
+		return;
+	}
+
+	{
+		uint64_t head = p_ring->head;
+		uint64_t tail = __atomic_load_n( &p_ring->tail, __ATOMIC_ACQUIRE );
+		log_record *p_record;
+
+		if( head - tail >= LOG_RING_SIZE )
+		{
+			__atomic_add_fetch( &p_ring->dropped, 1, __ATOMIC_RELAXED );
+			return;
+		}
+
+		p_record         = &p_ring->records[ head & (LOG_RING_SIZE - 1) ];
+		p_record->thread = p_ring->thread;
+
+		va_start( args, s_format );
+		_log_fill( p_record, level, s_function, line, s_format, args );
+		va_end( args );
+
+		__atomic_store_n( &p_ring->head, head + 1, __ATOMIC_RELEASE );
+	}
+}
+
+uint64_t log_dropped( void )
+{
+	const log_ring *p_ring;
+	uint64_t dropped = 0;
+
+	for( p_ring = __atomic_load_n( &p_rings, __ATOMIC_ACQUIRE ); p_ring; p_ring = p_ring->p_next )
+	{
+		dropped += __atomic_load_n( &p_ring->dropped, __ATOMIC_RELAXED );
+	}
+
+	return dropped;
+}
+
+void _log_key_create( void )
+{
+	pthread_key_create( &ring_key, _log_ring_release );
+}
+
+/* a thread that exits leaves its ring, and whatever is still in it, to the next thread */
+void _log_ring_release( void *data )
+{
+	log_ring *p_ring = (log_ring *) data;
+
+	__atomic_store_n( &p_ring->b_owned, FALSE, __ATOMIC_RELEASE );
+}
+
+log_ring* _log_ring_claim( void )
+{
+	log_ring *p_ring;
+
+	pthread_once( &key_once, _log_key_create );
+
+	for( p_ring = __atomic_load_n( &p_rings, __ATOMIC_ACQUIRE ); p_ring; p_ring = p_ring->p_next )
+	{
+		boolean b_owned = FALSE;
+
+		if( __atomic_compare_exchange_n( &p_ring->b_owned, &b_owned, TRUE, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
+		{
+			break;
+		}
+	}
+
+	if( !p_ring )
+	{
+		p_ring = (log_ring *) calloc( 1, sizeof(log_ring) );
+
+		if( !p_ring )
+		{
+			return NULL;
+		}
+
+		p_ring->b_owned = TRUE;
+		p_ring->thread  = __atomic_add_fetch( &ring_count, 1, __ATOMIC_RELAXED );
+		p_ring->p_next  = __atomic_load_n( &p_rings, __ATOMIC_RELAXED );
+
+		while( !__atomic_compare_exchange_n( &p_rings, &p_ring->p_next, p_ring, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+	}
+
+	pthread_setspecific( ring_key, p_ring );
+	p_thread_ring = p_ring;
+
+	return p_ring;
+}
+
+void _log_fill( log_record *p_record, log_level level, const char *s_function, int line, const char *s_format, va_list args )
+{
+	struct timespec now;
+	int length;
+
+	clock_gettime( CLOCK_REALTIME, &now );
+
+	p_record->timestamp  = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+	p_record->s_function = s_function;
+	p_record->line       = (uint32_t) line;
+	p_record->level      = (uint8_t) level;
+
+	length = vsnprintf( p_record->message, sizeof(p_record->message), s_format, args );
+
+	if( length < 0 ) length = 0;
+	if( length >= (int) sizeof(p_record->message) ) length = sizeof(p_record->message) - 1;
+
+	/* callers written for fprintf end their messages with a newline */
+	while( length > 0 && p_record->message[ length - 1 ] == '\n' ) length--;
+
+	p_record->message[ length ] = '\0';
+	p_record->length            = (uint8_t) length;
+}
+
+/* takes what each ring has, up to capacity records */
+size_t _log_collect( log_record *p_batch, size_t capacity )
+{
+	log_ring *p_ring;
+	size_t count = 0;
+
+	for( p_ring = __atomic_load_n( &p_rings, __ATOMIC_ACQUIRE ); p_ring && count < capacity; p_ring = p_ring->p_next )
+	{
+		uint64_t tail = p_ring->tail;
+		uint64_t head = __atomic_load_n( &p_ring->head, __ATOMIC_ACQUIRE );
+
+		while( tail < head && count < capacity )
+		{
+			p_batch[ count++ ] = p_ring->records[ tail & (LOG_RING_SIZE - 1) ];
+			tail++;
+		}
+
+		__atomic_store_n( &p_ring->tail, tail, __ATOMIC_RELEASE );
+	}
+
+	return count;
+}
+
+int _log_compare( const void *p_left, const void *p_right )
+{
+	const log_record *p_a = (const log_record *) p_left;
+	const log_record *p_b = (const log_record *) p_right;
+
+	return p_a->timestamp < p_b->timestamp ? -1 : p_a->timestamp > p_b->timestamp ? 1 : 0;
+}
+
+void _log_write( const log_record *p_record )
+{
+	static const char *levels[] = { "error", "warning", "info", "debug" };
+	const char *s_level         = p_record->level < sizeof(levels) / sizeof(levels[0]) ? levels[ p_record->level ] : "debug";
+
+	if( output_format == LOG_NDJSON )
+	{
+		time_t seconds = (time_t) (p_record->timestamp / 1000000000ULL);
+		char s_time[ 32 ];
+		struct tm tm;
+
+		gmtime_r( &seconds, &tm );
+		strftime( s_time, sizeof(s_time), "%Y-%m-%dT%H:%M:%S", &tm );
+
+		fprintf( stdout, "{\"time\":\"%s.%06uZ\",\"level\":\"%s\",\"thread\":%u,\"function\":\"%s\",\"line\":%u,\"message\":",
+		         s_time, (uint) (p_record->timestamp % 1000000000ULL / 1000), s_level, (uint) p_record->thread, p_record->s_function, (uint) p_record->line );
+		_log_write_json_string( stdout, p_record->message, p_record->length );
+		fputs( "}\n", stdout );
+	}
+	else if( p_record->level == LOG_INFO )
+	{
+		fwrite( p_record->message, 1, p_record->length, stdout );
+		fputc( '\n', stdout );
+	}
+	else if( p_record->level == LOG_DEBUG )
+	{
+		fwrite( p_record->message, 1, p_record->length, stderr );
+		fputc( '\n', stderr );
+	}
+	else
+	{
+		fprintf( stderr, "%s:%u: %s\n", p_record->s_function, (uint) p_record->line, p_record->message );
+	}
+}
+
+void _log_write_json_string( FILE *p_output, const char *s_string, size_t length )
+{
+	size_t i;
+
+	fputc( '"', p_output );
+
+	for( i = 0; i < length; i++ )
+	{
+		unsigned char c = (unsigned char) s_string[ i ];
+
+		if( c == '"' || c == '\\' ) fprintf( p_output, "\\%c", c );
+		else if( c < 0x20 )         fprintf( p_output, "\\u%04x", c );
+		else                        fputc( c, p_output );
+	}
+
+	fputc( '"', p_output );
+}
+
+void* _log_writer( void *data )
+{
+	log_record *p_batch = (log_record *) malloc( sizeof(log_record) * LOG_BATCH );
+	boolean b_stop      = FALSE;
+
+	(void) data;
+
+	if( !p_batch )
+	{
+		/* log_push() keeps queueing; log_stop() still works */
+		pthread_mutex_lock( &lock );
+		while( !b_stopping ) pthread_cond_wait( &wake, &lock );
+		pthread_mutex_unlock( &lock );
+		return NULL;
+	}
+
+	while( !b_stop )
+	{
+		uint64_t ticket;
+		uint64_t dropped;
+		size_t written = 0;
+		size_t count;
+
+		pthread_mutex_lock( &lock );
+		b_stop = b_stopping;
+		ticket = flush_requested;
+		pthread_mutex_unlock( &lock );
+
+		/* everything queued before the ticket was taken is written before it is answered */
+		while( (count = _log_collect( p_batch, LOG_BATCH )) > 0 )
+		{
+			size_t i;
+
+			qsort( p_batch, count, sizeof(log_record), _log_compare );
+
+			for( i = 0; i < count; i++ )
+			{
+				_log_write( &p_batch[ i ] );
+			}
+
+			written += count;
+
+			fflush( stdout );
+			fflush( stderr );
+		}
+
+		if( (dropped = log_dropped( )) > dropped_reported )
+		{
+			log_record record;
+
+			memset( &record, 0, sizeof(record) );
+			record.s_function = __FUNCTION__;
+			record.line       = __LINE__;
+			record.level      = LOG_WARNING;
+			record.length     = (uint8_t) snprintf( record.message, sizeof(record.message), "%llu log messages dropped", (unsigned long long) (dropped - dropped_reported) );
+			record.timestamp  = (uint64_t) time( NULL ) * 1000000000ULL;
+			_log_write( &record );
+			fflush( stderr );
+
+			dropped_reported = dropped;
+		}
+
+		pthread_mutex_lock( &lock );
+
+		if( flush_completed < ticket )
+		{
+			flush_completed = ticket;
+			pthread_cond_broadcast( &flushed );
+		}
+
+		if( !b_stopping && flush_requested == ticket )
+		{
+			struct timespec until;
+
+			clock_gettime( CLOCK_REALTIME, &until );
+			until.tv_nsec += (written > 0 ? LOG_BUSY_MS : LOG_INTERVAL_MS) * 1000000L;
+			if( until.tv_nsec >= 1000000000L )
+			{
+				until.tv_sec  += 1;
+				until.tv_nsec -= 1000000000L;
+			}
+
+			pthread_cond_timedwait( &wake, &lock, &until );
+		}
+
+		pthread_mutex_unlock( &lock );
+	}
+
+	free( p_batch );
+
+	return NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Logging that never waits on the terminal. A message is rendered into
+ * a fixed-size record in a ring owned by the calling thread, and a
+ * background thread writes the records out in time order. When a ring
+ * is full the message is counted as dropped instead of blocking.
+ *
+ * A disabled level costs one compare; the arguments are not evaluated.
+ * Before log_start() and after log_stop() messages are written directly.
+ *
+ * In text format, info messages go to stdout as they are and the other
+ * levels go to stderr behind "function:line: ". NDJSON puts one object
+ * per message on stdout.
+ */
+#define LOG_MESSAGE_SIZE    (232)   /* longer messages are cut */
+#define LOG_RING_SIZE       (256)   /* records per thread; a power of two */
+
+typedef enum {
+	LOG_NONE = -1,
+	LOG_ERROR = 0,
+	LOG_WARNING,
+	LOG_INFO,
+	LOG_DEBUG,
+} log_level;
+
+typedef enum {
+	LOG_TEXT = 0,
+	LOG_NDJSON,
+} log_format;
+
+typedef struct tag_log_record {
+	uint64_t timestamp;          /* ns since the epoch */
+	const char *s_function;      /* a literal, from __FUNCTION__ */
+	uint32_t line;
+	uint16_t thread;
+	uint8_t level;
+	uint8_t length;
+	char message[ LOG_MESSAGE_SIZE ];
+} log_record;
+
+extern int log_threshold;
+
+boolean  log_start          ( log_format format ); /* starts the writer thread */
+void     log_stop           ( void );              /* writes what is queued, then stops the writer */
+void     log_flush          ( void );              /* returns once what was logged before is written */
+void     log_push           ( log_level level, const char *s_function, int line, const char *s_format, ... ) __attribute__((format(printf, 4, 5)));
+uint64_t log_dropped        ( void );
+
+#define log_set_threshold( level )        (log_threshold = (int) (level))
+#define log_is_enabled( level )           ((int) (level) <= log_threshold)
+#define log_write( level, ... )           do { if( log_is_enabled(level) ) log_push( (level), __FUNCTION__, __LINE__, __VA_ARGS__ ); } while( 0 )
+#define log_error( ... )                  log_write( LOG_ERROR, __VA_ARGS__ )
+#define log_warning( ... )                log_write( LOG_WARNING, __VA_ARGS__ )
+#define log_info( ... )                   log_write( LOG_INFO, __VA_ARGS__ )
+#define log_debug( ... )                  log_write( LOG_DEBUG, __VA_ARGS__ )
+
+#endif /* _LOG_H_ */
@@ -4,15 +4,69 @@
 #include <ctype.h>
 #include <assert.h>
 #include "mime.h"
+#include "trace.h"
 
 
 typedef struct tag_mime_record {
-	char *mime_type;
-	char *extension;
+	const char *mime_type; /* interned */
+	const char *extension;
 } mime_record;
 
 int mime_record_compare( const void *a, const void *b );
 
+/*
+ * Magic numbers. Generic containers (zip, xml, riff, ...) only win
+ * when the extension is unknown; a .docx is a zip but should be
+ * uploaded as a .docx.
+ */
+typedef struct tag_mime_magic {
+	size_t offset;
+	const char *magic;
+	size_t length;
+	const char *mime_type;
+	boolean b_generic;
+} mime_magic;
+
+#define MAGIC( offset, s, type, generic )   { offset, s, sizeof(s) - 1, type, generic }
+
+static const mime_magic mime_magic_table[] = {
+	MAGIC(   0, "\xFF\xD8\xFF",                    "image/jpeg",                    FALSE ),
+	MAGIC(   0, "\x89PNG\r\n\x1A\n",               "image/png",                     FALSE ),
+	MAGIC(   0, "GIF87a",                          "image/gif",                     FALSE ),
+	MAGIC(   0, "GIF89a",                          "image/gif",                     FALSE ),
+	MAGIC(   0, "II*\0",                           "image/tiff",                    FALSE ),
+	MAGIC(   0, "MM\0*",                           "image/tiff",                    FALSE ),
+	MAGIC(   8, "WEBP",                            "image/webp",                    FALSE ),
+	MAGIC(   8, "WAVE",                            "audio/x-wav",                   FALSE ),
+	MAGIC(   8, "AVI ",                            "video/x-msvideo",               FALSE ),
+	MAGIC(   4, "ftypqt",                          "video/quicktime",               FALSE ),
+	MAGIC(   4, "ftypheic",                        "image/heic",                    FALSE ),
+	MAGIC(   4, "ftyp",                            "video/mp4",                     TRUE  ),
+	MAGIC(   0, "\x1A\x45\xDF\xA3",                 "video/x-matroska",              TRUE  ),
+	MAGIC(   0, "OggS",                            "application/ogg",               TRUE  ),
+	MAGIC(   0, "fLaC",                            "audio/flac",                    FALSE ),
+	MAGIC(   0, "ID3",                             "audio/mpeg",                    FALSE ),
+	MAGIC(   0, "%PDF-",                           "application/pdf",               FALSE ),
+	MAGIC(   0, "%!PS",                            "application/postscript",        FALSE ),
+	MAGIC(   0, "{\\rtf",                          "application/rtf",               FALSE ),
+	MAGIC(   0, "\x1F\x8B",                         "application/x-gzip",            FALSE ),
+	MAGIC(   0, "BZh",                             "application/x-bzip2",           FALSE ),
+	MAGIC(   0, "\xFD" "7zXZ\0",                   "application/x-xz",              FALSE ),
+	MAGIC(   0, "7z\xBC\xAF\x27\x1C",                "application/x-7z-compressed",   FALSE ),
+	MAGIC(   0, "\x28\xB5\x2F\xFD",                 "application/zstd",              FALSE ),
+	MAGIC(   0, "PK\x03\x04",                      "application/zip",               TRUE  ),
+	MAGIC( 257, "ustar",                           "application/x-tar",             FALSE ),
+	MAGIC(   0, "\x7F" "ELF",                      "application/x-executable",      TRUE  ),
+	MAGIC(   0, "SQLite format 3",                 "application/x-sqlite3",         FALSE ),
+	MAGIC(   0, "<?xml",                           "application/xml",               TRUE  ),
+	MAGIC(   0, "<!DOCTYPE html",                  "text/html",                     TRUE  ),
+	MAGIC(   0, "<html",                           "text/html",                     TRUE  ),
+	MAGIC(   0, "BM",                              "image/bmp",                     TRUE  ),
+	MAGIC(   0, "RIFF",                            "application/octet-stream",      TRUE  )
+};
+
+static boolean mime_looks_like_text( const byte *p_data, size_t length );
+
 /*
  * String helpers
  */
@@ -20,9 +74,6 @@ static char *strtrim_left( char *string );
 static char *strtrim_right( char *string );
 
 
-int mime_record_destroy( void *element );
-
-
 
 boolean mime_create( mime_table *p_table )
 {
@@ -37,7 +88,10 @@ boolean mime_create_from_file( mime_table *p_table, const char *s_mime_file )
 
 	assert( p_table );
 
-	vector_create( p_table, sizeof(mime_record), mime_record_destroy );
+	/* records own no memory; all strings live in the arena */
+	vector_create( &p_table->records, sizeof(mime_record), NULL );
+	arena_create( &p_table->strings, ARENA_DEFAULT_BLOCK_SIZE );
+	intern_create( &p_table->types, &p_table->strings );
 
 	f = fopen( s_mime_file, "rb" );
 
@@ -56,7 +110,8 @@ boolean mime_create_from_file( mime_table *p_table, const char *s_mime_file )
 
 		int token_count = 0;
 		char *mime_type = NULL;	
-		char *token     = strtok( buffer, "\t\n\r " );
+		char *p_state   = NULL;
+		char *token     = strtok_r( buffer, "\t\n\r ", &p_state );
 
 		while( token )
 		{
@@ -68,36 +123,30 @@ boolean mime_create_from_file( mime_table *p_table, const char *s_mime_file )
 			{
 				mime_record record;
 
-				record.mime_type = strdup( mime_type );
-				record.extension = strdup( token );
+				record.mime_type = intern_string( &p_table->types, mime_type );
+				record.extension = arena_strdup( &p_table->strings, token );
 
-				vector_push( p_table, &record ); 
+				vector_push( &p_table->records, &record ); 
 			}
 		
 			token_count += 1;
-			token        = strtok( NULL, "\t\n\r " );
+			token        = strtok_r( NULL, "\t\n\r ", &p_state );
 		}
 	}
 
 	/* sort the table */
-	qsort( vector_array(p_table), vector_size(p_table), sizeof(mime_record), mime_record_compare );
+	qsort( vector_array(&p_table->records), vector_size(&p_table->records), sizeof(mime_record), mime_record_compare );
 
 	return TRUE;	
 }
 
 void mime_destroy( mime_table *p_table )
 {
-	vector_destroy( p_table );
-}
-
-int mime_record_destroy( void *element )
-{
-	assert( element );
+	assert( p_table );
 
-	mime_record *p_record = (mime_record *) element;
-	free( p_record->extension );
-	free( p_record->mime_type );
-	return 1;
+	vector_destroy( &p_table->records );
+	intern_destroy( &p_table->types );
+	arena_destroy( &p_table->strings ); /* frees every string at once */
 }
 
 void mime_debug_table( const mime_table *p_table )
@@ -105,14 +154,14 @@ void mime_debug_table( const mime_table *p_table )
 	int i;
 	assert( p_table );
 
-	for( i = 0; i < vector_size(p_table); i++ )
+	for( i = 0; i < vector_size(&p_table->records); i++ )
 	{
-		mime_record *p_record = (mime_record *) vector_element_at( p_table, i );
+		mime_record *p_record = (mime_record *) vector_element_at( &p_table->records, i );
 		printf( "%20s --> %s\n", p_record->extension, p_record->mime_type );
 	}
 
 	printf( "     ===============================================\n" );
-	printf( "                   # of records: %lu\n", vector_size(p_table) );
+	printf( "                   # of records: %lu\n", vector_size(&p_table->records) );
 }
 
 const char *mime_type( const mime_table *p_table, const char *extension )
@@ -121,11 +170,80 @@ const char *mime_type( const mime_table *p_table, const char *extension )
 	mime_record *p_record = NULL;
 
 	assert( p_table );
-	key.extension = (char *) extension;
+	key.extension = extension;
+
+	TRACE1( mime_type_start, extension );
+
+	p_record = (mime_record *) bsearch( &key, vector_array(&p_table->records), vector_size(&p_table->records), sizeof(mime_record), mime_record_compare );
+
+	TRACE2( mime_type_done, extension, p_record ? p_record->mime_type : NULL );
+
+	return p_record ? p_record->mime_type : NULL;
+}
+
+/*
+ * Classifies a buffer by its first bytes. Returns NULL when nothing
+ * matches. The buffer is whatever the caller has already read; no I/O
+ * happens here.
+ */
+const char *mime_sniff( const byte *p_data, size_t length, boolean *p_b_generic )
+{
+	size_t i;
+
+	assert( p_data || length == 0 );
+
+	/* the ftyp/RIFF brands are listed before the bare containers */
+	for( i = 0; i < sizeof(mime_magic_table) / sizeof(mime_magic_table[0]); i++ )
+	{
+		const mime_magic *p_magic = &mime_magic_table[ i ];
+
+		if( p_magic->offset + p_magic->length <= length &&
+		    memcmp( p_data + p_magic->offset, p_magic->magic, p_magic->length ) == 0 )
+		{
+			if( p_b_generic ) *p_b_generic = p_magic->b_generic;
+			return p_magic->mime_type;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Content first, then the extension, then a text check. Extensionless
+ * files get a proper type as long as their first bytes say something.
+ */
+const char *mime_detect( const mime_table *p_table, const char *s_filename, const byte *p_data, size_t length )
+{
+	boolean b_generic    = FALSE;
+	const char *s_sniffed = mime_sniff( p_data, length, &b_generic );
+	const char *s_type    = NULL;
+
+	if( s_sniffed && !b_generic )
+	{
+		return s_sniffed;
+	}
+
+	if( p_table && s_filename )
+	{
+		const char *p_slash = strrchr( s_filename, '/' );
+		const char *p_dot   = strrchr( p_slash ? p_slash : s_filename, '.' );
 
-	p_record = (mime_record *) bsearch( &key, vector_array(p_table), vector_size(p_table), sizeof(mime_record), mime_record_compare );
+		if( p_dot && p_dot[ 1 ] != '\0' )
+		{
+			s_type = mime_type( p_table, p_dot + 1 );
+		}
+	}
+
+	if( s_type )
+	{
+		return s_type;
+	}
+	else if( s_sniffed )
+	{
+		return s_sniffed;
+	}
 
-	return p_record ? (const char *) p_record->mime_type : NULL;
+	return mime_looks_like_text( p_data, length ) ? "text/plain" : MIME_DEFAULT_TYPE;
 }
 
 int mime_record_compare( const void *a, const void *b )
@@ -134,6 +252,28 @@ int mime_record_compare( const void *a, const void *b )
 	return strcasecmp( ((mime_record*) a)->extension, ((mime_record*) b)->extension );
 }
 
+/* no NULs and hardly any control characters; UTF-8 passes */
+boolean mime_looks_like_text( const byte *p_data, size_t length )
+{
+	size_t control = 0;
+	size_t i;
+
+	if( length == 0 )
+	{
+		return FALSE;
+	}
+
+	for( i = 0; i < length; i++ )
+	{
+		byte c = p_data[ i ];
+
+		if( c == 0 ) return FALSE;
+		if( c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1B ) control++;
+	}
+
+	return control * 100 < length;
+}
+
 
 /*
  * String helpers
@@ -7,8 +7,14 @@
 #define _DEBUG_VECTOR
 #endif
 #include "vector.h"
+#include "arena.h"
+#include "intern.h"
 
-typedef vector mime_table; /* table of mime records */
+typedef struct tag_mime_table {
+	vector records;       /* sorted table of mime records */
+	arena strings;        /* backing store for extensions and types */
+	intern_table types;   /* each mime type is stored once */
+} mime_table;
 
 boolean     mime_create           ( mime_table *p_table );
 boolean     mime_create_from_file ( mime_table *p_table, const char *s_mime_file );
@@ -16,6 +22,11 @@ void        mime_destroy          ( mime_table *p_table );
 void        mime_debug_table      ( const mime_table *p_table );
 const char* mime_type             ( const mime_table *p_table, const char *extension );
 
+#define     MIME_SNIFF_LENGTH     (512)  /* enough for every signature below, including tar */
+#define     MIME_DEFAULT_TYPE     "application/octet-stream"
+const char* mime_sniff            ( const byte *p_data, size_t length, /*out*/ boolean *p_b_generic );
+const char* mime_detect           ( const mime_table *p_table, const char *s_filename, const byte *p_data, size_t length );
+
 
 
 #endif /* _MIME_H_ */
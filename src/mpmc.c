@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include "mpmc.h"
+
+#define MPMC_SPINS          (64)
+
+#define _mpmc_cell( p_queue, position )   ((p_queue)->p_cells + (size_t) ((position) & (p_queue)->mask) * (p_queue)->stride)
+#define _mpmc_sequence( p_cell )          ((uint64_t *) (p_cell))
+#define _mpmc_element( p_cell )           ((p_cell) + sizeof(uint64_t))
+
+static void _mpmc_wake ( mpmc_queue *p_queue );
+
+
+boolean mpmc_create( mpmc_queue *p_queue, size_t element_size, size_t capacity )
+{
+	uint64_t i;
+	size_t size = 2;
+
+	assert( p_queue );
+	assert( element_size > 0 );
+
+	while( size < capacity ) size <<= 1;
+
+	memset( p_queue, 0, sizeof(mpmc_queue) );
+	p_queue->element_size = element_size;
+	p_queue->stride       = (sizeof(uint64_t) + element_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	p_queue->mask         = size - 1;
+	p_queue->p_cells      = (byte *) malloc( size * p_queue->stride );
+
+	if( !p_queue->p_cells )
+	{
+		return FALSE;
+	}
+
+	/* cell i is free for the producer at position i */
+	for( i = 0; i < size; i++ )
+	{
+		*_mpmc_sequence( _mpmc_cell( p_queue, i ) ) = i;
+	}
+
+	pthread_mutex_init( &p_queue->lock, NULL );
+	pthread_cond_init( &p_queue->changed, NULL );
+
+	return TRUE;
+}
+
+void mpmc_destroy( mpmc_queue *p_queue )
+{
+	assert( p_queue );
+
+	pthread_cond_destroy( &p_queue->changed );
+	pthread_mutex_destroy( &p_queue->lock );
+	free( p_queue->p_cells );
+	p_queue->p_cells = NULL;
+}
+
+boolean mpmc_try_push( mpmc_queue *p_queue, const void *p_element )
+{
+	uint64_t position = __atomic_load_n( &p_queue->enqueue_position, __ATOMIC_RELAXED );
+	byte *p_cell;
+
+	for( ;; )
+	{
+		uint64_t sequence;
+		int64_t difference;
+
+		p_cell     = _mpmc_cell( p_queue, position );
+		sequence   = __atomic_load_n( _mpmc_sequence( p_cell ), __ATOMIC_ACQUIRE );
+		difference = (int64_t) sequence - (int64_t) position;
+
+		if( difference == 0 )
+		{
+			if( __atomic_compare_exchange_n( &p_queue->enqueue_position, &position, position + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+			{
+				break;
+			}
+		}
+		else if( difference < 0 )
+		{
+			return FALSE; /* the consumer a lap behind has not taken this cell yet */
+		}
+		else
+		{
+			position = __atomic_load_n( &p_queue->enqueue_position, __ATOMIC_RELAXED );
+		}
+	}
+
+	memcpy( _mpmc_element( p_cell ), p_element, p_queue->element_size );
+	__atomic_store_n( _mpmc_sequence( p_cell ), position + 1, __ATOMIC_RELEASE );
+
+	_mpmc_wake( p_queue );
+
+	return TRUE;
+}
+
+boolean mpmc_try_pop( mpmc_queue *p_queue, void *p_element )
+{
+	uint64_t position = __atomic_load_n( &p_queue->dequeue_position, __ATOMIC_RELAXED );
+	byte *p_cell;
+
+	for( ;; )
+	{
+		uint64_t sequence;
+		int64_t difference;
+
+		p_cell     = _mpmc_cell( p_queue, position );
+		sequence   = __atomic_load_n( _mpmc_sequence( p_cell ), __ATOMIC_ACQUIRE );
+		difference = (int64_t) sequence - (int64_t) (position + 1);
+
+		if( difference == 0 )
+		{
+			if( __atomic_compare_exchange_n( &p_queue->dequeue_position, &position, position + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+			{
+				break;
+			}
+		}
+		else if( difference < 0 )
+		{
+			return FALSE; /* nothing published here yet */
+		}
+		else
+		{
+			position = __atomic_load_n( &p_queue->dequeue_position, __ATOMIC_RELAXED );
+		}
+	}
+
+	memcpy( p_element, _mpmc_element( p_cell ), p_queue->element_size );
+	/* free for the producer one lap ahead */
+	__atomic_store_n( _mpmc_sequence( p_cell ), position + p_queue->mask + 1, __ATOMIC_RELEASE );
+
+	_mpmc_wake( p_queue );
+
+	return TRUE;
+}
+
+boolean mpmc_push( mpmc_queue *p_queue, const void *p_element )
+{
+	boolean b_result = FALSE;
+	uint spins;
+
+	for( spins = 0; spins < MPMC_SPINS; spins++ )
+	{
+		if( __atomic_load_n( &p_queue->b_closed, __ATOMIC_ACQUIRE ) ) return FALSE;
+		if( mpmc_try_push( p_queue, p_element ) ) return TRUE;
+		sched_yield( );
+	}
+
+	pthread_mutex_lock( &p_queue->lock );
+	__atomic_add_fetch( &p_queue->sleepers, 1, __ATOMIC_SEQ_CST );
+
+	/* announced as a sleeper before the last try, so a pop after it will wake us */
+	for( ;; )
+	{
+		if( __atomic_load_n( &p_queue->b_closed, __ATOMIC_ACQUIRE ) ) break;
+		if( (b_result = mpmc_try_push( p_queue, p_element )) ) break;
+		pthread_cond_wait( &p_queue->changed, &p_queue->lock );
+	}
+
+	__atomic_sub_fetch( &p_queue->sleepers, 1, __ATOMIC_SEQ_CST );
+	pthread_mutex_unlock( &p_queue->lock );
+
+	return b_result;
+}
+
+boolean mpmc_pop( mpmc_queue *p_queue, void *p_element )
+{
+	boolean b_result = FALSE;
+	uint spins;
+
+	for( spins = 0; spins < MPMC_SPINS; spins++ )
+	{
+		if( mpmc_try_pop( p_queue, p_element ) ) return TRUE;
+		if( __atomic_load_n( &p_queue->b_closed, __ATOMIC_ACQUIRE ) ) return mpmc_try_pop( p_queue, p_element );
+		sched_yield( );
+	}
+
+	pthread_mutex_lock( &p_queue->lock );
+	__atomic_add_fetch( &p_queue->sleepers, 1, __ATOMIC_SEQ_CST );
+
+	for( ;; )
+	{
+		if( (b_result = mpmc_try_pop( p_queue, p_element )) ) break;
+		/* closing happens after the last push, so an empty closed queue stays empty */
+		if( __atomic_load_n( &p_queue->b_closed, __ATOMIC_ACQUIRE ) ) break;
+		pthread_cond_wait( &p_queue->changed, &p_queue->lock );
+	}
+
+	__atomic_sub_fetch( &p_queue->sleepers, 1, __ATOMIC_SEQ_CST );
+	pthread_mutex_unlock( &p_queue->lock );
+
+	return b_result;
+}
+
+void mpmc_close( mpmc_queue *p_queue )
+{
+	pthread_mutex_lock( &p_queue->lock );
+	__atomic_store_n( &p_queue->b_closed, TRUE, __ATOMIC_SEQ_CST );
+	pthread_cond_broadcast( &p_queue->changed );
+	pthread_mutex_unlock( &p_queue->lock );
+}
+
+/* the lock is only taken when someone sleeps; they hold it until they are in the wait */
+void _mpmc_wake( mpmc_queue *p_queue )
+{
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+	if( __atomic_load_n( &p_queue->sleepers, __ATOMIC_RELAXED ) > 0 )
+	{
+		pthread_mutex_lock( &p_queue->lock );
+		pthread_cond_broadcast( &p_queue->changed );
+		pthread_mutex_unlock( &p_queue->lock );
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef _MPMC_H_
+#define _MPMC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+
+/*
+ * Bounded multi-producer, multi-consumer queue for handing work between
+ * pipeline stages. Every cell carries a sequence number that says whose
+ * turn it is, so producers and consumers claim cells with one CAS on
+ * their own position and never take a lock (D. Vyukov's design).
+ *
+ * The try_ calls never block. mpmc_push() and mpmc_pop() spin briefly,
+ * then sleep; the sleep is the only place a lock is taken, and a side
+ * that never has to wait never touches it.
+ */
+#define MPMC_CACHE_LINE     (64)
+
+typedef struct tag_mpmc_queue {
+	byte *p_cells;               /* capacity x stride: uint64_t sequence, then the element */
+	size_t element_size;
+	size_t stride;
+	uint64_t mask;
+	char pad0[ MPMC_CACHE_LINE ];
+	uint64_t enqueue_position;
+	char pad1[ MPMC_CACHE_LINE - sizeof(uint64_t) ];
+	uint64_t dequeue_position;
+	char pad2[ MPMC_CACHE_LINE - sizeof(uint64_t) ];
+	boolean b_closed;
+	uint sleepers;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} mpmc_queue;
+
+boolean mpmc_create   ( mpmc_queue *p_queue, size_t element_size, size_t capacity ); /* capacity is rounded up to a power of two */
+void    mpmc_destroy  ( mpmc_queue *p_queue );
+boolean mpmc_try_push ( mpmc_queue *p_queue, const void *p_element );          /* FALSE when full */
+boolean mpmc_try_pop  ( mpmc_queue *p_queue, /*out*/ void *p_element );        /* FALSE when empty */
+boolean mpmc_push     ( mpmc_queue *p_queue, const void *p_element );          /* waits for room; FALSE once closed */
+boolean mpmc_pop      ( mpmc_queue *p_queue, /*out*/ void *p_element );        /* waits for an element; FALSE once closed and empty */
+void    mpmc_close    ( mpmc_queue *p_queue );                                 /* wakes every waiter */
+
+#define mpmc_capacity( p_queue )    ((size_t) (p_queue)->mask + 1)
+
+#endif /* _MPMC_H_ */
@@ -0,0 +1,204 @@
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include "profile.h"
+
+#define profile_add_counter( p_counter, value )   __atomic_fetch_add( (p_counter), (value), __ATOMIC_RELAXED )
+#define profile_load_counter( p_counter )          __atomic_load_n( (p_counter), __ATOMIC_RELAXED )
+
+static __thread uint64_t profile_thread_busy_ns = 0;
+
+static const char *profile_stage_names[ PROFILE_STAGE_COUNT ] = {
+	"read",
+	"filter",
+	"hash",
+	"send"
+};
+
+
+void profiler_create( profiler *p_profiler, FILE *p_status )
+{
+	assert( p_profiler );
+
+	memset( p_profiler, 0, sizeof(profiler) );
+	p_profiler->start_ns = profiler_now( );
+	p_profiler->p_status = p_status;
+}
+
+uint64_t profiler_now( void )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+uint64_t profiler_begin( const profiler *p_profiler )
+{
+	return p_profiler ? profiler_now( ) : 0;
+}
+
+void profiler_end( profiler *p_profiler, profile_stage stage, uint64_t begin, uint64_t bytes )
+{
+	if( p_profiler )
+	{
+		profiler_add( p_profiler, stage, profiler_now( ) - begin, 0, bytes );
+		profiler_status( p_profiler, FALSE );
+	}
+}
+
+void profiler_add( profiler *p_profiler, profile_stage stage, uint64_t busy_ns, uint64_t blocked_ns, uint64_t bytes )
+{
+	profile_counters *p_counters;
+
+	if( !p_profiler )
+	{
+		return;
+	}
+
+	assert( stage < PROFILE_STAGE_COUNT );
+	p_counters = &p_profiler->stages[ stage ];
+
+	profile_add_counter( &p_counters->busy_ns, busy_ns );
+	profile_add_counter( &p_counters->blocked_ns, blocked_ns );
+	profile_add_counter( &p_counters->bytes, bytes );
+	profile_add_counter( &p_counters->calls, 1 );
+
+	profile_thread_busy_ns += busy_ns;
+}
+
+/*
+ * Lets a stage tell its own work from the work of stages it called
+ * into (cURL calling our read callback, for example).
+ */
+uint64_t profiler_thread_busy( void )
+{
+	return profile_thread_busy_ns;
+}
+
+void profiler_set_total( profiler *p_profiler, uint64_t files, uint64_t bytes )
+{
+	if( p_profiler )
+	{
+		profile_add_counter( &p_profiler->files_total, files );
+		profile_add_counter( &p_profiler->bytes_total, bytes );
+	}
+}
+
+void profiler_file_done( profiler *p_profiler )
+{
+	if( p_profiler )
+	{
+		profile_add_counter( &p_profiler->files_done, 1 );
+		profiler_status( p_profiler, FALSE );
+	}
+}
+
+profile_stage profiler_bottleneck( const profiler *p_profiler )
+{
+	profile_stage bottleneck = PROFILE_READ;
+	uint64_t most = 0;
+	int i;
+
+	assert( p_profiler );
+
+	for( i = 0; i < PROFILE_STAGE_COUNT; i++ )
+	{
+		uint64_t busy = profile_load_counter( &p_profiler->stages[ i ].busy_ns );
+
+		if( busy > most )
+		{
+			most       = busy;
+			bottleneck = (profile_stage) i;
+		}
+	}
+
+	return bottleneck;
+}
+
+const char* profiler_stage_name( profile_stage stage )
+{
+	assert( stage < PROFILE_STAGE_COUNT );
+	return profile_stage_names[ stage ];
+}
+
+/* redraws at most every PROFILE_STATUS_INTERVAL_NS, from whichever thread gets there first */
+void profiler_status( profiler *p_profiler, boolean b_force )
+{
+	uint64_t now;
+	uint64_t last;
+	double seconds;
+	double bytes;
+	double rate;
+	double files_rate;
+
+	if( !p_profiler || !p_profiler->p_status )
+	{
+		return;
+	}
+
+	now  = profiler_now( );
+	last = profile_load_counter( &p_profiler->last_status_ns );
+
+	if( !b_force && now - last < PROFILE_STATUS_INTERVAL_NS )
+	{
+		return;
+	}
+
+	if( !__atomic_compare_exchange_n( &p_profiler->last_status_ns, &last, now, FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) && !b_force )
+	{
+		return;
+	}
+
+	seconds    = (now - p_profiler->start_ns) / 1e9;
+	bytes      = (double) profile_load_counter( &p_profiler->stages[ PROFILE_SEND ].bytes );
+	rate       = seconds > 0.0 ? bytes / seconds : 0.0;
+	files_rate = seconds > 0.0 ? profile_load_counter( &p_profiler->files_done ) / seconds : 0.0;
+
+	fprintf( p_profiler->p_status, "\r%9.2f MB/s %7.1f files/s", rate / (1024.0 * 1024.0), files_rate );
+
+	if( p_profiler->bytes_total > 0 && rate > 0.0 )
+	{
+		double left = p_profiler->bytes_total > bytes ? (p_profiler->bytes_total - bytes) / rate : 0.0;
+		uint eta    = (uint) (left + 0.5);
+
+		fprintf( p_profiler->p_status, "  %3.0f%%  ETA %02u:%02u:%02u", 100.0 * bytes / p_profiler->bytes_total, eta / 3600, (eta / 60) % 60, eta % 60 );
+	}
+
+	fprintf( p_profiler->p_status, "  bottleneck: %-8s", profiler_stage_name( profiler_bottleneck( p_profiler ) ) );
+	fflush( p_profiler->p_status );
+}
+
+void profiler_report( const profiler *p_profiler, FILE *p_output )
+{
+	double wall;
+	int i;
+
+	assert( p_profiler );
+	assert( p_output );
+
+	wall = (profiler_now( ) - p_profiler->start_ns) / 1e9;
+
+	fprintf( p_output, "\n%-8s %10s %12s %10s %7s %10s %10s\n", "stage", "calls", "MB", "busy (s)", "util", "blocked", "MB/s busy" );
+
+	for( i = 0; i < PROFILE_STAGE_COUNT; i++ )
+	{
+		const profile_counters *p_counters = &p_profiler->stages[ i ];
+		double busy    = p_counters->busy_ns / 1e9;
+		double blocked = p_counters->blocked_ns / 1e9;
+		double mb      = p_counters->bytes / (1024.0 * 1024.0);
+
+		if( p_counters->calls == 0 )
+		{
+			continue;
+		}
+
+		fprintf( p_output, "%-8s %10llu %12.2f %10.3f %6.1f%% %10.3f %10.2f\n",
+		         profile_stage_names[ i ], (unsigned long long) p_counters->calls, mb, busy,
+		         wall > 0.0 ? 100.0 * busy / wall : 0.0, blocked, busy > 0.0 ? mb / busy : 0.0 );
+	}
+
+	fprintf( p_output, "%llu file(s) in %.3f s, bottleneck: %s\n", (unsigned long long) p_profiler->files_done, wall,
+	         profiler_stage_name( profiler_bottleneck( p_profiler ) ) );
+}
@@ -0,0 +1,57 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+
+/*
+ * Per-stage timing for the transfer path. Every stage records busy time
+ * (doing its own work), blocked time (waiting on the stage upstream of
+ * it) and bytes. The slowest stage is the one with the most busy time;
+ * that is the resource worth scaling.
+ *
+ * All functions take a NULL profiler and do nothing, so callers never
+ * have to check. Counters are updated atomically from any thread.
+ */
+typedef enum profile_stage {
+	PROFILE_READ = 0,    /* disk reads */
+	PROFILE_FILTER,      /* metadata stripping and other rewriting */
+	PROFILE_HASH,        /* checksums */
+	PROFILE_SEND,        /* network or local copy */
+	PROFILE_STAGE_COUNT
+} profile_stage;
+
+typedef struct tag_profile_counters {
+	uint64_t busy_ns;
+	uint64_t blocked_ns;
+	uint64_t bytes;
+	uint64_t calls;
+} profile_counters;
+
+typedef struct tag_profiler {
+	profile_counters stages[ PROFILE_STAGE_COUNT ];
+	uint64_t start_ns;
+	uint64_t last_status_ns;
+	uint64_t files_done;
+	uint64_t files_total;
+	uint64_t bytes_total;        /* bytes the final stage will move, for the ETA */
+	FILE *p_status;              /* live status line, NULL for none */
+} profiler;
+
+#define PROFILE_STATUS_INTERVAL_NS   (250000000ULL)
+
+void     profiler_create      ( profiler *p_profiler, FILE *p_status );
+uint64_t profiler_now         ( void );
+uint64_t profiler_begin       ( const profiler *p_profiler );
+void     profiler_end         ( profiler *p_profiler, profile_stage stage, uint64_t begin, uint64_t bytes );
+void     profiler_add         ( profiler *p_profiler, profile_stage stage, uint64_t busy_ns, uint64_t blocked_ns, uint64_t bytes );
+uint64_t profiler_thread_busy ( void ); /* busy time recorded by the calling thread so far */
+void     profiler_set_total   ( profiler *p_profiler, uint64_t files, uint64_t bytes );
+void     profiler_file_done   ( profiler *p_profiler );
+void     profiler_status      ( profiler *p_profiler, boolean b_force );
+void     profiler_report      ( const profiler *p_profiler, FILE *p_output );
+const char* profiler_stage_name ( profile_stage stage );
+profile_stage profiler_bottleneck ( const profiler *p_profiler );
+
+#endif /* _PROFILE_H_ */
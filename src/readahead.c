@@ -0,0 +1,936 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include "readahead.h"
+
+/* build with -D_READAHEAD_NO_IO_URING to always use the pread pool */
+#if !defined(_READAHEAD_NO_IO_URING) && defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define _READAHEAD_HAVE_IO_URING
+#endif
+#endif
+
+/* openat and statx came with 5.6, together with this feature flag */
+#if defined(_READAHEAD_HAVE_IO_URING) && defined(IORING_FEAT_RW_CUR_POS) && defined(STATX_SIZE)
+#define _READAHEAD_HAVE_URING_OPEN
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT                (0)
+#endif
+#ifndef O_NOATIME
+#define O_NOATIME               (0)
+#endif
+
+#if READAHEAD_CHUNK_SIZE > BUFFER_POOL_DEFAULT_SIZE || BUFFER_POOL_ALIGNMENT % READAHEAD_ALIGNMENT != 0
+#error "a read-ahead chunk must fit a shared pool buffer"
+#endif
+
+#define READAHEAD_POOL_QUEUE    (READAHEAD_POOL_THREADS * READAHEAD_WINDOW * 4)
+#define READAHEAD_OPEN_DATA     (~(uint64_t) 0)
+
+/* the pread fallback, shared by every reader and started on first use */
+typedef struct tag_readahead_job {
+	readahead_reader *p_reader;
+	uint slot;
+} readahead_job;
+
+typedef struct tag_readahead_pool {
+	pthread_t threads[ READAHEAD_POOL_THREADS ];
+	uint thread_count;
+	readahead_job jobs[ READAHEAD_POOL_QUEUE ];
+	size_t head;
+	size_t count;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} readahead_pool;
+
+static readahead_pool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER };
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+#ifdef _READAHEAD_HAVE_IO_URING
+static boolean b_uring_unavailable = FALSE; /* set once the kernel says no */
+#endif
+
+static void    _readahead_fill       ( readahead_reader *p_reader );
+static boolean _readahead_next_extent( readahead_reader *p_reader );
+static boolean _readahead_wait       ( readahead_reader *p_reader, readahead_slot *p_slot );
+static void    _readahead_drain      ( readahead_reader *p_reader );
+static boolean _readahead_open_file  ( readahead_reader *p_reader, const char *s_filename, int flags );
+static size_t  _readahead_request    ( size_t length, boolean b_direct );
+static boolean _readahead_undirect   ( readahead_reader *p_reader );
+static void    _readahead_note_cache ( readahead_reader *p_reader, readahead_slot *p_slot );
+static void    _readahead_drop_cache ( readahead_reader *p_reader, readahead_slot *p_slot );
+static void    _readahead_pool_start ( void );
+static boolean _readahead_pool_submit( readahead_reader *p_reader, uint slot );
+static void*   _readahead_pool_thread( void *data );
+#ifdef _READAHEAD_HAVE_IO_URING
+static boolean _readahead_ring_create  ( readahead_ring *p_ring, uint entries );
+static void    _readahead_ring_destroy ( readahead_ring *p_ring );
+static struct io_uring_sqe* _readahead_ring_sqe ( readahead_ring *p_ring );
+static boolean _readahead_ring_submit  ( readahead_ring *p_ring, uint wait );
+static boolean _readahead_ring_reap    ( readahead_reader *p_reader, uint wait );
+static void    _readahead_ring_read    ( readahead_reader *p_reader, uint slot );
+static void    _readahead_ring_complete( readahead_reader *p_reader, uint slot, int result );
+#endif
+#ifdef _READAHEAD_HAVE_URING_OPEN
+static int     _readahead_ring_call    ( readahead_ring *p_ring, struct io_uring_sqe *p_sqe );
+static boolean _readahead_ring_open    ( readahead_reader *p_reader, const char *s_filename, int flags );
+#endif
+
+
+boolean readahead_open( readahead_reader *p_reader, const char *s_filename, uint flags, off_t *p_size )
+{
+	/* from most to least cache friendly; O_NOATIME needs us to own the file */
+	static const int nocache_flags[] = { O_DIRECT | O_NOATIME, O_DIRECT, O_NOATIME, 0 };
+	uint i;
+
+	assert( p_reader );
+	assert( s_filename );
+
+	memset( p_reader, 0, sizeof(readahead_reader) );
+	p_reader->fd      = -1;
+	p_reader->ring.fd = -1;
+	p_reader->flags   = flags;
+
+	#ifdef _READAHEAD_HAVE_IO_URING
+	if( !__atomic_load_n( &b_uring_unavailable, __ATOMIC_RELAXED ) )
+	{
+		p_reader->b_uring = _readahead_ring_create( &p_reader->ring, 2 * READAHEAD_WINDOW );
+
+		if( !p_reader->b_uring && (errno == ENOSYS || errno == EPERM) )
+		{
+			/* old kernel or a seccomp filter: never ask again */
+			__atomic_store_n( &b_uring_unavailable, TRUE, __ATOMIC_RELAXED );
+		}
+	}
+	#endif
+
+	for( i = (flags & READAHEAD_NOCACHE) ? 0 : 3; i < sizeof(nocache_flags) / sizeof(nocache_flags[0]); i++ )
+	{
+		if( _readahead_open_file( p_reader, s_filename, nocache_flags[ i ] ) )
+		{
+			p_reader->b_direct = (nocache_flags[ i ] & O_DIRECT) != 0;
+			break;
+		}
+
+		/* a missing file stays missing whatever the flags */
+		if( errno != EINVAL && errno != EPERM ) break;
+	}
+
+	if( p_reader->fd < 0 )
+	{
+		readahead_close( p_reader );
+		return FALSE;
+	}
+
+	#ifdef POSIX_FADV_SEQUENTIAL
+	if( p_reader->b_direct )
+	{
+		/* the page cache is not involved */
+	}
+	else if( flags & READAHEAD_NOCACHE )
+	{
+		/* our window is the read-ahead; the kernel's would cache pages we never noted */
+		posix_fadvise( p_reader->fd, 0, 0, POSIX_FADV_RANDOM );
+	}
+	else
+	{
+		posix_fadvise( p_reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+	}
+	#endif
+
+	if( !(p_reader->p_pool = buffer_pool_shared( )) )
+	{
+		readahead_close( p_reader );
+		return FALSE;
+	}
+
+	if( !p_reader->b_uring )
+	{
+		pthread_mutex_init( &p_reader->lock, NULL );
+		pthread_cond_init( &p_reader->done, NULL );
+		p_reader->b_locks = TRUE;
+		pthread_once( &pool_once, _readahead_pool_start );
+	}
+
+	if( p_size ) *p_size = p_reader->size;
+
+	p_reader->extent_end = p_reader->size;
+
+	return TRUE;
+}
+
+ssize_t readahead_read( readahead_reader *p_reader, void *p_buffer, size_t size )
+{
+	readahead_slot *p_slot;
+	size_t length;
+
+	assert( p_reader );
+	assert( p_buffer || size == 0 );
+
+	if( p_reader->b_error )
+	{
+		return -1;
+	}
+
+	if( !p_reader->b_started )
+	{
+		p_reader->b_started = TRUE;
+		_readahead_fill( p_reader );
+	}
+
+	p_slot = &p_reader->slots[ p_reader->head ];
+
+	if( p_slot->state == READAHEAD_EMPTY )
+	{
+		return 0; /* nothing left to issue */
+	}
+
+	if( !_readahead_wait( p_reader, p_slot ) )
+	{
+		p_reader->b_error = TRUE;
+		return -1;
+	}
+
+	length = p_slot->filled - p_slot->consumed;
+	if( length > size ) length = size;
+
+	memcpy( p_buffer, p_slot->p_buffer + p_slot->consumed, length );
+	p_slot->consumed += length;
+
+	if( p_slot->consumed == p_slot->filled )
+	{
+		/* the file ended early (it shrank); whatever was issued past it reads as empty */
+		if( p_slot->filled < p_slot->length )
+		{
+			p_reader->size = p_slot->offset + (off_t) p_slot->filled;
+		}
+
+		if( (p_reader->flags & READAHEAD_NOCACHE) && p_slot->b_cached )
+		{
+			_readahead_drop_cache( p_reader, p_slot );
+		}
+
+		buffer_pool_release( p_reader->p_pool, p_slot->p_buffer );
+		p_slot->p_buffer = NULL;
+		p_reader->held--;
+
+		p_slot->state  = READAHEAD_EMPTY;
+		p_reader->head = (p_reader->head + 1) % READAHEAD_WINDOW;
+
+		_readahead_fill( p_reader );
+	}
+
+	return (ssize_t) length;
+}
+
+void readahead_set_extents( readahead_reader *p_reader, const readahead_extent *p_extents, size_t count )
+{
+	assert( p_reader );
+	assert( !p_reader->b_started );
+	assert( p_extents || count == 0 );
+
+	p_reader->p_extents    = p_extents;
+	p_reader->extent_count = count;
+	p_reader->extent_index = 0;
+	p_reader->next_offset  = count > 0 ? p_extents[ 0 ].offset : 0;
+	p_reader->extent_end   = count > 0 ? p_extents[ 0 ].offset + p_extents[ 0 ].length : 0;
+}
+
+void readahead_close( readahead_reader *p_reader )
+{
+	uint i;
+
+	assert( p_reader );
+
+	/* buffers cannot go while the kernel or a pool thread still writes to them */
+	_readahead_drain( p_reader );
+
+	#ifdef _READAHEAD_HAVE_IO_URING
+	if( p_reader->ring.fd >= 0 )
+	{
+		_readahead_ring_destroy( &p_reader->ring );
+	}
+	#endif
+
+	if( p_reader->b_locks )
+	{
+		pthread_cond_destroy( &p_reader->done );
+		pthread_mutex_destroy( &p_reader->lock );
+		p_reader->b_locks = FALSE;
+	}
+
+	if( p_reader->fd >= 0 )
+	{
+		close( p_reader->fd );
+		p_reader->fd = -1;
+	}
+
+	for( i = 0; i < READAHEAD_WINDOW; i++ )
+	{
+		if( p_reader->slots[ i ].p_buffer )
+		{
+			buffer_pool_release( p_reader->p_pool, p_reader->slots[ i ].p_buffer );
+			p_reader->slots[ i ].p_buffer = NULL;
+		}
+	}
+
+	p_reader->held = 0;
+}
+
+/* issue reads for every free slot, in file order starting after the consumer */
+void _readahead_fill( readahead_reader *p_reader )
+{
+	uint i;
+
+	for( i = 0; i < READAHEAD_WINDOW && _readahead_next_extent( p_reader ); i++ )
+	{
+		uint index             = (p_reader->head + i) % READAHEAD_WINDOW;
+		readahead_slot *p_slot = &p_reader->slots[ index ];
+		off_t remaining        = p_reader->extent_end - p_reader->next_offset; /* chunks never span extents */
+		boolean b_direct       = __atomic_load_n( &p_reader->b_direct, __ATOMIC_RELAXED ); /* pool threads may clear it */
+
+		if( p_slot->state != READAHEAD_EMPTY ) continue;
+
+		if( !p_slot->p_buffer )
+		{
+			/* issued slots stay contiguous from the head, so stopping here only narrows the window */
+			p_slot->p_buffer = p_reader->held == 0 ? buffer_pool_acquire( p_reader->p_pool ) : buffer_pool_try_acquire( p_reader->p_pool );
+
+			if( !p_slot->p_buffer ) break;
+			p_reader->held++;
+		}
+
+		p_slot->offset       = p_reader->next_offset;
+		p_slot->length       = remaining < READAHEAD_CHUNK_SIZE ? (size_t) remaining : READAHEAD_CHUNK_SIZE;
+		p_slot->filled       = 0;
+		p_slot->consumed     = 0;
+		p_slot->error        = 0;
+		p_slot->iov.iov_base = p_slot->p_buffer;
+		p_slot->iov.iov_len  = _readahead_request( p_slot->length, b_direct );
+		p_slot->state        = READAHEAD_PENDING;
+
+		p_slot->b_cached     = !b_direct;
+		p_slot->b_resident   = FALSE;
+
+		if( (p_reader->flags & READAHEAD_NOCACHE) && p_slot->b_cached )
+		{
+			_readahead_note_cache( p_reader, p_slot );
+		}
+
+		p_reader->next_offset += p_slot->length;
+
+		#ifdef _READAHEAD_HAVE_IO_URING
+		if( p_reader->b_uring )
+		{
+			p_reader->pending++;
+			_readahead_ring_read( p_reader, index );
+			continue;
+		}
+		#endif
+
+		pthread_mutex_lock( &p_reader->lock );
+		p_reader->pending++;
+		pthread_mutex_unlock( &p_reader->lock );
+
+		if( !_readahead_pool_submit( p_reader, index ) )
+		{
+			pthread_mutex_lock( &p_reader->lock );
+			p_slot->error = EAGAIN;
+			p_slot->state = READAHEAD_READY;
+			p_reader->pending--;
+			pthread_mutex_unlock( &p_reader->lock );
+		}
+	}
+
+	#ifdef _READAHEAD_HAVE_IO_URING
+	if( p_reader->b_uring && p_reader->ring.unsubmitted > 0 && !_readahead_ring_submit( &p_reader->ring, 0 ) )
+	{
+		p_reader->b_error = TRUE;
+	}
+	#endif
+}
+
+/* FALSE once every extent has been issued */
+boolean _readahead_next_extent( readahead_reader *p_reader )
+{
+	while( p_reader->next_offset >= p_reader->extent_end )
+	{
+		const readahead_extent *p_extent;
+
+		if( p_reader->extent_index + 1 >= p_reader->extent_count )
+		{
+			return FALSE;
+		}
+
+		p_extent = &p_reader->p_extents[ ++p_reader->extent_index ];
+		p_reader->next_offset = p_extent->offset;
+		p_reader->extent_end  = p_extent->offset + p_extent->length;
+	}
+
+	/* the file may have shrunk since it was mapped */
+	return p_reader->next_offset < p_reader->size;
+}
+
+boolean _readahead_wait( readahead_reader *p_reader, readahead_slot *p_slot )
+{
+	#ifdef _READAHEAD_HAVE_IO_URING
+	if( p_reader->b_uring )
+	{
+		while( p_slot->state == READAHEAD_PENDING )
+		{
+			if( !_readahead_ring_reap( p_reader, 1 ) ) return FALSE;
+		}
+
+		return p_slot->error == 0;
+	}
+	#endif
+
+	pthread_mutex_lock( &p_reader->lock );
+
+	while( p_slot->state == READAHEAD_PENDING )
+	{
+		pthread_cond_wait( &p_reader->done, &p_reader->lock );
+	}
+
+	pthread_mutex_unlock( &p_reader->lock );
+
+	return p_slot->error == 0;
+}
+
+void _readahead_drain( readahead_reader *p_reader )
+{
+	#ifdef _READAHEAD_HAVE_IO_URING
+	if( p_reader->b_uring )
+	{
+		while( p_reader->pending > 0 && _readahead_ring_reap( p_reader, 1 ) )
+			;
+		return;
+	}
+	#endif
+
+	if( !p_reader->b_locks ) return; /* the pool never saw this reader */
+
+	pthread_mutex_lock( &p_reader->lock );
+
+	while( p_reader->pending > 0 )
+	{
+		pthread_cond_wait( &p_reader->done, &p_reader->lock );
+	}
+
+	pthread_mutex_unlock( &p_reader->lock );
+}
+
+/* FALSE with errno set; the ring may lack openat/statx even though reads work */
+boolean _readahead_open_file( readahead_reader *p_reader, const char *s_filename, int flags )
+{
+	struct stat info;
+
+	#ifdef _READAHEAD_HAVE_URING_OPEN
+	if( p_reader->b_uring && _readahead_ring_open( p_reader, s_filename, flags ) )
+	{
+		return TRUE;
+	}
+	#endif
+
+	p_reader->fd = open( s_filename, O_RDONLY | O_CLOEXEC | flags );
+
+	if( p_reader->fd < 0 )
+	{
+		return FALSE;
+	}
+
+	if( fstat( p_reader->fd, &info ) != 0 )
+	{
+		int error = errno;
+
+		close( p_reader->fd );
+		p_reader->fd = -1;
+		errno = error;
+		return FALSE;
+	}
+
+	p_reader->size = info.st_size;
+
+	return TRUE;
+}
+
+/* bytes to ask for when length more are wanted; O_DIRECT only reads whole blocks */
+size_t _readahead_request( size_t length, boolean b_direct )
+{
+	if( b_direct )
+	{
+		return (length + READAHEAD_ALIGNMENT - 1) & ~((size_t) READAHEAD_ALIGNMENT - 1);
+	}
+
+	return length;
+}
+
+/*
+ * Some filesystems accept O_DIRECT at open and refuse the reads (or a
+ * short read leaves us unaligned). Carry on through the page cache; the
+ * NOCACHE release still drops what we pull in. Safe to call twice.
+ */
+boolean _readahead_undirect( readahead_reader *p_reader )
+{
+	int flags = fcntl( p_reader->fd, F_GETFL );
+
+	if( flags < 0 || fcntl( p_reader->fd, F_SETFL, flags & ~O_DIRECT ) != 0 )
+	{
+		return FALSE;
+	}
+
+	__atomic_store_n( &p_reader->b_direct, FALSE, __ATOMIC_RELAXED );
+
+	return TRUE;
+}
+
+/* remember which pages of the chunk were cached before we read it */
+void _readahead_note_cache( readahead_reader *p_reader, readahead_slot *p_slot )
+{
+	#ifdef __linux__
+	long page_size = sysconf( _SC_PAGESIZE );
+	void *p_map;
+
+	if( page_size < READAHEAD_ALIGNMENT || p_slot->offset % page_size != 0 )
+	{
+		return;
+	}
+
+	p_map = mmap( NULL, p_slot->length, PROT_READ, MAP_SHARED, p_reader->fd, p_slot->offset );
+
+	if( p_map != MAP_FAILED )
+	{
+		p_slot->b_resident = mincore( p_map, p_slot->length, p_slot->resident ) == 0;
+		munmap( p_map, p_slot->length );
+	}
+	#endif
+}
+
+/* drop the pages of a consumed chunk that were not cached before we read it */
+void _readahead_drop_cache( readahead_reader *p_reader, readahead_slot *p_slot )
+{
+	#ifdef POSIX_FADV_DONTNEED
+	long page_size = sysconf( _SC_PAGESIZE );
+	size_t pages;
+	size_t i = 0;
+
+	if( !p_slot->b_resident || page_size <= 0 )
+	{
+		/* no record of what was there: dropping is still better than evicting the service */
+		posix_fadvise( p_reader->fd, p_slot->offset, (off_t) p_slot->length, POSIX_FADV_DONTNEED );
+		return;
+	}
+
+	pages = (p_slot->length + (size_t) page_size - 1) / (size_t) page_size;
+
+	while( i < pages )
+	{
+		size_t first;
+
+		while( i < pages && (p_slot->resident[ i ] & 1) ) i++;
+		first = i;
+		while( i < pages && !(p_slot->resident[ i ] & 1) ) i++;
+
+		if( i > first )
+		{
+			posix_fadvise( p_reader->fd, p_slot->offset + (off_t) (first * (size_t) page_size), (off_t) ((i - first) * (size_t) page_size), POSIX_FADV_DONTNEED );
+		}
+	}
+	#endif
+}
+
+void _readahead_pool_start( void )
+{
+	uint i;
+
+	for( i = 0; i < READAHEAD_POOL_THREADS; i++ )
+	{
+		if( pthread_create( &pool.threads[ i ], NULL, _readahead_pool_thread, NULL ) != 0 ) break;
+		pthread_detach( pool.threads[ i ] );
+	}
+
+	pool.thread_count = i;
+}
+
+boolean _readahead_pool_submit( readahead_reader *p_reader, uint slot )
+{
+	if( pool.thread_count == 0 )
+	{
+		return FALSE;
+	}
+
+	pthread_mutex_lock( &pool.lock );
+
+	while( pool.count == READAHEAD_POOL_QUEUE )
+	{
+		pthread_cond_wait( &pool.not_full, &pool.lock );
+	}
+
+	pool.jobs[ (pool.head + pool.count) % READAHEAD_POOL_QUEUE ].p_reader = p_reader;
+	pool.jobs[ (pool.head + pool.count) % READAHEAD_POOL_QUEUE ].slot     = slot;
+	pool.count++;
+
+	pthread_cond_signal( &pool.not_empty );
+	pthread_mutex_unlock( &pool.lock );
+
+	return TRUE;
+}
+
+void* _readahead_pool_thread( void *data )
+{
+	(void) data;
+
+	for( ;; )
+	{
+		readahead_job job;
+		readahead_slot *p_slot;
+		int error = 0;
+
+		pthread_mutex_lock( &pool.lock );
+
+		while( pool.count == 0 )
+		{
+			pthread_cond_wait( &pool.not_empty, &pool.lock );
+		}
+
+		job        = pool.jobs[ pool.head ];
+		pool.head  = (pool.head + 1) % READAHEAD_POOL_QUEUE;
+		pool.count--;
+
+		pthread_cond_signal( &pool.not_full );
+		pthread_mutex_unlock( &pool.lock );
+
+		p_slot = &job.p_reader->slots[ job.slot ];
+
+		/* only this thread touches the buffer until the slot is marked ready */
+		while( p_slot->filled < p_slot->length )
+		{
+			boolean b_direct = __atomic_load_n( &job.p_reader->b_direct, __ATOMIC_RELAXED );
+			size_t request   = _readahead_request( p_slot->length - p_slot->filled, b_direct );
+			ssize_t n        = pread( job.p_reader->fd, p_slot->p_buffer + p_slot->filled, request, p_slot->offset + (off_t) p_slot->filled );
+
+			if( n < 0 && errno == EINTR ) continue;
+
+			if( n < 0 && errno == EINVAL && b_direct && _readahead_undirect( job.p_reader ) )
+			{
+				p_slot->b_cached = TRUE;
+				continue;
+			}
+
+			if( n < 0 ) error = errno;
+			if( n <= 0 ) break;
+
+			p_slot->filled += (size_t) n;
+		}
+
+		/* O_DIRECT reads whole blocks; the file may have grown since the stat */
+		if( p_slot->filled > p_slot->length ) p_slot->filled = p_slot->length;
+
+		pthread_mutex_lock( &job.p_reader->lock );
+		p_slot->error = error;
+		p_slot->state = READAHEAD_READY;
+		job.p_reader->pending--;
+		pthread_cond_broadcast( &job.p_reader->done );
+		pthread_mutex_unlock( &job.p_reader->lock );
+	}
+
+	return NULL;
+}
+
+#ifdef _READAHEAD_HAVE_IO_URING
+boolean _readahead_ring_create( readahead_ring *p_ring, uint entries )
+{
+	struct io_uring_params params;
+
+	memset( &params, 0, sizeof(params) );
+
+	p_ring->fd = (int) syscall( __NR_io_uring_setup, entries, &params );
+
+	if( p_ring->fd < 0 )
+	{
+		return FALSE;
+	}
+
+	p_ring->entries   = params.sq_entries;
+	p_ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(uint);
+	p_ring->cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	p_ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	#ifdef IORING_FEAT_SINGLE_MMAP
+	if( params.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		if( p_ring->cq_size > p_ring->sq_size ) p_ring->sq_size = p_ring->cq_size;
+		p_ring->cq_size = 0;
+	}
+	#endif
+
+	p_ring->p_sq = mmap( NULL, p_ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_SQ_RING );
+	p_ring->p_cq = p_ring->cq_size == 0 ? p_ring->p_sq :
+	               mmap( NULL, p_ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_CQ_RING );
+	p_ring->p_sqes = mmap( NULL, p_ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, p_ring->fd, IORING_OFF_SQES );
+
+	if( p_ring->p_sq == MAP_FAILED || p_ring->p_cq == MAP_FAILED || p_ring->p_sqes == MAP_FAILED )
+	{
+		_readahead_ring_destroy( p_ring );
+		errno = ENOMEM;
+		return FALSE;
+	}
+
+	p_ring->p_sq_head  = (uint *) ((byte *) p_ring->p_sq + params.sq_off.head);
+	p_ring->p_sq_tail  = (uint *) ((byte *) p_ring->p_sq + params.sq_off.tail);
+	p_ring->p_sq_mask  = (uint *) ((byte *) p_ring->p_sq + params.sq_off.ring_mask);
+	p_ring->p_sq_array = (uint *) ((byte *) p_ring->p_sq + params.sq_off.array);
+	p_ring->p_cq_head  = (uint *) ((byte *) p_ring->p_cq + params.cq_off.head);
+	p_ring->p_cq_tail  = (uint *) ((byte *) p_ring->p_cq + params.cq_off.tail);
+	p_ring->p_cq_mask  = (uint *) ((byte *) p_ring->p_cq + params.cq_off.ring_mask);
+	p_ring->p_cqes     = (byte *) p_ring->p_cq + params.cq_off.cqes;
+
+	return TRUE;
+}
+
+void _readahead_ring_destroy( readahead_ring *p_ring )
+{
+	if( p_ring->p_sqes && p_ring->p_sqes != MAP_FAILED ) munmap( p_ring->p_sqes, p_ring->sqes_size );
+	if( p_ring->cq_size > 0 && p_ring->p_cq && p_ring->p_cq != MAP_FAILED ) munmap( p_ring->p_cq, p_ring->cq_size );
+	if( p_ring->p_sq && p_ring->p_sq != MAP_FAILED ) munmap( p_ring->p_sq, p_ring->sq_size );
+
+	close( p_ring->fd );
+	memset( p_ring, 0, sizeof(readahead_ring) );
+	p_ring->fd = -1;
+}
+
+/* the next free submission entry, cleared; NULL when the ring is full */
+struct io_uring_sqe* _readahead_ring_sqe( readahead_ring *p_ring )
+{
+	uint head = __atomic_load_n( p_ring->p_sq_head, __ATOMIC_ACQUIRE );
+	uint tail = *p_ring->p_sq_tail + p_ring->unsubmitted; /* entries are published by _readahead_ring_submit() */
+	uint index;
+	struct io_uring_sqe *p_sqe;
+
+	if( tail - head >= p_ring->entries )
+	{
+		return NULL;
+	}
+
+	index = tail & *p_ring->p_sq_mask;
+	p_sqe = &((struct io_uring_sqe *) p_ring->p_sqes)[ index ];
+	memset( p_sqe, 0, sizeof(struct io_uring_sqe) );
+
+	p_ring->p_sq_array[ index ] = index;
+	p_ring->unsubmitted++;
+
+	/* the kernel sees the entry once the tail moves past it; callers fill it first */
+	return p_sqe;
+}
+
+boolean _readahead_ring_submit( readahead_ring *p_ring, uint wait )
+{
+	int result;
+
+	__atomic_store_n( p_ring->p_sq_tail, *p_ring->p_sq_tail + p_ring->unsubmitted, __ATOMIC_RELEASE );
+	p_ring->unsubmitted = 0;
+
+	for( ;; )
+	{
+		/* whatever an interrupted call did not get to is still in the ring */
+		uint submit = *p_ring->p_sq_tail - __atomic_load_n( p_ring->p_sq_head, __ATOMIC_ACQUIRE );
+
+		result = (int) syscall( __NR_io_uring_enter, p_ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+
+		if( result >= 0 || errno != EINTR ) break;
+	}
+
+	return result >= 0;
+}
+
+boolean _readahead_ring_reap( readahead_reader *p_reader, uint wait )
+{
+	readahead_ring *p_ring = &p_reader->ring;
+	uint head              = *p_ring->p_cq_head;
+	uint tail              = __atomic_load_n( p_ring->p_cq_tail, __ATOMIC_ACQUIRE );
+
+	if( head == tail && wait > 0 )
+	{
+		if( !_readahead_ring_submit( p_ring, wait ) ) return FALSE;
+		tail = __atomic_load_n( p_ring->p_cq_tail, __ATOMIC_ACQUIRE );
+	}
+
+	while( head != tail )
+	{
+		const struct io_uring_cqe *p_cqe = &((const struct io_uring_cqe *) p_ring->p_cqes)[ head & *p_ring->p_cq_mask ];
+
+		if( p_cqe->user_data < READAHEAD_WINDOW )
+		{
+			_readahead_ring_complete( p_reader, (uint) p_cqe->user_data, p_cqe->res );
+		}
+
+		head++;
+	}
+
+	__atomic_store_n( p_ring->p_cq_head, head, __ATOMIC_RELEASE );
+
+	/* short reads queued their remainder */
+	if( p_ring->unsubmitted > 0 && !_readahead_ring_submit( p_ring, 0 ) )
+	{
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void _readahead_ring_read( readahead_reader *p_reader, uint slot )
+{
+	readahead_slot *p_slot = &p_reader->slots[ slot ];
+	struct io_uring_sqe *p_sqe;
+
+	p_sqe = _readahead_ring_sqe( &p_reader->ring );
+
+	if( !p_sqe )
+	{
+		/* cannot happen with twice the window in entries, but never hang on it */
+		p_slot->error = EAGAIN;
+		p_slot->state = READAHEAD_READY;
+		p_reader->pending--;
+		return;
+	}
+
+	p_sqe->opcode    = IORING_OP_READV;
+	p_sqe->fd        = p_reader->fd;
+	p_sqe->addr      = (uint64_t) (uintptr_t) &p_slot->iov;
+	p_sqe->len       = 1;
+	p_sqe->off       = (uint64_t) (p_slot->offset + (off_t) p_slot->filled);
+	p_sqe->user_data = slot;
+}
+
+void _readahead_ring_complete( readahead_reader *p_reader, uint slot, int result )
+{
+	readahead_slot *p_slot = &p_reader->slots[ slot ];
+
+	if( result == -EINTR || result == -EAGAIN )
+	{
+		_readahead_ring_read( p_reader, slot );
+		return;
+	}
+
+	if( result == -EINVAL && !p_slot->b_cached && _readahead_undirect( p_reader ) )
+	{
+		p_slot->b_cached     = TRUE;
+		p_slot->iov.iov_len  = p_slot->length - p_slot->filled;
+		_readahead_ring_read( p_reader, slot );
+		return;
+	}
+
+	if( result > 0 )
+	{
+		p_slot->filled += (size_t) result;
+
+		/* O_DIRECT reads whole blocks; the file may have grown since the stat */
+		if( p_slot->filled > p_slot->length ) p_slot->filled = p_slot->length;
+
+		p_slot->iov.iov_base = p_slot->p_buffer + p_slot->filled;
+		p_slot->iov.iov_len  = _readahead_request( p_slot->length - p_slot->filled, p_reader->b_direct );
+
+		if( p_slot->filled < p_slot->length )
+		{
+			_readahead_ring_read( p_reader, slot );
+			return;
+		}
+	}
+	else if( result < 0 )
+	{
+		p_slot->error = -result;
+	}
+
+	p_slot->state = READAHEAD_READY;
+	p_reader->pending--;
+}
+#endif /* _READAHEAD_HAVE_IO_URING */
+
+#ifdef _READAHEAD_HAVE_URING_OPEN
+/* one request, submitted and waited for; returns its result */
+int _readahead_ring_call( readahead_ring *p_ring, struct io_uring_sqe *p_sqe )
+{
+	const struct io_uring_cqe *p_cqe;
+	uint head;
+	int result;
+
+	p_sqe->user_data = READAHEAD_OPEN_DATA;
+
+	if( !_readahead_ring_submit( p_ring, 1 ) )
+	{
+		return -errno;
+	}
+
+	head   = *p_ring->p_cq_head;
+	p_cqe  = &((const struct io_uring_cqe *) p_ring->p_cqes)[ head & *p_ring->p_cq_mask ];
+	result = p_cqe->res;
+	__atomic_store_n( p_ring->p_cq_head, head + 1, __ATOMIC_RELEASE );
+
+	return result;
+}
+
+/* FALSE leaves the open to the caller */
+boolean _readahead_ring_open( readahead_reader *p_reader, const char *s_filename, int flags )
+{
+	struct io_uring_sqe *p_sqe;
+	struct statx info;
+	int result;
+
+	p_sqe = _readahead_ring_sqe( &p_reader->ring );
+	if( !p_sqe ) return FALSE;
+
+	p_sqe->opcode     = IORING_OP_OPENAT;
+	p_sqe->fd         = AT_FDCWD;
+	p_sqe->addr       = (uint64_t) (uintptr_t) s_filename;
+	p_sqe->open_flags = O_RDONLY | O_CLOEXEC | flags;
+
+	result = _readahead_ring_call( &p_reader->ring, p_sqe );
+
+	if( result < 0 )
+	{
+		errno = -result;
+		return FALSE;
+	}
+
+	p_reader->fd = result;
+
+	p_sqe = _readahead_ring_sqe( &p_reader->ring );
+	if( !p_sqe ) return FALSE;
+
+	p_sqe->opcode      = IORING_OP_STATX;
+	p_sqe->fd          = p_reader->fd;
+	p_sqe->addr        = (uint64_t) (uintptr_t) "";
+	p_sqe->len         = STATX_SIZE;
+	p_sqe->off         = (uint64_t) (uintptr_t) &info;
+	p_sqe->statx_flags = AT_EMPTY_PATH;
+
+	result = _readahead_ring_call( &p_reader->ring, p_sqe );
+
+	if( result < 0 )
+	{
+		close( p_reader->fd );
+		p_reader->fd = -1;
+		errno = -result;
+		return FALSE;
+	}
+
+	p_reader->size = (off_t) info.stx_size;
+
+	return TRUE;
+}
+#endif /* _READAHEAD_HAVE_URING_OPEN */
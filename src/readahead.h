@@ -0,0 +1,120 @@
+#ifndef _READAHEAD_H_
+#define _READAHEAD_H_
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "types.h"
+#include "bufpool.h"
+
+/*
+ * Sequential file reader that keeps a window of chunk sized reads in
+ * flight ahead of the consumer, so a slow disk is waited on while the
+ * network is busy rather than after. The file is opened and statted
+ * through the same io_uring when the kernel has one; otherwise reads
+ * go to a small pread(2) thread pool shared by every reader.
+ *
+ * A reader is meant for one thread (an upload's cURL callback); use one
+ * reader per file.
+ *
+ * Chunk buffers come from the shared buffer pool and go back as soon as
+ * they are consumed. When the pool runs low a reader reads ahead less;
+ * a reader with nothing in flight waits for a buffer.
+ */
+#define READAHEAD_CHUNK_SIZE    (256 * 1024)  /* multiple of the alignment */
+#define READAHEAD_WINDOW        (8)           /* chunks in flight per file */
+#define READAHEAD_ALIGNMENT     (4096)
+#define READAHEAD_POOL_THREADS  (4)
+
+/*
+ * READAHEAD_NOCACHE leaves the page cache the way it was found, for
+ * backups of hot data on busy hosts. Reads use O_DIRECT; filesystems
+ * that refuse it are read through the cache, and pages the reader
+ * brought in are dropped (POSIX_FADV_DONTNEED) once consumed. Pages
+ * that were cached before are not touched. The atime is not updated
+ * either (O_NOATIME) when the file's owner allows it.
+ */
+#define READAHEAD_NOCACHE       (1 << 0)
+
+/* part of the file to read; by default the whole file is one extent */
+typedef struct tag_readahead_extent {
+	off_t offset;
+	off_t length;
+} readahead_extent;
+
+typedef enum {
+	READAHEAD_EMPTY = 0,
+	READAHEAD_PENDING,
+	READAHEAD_READY,
+} readahead_state;
+
+typedef struct tag_readahead_slot {
+	byte *p_buffer;         /* from the buffer pool while the slot is in use */
+	off_t offset;
+	size_t length;          /* asked for */
+	size_t filled;          /* arrived so far; less than length only at the end of file */
+	size_t consumed;
+	int error;              /* errno of a failed read */
+	struct iovec iov;       /* the part still to be read */
+	readahead_state state;
+	boolean b_cached;       /* went through the page cache (NOCACHE without O_DIRECT) */
+	boolean b_resident;     /* resident[] was filled before the read */
+	byte resident[ READAHEAD_CHUNK_SIZE / READAHEAD_ALIGNMENT ]; /* mincore(2) per page */
+} readahead_slot;
+
+/* raw io_uring, mapped without liburing */
+typedef struct tag_readahead_ring {
+	int fd;
+	uint entries;
+	void *p_sq;
+	size_t sq_size;
+	void *p_cq;             /* same mapping as p_sq on newer kernels */
+	size_t cq_size;
+	void *p_sqes;
+	size_t sqes_size;
+	uint *p_sq_head;
+	uint *p_sq_tail;
+	uint *p_sq_mask;
+	uint *p_sq_array;
+	uint *p_cq_head;
+	uint *p_cq_tail;
+	uint *p_cq_mask;
+	void *p_cqes;
+	uint unsubmitted;
+} readahead_ring;
+
+typedef struct tag_readahead_reader {
+	int fd;
+	off_t size;
+	off_t next_offset;      /* where the next read will be issued */
+	off_t extent_end;       /* end of the extent next_offset is in */
+	const readahead_extent *p_extents;
+	size_t extent_count;
+	size_t extent_index;
+	boolean b_started;      /* reads are issued from the first readahead_read() on */
+	uint head;              /* slot the consumer reads from */
+	uint pending;           /* reads in flight */
+	uint flags;
+	boolean b_direct;       /* O_DIRECT took; cleared if the filesystem balks later */
+	boolean b_uring;
+	boolean b_error;
+	readahead_ring ring;
+	pthread_mutex_t lock;   /* pool completions */
+	pthread_cond_t done;
+	boolean b_locks;        /* lock and done are initialized */
+	buffer_pool *p_pool;    /* slot buffers */
+	uint held;              /* slots holding a buffer */
+	readahead_slot slots[ READAHEAD_WINDOW ];
+} readahead_reader;
+
+boolean readahead_open  ( readahead_reader *p_reader, const char *s_filename, uint flags, /*out*/ off_t *p_size );
+ssize_t readahead_read  ( readahead_reader *p_reader, void *p_buffer, size_t size ); /* 0 at the end, -1 on error */
+/* read only these, in order, back to back; call before the first read, the array must outlive the reader */
+void    readahead_set_extents ( readahead_reader *p_reader, const readahead_extent *p_extents, size_t count );
+void    readahead_close ( readahead_reader *p_reader );
+
+#define readahead_uses_uring( p_reader )    ((p_reader)->b_uring)
+#define readahead_failed( p_reader )        ((p_reader)->b_error)
+
+#endif /* _READAHEAD_H_ */
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <openssl/sha.h>
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
@@ -9,7 +10,13 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include "base64.h"
+#include "log.h"
 #include "s3.h"
+#include "strip.h"
+#include "readahead.h"
+#include "sparse.h"
+#include "trace.h"
+#include "endpoint.h"
 
 #define S3_HOSTNAME          "s3.amazonaws.com"
 #define S3_USERAGENT         "Shrewd LLC/S3"
@@ -19,13 +26,31 @@ typedef struct sMemoryBuffer {
 	size_t size;
 } MemoryBuffer;
 
+typedef struct sMemoryReader {
+	const byte *buffer;
+	size_t size;
+	size_t offset;
+} MemoryReader;
+
+typedef struct sPrefixReader {
+	readahead_reader *p_source;
+	profiler *p_profiler;
+	const byte *p_prefix;              /* sent before the source: buffer, or a sparse header */
+	byte buffer[ MIME_SNIFF_LENGTH ];  /* already read while sniffing */
+	size_t length;
+	size_t offset;
+} PrefixReader;
+
 /* path sanity checks */
 /* JoeM: Previously we allowed empty strings (i.e. "") */
 #define s3_is_path_valid( s_path )                  ((s_path) && strlen((s_path)) > 0)
 
 
 
+/* libxml is set up on the first response parsed, and torn down with the last S3 */
 static uint s3_initialization_count = 0;
+static boolean s3_xml_initialized = FALSE;
+static pthread_mutex_t s3_initialization_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* file size helper */
 size_t file_size_from_pointer( FILE *p_file, boolean b_keep_open );
@@ -34,6 +59,16 @@ size_t  _s3_list_buckets_handle_response  ( void *ptr, size_t size, size_t nmemb
 boolean _s3_list_buckets_process_response ( const S3 *p_s3, const MemoryBuffer *p_memory );
 void    _print_s3_buckets( FILE *output, xmlDocPtr doc, xmlNodeSetPtr nodes );
 void    _debug_dump_response( FILE *p_output, const MemoryBuffer *p_memory ); 
+/* cURL Read Handlers */
+size_t  _s3_put_handle_read ( void *ptr, size_t size, size_t nmemb, void *data );
+size_t  _s3_put_handle_prefix_read ( void *ptr, size_t size, size_t nmemb, void *data );
+boolean _s3_put_object      ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *mime_type, const char *s_amz_header, size_t l_size, char *s_etag );
+size_t  _s3_put_handle_header ( void *ptr, size_t size, size_t nmemb, void *data );
+boolean _s3_lister_fetch      ( S3Lister *p_lister );
+boolean _s3_lister_process_response ( S3Lister *p_lister, const MemoryBuffer *p_memory );
+void    _s3_xml_initialize  ( void );
+const char* _s3_hostname    ( const S3 *p_s3 );
+void    _s3_endpoint_report ( const S3 *p_s3, const char *s_hostname, CURL *p_curl, boolean b_upload );
 
 
 void s3_initialize( S3 *p_s3, const char *access_id, const char *secret_key, boolean verbose )
@@ -41,37 +76,89 @@ void s3_initialize( S3 *p_s3, const char *access_id, const char *secret_key, boo
 	strncpy( p_s3->s_aws_access_id,  access_id,  sizeof(p_s3->s_aws_access_id) );
 	strncpy( p_s3->s_aws_secret_key, secret_key, sizeof(p_s3->s_aws_secret_key) );
 	p_s3->b_verbose = verbose;
+	p_s3->b_strip_metadata = FALSE;
+	p_s3->p_mime_table = NULL;
+	p_s3->p_profiler = NULL;
+	p_s3->b_cache_neutral = FALSE;
+	p_s3->b_sparse = FALSE;
+	p_s3->p_endpoints = NULL;
 	
-	if( s3_initialization_count <= 0 )
-	{
-		/* Init libxml */     
-		xmlInitParser( );
-		s3_initialization_count++;
-	}
+	pthread_mutex_lock( &s3_initialization_lock );
+	s3_initialization_count++;
+	pthread_mutex_unlock( &s3_initialization_lock );
 }
 
 void s3_deinitialize( void )
 {
-	if( s3_initialization_count > 0 )
+	pthread_mutex_lock( &s3_initialization_lock );
+
+	if( s3_initialization_count > 0 && --s3_initialization_count == 0 && s3_xml_initialized )
 	{
 		/* Shutdown libxml */
 		xmlCleanupParser();
-		s3_initialization_count--;
+		s3_xml_initialized = FALSE;
+	}
+
+	pthread_mutex_unlock( &s3_initialization_lock );
+}
+
+/* deletes and puts never parse XML, so they never pay for this */
+void _s3_xml_initialize( void )
+{
+	pthread_mutex_lock( &s3_initialization_lock );
+
+	if( !s3_xml_initialized )
+	{
+		/* Init libxml */
+		xmlInitParser( );
+		s3_xml_initialized = TRUE;
 	}
+
+	pthread_mutex_unlock( &s3_initialization_lock );
+}
+
+/* the fastest candidate endpoint when there are any, else the global one */
+const char* _s3_hostname( const S3 *p_s3 )
+{
+	const char *s_hostname = p_s3->p_endpoints ? endpoint_current( p_s3->p_endpoints ) : NULL;
+
+	return s_hostname ? s_hostname : S3_HOSTNAME;
+}
+
+/* 4xx is our fault, not the endpoint's; only no answer or 5xx count against it */
+void _s3_endpoint_report( const S3 *p_s3, const char *s_hostname, CURL *p_curl, boolean b_upload )
+{
+	curl_off_t first_byte = 0;
+	int i_response_code;
+
+	if( !p_s3->p_endpoints )
+	{
+		return;
+	}
+
+	/* an upload's first byte waits for the whole body, so its time says nothing */
+	if( !b_upload )
+	{
+		curl_easy_getinfo( p_curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte );
+	}
+
+	i_response_code = s3_response_code( p_curl );
+	endpoint_report( p_s3->p_endpoints, s_hostname, (uint64_t) first_byte * 1000, i_response_code > 0 && i_response_code < 500 );
 }
 
 void s3_format_time( /*out*/ char *s_destination_string, size_t length )
 {
-	time_t ts     = time( NULL );
-	struct tm *tm = gmtime( &ts );
+	time_t ts = time( NULL );
+	struct tm tm;
 
 	assert( s_destination_string );
-	
-	strftime( s_destination_string, length, "%a, %d %b %Y %H:%M:%S +0000", tm );
+
+	gmtime_r( &ts, &tm ); /* uploads may run on several threads */
+	strftime( s_destination_string, length, "%a, %d %b %Y %H:%M:%S +0000", &tm );
 }
 
-/* caller must free returned pointer */
-const byte *s3_sign( const S3 *p_s3, const char* s_sign_string )
+/* writes the base64 encoded signature into s_signature */
+boolean s3_sign( const S3 *p_s3, const char* s_sign_string, /*out*/ char *s_signature, size_t length )
 {
 	byte signature_plain[ EVP_MAX_MD_SIZE ];
 	unsigned int ret_size 	= 0;
@@ -79,6 +166,9 @@ const byte *s3_sign( const S3 *p_s3, const char* s_sign_string )
 
 	assert( p_s3 );
 	assert( s_sign_string );
+	assert( s_signature );
+
+	TRACE1( s3_sign_start, s_sign_string );
 
 	/* create signature */
 	HMAC_Init( &hmac, p_s3->s_aws_secret_key, strlen(p_s3->s_aws_secret_key), EVP_sha1() );
@@ -88,13 +178,21 @@ const byte *s3_sign( const S3 *p_s3, const char* s_sign_string )
 	/* JoeM: Let's be cautious and watch out for buffer overruns. */
 	assert( ret_size < EVP_MAX_MD_SIZE ); 
 
-	/* base64 encode signature */
-	const byte *signature_base64 = base64( signature_plain, (size_t) ret_size );
-	
 	/* cleanup */
 	HMAC_cleanup( &hmac );
 
-	return signature_base64; // this must be freed
+	if( base64_encoded_length(ret_size) + 1 > length )
+	{
+		TRACE2( s3_sign_done, s_sign_string, 0 );
+		return FALSE;
+	}
+
+	/* base64 encode signature */
+	base64_encode( signature_plain, (size_t) ret_size, s_signature );
+
+	TRACE2( s3_sign_done, s_sign_string, 1 );
+
+	return TRUE;
 }
 
 
@@ -120,10 +218,14 @@ boolean s3_list_buckets( CURL *p_curl, const S3 *p_s3 )
 	char url[ 1024 ];
 	#endif
 	MemoryBuffer chunk;
+	const char *s_hostname;
 
 	assert( p_curl );
 	assert( p_s3 );
 	memset( &chunk, 0, sizeof(MemoryBuffer) );
+
+	s_hostname = _s3_hostname( p_s3 );
+	TRACE1( s3_list_buckets_start, s_hostname );
 	
 	/* Prepare data */
 	{
@@ -142,10 +244,10 @@ boolean s3_list_buckets( CURL *p_curl, const S3 *p_s3 )
 		/* build URL */
 		{
 			#ifdef _S3_CURL_COPIES_STRINGS
-			snprintf( buffer, sizeof(buffer), "https://%s/", S3_HOSTNAME );
+			snprintf( buffer, sizeof(buffer), "https://%s/", s_hostname );
 			curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
 			#else
-			snprintf( url, sizeof(url), "https://%s/", S3_HOSTNAME );
+			snprintf( url, sizeof(url), "https://%s/", s_hostname );
 			curl_easy_setopt( p_curl, CURLOPT_URL, url );
 			#endif
 		}
@@ -162,10 +264,10 @@ boolean s3_list_buckets( CURL *p_curl, const S3 *p_s3 )
 			{
 				snprintf( buffer, sizeof(buffer), "GET\n\n\n%s\n/", format_time );
 				/* sign and base64 encode signature */
-				const byte *signature_base64 = s3_sign( p_s3, buffer /* PUT string */ );
+				char signature_base64[ S3_MAX_SIGNATURE ];
+				s3_sign( p_s3, buffer /* PUT string */, signature_base64, sizeof(signature_base64) );
 				snprintf( buffer, sizeof(buffer), "Authorization: AWS %s:%s", p_s3->s_aws_access_id, signature_base64 );
 				headerlist = curl_slist_append( headerlist, buffer /* Authorization header */ );
-				free( (byte *) signature_base64 ); /* signature cleanup */
 			}
 
 			curl_easy_setopt( p_curl, CURLOPT_HTTPHEADER, headerlist );
@@ -176,7 +278,7 @@ boolean s3_list_buckets( CURL *p_curl, const S3 *p_s3 )
 
 		if( res != 0 )
 		{
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "%s:%d: Error performing curl request (res = %d, err = %.1024s).\n", __FUNCTION__, __LINE__, res, curl_err );			
+			if( s3_is_verbose(p_s3) ) log_error( "Error performing curl request (res = %d, err = %.1024s).", res, curl_err );			
 			b_result = FALSE;
 		}	
 
@@ -185,10 +287,14 @@ boolean s3_list_buckets( CURL *p_curl, const S3 *p_s3 )
 		if( i_response_code != 200 )
 		{
 			/* did we not get 200? */
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "%s:%d: Wrong HTTP response while talking to S3 host (res = %d).\n", __FUNCTION__, __LINE__, i_response_code );			
+			if( s3_is_verbose(p_s3) ) log_error( "Wrong HTTP response while talking to S3 host (res = %d).", i_response_code );			
 			b_result = FALSE;
 		}
 
+		_s3_endpoint_report( p_s3, s_hostname, p_curl, FALSE );
+
+		TRACE3( s3_list_buckets_done, (uint64_t) chunk.size, i_response_code, b_result );
+
 		/* cleanup */
 		curl_slist_free_all( headerlist );
 		#ifdef _DEBUG
@@ -234,10 +340,11 @@ boolean _s3_list_buckets_process_response ( const S3 *p_s3, const MemoryBuffer *
 	assert( p_memory );
 
 	/* Load XML document */
+	_s3_xml_initialize( );
 	doc = xmlParseMemory( (char *) p_memory->buffer, p_memory->size );
 	if( doc == NULL )
 	{
-		if( s3_is_verbose(p_s3) ) fprintf( stderr, "Error: unable to parse memory buffer.\n" );
+		if( s3_is_verbose(p_s3) ) log_error( "Unable to parse memory buffer." );
 		return FALSE;
 	}
 
@@ -245,7 +352,7 @@ boolean _s3_list_buckets_process_response ( const S3 *p_s3, const MemoryBuffer *
 	xpathCtx = xmlXPathNewContext( doc );
 	if( xpathCtx == NULL )
 	{
-		if( s3_is_verbose(p_s3) ) fprintf( stderr,"Error: unable to create new XPath context\n" );
+		if( s3_is_verbose(p_s3) ) log_error( "Unable to create new XPath context" );
 		xmlFreeDoc( doc );
 		return FALSE;
 	}
@@ -255,7 +362,7 @@ boolean _s3_list_buckets_process_response ( const S3 *p_s3, const MemoryBuffer *
 	const char *href = "http://s3.amazonaws.com/doc/2006-03-01/";
 	if( xmlXPathRegisterNs(xpathCtx, BAD_CAST prefix, BAD_CAST href) != 0 )
 	{
-		if( s3_is_verbose(p_s3) ) fprintf( stderr,"Error: unable to register NS with prefix=\"%s\" and href=\"%s\"\n", prefix, href );
+		if( s3_is_verbose(p_s3) ) log_error( "Unable to register NS with prefix=\"%s\" and href=\"%s\"", prefix, href );
 		xmlXPathFreeContext( xpathCtx );
 		xmlFreeDoc( doc );
 		return FALSE;
@@ -265,7 +372,7 @@ boolean _s3_list_buckets_process_response ( const S3 *p_s3, const MemoryBuffer *
 	xpathObj = xmlXPathEvalExpression( BAD_CAST "//aws:Bucket", xpathCtx );
 	if( xpathObj == NULL )
 	{
-		if( s3_is_verbose(p_s3) ) fprintf( stderr,"Error: unable to evaluate xpath expression.\n" );
+		if( s3_is_verbose(p_s3) ) log_error( "Unable to evaluate xpath expression." );
 		xmlXPathFreeContext( xpathCtx );
 		xmlFreeDoc( doc );
 		return FALSE;
@@ -342,19 +449,20 @@ void _debug_dump_response( FILE *p_output, const MemoryBuffer *p_memory )
 	fprintf( p_output, "------------------------------------------------\n" );
 }
 
-boolean s3_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *s_filename, const char *mime_type )
+boolean s3_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *s_filename, const char *mime_type, char *s_etag )
 {
-	char curl_err[ CURL_ERROR_SIZE ];
-    char format_time[ 128 ];
-	char buffer[ 1024 ];
-	#ifndef _S3_CURL_COPIES_STRINGS
-	char url[ 1024 ];
-	#endif
-	struct curl_slist *headerlist = NULL;
 	FILE *fd_tmp                  = NULL;
+	FILE *p_stream                = NULL;
 	size_t l_size                 = 0;
-	CURLcode res                  = 0;
 	boolean b_result              = TRUE;
+	boolean b_strip               = FALSE;
+	boolean b_source              = FALSE;
+	strip_reader reader;
+	PrefixReader prefix;
+	readahead_reader source;
+	sparse_map map;
+	byte *p_sparse_header         = NULL;
+	char s_sparse_size[ 64 ];
 
 	assert( p_curl );
 	assert( p_s3 );
@@ -363,48 +471,287 @@ boolean s3_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const c
 	assert( s_key );
 	assert( *s_key && *s_key != '/' );
 	assert( s_filename );
-	assert( mime_type );
+
+	TRACE3( s3_put_file_start, s_bucket, s_key, s_filename );
 	
-	/* Prepare data */
+	/* sanity checks */
+	if( !s3_is_path_valid( s_key ) )
 	{
-		s3_format_time( format_time, sizeof(format_time) );
-		
-		/* sanity checks */
-		if( !s3_is_path_valid( s_key ) )
+		if( s3_is_verbose(p_s3) ) log_error( "Bad S3 key." );
+		b_result = FALSE;
+	}	
+
+	if( b_result && p_s3->b_strip_metadata )
+	{
+		/* JPEG and PNG go through the stripping filter, everything else as is */
+		off_t stripped_size = 0;
+
+		fd_tmp = fopen( s_filename, "rb" );
+
+		if( !fd_tmp )
 		{
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "Bad S3 key.\n" );
+			if( s3_is_verbose(p_s3) ) log_error( "Cannot open file" );
 			b_result = FALSE;
-		}	
+		}
+		else
+		{
+			#ifdef _NO_FILE_STDIO_STREAM
+			p_stream = fd_tmp; /* I had no stdio_stream in my FILE structure */
+			#else
+			p_stream = fd_tmp->stdio_stream; /*** URGENT: this is for FCGI compatibility, normally is would be fd_tmp only !!! ***/
+			#endif
+
+			b_strip = strip_reader_open( &reader, p_stream, &stripped_size );
+		}
+
+		if( b_strip )
+		{
+			reader.p_profiler = p_s3->p_profiler;
+			curl_easy_setopt( p_curl, CURLOPT_READFUNCTION, strip_reader_read );
+			curl_easy_setopt( p_curl, CURLOPT_READDATA, &reader );
+			l_size = (size_t) stripped_size;
+
+			if( !mime_type ) mime_type = reader.filter.format == STRIP_JPEG ? "image/jpeg" : "image/png";
+		}
+		else if( fd_tmp )
+		{
+			fclose( fd_tmp );
+			fd_tmp = NULL;
+		}
 	}
 
-	/* open file */
-	if( b_result )
+	if( b_result && !b_strip )
 	{
-		fd_tmp = fopen( s_filename, "rb" );
+		off_t size = 0;
 
-		if( !fd_tmp )
+		/* reads are kept in flight ahead of cURL so a slow disk overlaps with sending */
+		b_source = readahead_open( &source, s_filename, p_s3->b_cache_neutral ? READAHEAD_NOCACHE : 0, &size );
+
+		if( !b_source )
 		{
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "Cannot open file\n" );
+			if( s3_is_verbose(p_s3) ) log_error( "Cannot open file" );
 			b_result = FALSE;
 		}
+		else
+		{
+			l_size = (size_t) size;
+
+			prefix.p_source   = &source;
+			prefix.p_profiler = p_s3->p_profiler;
+			prefix.p_prefix   = prefix.buffer;
+			prefix.length     = 0;
+			prefix.offset     = 0;
+		}
+
+		if( b_result && p_s3->b_sparse && sparse_map_create( &map ) )
+		{
+			/* only the data extents are read and sent, behind a header that maps them */
+			if( sparse_map_file( &map, source.fd, size ) && sparse_map_is_worthwhile( &map ) )
+			{
+				p_sparse_header = (byte *) malloc( sparse_header_size( &map ) );
+			}
+
+			if( p_sparse_header )
+			{
+				sparse_header_write( &map, p_sparse_header );
+				readahead_set_extents( &source, sparse_map_extents( &map ), sparse_map_count( &map ) );
+
+				prefix.p_prefix = p_sparse_header;
+				prefix.length   = sparse_header_size( &map );
+				l_size          = prefix.length + (size_t) map.data;
+				mime_type       = SPARSE_MIME_TYPE;
+				snprintf( s_sparse_size, sizeof(s_sparse_size), "x-amz-meta-sparse-size:%lld", (long long) size );
+
+				if( s3_is_verbose(p_s3) ) log_debug( "%s is sparse, sending %lld of %lld bytes in %zu extents", s_filename, (long long) map.data, (long long) size, sparse_map_count( &map ) );
+			}
+			else
+			{
+				sparse_map_destroy( &map );
+			}
+		}
+
+		if( b_result && !mime_type )
+		{
+			/* the first read doubles as the sniffing buffer and is uploaded from memory */
+			uint64_t begin = profiler_begin( p_s3->p_profiler );
+
+			while( prefix.length < sizeof(prefix.buffer) )
+			{
+				ssize_t n = readahead_read( &source, prefix.buffer + prefix.length, sizeof(prefix.buffer) - prefix.length );
+
+				if( n <= 0 ) break;
+				prefix.length += (size_t) n;
+			}
+
+			profiler_end( p_s3->p_profiler, PROFILE_READ, begin, prefix.length );
+
+			if( readahead_failed( &source ) )
+			{
+				if( s3_is_verbose(p_s3) ) log_error( "Cannot read file" );
+				b_result = FALSE;
+			}
+
+			mime_type = mime_detect( p_s3->p_mime_table, s_filename, prefix.buffer, prefix.length );
+		}
+
+		curl_easy_setopt( p_curl, CURLOPT_READFUNCTION, _s3_put_handle_prefix_read );
+		curl_easy_setopt( p_curl, CURLOPT_READDATA, &prefix );
 	}
 
 	if( b_result /*ec == 0*/ )
 	{
-		#ifdef _NO_FILE_STDIO_STREAM
-		curl_easy_setopt( p_curl, CURLOPT_READDATA, fd_tmp ); /* I had no stdio_stream in my FILE structure */
-		#else
-		curl_easy_setopt( p_curl, CURLOPT_READDATA, fd_tmp->stdio_stream ); /*** URGENT: this is for FCGI compatibility, normally is would be fd_tmp only !!! ***/		
-		#endif
+		b_result = _s3_put_object( p_curl, p_s3, s_bucket, s_key, mime_type, p_sparse_header ? s_sparse_size : NULL, l_size, s_etag );
+	}
+
+	/* cleanup */
+	if( fd_tmp ) fclose( fd_tmp );
+	if( b_source ) readahead_close( &source );
+	if( p_sparse_header )
+	{
+		/* the reader walked the map's extents; it is closed first */
+		sparse_map_destroy( &map );
+		free( p_sparse_header );
+	}
+
+	TRACE4( s3_put_file_done, s_bucket, s_key, (uint64_t) l_size, b_result );
+
+	return b_result;
+}
+
+boolean s3_put_buffer( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const byte *p_data, size_t length, const char *mime_type, char *s_etag )
+{
+	MemoryReader reader;
+
+	assert( p_curl );
+	assert( p_s3 );
+	assert( s_bucket );
+	assert( *s_bucket && *s_bucket != '/' );
+	assert( s_key );
+	assert( *s_key && *s_key != '/' );
+	assert( p_data || length == 0 );
+	assert( mime_type );
+
+	/* sanity checks */
+	if( !s3_is_path_valid( s_key ) )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "Bad S3 key." );
+		return FALSE;
+	}
+
+	reader.buffer = p_data;
+	reader.size   = length;
+	reader.offset = 0;
+
+	/* the body is read straight out of the caller's memory */
+	curl_easy_setopt( p_curl, CURLOPT_READFUNCTION, _s3_put_handle_read );
+	curl_easy_setopt( p_curl, CURLOPT_READDATA, (void *) &reader );
+
+	return _s3_put_object( p_curl, p_s3, s_bucket, s_key, mime_type, NULL, length, s_etag );
+}
+
+boolean s3_put_reader( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, s3_read_function read_function, void *p_data, size_t length, const char *mime_type, char *s_etag )
+{
+	assert( p_curl );
+	assert( p_s3 );
+	assert( s_bucket );
+	assert( *s_bucket && *s_bucket != '/' );
+	assert( s_key );
+	assert( *s_key && *s_key != '/' );
+	assert( read_function );
+	assert( mime_type );
+
+	/* sanity checks */
+	if( !s3_is_path_valid( s_key ) )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "Bad S3 key." );
+		return FALSE;
+	}
+
+	/* the body comes from whatever the caller reads it from, e.g. a fan-out */
+	curl_easy_setopt( p_curl, CURLOPT_READFUNCTION, read_function );
+	curl_easy_setopt( p_curl, CURLOPT_READDATA, p_data );
+
+	return _s3_put_object( p_curl, p_s3, s_bucket, s_key, mime_type, NULL, length, s_etag );
+}
+
+/*
+ * The signed headers of a PUT; s_resource is "bucket/key", URL encoded.
+ * s_amz_header is one more "x-amz-...:value" header sorting after
+ * x-amz-acl, or NULL. Free the list with curl_slist_free_all().
+ */
+struct curl_slist* s3_put_headers( const S3 *p_s3, const char *s_resource, const char *mime_type, const char *s_date, const char *s_amz_header )
+{
+	struct curl_slist *headerlist = NULL;
+	char buffer[ 1024 ];
+
+	assert( p_s3 );
+	assert( s_resource );
+	assert( mime_type );
+	assert( s_date );
+
+	/* build and add content type header */
+	{
+		snprintf( buffer, sizeof(buffer), "Content-Type: %s", mime_type );
+		headerlist = curl_slist_append( headerlist, buffer /* content type header */ );
+	}
+
+	/* build and add date header */
+	{
+		snprintf( buffer, sizeof(buffer), "Date: %s", s_date );
+		headerlist = curl_slist_append( headerlist, buffer /* data header */ );
+	}
+
+	/* build and add ACL header */
+	{
+		snprintf( buffer, sizeof(buffer), "x-amz-acl: public-read" );
+		headerlist = curl_slist_append( headerlist, buffer /* ACL header */ );
+	}
+
+	if( s_amz_header )
+	{
+		headerlist = curl_slist_append( headerlist, s_amz_header /* metadata header */ );
+	}
+
+	/* build and add authorization header */
+	{
+		snprintf( buffer, sizeof(buffer), "PUT\n\n%s\n%s\nx-amz-acl:public-read\n%s%s/%s", mime_type, s_date,
+		          s_amz_header ? s_amz_header : "", s_amz_header ? "\n" : "", s_resource );
+		/* sign and base64 encode signature */
+		char signature_base64[ S3_MAX_SIGNATURE ];
+		s3_sign( p_s3, buffer /* PUT string */, signature_base64, sizeof(signature_base64) );
+		snprintf( buffer, sizeof(buffer), "Authorization: AWS %s:%s", p_s3->s_aws_access_id, signature_base64 );
+		headerlist = curl_slist_append( headerlist, buffer /* Authorization header */ );
+	}
+
+	return headerlist;
+}
+
+/* everything a PUT needs once its body source (READFUNCTION/READDATA) is set up */
+boolean _s3_put_object( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *mime_type, const char *s_amz_header, size_t l_size, char *s_etag )
+{
+	char curl_err[ CURL_ERROR_SIZE ];
+    char format_time[ 128 ];
+	char buffer[ 1024 ];
+	#ifndef _S3_CURL_COPIES_STRINGS
+	char url[ 1024 ];
+	#endif
+	struct curl_slist *headerlist = NULL;
+	CURLcode res                  = 0;
+	boolean b_result              = TRUE;
+	const char *s_hostname        = _s3_hostname( p_s3 );
+
+	/* Prepare data */
+	{
+		s3_format_time( format_time, sizeof(format_time) );
+	}
+
+	if( b_result )
+	{
 		curl_easy_setopt( p_curl, CURLOPT_UPLOAD, 1 );
 		curl_easy_setopt( p_curl, CURLOPT_ERRORBUFFER, curl_err );
 		curl_easy_setopt( p_curl, CURLOPT_USERAGENT, S3_USERAGENT );
 		curl_easy_setopt( p_curl, CURLOPT_FAILONERROR, 1 ); 
-	
-
-		l_size = file_size_from_pointer( fd_tmp, TRUE ); /* determine filesize */
-
-		curl_easy_setopt( p_curl, CURLOPT_INFILESIZE, l_size );
+		curl_easy_setopt( p_curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t) l_size );
 
 		const char *uri_encoded = NULL;
 		/* URL encode resource URI */
@@ -413,60 +760,55 @@ boolean s3_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const c
 			uri_encoded = curl_escape( buffer, 0 );
 		}
 
-
 		/* build URL */
 		{
 			#ifdef _S3_CURL_COPIES_STRINGS
-			snprintf( buffer, sizeof(buffer), "https://%s/%s", S3_HOSTNAME, uri_encoded );
+			snprintf( buffer, sizeof(buffer), "https://%s/%s", s_hostname, uri_encoded );
 			curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
 			#else
-			snprintf( url, sizeof(url), "https://%s/%s", S3_HOSTNAME, uri_encoded );
+			snprintf( url, sizeof(url), "https://%s/%s", s_hostname, uri_encoded );
 			curl_easy_setopt( p_curl, CURLOPT_URL, url /* URL */ );
 			#endif
 		}
 
 		/* assemble headers and add headers to curl request */
-		{
-			/* build and add content type header */
-			{
-				snprintf( buffer, sizeof(buffer), "Content-Type: %s", mime_type );
-				headerlist = curl_slist_append( headerlist, buffer /* content type header */ );
-			}
-
-			/* build and add date header */
-			{
-				snprintf( buffer, sizeof(buffer), "Date: %s", format_time );
-				headerlist = curl_slist_append( headerlist, buffer /* data header */ );
-			}
-
-			/* build and add ACL header */
-			{
-				snprintf( buffer, sizeof(buffer), "x-amz-acl: public-read" );
-				headerlist = curl_slist_append( headerlist, buffer /* ACL header */ );
-			}
-
-			/* build and add authorization header */
-			{
-				snprintf( buffer, sizeof(buffer), "PUT\n\n%s\n%s\nx-amz-acl:public-read\n/%s", mime_type, format_time, uri_encoded );
-				/* sign and base64 encode signature */
-				const byte *signature_base64 = s3_sign( p_s3, buffer /* PUT string */ );
-				snprintf( buffer, sizeof(buffer), "Authorization: AWS %s:%s", p_s3->s_aws_access_id, signature_base64 );
-				headerlist = curl_slist_append( headerlist, buffer /* Authorization header */ );
-				free( (byte *) signature_base64 ); /* signature cleanup */
-			}
-		
-			curl_easy_setopt( p_curl, CURLOPT_HTTPHEADER, headerlist );
-		}
+		headerlist = s3_put_headers( p_s3, uri_encoded, mime_type, format_time, s_amz_header );
+		curl_easy_setopt( p_curl, CURLOPT_HTTPHEADER, headerlist );
 	
 		/* free encoded URI */	
 		curl_free( (char *) uri_encoded );
 
-		/* perform request */				
+		/* perform request; time spent in our read callbacks is upstream of the network */
+		uint64_t upstream_ns = profiler_thread_busy( );
+		uint64_t begin       = profiler_begin( p_s3->p_profiler );
+
+		if( s_etag )
+		{
+			*s_etag = '\0';
+			curl_easy_setopt( p_curl, CURLOPT_HEADERFUNCTION, _s3_put_handle_header );
+			curl_easy_setopt( p_curl, CURLOPT_HEADERDATA, s_etag );
+		}
+
 		res = curl_easy_perform( p_curl );
 
+		if( s_etag )
+		{
+			/* the handle is reused; do not leave it pointing at our stack */
+			curl_easy_setopt( p_curl, CURLOPT_HEADERFUNCTION, NULL );
+			curl_easy_setopt( p_curl, CURLOPT_HEADERDATA, NULL );
+		}
+
+		if( p_s3->p_profiler )
+		{
+			uint64_t elapsed = profiler_now( ) - begin;
+
+			upstream_ns = profiler_thread_busy( ) - upstream_ns;
+			profiler_add( p_s3->p_profiler, PROFILE_SEND, elapsed > upstream_ns ? elapsed - upstream_ns : 0, upstream_ns, l_size );
+		}
+
 		if( res != 0 )
 		{
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "%s:%d: Error performing curl request (res = %d, err = %.1024s).\n", __FUNCTION__, __LINE__, res, curl_err );			
+			if( s3_is_verbose(p_s3) ) log_error( "Error performing curl request (res = %d, err = %.1024s).", res, curl_err );			
 			b_result = FALSE;
 		}	
 
@@ -475,12 +817,16 @@ boolean s3_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const c
 		if( i_response_code != 200 )
 		{
 			/* did we not get 200? */
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "%s:%d: Wrong HTTP response while talking to S3 host (res = %d).\n", __FUNCTION__, __LINE__, i_response_code );			
+			if( s3_is_verbose(p_s3) ) log_error( "Wrong HTTP response while talking to S3 host (res = %d).", i_response_code );			
 			b_result = FALSE;
 		}
 
+		_s3_endpoint_report( p_s3, s_hostname, p_curl, TRUE );
+
+		/* every PUT, including s3_put_buffer() and the block uploads */
+		TRACE5( s3_put_request, s_key, (uint64_t) l_size, (int) res, i_response_code, b_result );
+
 		/* cleanup */
-		fclose( fd_tmp );
 		curl_slist_free_all( headerlist );
 		#ifdef _DEBUG
 		headerlist = NULL;
@@ -490,6 +836,269 @@ boolean s3_put_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const c
 	return b_result;
 }
 
+boolean s3_lister_begin( S3Lister *p_lister, CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_prefix )
+{
+	assert( p_lister );
+	assert( p_curl );
+	assert( p_s3 );
+	assert( s_bucket && *s_bucket );
+
+	memset( p_lister, 0, sizeof(S3Lister) );
+	p_lister->p_curl = p_curl;
+	p_lister->p_s3   = p_s3;
+	strncpy( p_lister->s_bucket, s_bucket, sizeof(p_lister->s_bucket) - 1 );
+	strncpy( p_lister->s_prefix, s_prefix ? s_prefix : "", sizeof(p_lister->s_prefix) - 1 );
+
+	p_lister->objects = (S3Object *) malloc( sizeof(S3Object) * S3_LIST_PAGE_SIZE );
+
+	if( !p_lister->objects )
+	{
+		p_lister->b_error = TRUE;
+		return FALSE;
+	}
+
+	p_lister->b_truncated = TRUE; /* nothing fetched yet */
+
+	return TRUE;
+}
+
+boolean s3_lister_next( S3Lister *p_lister, const S3Object **p_p_object )
+{
+	assert( p_lister );
+	assert( p_p_object );
+
+	while( p_lister->next >= p_lister->count )
+	{
+		if( p_lister->b_error || !p_lister->b_truncated )
+		{
+			return FALSE;
+		}
+
+		if( !_s3_lister_fetch( p_lister ) )
+		{
+			p_lister->b_error = TRUE;
+			return FALSE;
+		}
+	}
+
+	*p_p_object = &p_lister->objects[ p_lister->next++ ];
+
+	return TRUE;
+}
+
+void s3_lister_end( S3Lister *p_lister )
+{
+	assert( p_lister );
+
+	free( p_lister->objects );
+	p_lister->objects = NULL;
+	p_lister->count   = 0;
+	p_lister->next    = 0;
+}
+
+/* GET /bucket/?prefix=...&marker=... */
+boolean _s3_lister_fetch( S3Lister *p_lister )
+{
+	char curl_err[ CURL_ERROR_SIZE ];
+	char format_time[ 128 ];
+	char buffer[ 1024 ];
+	char url[ 3 * 2 * S3_MAX_KEY + 1024 ];
+	struct curl_slist *headerlist = NULL;
+	const S3 *p_s3                = p_lister->p_s3;
+	CURL *p_curl                  = p_lister->p_curl;
+	CURLcode res                  = 0;
+	boolean b_result              = TRUE;
+	char *s_prefix                = NULL;
+	char *s_marker                = NULL;
+	const char *s_hostname        = _s3_hostname( p_s3 );
+	MemoryBuffer chunk;
+
+	memset( &chunk, 0, sizeof(MemoryBuffer) );
+	s3_format_time( format_time, sizeof(format_time) );
+
+	s_prefix = curl_easy_escape( p_curl, p_lister->s_prefix, 0 );
+	s_marker = curl_easy_escape( p_curl, p_lister->s_marker, 0 );
+
+	if( !s_prefix || !s_marker )
+	{
+		curl_free( s_prefix );
+		curl_free( s_marker );
+		return FALSE;
+	}
+
+	snprintf( url, sizeof(url), "https://%s/%s/?prefix=%s&marker=%s&max-keys=%d", s_hostname, p_lister->s_bucket, s_prefix, s_marker, S3_LIST_PAGE_SIZE );
+	curl_free( s_prefix );
+	curl_free( s_marker );
+
+	curl_easy_setopt( p_curl, CURLOPT_ERRORBUFFER, curl_err );
+	curl_easy_setopt( p_curl, CURLOPT_USERAGENT, S3_USERAGENT );
+	curl_easy_setopt( p_curl, CURLOPT_FAILONERROR, 1 );
+	curl_easy_setopt( p_curl, CURLOPT_HTTPGET, 1 );
+	curl_easy_setopt( p_curl, CURLOPT_WRITEFUNCTION, _s3_list_buckets_handle_response );
+	curl_easy_setopt( p_curl, CURLOPT_WRITEDATA, (void *) &chunk );
+	curl_easy_setopt( p_curl, CURLOPT_URL, url );
+
+	snprintf( buffer, sizeof(buffer), "Date: %s", format_time );
+	headerlist = curl_slist_append( headerlist, buffer );
+
+	{
+		char signature_base64[ S3_MAX_SIGNATURE ];
+
+		/* the query string is not part of the signed resource */
+		snprintf( buffer, sizeof(buffer), "GET\n\n\n%s\n/%s/", format_time, p_lister->s_bucket );
+		s3_sign( p_s3, buffer, signature_base64, sizeof(signature_base64) );
+		snprintf( buffer, sizeof(buffer), "Authorization: AWS %s:%s", p_s3->s_aws_access_id, signature_base64 );
+		headerlist = curl_slist_append( headerlist, buffer );
+	}
+
+	curl_easy_setopt( p_curl, CURLOPT_HTTPHEADER, headerlist );
+
+	res = curl_easy_perform( p_curl );
+
+	if( res != 0 )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "Error performing curl request (res = %d, err = %.1024s).", res, curl_err );
+		b_result = FALSE;
+	}
+	else if( s3_response_code( p_curl ) != 200 )
+	{
+		if( s3_is_verbose(p_s3) ) log_error( "Wrong HTTP response while talking to S3 host (res = %d).", s3_response_code( p_curl ) );
+		b_result = FALSE;
+	}
+
+	_s3_endpoint_report( p_s3, s_hostname, p_curl, FALSE );
+
+	curl_slist_free_all( headerlist );
+	curl_easy_setopt( p_curl, CURLOPT_HTTPHEADER, NULL );
+
+	if( b_result )
+	{
+		b_result = chunk.buffer && _s3_lister_process_response( p_lister, &chunk );
+	}
+
+	free( chunk.buffer );
+
+	return b_result;
+}
+
+boolean _s3_lister_process_response( S3Lister *p_lister, const MemoryBuffer *p_memory )
+{
+	xmlDocPtr doc;
+	xmlXPathContextPtr xpathCtx;
+	xmlXPathObjectPtr xpathObj;
+	xmlNodeSetPtr nodes;
+	int i;
+
+	_s3_xml_initialize( );
+	doc = xmlParseMemory( (char *) p_memory->buffer, p_memory->size );
+
+	if( doc == NULL )
+	{
+		if( s3_is_verbose(p_lister->p_s3) ) log_error( "Unable to parse memory buffer." );
+		return FALSE;
+	}
+
+	xpathCtx = xmlXPathNewContext( doc );
+
+	if( xpathCtx == NULL || xmlXPathRegisterNs( xpathCtx, BAD_CAST "aws", BAD_CAST "http://s3.amazonaws.com/doc/2006-03-01/" ) != 0 )
+	{
+		if( xpathCtx ) xmlXPathFreeContext( xpathCtx );
+		xmlFreeDoc( doc );
+		return FALSE;
+	}
+
+	p_lister->count       = 0;
+	p_lister->next        = 0;
+	p_lister->b_truncated = FALSE;
+
+	xpathObj = xmlXPathEvalExpression( BAD_CAST "//aws:IsTruncated", xpathCtx );
+
+	if( xpathObj && xpathObj->nodesetval && xpathObj->nodesetval->nodeNr > 0 )
+	{
+		xmlChar *value = xmlNodeGetContent( xpathObj->nodesetval->nodeTab[ 0 ] );
+		p_lister->b_truncated = value && xmlStrcasecmp( value, BAD_CAST "true" ) == 0;
+		xmlFree( value );
+	}
+
+	if( xpathObj ) xmlXPathFreeObject( xpathObj );
+
+	xpathObj = xmlXPathEvalExpression( BAD_CAST "//aws:Contents", xpathCtx );
+	nodes    = xpathObj ? xpathObj->nodesetval : NULL;
+
+	for( i = 0; nodes && i < nodes->nodeNr && p_lister->count < S3_LIST_PAGE_SIZE; i++ )
+	{
+		S3Object *p_object = &p_lister->objects[ p_lister->count ];
+		xmlNodePtr child;
+
+		memset( p_object, 0, sizeof(S3Object) );
+
+		for( child = nodes->nodeTab[ i ]->children; child; child = child->next )
+		{
+			xmlChar *value;
+
+			if( child->type != XML_ELEMENT_NODE ) continue;
+
+			value = xmlNodeListGetString( doc, child->children, 1 );
+			if( !value ) continue;
+
+			if( xmlStrcasecmp( child->name, BAD_CAST "key" ) == 0 )
+			{
+				strncpy( p_object->s_key, (const char *) value, sizeof(p_object->s_key) - 1 );
+			}
+			else if( xmlStrcasecmp( child->name, BAD_CAST "size" ) == 0 )
+			{
+				p_object->size = strtoull( (const char *) value, NULL, 10 );
+			}
+			else if( xmlStrcasecmp( child->name, BAD_CAST "lastmodified" ) == 0 )
+			{
+				struct tm tm;
+
+				/* 2009-10-12T17:50:30.000Z */
+				memset( &tm, 0, sizeof(tm) );
+				if( sscanf( (const char *) value, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec ) == 6 )
+				{
+					tm.tm_year -= 1900;
+					tm.tm_mon  -= 1;
+					p_object->modified = timegm( &tm );
+				}
+			}
+			else if( xmlStrcasecmp( child->name, BAD_CAST "etag" ) == 0 )
+			{
+				const char *p_begin = (const char *) value;
+				size_t length;
+
+				if( *p_begin == '"' ) p_begin++;
+				length = strcspn( p_begin, "\"" );
+				if( length >= sizeof(p_object->s_etag) ) length = sizeof(p_object->s_etag) - 1;
+				memcpy( p_object->s_etag, p_begin, length );
+			}
+
+			xmlFree( value );
+		}
+
+		if( p_object->s_key[ 0 ] != '\0' )
+		{
+			p_lister->count++;
+		}
+	}
+
+	if( p_lister->count > 0 )
+	{
+		/* the next page starts after the last key of this one */
+		strcpy( p_lister->s_marker, p_lister->objects[ p_lister->count - 1 ].s_key );
+	}
+	else
+	{
+		p_lister->b_truncated = FALSE;
+	}
+
+	if( xpathObj ) xmlXPathFreeObject( xpathObj );
+	xmlXPathFreeContext( xpathCtx );
+	xmlFreeDoc( doc );
+
+	return TRUE;
+}
+
 boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key )
 {
 	char curl_err[ CURL_ERROR_SIZE ];
@@ -501,6 +1110,7 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 	struct curl_slist *headerlist = NULL;
 	CURLcode res                  = 0;
 	boolean b_result              = TRUE;
+	const char *s_hostname;
 
 	assert( p_curl );
 	assert( p_s3 );
@@ -508,6 +1118,10 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 	assert( *s_bucket && *s_bucket != '/' );
 	assert( s_key );
 	assert( *s_key && *s_key != '/' );
+
+	s_hostname = _s3_hostname( p_s3 );
+
+	TRACE2( s3_delete_file_start, s_bucket, s_key );
 	
 	/* Prepare data */
 	{
@@ -516,7 +1130,7 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 		/* sanity checks */
 		if( !s3_is_path_valid( s_key ) )
 		{
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "Bad S3 key.\n" );
+			if( s3_is_verbose(p_s3) ) log_error( "Bad S3 key." );
 			b_result = FALSE;
 		}	
 	}
@@ -538,10 +1152,10 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 		/* build URL */
 		{
 			#ifdef _S3_CURL_COPIES_STRINGS
-			snprintf( buffer, sizeof(buffer), "https://%s/%s", S3_HOSTNAME, uri_encoded );
+			snprintf( buffer, sizeof(buffer), "https://%s/%s", s_hostname, uri_encoded );
 			curl_easy_setopt( p_curl, CURLOPT_URL, buffer /* URL */ );
 			#else
-			snprintf( url, sizeof(url), "https://%s/%s", S3_HOSTNAME, uri_encoded );
+			snprintf( url, sizeof(url), "https://%s/%s", s_hostname, uri_encoded );
 			curl_easy_setopt( p_curl, CURLOPT_URL, url );
 			#endif
 		}
@@ -558,10 +1172,10 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 			{
 				snprintf( buffer, sizeof(buffer), "DELETE\n\n\n%s\n/%s", format_time, uri_encoded );
 				/* sign and base64 encode signature */
-				const byte *signature_base64 = s3_sign( p_s3, buffer /* DELETE string */ );
+				char signature_base64[ S3_MAX_SIGNATURE ];
+				s3_sign( p_s3, buffer /* DELETE string */, signature_base64, sizeof(signature_base64) );
 				snprintf( buffer, sizeof(buffer), "Authorization: AWS %s:%s", p_s3->s_aws_access_id, signature_base64 );
 				headerlist = curl_slist_append( headerlist, buffer /* Authorization header */ );
-				free( (byte *) signature_base64 ); /* signature cleanup */
 			}
 		
 			curl_easy_setopt( p_curl, CURLOPT_HTTPHEADER, headerlist );
@@ -576,7 +1190,7 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 		/* wir ignorieren hier fehler 21, weil wenn file nicht existert, is das wurst. */
 		if (res != 0 && res != 21) 
 		{
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "%s:%d: Error performing curl request (res = %d, err = %.1024s).\n", __FUNCTION__, __LINE__, res, curl_err );			
+			if( s3_is_verbose(p_s3) ) log_error( "Error performing curl request (res = %d, err = %.1024s).", res, curl_err );			
 			b_result = FALSE;
 		}
 
@@ -585,10 +1199,12 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 		if( i_response_code != 200 && i_response_code != 204 )
 		{
 			/* did we not get 200 or 204? */
-			if( s3_is_verbose(p_s3) ) fprintf( stderr, "%s:%d: Wrong HTTP response while talking to S3 host (res = %d).\n", __FUNCTION__, __LINE__, i_response_code );			
+			if( s3_is_verbose(p_s3) ) log_error( "Wrong HTTP response while talking to S3 host (res = %d).", i_response_code );			
 			b_result = FALSE;
 		}
 
+		_s3_endpoint_report( p_s3, s_hostname, p_curl, FALSE );
+
 		/* cleanup */
 		curl_slist_free_all( headerlist );
 		#ifdef _DEBUG
@@ -596,9 +1212,78 @@ boolean s3_delete_file( CURL *p_curl, const S3 *p_s3, const char *s_bucket, cons
 		#endif
 	}
 
+	TRACE3( s3_delete_file_done, s_bucket, s_key, b_result );
+
 	return b_result;
 }
 
+size_t _s3_put_handle_read( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	MemoryReader *p_reader = (MemoryReader *) data;
+	size_t length          = size * nmemb;
+
+	if( length > p_reader->size - p_reader->offset )
+	{
+		length = p_reader->size - p_reader->offset;
+	}
+
+	memcpy( ptr, p_reader->buffer + p_reader->offset, length );
+	p_reader->offset += length;
+
+	return length;
+}
+
+/* picks ETag: "..." out of the response headers, without the quotes */
+size_t _s3_put_handle_header( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	char *s_etag        = (char *) data;
+	const char *s_line  = (const char *) ptr;
+	size_t length       = size * nmemb;
+
+	if( length > 5 && strncasecmp( s_line, "ETag:", 5 ) == 0 )
+	{
+		const char *p_begin = s_line + 5;
+		const char *p_end   = s_line + length;
+		size_t count;
+
+		while( p_begin < p_end && (*p_begin == ' ' || *p_begin == '"') ) p_begin++;
+		while( p_end > p_begin && (p_end[ -1 ] == '\r' || p_end[ -1 ] == '\n' || p_end[ -1 ] == '"' || p_end[ -1 ] == ' ') ) p_end--;
+
+		count = (size_t) (p_end - p_begin) < S3_MAX_ETAG - 1 ? (size_t) (p_end - p_begin) : S3_MAX_ETAG - 1;
+		memcpy( s_etag, p_begin, count );
+		s_etag[ count ] = '\0';
+	}
+
+	return length;
+}
+
+size_t _s3_put_handle_prefix_read( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	PrefixReader *p_reader = (PrefixReader *) data;
+	size_t length          = size * nmemb;
+
+	if( p_reader->offset < p_reader->length )
+	{
+		if( length > p_reader->length - p_reader->offset )
+		{
+			length = p_reader->length - p_reader->offset;
+		}
+
+		memcpy( ptr, p_reader->p_prefix + p_reader->offset, length );
+		p_reader->offset += length;
+
+		return length;
+	}
+
+	uint64_t begin = profiler_begin( p_reader->p_profiler );
+	ssize_t n      = readahead_read( p_reader->p_source, ptr, length );
+
+	/* mostly a copy out of the window; the time here is what the disk could not hide */
+	profiler_end( p_reader->p_profiler, PROFILE_READ, begin, n > 0 ? (uint64_t) n : 0 );
+
+	return n < 0 ? CURL_READFUNC_ABORT : (size_t) n;
+}
+
 size_t file_size_from_pointer( FILE *p_file, boolean b_keep_open )
 {
 	size_t size = 0;
@@ -2,25 +2,80 @@
 #define _S3_H_
 
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 #include <curl/curl.h>
 #include "types.h"
+#include "mime.h"
+#include "profile.h"
+#include "endpoint.h"
 
 typedef struct sS3 {
 	char s_aws_access_id[ 64 ];
 	char s_aws_secret_key[ 64 ];
 	boolean b_verbose;
+	boolean b_strip_metadata;    /* drop EXIF/comments from JPEG and PNG uploads */
+	const mime_table *p_mime_table; /* extension fallback when sniffing, may be NULL */
+	profiler *p_profiler;        /* stage timings for uploads, may be NULL */
+	boolean b_cache_neutral;     /* read sources around the page cache (see readahead.h) */
+	boolean b_sparse;            /* upload sparse files as their data extents (see sparse.h) */
+	endpoint_set *p_endpoints;   /* candidate hosts to pick from (see endpoint.h), may be NULL */
 } S3;
 
 #define S3_MAX_BUCKET_NAME   (255)
+#define S3_MAX_SIGNATURE     (128) /* base64 encoded HMAC-SHA1, with room to spare */
+#define S3_MAX_ETAG          (72)
+#define S3_MAX_KEY           (1024)
+#define S3_LIST_PAGE_SIZE    (1000) /* what S3 returns per request at most */
+
+/* a cURL read callback: fills ptr with up to size * nmemb bytes of the body */
+typedef size_t (*s3_read_function)( void *ptr, size_t size, size_t nmemb, void *data );
+
+typedef struct sS3Object {
+	char s_key[ S3_MAX_KEY + 1 ];
+	uint64_t size;
+	time_t modified;
+	char s_etag[ S3_MAX_ETAG ];
+} S3Object;
+
+/*
+ * Pulls the objects of a bucket in key order, one page at a time, so
+ * listing any number of keys needs one page worth of memory.
+ */
+typedef struct sS3Lister {
+	CURL *p_curl;
+	const S3 *p_s3;
+	char s_bucket[ S3_MAX_BUCKET_NAME ];
+	char s_prefix[ S3_MAX_KEY + 1 ];
+	char s_marker[ S3_MAX_KEY + 1 ];   /* last key of the previous page */
+	S3Object *objects;                 /* current page */
+	size_t count;
+	size_t next;
+	boolean b_truncated;               /* more pages follow */
+	boolean b_error;
+} S3Lister;
 
 #define s3_is_verbose( p_s3 ) ( (p_s3)->b_verbose )
+#define s3_set_strip_metadata( p_s3, b_strip )   ((p_s3)->b_strip_metadata = (b_strip))
+#define s3_set_mime_table( p_s3, p_table )       ((p_s3)->p_mime_table = (p_table))
+#define s3_set_profiler( p_s3, p_prof )          ((p_s3)->p_profiler = (p_prof))
+#define s3_set_cache_neutral( p_s3, b_neutral )  ((p_s3)->b_cache_neutral = (b_neutral))
+#define s3_set_sparse( p_s3, b_sparse_files )    ((p_s3)->b_sparse = (b_sparse_files))
+#define s3_set_endpoints( p_s3, p_set )          ((p_s3)->p_endpoints = (p_set))
 void    s3_initialize     ( S3 *p_s3, const char *access_id, const char *secret_key, boolean verbose );
 void    s3_deinitialize   ( void );
 void    s3_format_time    ( /* out */ char *s_destination_string, size_t length );
-const   byte *s3_sign     ( const S3 *p_s3, const char* s_sign_string );
+boolean s3_sign           ( const S3 *p_s3, const char* s_sign_string, /* out */ char *s_signature, size_t length );
 int     s3_response_code  ( const CURL *p_curl );
 boolean s3_list_buckets   ( CURL *p_curl, const S3 *p_s3 );
-boolean s3_put_file       ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *s_filename, const char *mime_type );
+boolean s3_put_file       ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const char *s_filename, const char *mime_type, /*out*/ char *s_etag ); /* NULL mime_type sniffs the content */
+struct curl_slist* s3_put_headers ( const S3 *p_s3, const char *s_resource, const char *mime_type, const char *s_date, const char *s_amz_header ); /* signed; s_resource is URL encoded */
+boolean s3_put_buffer     ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, const byte *p_data, size_t length, const char *mime_type, /*out*/ char *s_etag );
+boolean s3_put_reader     ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key, s3_read_function read_function, void *p_data, size_t length, const char *mime_type, /*out*/ char *s_etag ); /* exactly length bytes from read_function */
+boolean s3_lister_begin   ( S3Lister *p_lister, CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_prefix );
+boolean s3_lister_next    ( S3Lister *p_lister, /*out*/ const S3Object **p_p_object ); /* FALSE at the end or on error */
+void    s3_lister_end     ( S3Lister *p_lister );
+#define s3_lister_failed( p_lister )                ((p_lister)->b_error)
 boolean s3_delete_file    ( CURL *p_curl, const S3 *p_s3, const char *s_bucket, const char *s_key );
 #define s3_verify_response_code( p_curl, i_code )   (s3_response_code( (p_curl) ) == ((int) i_code))
 #define s3_response_ok( p_curl )                    (s3_verify_response_code( (p_curl), 200 ))
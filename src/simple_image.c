@@ -1,8 +1,12 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <magick/api.h>
 #include "simple_image.h"
+#include "mime.h"
+#include "trace.h"
+#include "log.h"
 
 #define MAX_PATH 255
 
@@ -15,7 +19,7 @@ boolean simple_image_initialize( const char *s_client_path, size_t length )
 	{
 		if( getcwd( s_cwd, sizeof(s_cwd) ) < 0 )
 		{
-			fprintf( stderr, "Unable to determine current working directory.\n" );
+			log_error( "Unable to determine current working directory." );
 			return FALSE;
 		}
 	}
@@ -44,6 +48,17 @@ boolean simple_image_deinitialize( )
 }
 
 boolean simple_image_load( const char *s_filename, size_t length, Image **p_p_image )
+{
+	return simple_image_load_at_size( s_filename, length, 0, 0, p_p_image );
+}
+
+/*
+ * The size is only a hint for decoders that can scale while decoding.
+ * libjpeg scales by 1/2, 1/4 or 1/8 in the DCT domain and never goes
+ * below the requested size, so the result still needs a final resize.
+ * A height without a width is ignored.
+ */
+boolean simple_image_load_at_size( const char *s_filename, size_t length, uint width, uint height, Image **p_p_image )
 {
 	boolean b_result = TRUE;
 	ImageInfo *p_info = NULL;
@@ -52,6 +67,19 @@ boolean simple_image_load( const char *s_filename, size_t length, Image **p_p_im
     p_info = CloneImageInfo( (ImageInfo *) NULL );
     strncpy( p_info->filename, s_filename, length );
 	p_info->filename[ length ] = '\0';
+
+	TRACE3( image_load_start, p_info->filename, width, height );
+
+	if( width > 0 )
+	{
+		char s_size[ MaxTextExtent ];
+
+		if( height > 0 ) snprintf( s_size, sizeof(s_size), "%ux%u", width, height );
+		else             snprintf( s_size, sizeof(s_size), "%u", width );
+
+		SetImageOption( p_info, "jpeg:size", s_size );
+	}
+
     *p_p_image = ReadImage( p_info, p_exception );
 
     if( p_exception->severity != UndefinedException )
@@ -66,6 +94,8 @@ boolean simple_image_load( const char *s_filename, size_t length, Image **p_p_im
 	assert( b_result && (*p_p_image) );
 	assert( b_result && (*p_p_image)->signature == MagickSignature );
 
+	TRACE4( image_load_done, p_info->filename, *p_p_image ? (*p_p_image)->columns : 0, *p_p_image ? (*p_p_image)->rows : 0, b_result );
+
 	DestroyImageInfo( p_info );
 	DestroyExceptionInfo( p_exception );
 
@@ -84,6 +114,8 @@ boolean simple_image_write( const char *s_filename, size_t length, Image *p_imag
     strncpy( p_image->filename, s_filename, length );
 	p_image->filename[ length ] = '\0';
 
+	TRACE3( image_write_start, p_image->filename, p_image->columns, p_image->rows );
+
 	//p_info->quality = 90;
 	p_image->quality = 90;
 
@@ -101,6 +133,8 @@ boolean simple_image_write( const char *s_filename, size_t length, Image *p_imag
 		b_result = FALSE;
 	}
 
+	TRACE2( image_write_done, p_image->filename, b_result );
+
 	DestroyImageInfo( p_info );
 	DestroyExceptionInfo( p_exception );
 	return b_result;
@@ -111,6 +145,80 @@ void simple_image_destroy( Image *p_image )
 	DestroyImage( p_image );
 }
 
+boolean simple_image_clone( const Image *p_image, /*out*/ Image **p_p_new_image )
+{
+	boolean b_result = TRUE;
+	ExceptionInfo *p_exception = AcquireExceptionInfo( );
+
+	*p_p_new_image = CloneImage( p_image, 0, 0, MagickTrue, p_exception );
+
+    if( p_exception->severity != UndefinedException )
+	{
+		CatchException( p_exception );
+		b_result = FALSE;
+	}
+
+	b_result &= *p_p_new_image != NULL;
+
+	DestroyExceptionInfo( p_exception );
+	return b_result;
+}
+
+/* Encodes the image in memory; s_format may be NULL to keep the current format. Free with simple_image_free_blob(). */
+boolean simple_image_to_blob( Image *p_image, const char *s_format, uint quality, /*out*/ byte **p_p_blob, /*out*/ size_t *p_length )
+{
+	boolean b_result = TRUE;
+	ImageInfo *p_info = NULL;
+	ExceptionInfo *p_exception = AcquireExceptionInfo( );
+
+	assert( p_image );
+	assert( p_p_blob );
+	assert( p_length );
+
+    p_info = CloneImageInfo( (ImageInfo *) NULL );
+
+	if( s_format )
+	{
+		strncpy( p_info->magick, s_format, sizeof(p_info->magick) - 1 );
+		strncpy( p_image->magick, s_format, sizeof(p_image->magick) - 1 );
+	}
+	else
+	{
+		strncpy( p_info->magick, p_image->magick, sizeof(p_info->magick) - 1 );
+	}
+
+	if( quality > 0 )
+	{
+		p_info->quality  = quality;
+		p_image->quality = quality;
+	}
+
+	*p_length = 0;
+
+	TRACE4( image_encode_start, p_info->magick, p_image->columns, p_image->rows, quality );
+
+	*p_p_blob = (byte *) ImageToBlob( p_info, p_image, p_length, p_exception );
+
+    if( p_exception->severity != UndefinedException )
+	{
+		CatchException( p_exception );
+		b_result = FALSE;
+	}
+
+	b_result &= *p_p_blob != NULL;
+
+	TRACE3( image_encode_done, p_info->magick, (uint64_t) *p_length, b_result );
+
+	DestroyImageInfo( p_info );
+	DestroyExceptionInfo( p_exception );
+	return b_result;
+}
+
+void simple_image_free_blob( byte *p_blob )
+{
+	RelinquishMagickMemory( p_blob );
+}
+
 const char* simple_image_format_description( const Image *data )
 {
 	ExceptionInfo *p_exception = AcquireExceptionInfo( );
@@ -125,6 +233,8 @@ boolean simple_image_resize( const Image *p_image, uint width, uint height, /*ou
 	boolean b_result = TRUE;
 	ExceptionInfo *p_exception = AcquireExceptionInfo( );
 
+	TRACE4( image_resize_start, p_image->columns, p_image->rows, width, height );
+
 	/* This can be expanded later to accept different resize filters */
 	*p_p_new_image = ResizeImage( p_image, width, height, LanczosFilter, 1.0, p_exception );
 
@@ -136,6 +246,8 @@ boolean simple_image_resize( const Image *p_image, uint width, uint height, /*ou
 
 	b_result &= *p_p_new_image != NULL;
 
+	TRACE3( image_resize_done, *p_p_new_image ? (*p_p_new_image)->columns : 0, *p_p_new_image ? (*p_p_new_image)->rows : 0, b_result );
+
 	DestroyExceptionInfo( p_exception );
 	return b_result;
 }
@@ -145,6 +257,8 @@ boolean simple_image_rotate( const Image *p_image, double angle_in_degrees, /*ou
 	boolean b_result = TRUE;
 	ExceptionInfo *p_exception = AcquireExceptionInfo( );
 
+	TRACE3( image_rotate_start, p_image->columns, p_image->rows, (int64_t) angle_in_degrees );
+
 	*p_p_new_image = RotateImage( p_image, angle_in_degrees, p_exception );
 
     if( p_exception->severity != UndefinedException )
@@ -155,6 +269,8 @@ boolean simple_image_rotate( const Image *p_image, double angle_in_degrees, /*ou
 
 	b_result &= *p_p_new_image != NULL;
 
+	TRACE3( image_rotate_done, *p_p_new_image ? (*p_p_new_image)->columns : 0, *p_p_new_image ? (*p_p_new_image)->rows : 0, b_result );
+
 	DestroyExceptionInfo( p_exception );
 	return b_result;
 }
@@ -170,6 +286,8 @@ boolean simple_image_crop( const Image *p_image, uint x, uint y, uint width, uin
 	geometry.width  = width;
 	geometry.height = height;
 	
+	TRACE4( image_crop_start, p_image->columns, p_image->rows, width, height );
+
 	*p_p_new_image = CropImage( p_image, &geometry, p_exception );
 
     if( p_exception->severity != UndefinedException )
@@ -180,6 +298,8 @@ boolean simple_image_crop( const Image *p_image, uint x, uint y, uint width, uin
 
 	b_result &= *p_p_new_image != NULL;
 
+	TRACE3( image_crop_done, *p_p_new_image ? (*p_p_new_image)->columns : 0, *p_p_new_image ? (*p_p_new_image)->rows : 0, b_result );
+
 	DestroyExceptionInfo( p_exception );
 	return b_result;
 }
@@ -278,49 +398,37 @@ boolean simple_image_is_jpeg( const Image *data )
 	return strncmp( format, SIMPLE_IMAGE_JPEG, SIMPLE_IMAGE_JPEG_LENGTH ) == 0;
 }
 
+/* looks at the magic number only; nothing is decoded */
+boolean simple_image_is_data_jpeg( const byte *p_data, size_t length )
+{
+	const char *s_type = mime_sniff( p_data, length, NULL );
+	return s_type && strcmp( s_type, "image/jpeg" ) == 0;
+}
+
 boolean simple_image_is_file_jpeg( const char *s_filename, size_t length )
 {
-	boolean b_is_jpeg        = TRUE;
-	const char *ext          = strrchr( s_filename, '.' ) + 1;
+	byte header[ 4 ];
+	ssize_t count = -1;
+	char s_path[ MaxTextExtent ];
+	int fd;
 
-	if( strncasecmp(ext, "jpg", 3) != 0 &&
-	    strncasecmp(ext, "jpe", 3) != 0 &&
-	    strncasecmp(ext, "jpeg", 4) != 0 )
+	if( length >= sizeof(s_path) )
 	{
-		b_is_jpeg = FALSE;
+		return FALSE;
 	}
 
-	if( b_is_jpeg )
-	{
-		ExceptionInfo *p_exception = AcquireExceptionInfo( );
-		ImageInfo *p_image_info = NULL;
-		Image *p_image          = NULL;
-
-		p_image_info = CloneImageInfo( NULL );
-		strncpy( p_image_info->filename, s_filename, length );
-		p_image_info->filename[ length ] = '\0';
-		p_image = PingImage( p_image_info, p_exception );
+	strncpy( s_path, s_filename, length );
+	s_path[ length ] = '\0';
 
-		if( p_exception->severity != UndefinedException )
-		{
-			CatchException( p_exception );
-			DestroyImageInfo( p_image_info );
-			b_is_jpeg = FALSE;
-		}
-
-		assert( p_image_info );
-		assert( p_image );
-		assert( p_image->signature == MagickSignature );
+	fd = open( s_path, O_RDONLY );
 
-		b_is_jpeg = simple_image_is_jpeg( p_image );
-	
-		/* clean up */	
-		DestroyImageInfo( p_image_info );
-		DestroyImage( p_image );
-		DestroyExceptionInfo( p_exception );
+	if( fd >= 0 )
+	{
+		count = read( fd, header, sizeof(header) );
+		close( fd );
 	}
 
-	return b_is_jpeg;	
+	return count > 0 && simple_image_is_data_jpeg( header, (size_t) count );
 }
 
 
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "sparse.h"
+#include "bufpool.h"
+
+#define SPARSE_HEADER_SIZE      (8 + 8 + 8)
+#define SPARSE_EXTENT_SIZE      (8 + 8)
+
+static void     _sparse_put_u64  ( byte *p_out, uint64_t value );
+static uint64_t _sparse_get_u64  ( const byte *p_in );
+static boolean  _sparse_read_all ( int fd, void *p_buffer, size_t length );
+
+
+boolean sparse_map_create( sparse_map *p_map )
+{
+	assert( p_map );
+
+	p_map->size = 0;
+	p_map->data = 0;
+
+	return vector_create( &p_map->extents, sizeof(readahead_extent), NULL );
+}
+
+void sparse_map_destroy( sparse_map *p_map )
+{
+	assert( p_map );
+	vector_destroy( &p_map->extents );
+}
+
+boolean sparse_map_file( sparse_map *p_map, int fd, off_t size )
+{
+	#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+	off_t position = 0;
+
+	assert( p_map );
+	assert( fd >= 0 );
+
+	p_map->size = size;
+	p_map->data = 0;
+	p_map->extents.size = 0;
+
+	while( position < size )
+	{
+		readahead_extent extent;
+		readahead_extent *p_last;
+		off_t hole;
+
+		extent.offset = lseek( fd, position, SEEK_DATA );
+
+		if( extent.offset < 0 )
+		{
+			if( errno == ENXIO ) break; /* only a hole is left */
+			return FALSE;
+		}
+
+		hole = lseek( fd, extent.offset, SEEK_HOLE );
+
+		if( hole < 0 )
+		{
+			return FALSE;
+		}
+
+		if( hole > size ) hole = size;
+		extent.length = hole - extent.offset;
+		position      = hole;
+
+		if( extent.length <= 0 ) break;
+
+		p_last = vector_is_empty(&p_map->extents) ? NULL :
+		         (readahead_extent *) vector_element_at( &p_map->extents, vector_size(&p_map->extents) - 1 );
+
+		if( p_last && extent.offset - (p_last->offset + p_last->length) < SPARSE_MIN_HOLE )
+		{
+			/* reading a small hole beats another extent */
+			p_map->data    += extent.offset + extent.length - (p_last->offset + p_last->length);
+			p_last->length  = extent.offset + extent.length - p_last->offset;
+		}
+		else
+		{
+			p_map->data += extent.length;
+			vector_push( &p_map->extents, &extent );
+		}
+	}
+
+	lseek( fd, 0, SEEK_SET );
+
+	return TRUE;
+	#else
+	(void) p_map; (void) fd; (void) size;
+	return FALSE;
+	#endif
+}
+
+size_t sparse_header_size( const sparse_map *p_map )
+{
+	assert( p_map );
+	return SPARSE_HEADER_SIZE + SPARSE_EXTENT_SIZE * vector_size( (vector *) &p_map->extents );
+}
+
+void sparse_header_write( const sparse_map *p_map, byte *p_header )
+{
+	const readahead_extent *p_extents = sparse_map_extents( p_map );
+	size_t count = sparse_map_count( p_map );
+	size_t i;
+
+	assert( p_header );
+
+	memcpy( p_header, SPARSE_MAGIC, 8 );
+	_sparse_put_u64( p_header + 8, (uint64_t) p_map->size );
+	_sparse_put_u64( p_header + 16, (uint64_t) count );
+	p_header += SPARSE_HEADER_SIZE;
+
+	for( i = 0; i < count; i++ )
+	{
+		_sparse_put_u64( p_header, (uint64_t) p_extents[ i ].offset );
+		_sparse_put_u64( p_header + 8, (uint64_t) p_extents[ i ].length );
+		p_header += SPARSE_EXTENT_SIZE;
+	}
+}
+
+/* fd_in is a sparse object as uploaded; fd_out gets the file back, holes and all */
+boolean sparse_unpack( int fd_in, int fd_out )
+{
+	byte header[ SPARSE_HEADER_SIZE ];
+	byte *p_extents = NULL;
+	byte *p_buffer  = NULL;
+	buffer_pool *p_pool = buffer_pool_shared( );
+	boolean b_result = TRUE;
+	uint64_t size;
+	uint64_t count;
+	uint64_t i;
+
+	if( !_sparse_read_all( fd_in, header, sizeof(header) ) || memcmp( header, SPARSE_MAGIC, 8 ) != 0 )
+	{
+		return FALSE;
+	}
+
+	size  = _sparse_get_u64( header + 8 );
+	count = _sparse_get_u64( header + 16 );
+
+	if( count > SIZE_MAX / SPARSE_EXTENT_SIZE || !p_pool )
+	{
+		return FALSE;
+	}
+
+	p_extents = (byte *) malloc( count * SPARSE_EXTENT_SIZE + 1 );
+	p_buffer  = buffer_pool_acquire( p_pool );
+
+	if( !p_extents || !p_buffer || !_sparse_read_all( fd_in, p_extents, count * SPARSE_EXTENT_SIZE ) )
+	{
+		b_result = FALSE;
+	}
+
+	for( i = 0; b_result && i < count; i++ )
+	{
+		uint64_t offset = _sparse_get_u64( p_extents + i * SPARSE_EXTENT_SIZE );
+		uint64_t length = _sparse_get_u64( p_extents + i * SPARSE_EXTENT_SIZE + 8 );
+
+		if( offset + length > size || offset + length < offset )
+		{
+			b_result = FALSE;
+			break;
+		}
+
+		while( b_result && length > 0 )
+		{
+			size_t chunk = length < buffer_pool_buffer_size( p_pool ) ? (size_t) length : buffer_pool_buffer_size( p_pool );
+
+			b_result = _sparse_read_all( fd_in, p_buffer, chunk ) &&
+			           pwrite( fd_out, p_buffer, chunk, (off_t) offset ) == (ssize_t) chunk;
+
+			offset += chunk;
+			length -= chunk;
+		}
+	}
+
+	/* whatever was never written stays a hole */
+	if( b_result && ftruncate( fd_out, (off_t) size ) != 0 )
+	{
+		b_result = FALSE;
+	}
+
+	buffer_pool_release( p_pool, p_buffer );
+	free( p_extents );
+
+	return b_result;
+}
+
+void _sparse_put_u64( byte *p_out, uint64_t value )
+{
+	int i;
+
+	for( i = 0; i < 8; i++ )
+	{
+		p_out[ i ] = (byte) (value >> (8 * i));
+	}
+}
+
+uint64_t _sparse_get_u64( const byte *p_in )
+{
+	uint64_t value = 0;
+	int i;
+
+	for( i = 7; i >= 0; i-- )
+	{
+		value = (value << 8) | p_in[ i ];
+	}
+
+	return value;
+}
+
+boolean _sparse_read_all( int fd, void *p_buffer, size_t length )
+{
+	byte *p_out = (byte *) p_buffer;
+
+	while( length > 0 )
+	{
+		ssize_t n = read( fd, p_out, length );
+
+		if( n < 0 && errno == EINTR ) continue;
+		if( n <= 0 ) return FALSE;
+
+		p_out  += n;
+		length -= (size_t) n;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,44 @@
+#ifndef _SPARSE_H_
+#define _SPARSE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h"
+#include "vector.h"
+#include "readahead.h"
+
+/*
+ * Sparse files (VM images, database preallocations) are uploaded as
+ * their data extents only. The object body is
+ *
+ *   "BTSPARS1", u64 logical size, u64 extent count       (little endian)
+ *   extent count x { u64 offset, u64 length }
+ *   the bytes of every extent, back to back
+ *
+ * and sparse_unpack() turns it back into a file with the same holes.
+ * Holes shorter than SPARSE_MIN_HOLE are read as data: they cost more
+ * in extent entries and seeks than they save.
+ */
+#define SPARSE_MAGIC            "BTSPARS1"
+#define SPARSE_MIME_TYPE        "application/x-backup-sparse"
+#define SPARSE_MIN_HOLE         (64 * 1024)
+#define SPARSE_MIN_SAVING       (1024 * 1024)  /* below this a file goes up as is */
+
+typedef struct tag_sparse_map {
+	off_t size;             /* logical size of the file */
+	off_t data;             /* bytes in extents */
+	vector extents;         /* readahead_extent, in file order */
+} sparse_map;
+
+boolean sparse_map_create   ( sparse_map *p_map );
+void    sparse_map_destroy  ( sparse_map *p_map );
+boolean sparse_map_file     ( sparse_map *p_map, int fd, off_t size ); /* FALSE when the filesystem cannot tell */
+size_t  sparse_header_size  ( const sparse_map *p_map );
+void    sparse_header_write ( const sparse_map *p_map, /*out*/ byte *p_header );
+boolean sparse_unpack       ( int fd_in, int fd_out );
+
+#define sparse_map_extents( p_map )         ((const readahead_extent *) vector_array( &(p_map)->extents ))
+#define sparse_map_count( p_map )           (vector_size( &(p_map)->extents ))
+#define sparse_map_is_worthwhile( p_map )   ((p_map)->size - (p_map)->data >= SPARSE_MIN_SAVING + (off_t) sparse_header_size( p_map ))
+
+#endif /* _SPARSE_H_ */
@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <curl/curl.h>
+#include "strip.h"
+
+enum strip_state {
+	STRIP_STATE_HEADER = 0,  /* collecting a marker or chunk header */
+	STRIP_STATE_BODY,        /* inside a segment, copying or dropping */
+	STRIP_STATE_PASS         /* everything else goes straight through */
+};
+
+#define JPEG_SOS     (0xDA)
+#define JPEG_EOI     (0xD9)
+#define JPEG_COM     (0xFE)
+
+static const byte png_signature[ 8 ] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+static size_t  _strip_header_byte  ( strip_filter *p_filter, byte b, byte *p_out );
+static size_t  _strip_jpeg_byte    ( strip_filter *p_filter, byte b, byte *p_out );
+static size_t  _strip_png_byte     ( strip_filter *p_filter, byte b, byte *p_out );
+static size_t  _strip_flush        ( strip_filter *p_filter, byte *p_out );
+static void    _strip_segment      ( strip_filter *p_filter, size_t length, boolean b_drop, boolean b_last );
+static void    _strip_segment_done ( strip_filter *p_filter );
+static boolean _strip_jpeg_drop    ( byte marker );
+static boolean _strip_png_drop     ( const byte *type );
+
+
+strip_format strip_detect( const byte *p_data, size_t length )
+{
+	if( length >= 3 && p_data[ 0 ] == 0xFF && p_data[ 1 ] == 0xD8 && p_data[ 2 ] == 0xFF )
+	{
+		return STRIP_JPEG;
+	}
+	else if( length >= sizeof(png_signature) && memcmp( p_data, png_signature, sizeof(png_signature) ) == 0 )
+	{
+		return STRIP_PNG;
+	}
+
+	return STRIP_NONE;
+}
+
+void strip_filter_begin( strip_filter *p_filter, strip_format format )
+{
+	assert( p_filter );
+
+	memset( p_filter, 0, sizeof(strip_filter) );
+	p_filter->format = format;
+
+	switch( format )
+	{
+		case STRIP_JPEG: /* SOI */
+			_strip_segment( p_filter, 2, FALSE, FALSE );
+			break;
+		case STRIP_PNG:
+			_strip_segment( p_filter, sizeof(png_signature), FALSE, FALSE );
+			break;
+		case STRIP_NONE:
+		default:
+			p_filter->state = STRIP_STATE_PASS;
+			break;
+	}
+}
+
+size_t strip_filter_process( strip_filter *p_filter, const byte *p_in, size_t length, byte *p_out )
+{
+	size_t written = 0;
+
+	assert( p_filter );
+	assert( p_in || length == 0 );
+	assert( p_out );
+
+	while( length > 0 )
+	{
+		switch( p_filter->state )
+		{
+			case STRIP_STATE_PASS:
+				memcpy( p_out + written, p_in, length );
+				written += length;
+				length   = 0;
+				break;
+			case STRIP_STATE_BODY:
+			{
+				size_t n = p_filter->remaining < length ? p_filter->remaining : length;
+
+				if( !p_filter->b_drop )
+				{
+					memcpy( p_out + written, p_in, n );
+					written += n;
+				}
+
+				p_in   += n;
+				length -= n;
+				p_filter->remaining -= n;
+
+				if( p_filter->remaining == 0 ) _strip_segment_done( p_filter );
+				break;
+			}
+			case STRIP_STATE_HEADER:
+			default:
+				written += _strip_header_byte( p_filter, *p_in, p_out + written );
+				p_in++;
+				length--;
+				break;
+		}
+	}
+
+	return written;
+}
+
+/* a truncated header is kept as it is */
+size_t strip_filter_end( strip_filter *p_filter, byte *p_out )
+{
+	assert( p_filter );
+	return p_filter->state == STRIP_STATE_HEADER ? _strip_flush( p_filter, p_out ) : 0;
+}
+
+size_t strip_filter_opaque( const strip_filter *p_filter )
+{
+	assert( p_filter );
+
+	switch( p_filter->state )
+	{
+		case STRIP_STATE_PASS: return SIZE_MAX;
+		case STRIP_STATE_BODY: return p_filter->remaining;
+		default:               return 0;
+	}
+}
+
+size_t strip_filter_skip( strip_filter *p_filter, size_t length )
+{
+	assert( p_filter );
+	assert( length <= strip_filter_opaque( p_filter ) );
+
+	if( p_filter->state == STRIP_STATE_PASS )
+	{
+		return length;
+	}
+
+	p_filter->remaining -= length;
+
+	if( p_filter->b_drop )
+	{
+		length = 0;
+	}
+
+	if( p_filter->remaining == 0 ) _strip_segment_done( p_filter );
+
+	return length;
+}
+
+boolean strip_reader_open( strip_reader *p_reader, FILE *p_file, off_t *p_size )
+{
+	byte header[ STRIP_DETECT_LENGTH ];
+	size_t length;
+	strip_format format;
+
+	assert( p_reader );
+	assert( p_file );
+
+	length = fread( header, 1, sizeof(header), p_file );
+	format = strip_detect( header, length );
+
+	if( format == STRIP_NONE || !strip_measure( p_file, format, p_size ) )
+	{
+		rewind( p_file );
+		return FALSE;
+	}
+
+	rewind( p_file );
+	p_reader->p_file     = p_file;
+	p_reader->p_profiler = NULL;
+	p_reader->b_eof      = FALSE;
+	strip_filter_begin( &p_reader->filter, format );
+
+	return TRUE;
+}
+
+size_t strip_reader_read( void *ptr, size_t size, size_t nmemb, void *data )
+{
+	strip_reader *p_reader = (strip_reader *) data;
+	size_t capacity        = size * nmemb;
+	size_t written         = 0;
+
+	assert( p_reader );
+	assert( capacity > STRIP_MAX_PENDING );
+
+	/* returning 0 would end the upload, so keep going until something is kept */
+	while( written == 0 && !p_reader->b_eof )
+	{
+		size_t want = capacity - STRIP_MAX_PENDING;
+		size_t n;
+		uint64_t begin;
+
+		if( strip_filter_dropping( &p_reader->filter ) )
+		{
+			size_t skip = strip_filter_opaque( &p_reader->filter );
+
+			if( fseeko( p_reader->p_file, (off_t) skip, SEEK_CUR ) != 0 )
+			{
+				return CURL_READFUNC_ABORT;
+			}
+
+			strip_filter_skip( &p_reader->filter, skip );
+			continue;
+		}
+
+		if( want > sizeof(p_reader->buffer) ) want = sizeof(p_reader->buffer);
+
+		begin = profiler_begin( p_reader->p_profiler );
+		n     = fread( p_reader->buffer, 1, want, p_reader->p_file );
+		profiler_end( p_reader->p_profiler, PROFILE_READ, begin, n );
+
+		if( n == 0 )
+		{
+			if( ferror( p_reader->p_file ) )
+			{
+				return CURL_READFUNC_ABORT;
+			}
+
+			p_reader->b_eof = TRUE;
+			written = strip_filter_end( &p_reader->filter, (byte *) ptr );
+		}
+		else
+		{
+			begin   = profiler_begin( p_reader->p_profiler );
+			written = strip_filter_process( &p_reader->filter, p_reader->buffer, n, (byte *) ptr );
+			profiler_end( p_reader->p_profiler, PROFILE_FILTER, begin, n );
+		}
+	}
+
+	return written;
+}
+
+/*
+ * Works out the stripped size up front (for Content-Length) by reading
+ * only the segment headers and seeking over everything else.
+ */
+boolean strip_measure( FILE *p_file, strip_format format, off_t *p_size )
+{
+	strip_filter filter;
+	byte out[ STRIP_MAX_PENDING + 1 ];
+	off_t total;
+	off_t position = 0;
+	off_t size     = 0;
+
+	assert( p_file );
+	assert( p_size );
+
+	if( fseeko( p_file, 0, SEEK_END ) != 0 || (total = ftello( p_file )) < 0 || fseeko( p_file, 0, SEEK_SET ) != 0 )
+	{
+		return FALSE;
+	}
+
+	strip_filter_begin( &filter, format );
+
+	while( position < total )
+	{
+		size_t opaque = strip_filter_opaque( &filter );
+
+		if( opaque > 0 )
+		{
+			size_t n = (size_t) (total - position);
+
+			if( opaque < n ) n = opaque;
+
+			size     += strip_filter_skip( &filter, n );
+			position += (off_t) n;
+
+			if( fseeko( p_file, position, SEEK_SET ) != 0 ) return FALSE;
+		}
+		else
+		{
+			int c = fgetc( p_file );
+			byte b;
+
+			if( c == EOF ) return FALSE;
+
+			b = (byte) c;
+			size += strip_filter_process( &filter, &b, 1, out );
+			position++;
+		}
+	}
+
+	size += strip_filter_end( &filter, out );
+
+	*p_size = size;
+
+	return TRUE;
+}
+
+size_t _strip_header_byte( strip_filter *p_filter, byte b, byte *p_out )
+{
+	return p_filter->format == STRIP_JPEG ? _strip_jpeg_byte( p_filter, b, p_out ) : _strip_png_byte( p_filter, b, p_out );
+}
+
+/* pending holds FF, marker, length high, length low */
+size_t _strip_jpeg_byte( strip_filter *p_filter, byte b, byte *p_out )
+{
+	byte marker;
+
+	if( p_filter->pending_length == 1 && b == 0xFF )
+	{
+		return 0; /* fill byte */
+	}
+
+	p_filter->pending[ p_filter->pending_length++ ] = b;
+
+	switch( p_filter->pending_length )
+	{
+		case 1:
+			if( b != 0xFF )
+			{
+				p_filter->state = STRIP_STATE_PASS;
+				return _strip_flush( p_filter, p_out );
+			}
+			return 0;
+		case 2:
+			/* markers without a length: TEM, RSTn, SOI and EOI */
+			if( b == 0x01 || (b >= 0xD0 && b <= JPEG_EOI) )
+			{
+				if( b == JPEG_EOI ) p_filter->state = STRIP_STATE_PASS;
+				return _strip_flush( p_filter, p_out );
+			}
+			else if( b == 0x00 )
+			{
+				p_filter->state = STRIP_STATE_PASS;
+				return _strip_flush( p_filter, p_out );
+			}
+			return 0;
+		case 3:
+			return 0;
+		default:
+			break;
+	}
+
+	marker = p_filter->pending[ 1 ];
+
+	{
+		size_t length = ((size_t) p_filter->pending[ 2 ] << 8) | p_filter->pending[ 3 ];
+		boolean b_drop;
+
+		if( length < 2 )
+		{
+			p_filter->state = STRIP_STATE_PASS;
+			return _strip_flush( p_filter, p_out );
+		}
+
+		/* after SOS comes entropy coded data, which is left alone */
+		b_drop = _strip_jpeg_drop( marker );
+		_strip_segment( p_filter, length - 2, b_drop, marker == JPEG_SOS );
+
+		if( b_drop )
+		{
+			p_filter->pending_length = 0;
+			return 0;
+		}
+
+		return _strip_flush( p_filter, p_out );
+	}
+}
+
+/* pending holds the chunk length and type */
+size_t _strip_png_byte( strip_filter *p_filter, byte b, byte *p_out )
+{
+	uint32_t length;
+	boolean b_drop;
+
+	p_filter->pending[ p_filter->pending_length++ ] = b;
+
+	if( p_filter->pending_length < 8 )
+	{
+		return 0;
+	}
+
+	length = ((uint32_t) p_filter->pending[ 0 ] << 24) | ((uint32_t) p_filter->pending[ 1 ] << 16) |
+	         ((uint32_t) p_filter->pending[ 2 ] << 8)  |  (uint32_t) p_filter->pending[ 3 ];
+
+	if( length > 0x7FFFFFFF )
+	{
+		p_filter->state = STRIP_STATE_PASS;
+		return _strip_flush( p_filter, p_out );
+	}
+
+	b_drop = _strip_png_drop( &p_filter->pending[ 4 ] );
+	_strip_segment( p_filter, (size_t) length + 4 /* CRC */, b_drop, memcmp( &p_filter->pending[ 4 ], "IEND", 4 ) == 0 );
+
+	if( b_drop )
+	{
+		p_filter->pending_length = 0;
+		return 0;
+	}
+
+	return _strip_flush( p_filter, p_out );
+}
+
+size_t _strip_flush( strip_filter *p_filter, byte *p_out )
+{
+	size_t length = p_filter->pending_length;
+
+	memcpy( p_out, p_filter->pending, length );
+	p_filter->pending_length = 0;
+
+	return length;
+}
+
+void _strip_segment( strip_filter *p_filter, size_t length, boolean b_drop, boolean b_last )
+{
+	p_filter->remaining = length;
+	p_filter->b_drop    = b_drop;
+	p_filter->b_last    = b_last;
+	p_filter->state     = STRIP_STATE_BODY;
+
+	if( length == 0 ) _strip_segment_done( p_filter );
+}
+
+void _strip_segment_done( strip_filter *p_filter )
+{
+	p_filter->state  = p_filter->b_last ? STRIP_STATE_PASS : STRIP_STATE_HEADER;
+	p_filter->b_drop = FALSE;
+}
+
+boolean _strip_jpeg_drop( byte marker )
+{
+	if( marker == JPEG_COM ) return TRUE;
+	if( marker < 0xE0 || marker > 0xEF ) return FALSE;
+
+	switch( marker - 0xE0 )
+	{
+		case 0:  /* JFIF */
+		case 2:  /* ICC profile */
+		case 14: /* Adobe */
+			return FALSE;
+		default:
+			return TRUE;
+	}
+}
+
+boolean _strip_png_drop( const byte *type )
+{
+	static const char *dropped[] = { "tEXt", "zTXt", "iTXt", "eXIf", "tIME" };
+	size_t i;
+
+	for( i = 0; i < sizeof(dropped) / sizeof(dropped[0]); i++ )
+	{
+		if( memcmp( type, dropped[ i ], 4 ) == 0 ) return TRUE;
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,64 @@
+#ifndef _STRIP_H_
+#define _STRIP_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h"
+#include "profile.h"
+
+/*
+ * Lossless metadata stripping for JPEG and PNG. The image data is never
+ * decoded; segments and chunks are copied straight through or dropped.
+ *
+ *   JPEG: APP1 (EXIF, XMP), APP3 - APP13, APP15 and COM are dropped.
+ *         APP0 (JFIF), APP2 (ICC profile) and APP14 (Adobe colour
+ *         transform) are kept because decoders need them.
+ *   PNG:  tEXt, zTXt, iTXt, eXIf and tIME are dropped.
+ *
+ * Anything that does not parse is passed through untouched from that
+ * point on.
+ */
+typedef enum strip_format {
+	STRIP_NONE = 0,
+	STRIP_JPEG,
+	STRIP_PNG
+} strip_format;
+
+#define STRIP_MAX_PENDING       (8)     /* bytes a filter may hold between calls */
+#define STRIP_DETECT_LENGTH     (8)     /* bytes strip_detect() wants to see */
+
+typedef struct tag_strip_filter {
+	strip_format format;
+	int state;
+	size_t remaining;                   /* bytes left in the current segment */
+	boolean b_drop;                     /* current segment is being dropped */
+	boolean b_last;                     /* pass the rest through after this segment */
+	byte pending[ STRIP_MAX_PENDING ];  /* segment header seen so far */
+	size_t pending_length;
+} strip_filter;
+
+strip_format strip_detect          ( const byte *p_data, size_t length );
+void         strip_filter_begin    ( strip_filter *p_filter, strip_format format );
+size_t       strip_filter_process  ( strip_filter *p_filter, const byte *p_in, size_t length, /*out*/ byte *p_out ); /* p_out holds length + STRIP_MAX_PENDING */
+size_t       strip_filter_end      ( strip_filter *p_filter, /*out*/ byte *p_out );
+size_t       strip_filter_opaque   ( const strip_filter *p_filter ); /* bytes that can be skipped without looking at them */
+size_t       strip_filter_skip     ( strip_filter *p_filter, size_t length ); /* returns how many of them are kept */
+#define      strip_filter_dropping( p_filter )   ((p_filter)->b_drop && strip_filter_opaque( p_filter ) > 0)
+
+/*
+ * A cURL read callback (CURLOPT_READFUNCTION) that strips a file on the
+ * fly. Dropped segments are seeked over rather than read.
+ */
+typedef struct tag_strip_reader {
+	FILE *p_file;
+	profiler *p_profiler;               /* may be NULL */
+	strip_filter filter;
+	boolean b_eof;
+	byte buffer[ 16384 ];
+} strip_reader;
+
+boolean strip_reader_open  ( strip_reader *p_reader, FILE *p_file, /*out*/ off_t *p_size ); /* FALSE if not JPEG or PNG */
+size_t  strip_reader_read  ( void *ptr, size_t size, size_t nmemb, void *data );
+boolean strip_measure      ( FILE *p_file, strip_format format, /*out*/ off_t *p_size );
+
+#endif /* _STRIP_H_ */
@@ -0,0 +1,810 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "mpmc.h"
+#include "log.h"
+#include "sync.h"
+
+#define SYNC_MAX_PATH        (4096)
+
+/* sparse uploads to S3 are packed (see sparse.h), so their sizes differ from the files */
+#define _sync_is_sparse( p_options )  ((p_options)->p_s3 && (p_options)->p_s3->b_sparse)
+/* and stripped images are smaller than theirs */
+#define _sync_is_stripped( p_options ) ((p_options)->p_s3 && (p_options)->p_s3->b_strip_metadata)
+
+typedef enum {
+	SYNC_PUT_CREATED = 0,
+	SYNC_PUT_CHANGED,
+	SYNC_DELETE,
+} sync_action_type;
+
+typedef struct tag_sync_action {
+	sync_action_type type;
+	uint64_t size;                   /* of the local file, for the catalog */
+	int64_t mtime;
+	char s_key[ SYNC_MAX_KEY + 1 ];
+} sync_action;
+
+/* bounded, lock-free queue between the merge-join and the workers */
+typedef struct tag_sync_queue {
+	const sync_options *p_options;
+	const char *s_prefix;            /* normalized, "" or ending in '/' */
+	sync_stats *p_stats;
+	mpmc_queue actions;              /* of sync_action */
+	pthread_mutex_t catalog_lock;    /* the workers record into one catalog */
+} sync_queue;
+
+/* the remote side of the join: an S3 listing or a walked local target */
+typedef struct tag_sync_remote {
+	S3Lister lister;
+	CURL *p_curl;
+	size_t prefix_length;
+	sync_sorter sorter;
+	boolean b_s3;
+	sync_record record;
+} sync_remote;
+
+static int     _sync_compare_keys   ( const char *s_a, size_t a_length, const char *s_b, size_t b_length );
+static int     _sync_compare_records( const void *p_left, const void *p_right );
+static boolean _sync_sorter_spill   ( sync_sorter *p_sorter );
+static boolean _sync_spill_read       ( sync_spill *p_run );
+static boolean _sync_heap_less      ( const sync_sorter *p_sorter, size_t a, size_t b );
+static void    _sync_heap_down      ( sync_sorter *p_sorter, size_t i );
+static boolean _sync_walk           ( sync_sorter *p_sorter, char *s_path, size_t base_length, size_t length, boolean b_verbose );
+static boolean _sync_remote_next    ( sync_remote *p_remote, /*out*/ const sync_record **p_p_record );
+static boolean _sync_remote_failed  ( const sync_remote *p_remote );
+static boolean _sync_catalog_add    ( void *data, const catalog_entry *p_entry );
+static boolean _sync_is_changed     ( const sync_options *p_options, const sync_record *p_local, const sync_record *p_remote );
+static void    _sync_record         ( sync_queue *p_queue, const sync_action *p_action, const char *s_key, const char *s_etag );
+static void    _sync_queue_push     ( sync_queue *p_queue, sync_action_type type, const sync_record *p_record );
+static void    _sync_count          ( size_t *p_counter );
+static void*   _sync_worker         ( void *data );
+
+
+boolean sync_sorter_create( sync_sorter *p_sorter, size_t memory_limit )
+{
+	assert( p_sorter );
+
+	memset( p_sorter, 0, sizeof(sync_sorter) );
+	p_sorter->memory_limit = memory_limit > 0 ? memory_limit : SYNC_DEFAULT_MEMORY;
+
+	return vector_create( &p_sorter->records, sizeof(sync_record), NULL ) &&
+	       vector_create( &p_sorter->runs, sizeof(sync_spill), NULL ) &&
+	       arena_create( &p_sorter->keys, 0 );
+}
+
+void sync_sorter_destroy( sync_sorter *p_sorter )
+{
+	size_t i;
+
+	assert( p_sorter );
+
+	for( i = 0; i < vector_size(&p_sorter->runs); i++ )
+	{
+		sync_spill *p_run = (sync_spill *) vector_element_at( &p_sorter->runs, i );
+		if( p_run->p_file ) fclose( p_run->p_file );
+	}
+
+	free( p_sorter->p_heap );
+	arena_destroy( &p_sorter->keys );
+	vector_destroy( &p_sorter->runs );
+	vector_destroy( &p_sorter->records );
+}
+
+boolean sync_sorter_add( sync_sorter *p_sorter, const char *s_key, uint64_t size, int64_t mtime )
+{
+	sync_record record;
+
+	assert( p_sorter );
+	assert( s_key );
+
+	record.key_length = strlen( s_key );
+
+	if( record.key_length > SYNC_MAX_KEY )
+	{
+		return FALSE;
+	}
+
+	record.s_key = arena_strndup( &p_sorter->keys, s_key, record.key_length );
+	record.size  = size;
+	record.mtime = mtime;
+
+	if( !record.s_key || !vector_push( &p_sorter->records, &record ) )
+	{
+		p_sorter->b_error = TRUE;
+		return FALSE;
+	}
+
+	if( arena_bytes_allocated(&p_sorter->keys) + vector_array_size(&p_sorter->records) * sizeof(sync_record) >= p_sorter->memory_limit )
+	{
+		return _sync_sorter_spill( p_sorter );
+	}
+
+	return TRUE;
+}
+
+boolean sync_sorter_finish( sync_sorter *p_sorter )
+{
+	size_t i;
+
+	assert( p_sorter );
+
+	p_sorter->next = 0;
+
+	if( vector_is_empty(&p_sorter->runs) )
+	{
+		qsort( vector_array(&p_sorter->records), vector_size(&p_sorter->records), sizeof(sync_record), _sync_compare_records );
+		return !p_sorter->b_error;
+	}
+
+	/* part of it is on disk already, so the rest goes there too */
+	if( !vector_is_empty(&p_sorter->records) && !_sync_sorter_spill( p_sorter ) )
+	{
+		return FALSE;
+	}
+
+	p_sorter->p_heap = (size_t *) malloc( sizeof(size_t) * vector_size(&p_sorter->runs) );
+
+	if( !p_sorter->p_heap )
+	{
+		p_sorter->b_error = TRUE;
+		return FALSE;
+	}
+
+	for( i = 0; i < vector_size(&p_sorter->runs); i++ )
+	{
+		sync_spill *p_run = (sync_spill *) vector_element_at( &p_sorter->runs, i );
+
+		rewind( p_run->p_file );
+
+		if( _sync_spill_read( p_run ) )
+		{
+			p_sorter->p_heap[ p_sorter->heap_size++ ] = i;
+		}
+	}
+
+	for( i = p_sorter->heap_size / 2; i-- > 0; )
+	{
+		_sync_heap_down( p_sorter, i );
+	}
+
+	return !p_sorter->b_error;
+}
+
+boolean sync_sorter_next( sync_sorter *p_sorter, const sync_record **p_p_record )
+{
+	assert( p_sorter );
+	assert( p_p_record );
+
+	if( vector_is_empty(&p_sorter->runs) )
+	{
+		if( p_sorter->next >= vector_size(&p_sorter->records) ) return FALSE;
+
+		*p_p_record = (const sync_record *) vector_element_at( &p_sorter->records, p_sorter->next++ );
+		return TRUE;
+	}
+
+	/* the record handed out last time is still at the top; move past it now */
+	if( p_sorter->next > 0 && p_sorter->heap_size > 0 )
+	{
+		sync_spill *p_top = (sync_spill *) vector_element_at( &p_sorter->runs, p_sorter->p_heap[ 0 ] );
+
+		if( !_sync_spill_read( p_top ) )
+		{
+			if( ferror( p_top->p_file ) ) p_sorter->b_error = TRUE;
+			p_sorter->p_heap[ 0 ] = p_sorter->p_heap[ --p_sorter->heap_size ];
+		}
+
+		_sync_heap_down( p_sorter, 0 );
+	}
+
+	if( p_sorter->heap_size == 0 || p_sorter->b_error )
+	{
+		return FALSE;
+	}
+
+	*p_p_record = &((sync_spill *) vector_element_at( &p_sorter->runs, p_sorter->p_heap[ 0 ] ))->current;
+	p_sorter->next++;
+
+	return TRUE;
+}
+
+void sync_options_initialize( sync_options *p_options )
+{
+	assert( p_options );
+
+	memset( p_options, 0, sizeof(sync_options) );
+	p_options->workers      = SYNC_DEFAULT_WORKERS;
+	p_options->memory_limit = SYNC_DEFAULT_MEMORY;
+}
+
+boolean sync_run( const sync_options *p_options, sync_stats *p_stats )
+{
+	char s_path[ SYNC_MAX_PATH ];
+	char s_prefix[ SYNC_MAX_KEY + 1 ];
+	pthread_t threads[ SYNC_MAX_WORKERS ];
+	sync_sorter local;
+	sync_remote remote;
+	sync_queue queue;
+	const sync_record *p_local  = NULL;
+	const sync_record *p_remote = NULL;
+	boolean b_have_local;
+	boolean b_have_remote;
+	boolean b_result = TRUE;
+	size_t length;
+	uint workers;
+	uint i;
+
+	assert( p_options );
+	assert( p_options->s_directory );
+	assert( p_options->s_bucket );
+	assert( p_options->p_s3 || p_options->p_fs );
+	assert( p_stats );
+
+	memset( p_stats, 0, sizeof(sync_stats) );
+	memset( &remote, 0, sizeof(sync_remote) );
+
+	/* "photos" and "photos/" both mean everything below photos/ */
+	snprintf( s_prefix, sizeof(s_prefix), "%s", p_options->s_prefix ? p_options->s_prefix : "" );
+	length = strlen( s_prefix );
+	if( length > 0 && s_prefix[ length - 1 ] != '/' && length < SYNC_MAX_KEY )
+	{
+		s_prefix[ length++ ] = '/';
+		s_prefix[ length ]   = '\0';
+	}
+
+	if( !sync_sorter_create( &local, p_options->memory_limit ) )
+	{
+		return FALSE;
+	}
+
+	/* local side */
+	length = strlen( p_options->s_directory );
+	while( length > 1 && p_options->s_directory[ length - 1 ] == '/' ) length--;
+
+	if( length >= sizeof(s_path) )
+	{
+		sync_sorter_destroy( &local );
+		return FALSE;
+	}
+
+	memcpy( s_path, p_options->s_directory, length );
+	s_path[ length ] = '\0';
+
+	if( !_sync_walk( &local, s_path, length, length, p_options->b_verbose ) || !sync_sorter_finish( &local ) )
+	{
+		if( p_options->b_verbose ) log_error( "Unable to scan local directory (%s).", p_options->s_directory );
+		sync_sorter_destroy( &local );
+		return FALSE;
+	}
+
+	if( p_options->b_verbose && sync_sorter_runs(&local) > 0 ) log_debug( "Local listing spilled to %zu sorted runs.", sync_sorter_runs(&local) );
+
+	/* remote side */
+	if( p_options->p_catalog )
+	{
+		char s_catalog_prefix[ CATALOG_MAX_KEY ];
+
+		/* catalog keys are "bucket/key"; the sorter holds them relative to the prefix, as the local side does */
+		remote.prefix_length = (size_t) snprintf( s_catalog_prefix, sizeof(s_catalog_prefix), "%s/%s", p_options->s_bucket, s_prefix );
+
+		if( remote.prefix_length >= sizeof(s_catalog_prefix) || !sync_sorter_create( &remote.sorter, p_options->memory_limit ) )
+		{
+			sync_sorter_destroy( &local );
+			return FALSE;
+		}
+
+		if( !catalog_scan( p_options->p_catalog, s_catalog_prefix, _sync_catalog_add, &remote ) ||
+		    sync_sorter_failed(&remote.sorter) || !sync_sorter_finish( &remote.sorter ) )
+		{
+			if( p_options->b_verbose ) log_error( "Unable to read the catalog below %s.", s_catalog_prefix );
+			sync_sorter_destroy( &remote.sorter );
+			sync_sorter_destroy( &local );
+			return FALSE;
+		}
+	}
+	else if( p_options->p_s3 )
+	{
+		remote.b_s3          = TRUE;
+		remote.prefix_length = strlen( s_prefix );
+		remote.p_curl        = curl_easy_init( );
+
+		if( !remote.p_curl || !s3_lister_begin( &remote.lister, remote.p_curl, p_options->p_s3, p_options->s_bucket, s_prefix ) )
+		{
+			if( remote.p_curl ) curl_easy_cleanup( remote.p_curl );
+			sync_sorter_destroy( &local );
+			return FALSE;
+		}
+	}
+	else
+	{
+		int n = snprintf( s_path, sizeof(s_path), "%s/%s/%s", p_options->p_fs->s_root, p_options->s_bucket, s_prefix );
+
+		if( n <= 0 || (size_t) n >= sizeof(s_path) || !sync_sorter_create( &remote.sorter, p_options->memory_limit ) )
+		{
+			sync_sorter_destroy( &local );
+			return FALSE;
+		}
+
+		length = (size_t) n;
+		while( length > 1 && s_path[ length - 1 ] == '/' ) s_path[ --length ] = '\0';
+
+		if( !_sync_walk( &remote.sorter, s_path, length, length, p_options->b_verbose ) || !sync_sorter_finish( &remote.sorter ) )
+		{
+			if( p_options->b_verbose ) log_error( "Unable to scan target directory (%s).", s_path );
+			sync_sorter_destroy( &remote.sorter );
+			sync_sorter_destroy( &local );
+			return FALSE;
+		}
+	}
+
+	/* workers */
+	memset( &queue, 0, sizeof(sync_queue) );
+	queue.p_options = p_options;
+	queue.s_prefix  = s_prefix;
+	queue.p_stats   = p_stats;
+
+	if( !mpmc_create( &queue.actions, sizeof(sync_action), SYNC_QUEUE_SIZE ) )
+	{
+		if( remote.b_s3 )
+		{
+			s3_lister_end( &remote.lister );
+			curl_easy_cleanup( remote.p_curl );
+		}
+		else
+		{
+			sync_sorter_destroy( &remote.sorter );
+		}
+
+		sync_sorter_destroy( &local );
+		return FALSE;
+	}
+
+	pthread_mutex_init( &queue.catalog_lock, NULL );
+
+	workers = p_options->workers > 0 ? p_options->workers : SYNC_DEFAULT_WORKERS;
+	if( workers > SYNC_MAX_WORKERS ) workers = SYNC_MAX_WORKERS;
+
+	for( i = 0; i < workers; i++ )
+	{
+		if( pthread_create( &threads[ i ], NULL, _sync_worker, &queue ) != 0 )
+		{
+			break;
+		}
+	}
+
+	workers = i;
+
+	if( workers == 0 )
+	{
+		b_result = FALSE;
+	}
+
+	/* merge-join: both streams are in byte order */
+	b_have_local  = b_result && sync_sorter_next( &local, &p_local );
+	b_have_remote = b_result && _sync_remote_next( &remote, &p_remote );
+
+	/* a stream that fails ends early, which would read as "missing" on the other side */
+	while( (b_have_local || b_have_remote) && !sync_sorter_failed(&local) && !_sync_remote_failed( &remote ) )
+	{
+		int compare = !b_have_remote ? -1 :
+		              !b_have_local  ?  1 :
+		              _sync_compare_keys( p_local->s_key, p_local->key_length, p_remote->s_key, p_remote->key_length );
+
+		if( compare < 0 )
+		{
+			_sync_queue_push( &queue, SYNC_PUT_CREATED, p_local );
+			b_have_local = sync_sorter_next( &local, &p_local );
+		}
+		else if( compare > 0 )
+		{
+			if( p_options->b_delete )
+			{
+				_sync_queue_push( &queue, SYNC_DELETE, p_remote );
+			}
+
+			b_have_remote = _sync_remote_next( &remote, &p_remote );
+		}
+		else
+		{
+			if( _sync_is_changed( p_options, p_local, p_remote ) )
+			{
+				_sync_queue_push( &queue, SYNC_PUT_CHANGED, p_local );
+			}
+			else
+			{
+				_sync_count( &p_stats->unchanged );
+			}
+
+			b_have_local  = sync_sorter_next( &local, &p_local );
+			b_have_remote = _sync_remote_next( &remote, &p_remote );
+		}
+	}
+
+	mpmc_close( &queue.actions );
+
+	for( i = 0; i < workers; i++ )
+	{
+		pthread_join( threads[ i ], NULL );
+	}
+
+	/* a listing that broke off half way must not be read as "deleted remotely" */
+	if( sync_sorter_failed(&local) )
+	{
+		b_result = FALSE;
+	}
+
+	if( remote.b_s3 )
+	{
+		if( s3_lister_failed(&remote.lister) )
+		{
+			if( p_options->b_verbose ) log_error( "Listing bucket %s failed part way.", p_options->s_bucket );
+			b_result = FALSE;
+		}
+
+		s3_lister_end( &remote.lister );
+		curl_easy_cleanup( remote.p_curl );
+	}
+	else
+	{
+		if( sync_sorter_failed(&remote.sorter) ) b_result = FALSE;
+		sync_sorter_destroy( &remote.sorter );
+	}
+
+	pthread_mutex_destroy( &queue.catalog_lock );
+	mpmc_destroy( &queue.actions );
+	sync_sorter_destroy( &local );
+
+	return b_result && p_stats->failed == 0;
+}
+
+int _sync_compare_keys( const char *s_a, size_t a_length, const char *s_b, size_t b_length )
+{
+	int compare = memcmp( s_a, s_b, a_length < b_length ? a_length : b_length );
+
+	if( compare != 0 ) return compare;
+
+	return a_length < b_length ? -1 : a_length > b_length ? 1 : 0;
+}
+
+int _sync_compare_records( const void *p_left, const void *p_right )
+{
+	const sync_record *p_a = (const sync_record *) p_left;
+	const sync_record *p_b = (const sync_record *) p_right;
+
+	return _sync_compare_keys( p_a->s_key, p_a->key_length, p_b->s_key, p_b->key_length );
+}
+
+/* run format: [u32 key length][key][u64 size][i64 mtime] ... */
+boolean _sync_sorter_spill( sync_sorter *p_sorter )
+{
+	sync_spill run;
+	size_t i;
+
+	memset( &run, 0, sizeof(sync_spill) );
+	run.p_file = tmpfile( );
+
+	if( !run.p_file )
+	{
+		p_sorter->b_error = TRUE;
+		return FALSE;
+	}
+
+	qsort( vector_array(&p_sorter->records), vector_size(&p_sorter->records), sizeof(sync_record), _sync_compare_records );
+
+	for( i = 0; i < vector_size(&p_sorter->records); i++ )
+	{
+		const sync_record *p_record = (const sync_record *) vector_element_at( &p_sorter->records, i );
+		uint32_t key_length         = (uint32_t) p_record->key_length;
+
+		if( fwrite( &key_length, sizeof(key_length), 1, run.p_file ) != 1 ||
+		    fwrite( p_record->s_key, 1, key_length, run.p_file ) != key_length ||
+		    fwrite( &p_record->size, sizeof(p_record->size), 1, run.p_file ) != 1 ||
+		    fwrite( &p_record->mtime, sizeof(p_record->mtime), 1, run.p_file ) != 1 )
+		{
+			fclose( run.p_file );
+			p_sorter->b_error = TRUE;
+			return FALSE;
+		}
+	}
+
+	if( fflush( run.p_file ) != 0 || !vector_push( &p_sorter->runs, &run ) )
+	{
+		fclose( run.p_file );
+		p_sorter->b_error = TRUE;
+		return FALSE;
+	}
+
+	p_sorter->records.size = 0;
+	arena_reset( &p_sorter->keys );
+
+	return TRUE;
+}
+
+boolean _sync_spill_read( sync_spill *p_run )
+{
+	uint32_t key_length;
+
+	if( fread( &key_length, sizeof(key_length), 1, p_run->p_file ) != 1 || key_length > SYNC_MAX_KEY ||
+	    fread( p_run->s_key, 1, key_length, p_run->p_file ) != key_length ||
+	    fread( &p_run->current.size, sizeof(p_run->current.size), 1, p_run->p_file ) != 1 ||
+	    fread( &p_run->current.mtime, sizeof(p_run->current.mtime), 1, p_run->p_file ) != 1 )
+	{
+		return FALSE;
+	}
+
+	p_run->s_key[ key_length ]  = '\0';
+	p_run->current.s_key        = p_run->s_key;
+	p_run->current.key_length   = key_length;
+
+	return TRUE;
+}
+
+boolean _sync_heap_less( const sync_sorter *p_sorter, size_t a, size_t b )
+{
+	const sync_spill *p_a = (const sync_spill *) vector_element_at( (vector *) &p_sorter->runs, p_sorter->p_heap[ a ] );
+	const sync_spill *p_b = (const sync_spill *) vector_element_at( (vector *) &p_sorter->runs, p_sorter->p_heap[ b ] );
+
+	return _sync_compare_records( &p_a->current, &p_b->current ) < 0;
+}
+
+void _sync_heap_down( sync_sorter *p_sorter, size_t i )
+{
+	for( ;; )
+	{
+		size_t left     = 2 * i + 1;
+		size_t smallest = i;
+		size_t swap;
+
+		if( left < p_sorter->heap_size && _sync_heap_less( p_sorter, left, smallest ) ) smallest = left;
+		if( left + 1 < p_sorter->heap_size && _sync_heap_less( p_sorter, left + 1, smallest ) ) smallest = left + 1;
+		if( smallest == i ) break;
+
+		swap                          = p_sorter->p_heap[ i ];
+		p_sorter->p_heap[ i ]         = p_sorter->p_heap[ smallest ];
+		p_sorter->p_heap[ smallest ]  = swap;
+		i = smallest;
+	}
+}
+
+/*
+ * s_path holds the directory being walked (length bytes); the keys are
+ * whatever follows the first base_length bytes. A missing top directory
+ * is an empty tree, symlinked directories are not followed.
+ */
+boolean _sync_walk( sync_sorter *p_sorter, char *s_path, size_t base_length, size_t length, boolean b_verbose )
+{
+	struct dirent *p_dirent;
+	DIR *p_directory;
+	boolean b_result = TRUE;
+
+	p_directory = opendir( s_path );
+
+	if( !p_directory )
+	{
+		if( length == base_length && errno == ENOENT ) return TRUE;
+		if( b_verbose ) log_error( "Cannot open directory (%s)", s_path );
+		return FALSE;
+	}
+
+	while( b_result && (p_dirent = readdir( p_directory )) )
+	{
+		size_t name_length = strlen( p_dirent->d_name );
+		struct stat info;
+
+		if( strcmp( p_dirent->d_name, "." ) == 0 || strcmp( p_dirent->d_name, ".." ) == 0 ) continue;
+
+		if( length + 1 + name_length >= SYNC_MAX_PATH || length + 1 + name_length - base_length - 1 > SYNC_MAX_KEY )
+		{
+			if( b_verbose ) log_warning( "Skipping %s/%s, the path is too long.", s_path, p_dirent->d_name );
+			continue;
+		}
+
+		s_path[ length ] = '/';
+		memcpy( s_path + length + 1, p_dirent->d_name, name_length + 1 );
+
+		if( lstat( s_path, &info ) != 0 )
+		{
+			s_path[ length ] = '\0';
+			continue;
+		}
+
+		if( S_ISLNK(info.st_mode) && stat( s_path, &info ) != 0 )
+		{
+			s_path[ length ] = '\0';
+			continue;
+		}
+
+		if( S_ISREG(info.st_mode) )
+		{
+			b_result = sync_sorter_add( p_sorter, s_path + base_length + 1, info.st_size, info.st_mtime );
+		}
+		else if( S_ISDIR(info.st_mode) && !S_ISLNK(info.st_mode) )
+		{
+			b_result = _sync_walk( p_sorter, s_path, base_length, length + 1 + name_length, b_verbose );
+		}
+
+		s_path[ length ] = '\0';
+	}
+
+	closedir( p_directory );
+
+	return b_result;
+}
+
+boolean _sync_remote_next( sync_remote *p_remote, const sync_record **p_p_record )
+{
+	const S3Object *p_object;
+
+	if( !p_remote->b_s3 )
+	{
+		return sync_sorter_next( &p_remote->sorter, p_p_record );
+	}
+
+	while( s3_lister_next( &p_remote->lister, &p_object ) )
+	{
+		const char *s_key = p_object->s_key + p_remote->prefix_length;
+		size_t length     = strlen( s_key );
+
+		/* the prefix itself and "folder" placeholders have no local file */
+		if( length == 0 || s_key[ length - 1 ] == '/' ) continue;
+
+		p_remote->record.s_key      = s_key;
+		p_remote->record.key_length = length;
+		p_remote->record.size       = p_object->size;
+		p_remote->record.mtime      = p_object->modified;
+		*p_p_record = &p_remote->record;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+boolean _sync_remote_failed( const sync_remote *p_remote )
+{
+	return p_remote->b_s3 ? s3_lister_failed(&p_remote->lister) : sync_sorter_failed(&p_remote->sorter);
+}
+
+/* keys the bucket and prefix of a sync away, into the remote sorter */
+boolean _sync_catalog_add( void *data, const catalog_entry *p_entry )
+{
+	sync_remote *p_remote = (sync_remote *) data;
+	const char *s_key     = p_entry->s_key + p_remote->prefix_length;
+
+	/* a key too long for the sorter is skipped; running out of memory stops the scan */
+	return sync_sorter_add( &p_remote->sorter, s_key, p_entry->size, (int64_t) p_entry->mtime ) || !sync_sorter_failed(&p_remote->sorter);
+}
+
+/*
+ * The catalog holds the size and mtime the file had when it was sent, so
+ * any difference means a change. A listing has the object's own: it is
+ * newer than the file whenever it was made from it.
+ */
+boolean _sync_is_changed( const sync_options *p_options, const sync_record *p_local, const sync_record *p_remote )
+{
+	if( p_options->p_catalog )
+	{
+		return p_local->size != p_remote->size || p_local->mtime != p_remote->mtime;
+	}
+
+	if( _sync_is_sparse( p_options ) || _sync_is_stripped( p_options ) )
+	{
+		return p_local->mtime > p_remote->mtime;
+	}
+
+	return p_local->size != p_remote->size || p_local->mtime > p_remote->mtime;
+}
+
+void _sync_queue_push( sync_queue *p_queue, sync_action_type type, const sync_record *p_record )
+{
+	sync_action action;
+
+	action.type  = type;
+	action.size  = p_record->size;
+	action.mtime = p_record->mtime;
+	memcpy( action.s_key, p_record->s_key, p_record->key_length );
+	action.s_key[ p_record->key_length ] = '\0';
+
+	/* waits while the workers are SYNC_QUEUE_SIZE actions behind */
+	mpmc_push( &p_queue->actions, &action );
+}
+
+/* shared by the join and every worker */
+void _sync_count( size_t *p_counter )
+{
+	__atomic_add_fetch( p_counter, 1, __ATOMIC_RELAXED );
+}
+
+void* _sync_worker( void *data )
+{
+	char s_path[ SYNC_MAX_PATH ];
+	char s_key[ 2 * SYNC_MAX_KEY + 2 ];
+	sync_queue *p_queue           = (sync_queue *) data;
+	const sync_options *p_options = p_queue->p_options;
+	CURL *p_curl                  = p_options->p_s3 ? curl_easy_init( ) : NULL;
+	char s_etag[ S3_MAX_ETAG ];
+	sync_action action;
+
+	for( ;; )
+	{
+		boolean b_done;
+
+		s_etag[ 0 ] = '\0';
+
+		/* FALSE once the join has closed the queue and it has drained */
+		if( !mpmc_pop( &p_queue->actions, &action ) )
+		{
+			break;
+		}
+
+		snprintf( s_key, sizeof(s_key), "%s%s", p_queue->s_prefix, action.s_key );
+
+		if( p_options->p_s3 && !p_curl )
+		{
+			b_done = FALSE;
+		}
+		else if( action.type == SYNC_DELETE )
+		{
+			if( p_options->b_verbose ) log_debug( "Deleting %s/%s", p_options->s_bucket, s_key );
+
+			b_done = p_options->p_s3 ? s3_delete_file( p_curl, p_options->p_s3, p_options->s_bucket, s_key )
+			                         : localfs_delete_file( p_options->p_fs, p_options->s_bucket, s_key );
+		}
+		else
+		{
+			snprintf( s_path, sizeof(s_path), "%s/%s", p_options->s_directory, action.s_key );
+
+			if( p_options->b_verbose ) log_debug( "Uploading %s to %s/%s", s_path, p_options->s_bucket, s_key );
+
+			b_done = p_options->p_s3 ? s3_put_file( p_curl, p_options->p_s3, p_options->s_bucket, s_key, s_path, NULL, s_etag )
+			                         : localfs_put_file( p_options->p_fs, p_options->s_bucket, s_key, s_path );
+		}
+
+		if( b_done && p_options->p_catalog )
+		{
+			_sync_record( p_queue, &action, s_key, s_etag );
+		}
+
+		_sync_count( !b_done                        ? &p_queue->p_stats->failed :
+		             action.type == SYNC_DELETE      ? &p_queue->p_stats->deleted :
+		             action.type == SYNC_PUT_CHANGED ? &p_queue->p_stats->changed :
+		                                               &p_queue->p_stats->created );
+	}
+
+	if( p_curl ) curl_easy_cleanup( p_curl );
+
+	return NULL;
+}
+
+/* queued in the catalog, which the caller commits once the sync is over */
+void _sync_record( sync_queue *p_queue, const sync_action *p_action, const char *s_key, const char *s_etag )
+{
+	const sync_options *p_options = p_queue->p_options;
+	char s_catalog_key[ CATALOG_MAX_KEY ];
+
+	/* a cut-off key would name no object, and the real one would never be found */
+	if( (size_t) snprintf( s_catalog_key, sizeof(s_catalog_key), "%s/%s", p_options->s_bucket, s_key ) >= sizeof(s_catalog_key) )
+	{
+		if( p_options->b_verbose ) log_warning( "Not cataloging %s/%s, the key is too long.", p_options->s_bucket, s_key );
+		return;
+	}
+
+	pthread_mutex_lock( &p_queue->catalog_lock );
+
+	if( p_action->type == SYNC_DELETE )
+	{
+		catalog_delete( p_options->p_catalog, s_catalog_key );
+	}
+	else
+	{
+		catalog_put( p_options->p_catalog, s_catalog_key, p_action->size, p_action->mtime, s_etag );
+	}
+
+	pthread_mutex_unlock( &p_queue->catalog_lock );
+}
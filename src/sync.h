@@ -0,0 +1,98 @@
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "types.h"
+#include "vector.h"
+#include "arena.h"
+#include "s3.h"
+#include "localfs.h"
+#include "catalog.h"
+
+/*
+ * Mirrors a local directory tree below a bucket prefix.
+ *
+ * Both sides are turned into streams sorted by key: the local tree goes
+ * through an external sorter, the remote side is an S3 listing (which
+ * already comes in key order) or, for a local target, another sorted
+ * walk. One merge-join pass over the two streams decides what is new,
+ * changed or gone, so memory stays bounded no matter how many keys
+ * there are. Decisions are queued to worker threads that upload and
+ * delete while the join is still running.
+ *
+ * With a catalog (see catalog.h) the remote side is read from it
+ * instead, so no listing is requested at all, and every put and delete
+ * is recorded back into it. The catalog only knows what it was told:
+ * objects uploaded by other means look missing and are sent again.
+ */
+#define SYNC_MAX_KEY             (1024)
+#define SYNC_DEFAULT_MEMORY      (256 * 1024 * 1024) /* per sorter, before runs spill to disk */
+#define SYNC_DEFAULT_WORKERS     (8)
+#define SYNC_MAX_WORKERS         (64)
+#define SYNC_QUEUE_SIZE          (256)
+
+typedef struct tag_sync_record {
+	const char *s_key;      /* relative to the synced directory, '/' separated */
+	size_t key_length;
+	uint64_t size;
+	int64_t mtime;
+} sync_record;
+
+/* one run spilled to disk, read back during the merge */
+typedef struct tag_sync_spill {
+	FILE *p_file;
+	sync_record current;
+	char s_key[ SYNC_MAX_KEY + 1 ];
+} sync_spill;
+
+/*
+ * Records are gathered in memory until they pass memory_limit; then
+ * they are sorted and written out as a run. Reading back merges the
+ * runs with a heap. Everything that fits stays in memory.
+ */
+typedef struct tag_sync_sorter {
+	vector records;
+	arena keys;
+	size_t memory_limit;
+	vector runs;            /* sync_spill, when anything spilled */
+	size_t *p_heap;         /* run indices ordered by their current key */
+	size_t heap_size;
+	size_t next;            /* in-memory cursor */
+	boolean b_error;
+} sync_sorter;
+
+boolean sync_sorter_create  ( sync_sorter *p_sorter, size_t memory_limit );
+void    sync_sorter_destroy ( sync_sorter *p_sorter );
+boolean sync_sorter_add     ( sync_sorter *p_sorter, const char *s_key, uint64_t size, int64_t mtime );
+boolean sync_sorter_finish  ( sync_sorter *p_sorter ); /* no more adds; starts reading back */
+boolean sync_sorter_next    ( sync_sorter *p_sorter, /*out*/ const sync_record **p_p_record );
+
+#define sync_sorter_failed( p_sorter )       ((p_sorter)->b_error)
+#define sync_sorter_runs( p_sorter )         (vector_size( &(p_sorter)->runs ))
+
+typedef struct tag_sync_options {
+	const char *s_directory;
+	const char *s_bucket;
+	const char *s_prefix;   /* keys go below it; may be NULL */
+	const S3 *p_s3;         /* target: S3 ... */
+	const LocalFS *p_fs;    /* ... or a local directory */
+	catalog *p_catalog;     /* stands in for the remote listing and is kept up to date; may be NULL */
+	boolean b_delete;       /* remove remote keys without a local file */
+	uint workers;
+	size_t memory_limit;
+	boolean b_verbose;
+} sync_options;
+
+typedef struct tag_sync_stats {
+	size_t created;
+	size_t changed;
+	size_t unchanged;
+	size_t deleted;
+	size_t failed;
+} sync_stats;
+
+void    sync_options_initialize ( sync_options *p_options );
+boolean sync_run                ( const sync_options *p_options, /*out*/ sync_stats *p_stats );
+
+#endif /* _SYNC_H_ */
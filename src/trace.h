@@ -0,0 +1,40 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * USDT probes under the "backup" provider, for bpftrace, perf and
+ * SystemTap. A probe is a single nop until a tracer attaches, so they
+ * stay in release builds; see trace/ for example scripts, and list them
+ * with bpftrace -l 'usdt:/path/to/backup-tool:backup:*'.
+ *
+ * Strings are passed as pointers (read them with str()), sizes as
+ * 64-bit integers, and status as 1 for success, 0 for failure.
+ *
+ * Without systemtap's <sys/sdt.h>, or when built with -D_TRACE_NO_SDT,
+ * the probes compile to nothing and their arguments are not evaluated.
+ */
+#if !defined(_TRACE_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define _TRACE_HAVE_SDT
+#endif
+#endif
+
+#ifdef _TRACE_HAVE_SDT
+#define TRACE1( probe, a )                  DTRACE_PROBE1( backup, probe, a )
+#define TRACE2( probe, a, b )               DTRACE_PROBE2( backup, probe, a, b )
+#define TRACE3( probe, a, b, c )            DTRACE_PROBE3( backup, probe, a, b, c )
+#define TRACE4( probe, a, b, c, d )         DTRACE_PROBE4( backup, probe, a, b, c, d )
+#define TRACE5( probe, a, b, c, d, e )      DTRACE_PROBE5( backup, probe, a, b, c, d, e )
+#else
+/* sizeof counts as a use of the arguments without evaluating them */
+#define TRACE1( probe, a )                  ((void) sizeof( a ))
+#define TRACE2( probe, a, b )               (TRACE1( probe, a ), (void) sizeof( b ))
+#define TRACE3( probe, a, b, c )            (TRACE2( probe, a, b ), (void) sizeof( c ))
+#define TRACE4( probe, a, b, c, d )         (TRACE3( probe, a, b, c ), (void) sizeof( d ))
+#define TRACE5( probe, a, b, c, d, e )      (TRACE4( probe, a, b, c, d ), (void) sizeof( e ))
+#endif
+
+#endif /* _TRACE_H_ */
@@ -26,9 +26,17 @@ void vector_destroy( vector *p_vector )
 {
 	assert( p_vector );
 
-	while( !vector_is_empty(p_vector) )
+	/* elements without a destroy callback (e.g. arena backed) are dropped in one go */
+	if( p_vector->element_destroy_callback )
 	{
-		vector_pop( p_vector );
+		while( !vector_is_empty(p_vector) )
+		{
+			vector_pop( p_vector );
+		}
+	}
+	else
+	{
+		p_vector->size = 0;
 	}
 
 	free( p_vector->array );
@@ -38,7 +46,7 @@ void vector_destroy( vector *p_vector )
 	p_vector->array                   = NULL;
 	p_vector->array_size              = 0;
 	p_vector->size                    = 0;
-	p_vector-element_destroy_callback = NULL;
+	p_vector->element_destroy_callback = NULL;
 	#endif
 }
 
@@ -69,11 +77,13 @@ int vector_pop( vector *p_vector )
 {
 	assert( p_vector );
 
-	void *element = vector_array(p_vector) + vector_size(p_vector) * vector_element_size(p_vector);
-	int result    = p_vector->element_destroy_callback( element );
+	assert( !vector_is_empty(p_vector) );
+
+	void *element = vector_array(p_vector) + (vector_size(p_vector) - 1) * vector_element_size(p_vector);
+	int result    = p_vector->element_destroy_callback ? p_vector->element_destroy_callback( element ) : 1;
 
 	#ifdef _DEBUG_VECTOR
-	memset( vector_array(p_vector) + vector_size(p_vector) * vector_element_size(p_vector), 0, vector_element_size(p_vector) );
+	memset( element, 0, vector_element_size(p_vector) );
 	#endif
 
 	p_vector->size--;
@@ -5,6 +5,7 @@
 
 #define INITIAL_ARRAY_SIZE    250
 
+/* may be NULL when elements own no memory */
 typedef int (*vector_element_function)( void *element );
 
 
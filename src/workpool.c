@@ -0,0 +1,384 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include "workpool.h"
+
+#define WORKPOOL_SPINS      (32)
+
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+static workpool shared_pool;
+static boolean b_shared_ready     = FALSE;
+
+/* the worker running on this thread, if any, so submits from a task stay local */
+static __thread workpool_worker *p_current_worker = NULL;
+
+static boolean        _workpool_deque_push  ( workpool_deque *p_deque, workpool_task *p_task );
+static workpool_task* _workpool_deque_pop   ( workpool_deque *p_deque );
+static workpool_task* _workpool_deque_steal ( workpool_deque *p_deque );
+static workpool_task* _workpool_find        ( workpool *p_pool, workpool_worker *p_self );
+static void           _workpool_run         ( workpool *p_pool, workpool_task *p_task );
+static void           _workpool_wake        ( workpool *p_pool, boolean b_everyone );
+static void*          _workpool_thread      ( void *data );
+static void           _workpool_shared_create ( void );
+
+
+boolean workpool_create( workpool *p_pool, uint threads )
+{
+	uint i;
+
+	assert( p_pool );
+
+	if( threads == 0 )
+	{
+		long online = sysconf( _SC_NPROCESSORS_ONLN );
+		threads = online > 0 ? (uint) online : 1;
+	}
+
+	if( threads > WORKPOOL_MAX_THREADS ) threads = WORKPOOL_MAX_THREADS;
+
+	memset( p_pool, 0, sizeof(workpool) );
+	p_pool->p_workers = (workpool_worker *) calloc( threads, sizeof(workpool_worker) );
+
+	if( !p_pool->p_workers )
+	{
+		return FALSE;
+	}
+
+	if( !mpmc_create( &p_pool->injection, sizeof(workpool_task *), WORKPOOL_INJECT_SIZE ) )
+	{
+		free( p_pool->p_workers );
+		return FALSE;
+	}
+
+	pthread_mutex_init( &p_pool->lock, NULL );
+	pthread_cond_init( &p_pool->changed, NULL );
+
+	/* workers that never start leave empty deques behind, which thieves skip */
+	p_pool->count = threads;
+
+	for( i = 0; i < threads; i++ )
+	{
+		workpool_worker *p_worker = &p_pool->p_workers[ i ];
+
+		p_worker->p_pool = p_pool;
+		p_worker->index  = i;
+		p_worker->seed   = 2654435761u * (i + 1);
+
+		if( pthread_create( &p_worker->thread, NULL, _workpool_thread, p_worker ) != 0 )
+		{
+			break;
+		}
+	}
+
+	if( i == 0 )
+	{
+		pthread_cond_destroy( &p_pool->changed );
+		pthread_mutex_destroy( &p_pool->lock );
+		mpmc_destroy( &p_pool->injection );
+		free( p_pool->p_workers );
+		return FALSE;
+	}
+
+	__atomic_store_n( &p_pool->count, i, __ATOMIC_RELEASE );
+
+	return TRUE;
+}
+
+void workpool_destroy( workpool *p_pool )
+{
+	uint i;
+
+	assert( p_pool );
+
+	pthread_mutex_lock( &p_pool->lock );
+	__atomic_store_n( &p_pool->b_stopping, TRUE, __ATOMIC_SEQ_CST );
+	pthread_cond_broadcast( &p_pool->changed );
+	pthread_mutex_unlock( &p_pool->lock );
+
+	for( i = 0; i < p_pool->count; i++ )
+	{
+		pthread_join( p_pool->p_workers[ i ].thread, NULL );
+	}
+
+	pthread_cond_destroy( &p_pool->changed );
+	pthread_mutex_destroy( &p_pool->lock );
+	mpmc_destroy( &p_pool->injection );
+	free( p_pool->p_workers );
+	p_pool->p_workers = NULL;
+}
+
+void workpool_submit( workpool *p_pool, workpool_batch *p_batch, workpool_fn fn, void *p_arg )
+{
+	workpool_task *p_task = (workpool_task *) malloc( sizeof(workpool_task) );
+
+	assert( p_pool );
+	assert( fn );
+
+	if( !p_task )
+	{
+		fn( p_arg );
+		return;
+	}
+
+	p_task->fn      = fn;
+	p_task->p_arg   = p_arg;
+	p_task->p_batch = p_batch;
+
+	if( p_batch ) __atomic_add_fetch( &p_batch->remaining, 1, __ATOMIC_RELAXED );
+
+	if( p_current_worker && p_current_worker->p_pool == p_pool )
+	{
+		if( !_workpool_deque_push( &p_current_worker->deque, p_task ) )
+		{
+			_workpool_run( p_pool, p_task );
+			return;
+		}
+	}
+	else if( !mpmc_push( &p_pool->injection, &p_task ) )
+	{
+		_workpool_run( p_pool, p_task );
+		return;
+	}
+
+	_workpool_wake( p_pool, FALSE );
+}
+
+void workpool_wait( workpool *p_pool, workpool_batch *p_batch )
+{
+	workpool_worker *p_self = p_current_worker && p_current_worker->p_pool == p_pool ? p_current_worker : NULL;
+	workpool_task *p_task;
+
+	assert( p_pool );
+	assert( p_batch );
+
+	while( __atomic_load_n( &p_batch->remaining, __ATOMIC_ACQUIRE ) > 0 )
+	{
+		if( (p_task = _workpool_find( p_pool, p_self )) )
+		{
+			_workpool_run( p_pool, p_task );
+			continue;
+		}
+
+		pthread_mutex_lock( &p_pool->lock );
+		__atomic_add_fetch( &p_pool->sleepers, 1, __ATOMIC_SEQ_CST );
+
+		while( __atomic_load_n( &p_batch->remaining, __ATOMIC_ACQUIRE ) > 0 && !(p_task = _workpool_find( p_pool, p_self )) )
+		{
+			pthread_cond_wait( &p_pool->changed, &p_pool->lock );
+		}
+
+		__atomic_sub_fetch( &p_pool->sleepers, 1, __ATOMIC_SEQ_CST );
+		pthread_mutex_unlock( &p_pool->lock );
+
+		if( p_task )
+		{
+			_workpool_run( p_pool, p_task );
+			p_task = NULL;
+		}
+	}
+}
+
+workpool* workpool_shared( void )
+{
+	pthread_once( &shared_once, _workpool_shared_create );
+
+	return b_shared_ready ? &shared_pool : NULL;
+}
+
+/* lives until the process exits, like the shared buffer pool */
+void _workpool_shared_create( void )
+{
+	b_shared_ready = workpool_create( &shared_pool, 0 );
+}
+
+/* owner only; FALSE when full */
+boolean _workpool_deque_push( workpool_deque *p_deque, workpool_task *p_task )
+{
+	int64_t bottom = __atomic_load_n( &p_deque->bottom, __ATOMIC_RELAXED );
+	int64_t top    = __atomic_load_n( &p_deque->top, __ATOMIC_ACQUIRE );
+
+	if( bottom - top >= WORKPOOL_DEQUE_SIZE )
+	{
+		return FALSE;
+	}
+
+	__atomic_store_n( &p_deque->p_slots[ bottom & (WORKPOOL_DEQUE_SIZE - 1) ], p_task, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	__atomic_store_n( &p_deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+
+	return TRUE;
+}
+
+/* owner only; newest first, so the task it just pushed is still in cache */
+workpool_task* _workpool_deque_pop( workpool_deque *p_deque )
+{
+	int64_t bottom = __atomic_load_n( &p_deque->bottom, __ATOMIC_RELAXED ) - 1;
+	int64_t top;
+	workpool_task *p_task = NULL;
+
+	__atomic_store_n( &p_deque->bottom, bottom, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+	top = __atomic_load_n( &p_deque->top, __ATOMIC_RELAXED );
+
+	if( top <= bottom )
+	{
+		p_task = __atomic_load_n( &p_deque->p_slots[ bottom & (WORKPOOL_DEQUE_SIZE - 1) ], __ATOMIC_RELAXED );
+
+		if( top == bottom )
+		{
+			/* the last one: race the thieves for it */
+			if( !__atomic_compare_exchange_n( &p_deque->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+			{
+				p_task = NULL;
+			}
+
+			__atomic_store_n( &p_deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+		}
+	}
+	else
+	{
+		__atomic_store_n( &p_deque->bottom, bottom + 1, __ATOMIC_RELAXED );
+	}
+
+	return p_task;
+}
+
+/* any thread; oldest first */
+workpool_task* _workpool_deque_steal( workpool_deque *p_deque )
+{
+	for( ;; )
+	{
+		int64_t top = __atomic_load_n( &p_deque->top, __ATOMIC_ACQUIRE );
+		int64_t bottom;
+		workpool_task *p_task;
+
+		__atomic_thread_fence( __ATOMIC_SEQ_CST );
+		bottom = __atomic_load_n( &p_deque->bottom, __ATOMIC_ACQUIRE );
+
+		if( top >= bottom )
+		{
+			return NULL;
+		}
+
+		p_task = __atomic_load_n( &p_deque->p_slots[ top & (WORKPOOL_DEQUE_SIZE - 1) ], __ATOMIC_RELAXED );
+
+		if( __atomic_compare_exchange_n( &p_deque->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+		{
+			return p_task;
+		}
+	}
+}
+
+/* own deque, then the injection queue, then the other workers from a random start */
+workpool_task* _workpool_find( workpool *p_pool, workpool_worker *p_self )
+{
+	workpool_task *p_task = NULL;
+	uint count            = __atomic_load_n( &p_pool->count, __ATOMIC_ACQUIRE );
+	uint start            = 0;
+	uint i;
+
+	if( p_self )
+	{
+		if( (p_task = _workpool_deque_pop( &p_self->deque )) ) return p_task;
+
+		p_self->seed ^= p_self->seed << 13;
+		p_self->seed ^= p_self->seed >> 17;
+		p_self->seed ^= p_self->seed << 5;
+		start = p_self->seed;
+	}
+
+	if( mpmc_try_pop( &p_pool->injection, &p_task ) ) return p_task;
+
+	for( i = 0; i < count; i++ )
+	{
+		workpool_worker *p_victim = &p_pool->p_workers[ (start + i) % count ];
+
+		if( p_victim != p_self && (p_task = _workpool_deque_steal( &p_victim->deque )) )
+		{
+			return p_task;
+		}
+	}
+
+	return NULL;
+}
+
+void _workpool_run( workpool *p_pool, workpool_task *p_task )
+{
+	workpool_batch *p_batch = p_task->p_batch;
+
+	p_task->fn( p_task->p_arg );
+	free( p_task );
+
+	/* the waiter may free the batch as soon as it reaches zero */
+	if( p_batch && __atomic_sub_fetch( &p_batch->remaining, 1, __ATOMIC_ACQ_REL ) == 0 )
+	{
+		_workpool_wake( p_pool, TRUE );
+	}
+}
+
+/* only takes the lock when someone sleeps; they hold it until they are in the wait */
+void _workpool_wake( workpool *p_pool, boolean b_everyone )
+{
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+	if( __atomic_load_n( &p_pool->sleepers, __ATOMIC_RELAXED ) > 0 )
+	{
+		pthread_mutex_lock( &p_pool->lock );
+
+		if( b_everyone ) pthread_cond_broadcast( &p_pool->changed );
+		else             pthread_cond_signal( &p_pool->changed );
+
+		pthread_mutex_unlock( &p_pool->lock );
+	}
+}
+
+void* _workpool_thread( void *data )
+{
+	workpool_worker *p_self = (workpool_worker *) data;
+	workpool *p_pool        = p_self->p_pool;
+	workpool_task *p_task;
+	uint spins              = 0;
+
+	p_current_worker = p_self;
+
+	for( ;; )
+	{
+		if( (p_task = _workpool_find( p_pool, p_self )) )
+		{
+			_workpool_run( p_pool, p_task );
+			spins = 0;
+			continue;
+		}
+
+		if( spins++ < WORKPOOL_SPINS )
+		{
+			sched_yield( );
+			continue;
+		}
+
+		pthread_mutex_lock( &p_pool->lock );
+		__atomic_add_fetch( &p_pool->sleepers, 1, __ATOMIC_SEQ_CST );
+
+		while( !(p_task = _workpool_find( p_pool, p_self )) && !__atomic_load_n( &p_pool->b_stopping, __ATOMIC_ACQUIRE ) )
+		{
+			pthread_cond_wait( &p_pool->changed, &p_pool->lock );
+		}
+
+		__atomic_sub_fetch( &p_pool->sleepers, 1, __ATOMIC_SEQ_CST );
+		pthread_mutex_unlock( &p_pool->lock );
+
+		if( !p_task )
+		{
+			break;
+		}
+
+		_workpool_run( p_pool, p_task );
+		spins = 0;
+	}
+
+	p_current_worker = NULL;
+
+	return NULL;
+}
@@ -0,0 +1,74 @@
+#ifndef _WORKPOOL_H_
+#define _WORKPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "mpmc.h"
+
+/*
+ * Work-stealing pool for CPU-bound stages (hashing, packing). Each worker
+ * owns a deque: it pushes and pops at the bottom, idle workers steal from
+ * the top, so nobody contends until somebody runs dry (Chase and Lev).
+ * Tasks submitted from outside the pool go through a lock-free injection
+ * queue that every worker polls.
+ *
+ * Workers are never blocked on I/O for long, so network transfers keep
+ * their own threads; a pool sized to the CPUs only does CPU work.
+ */
+#define WORKPOOL_MAX_THREADS    (64)
+#define WORKPOOL_DEQUE_SIZE     (1024)  /* power of two; a full deque runs the task inline */
+#define WORKPOOL_INJECT_SIZE    (1024)
+
+typedef void (*workpool_fn)( void *p_arg );
+
+/* counts outstanding tasks so a caller can wait for just its own */
+typedef struct tag_workpool_batch {
+	uint remaining;
+} workpool_batch;
+
+typedef struct tag_workpool_task {
+	workpool_fn fn;
+	void *p_arg;
+	workpool_batch *p_batch;
+} workpool_task;
+
+typedef struct tag_workpool_deque {
+	int64_t top;                 /* thieves take from here */
+	char pad0[ MPMC_CACHE_LINE - sizeof(int64_t) ];
+	int64_t bottom;              /* the owner pushes and pops here */
+	char pad1[ MPMC_CACHE_LINE - sizeof(int64_t) ];
+	workpool_task *p_slots[ WORKPOOL_DEQUE_SIZE ];
+} workpool_deque;
+
+struct tag_workpool;
+
+typedef struct tag_workpool_worker {
+	workpool_deque deque;
+	struct tag_workpool *p_pool;
+	pthread_t thread;
+	uint index;
+	uint seed;                   /* picks steal victims */
+} workpool_worker;
+
+typedef struct tag_workpool {
+	workpool_worker *p_workers;
+	uint count;
+	mpmc_queue injection;        /* of workpool_task* */
+	boolean b_stopping;
+	uint sleepers;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} workpool;
+
+boolean   workpool_create  ( workpool *p_pool, uint threads ); /* 0 means one per CPU */
+void      workpool_destroy ( workpool *p_pool );                /* runs what is queued first */
+void      workpool_submit  ( workpool *p_pool, workpool_batch *p_batch, workpool_fn fn, void *p_arg ); /* runs inline when it cannot queue */
+void      workpool_wait    ( workpool *p_pool, workpool_batch *p_batch ); /* runs queued tasks while it waits */
+workpool* workpool_shared  ( void );                            /* NULL if no worker could be started */
+
+#define workpool_batch_initialize( p_batch )   ((p_batch)->remaining = 0)
+#define workpool_threads( p_pool )             ((p_pool)->count)
+
+#endif /* _WORKPOOL_H_ */